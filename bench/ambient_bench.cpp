@@ -0,0 +1,216 @@
+// Host benchmark for the ambient loudness estimator (src/ambient.cpp).
+//
+//   g++ -O2 -std=gnu++17 -Isrc bench/ambient_bench.cpp src/ambient.cpp -o ambient_bench && ./ambient_bench [trace.wav]
+//
+// Noise traces are fed burst by burst as the ambient task would on the device
+// (AMBIENT_BURST_SAMPLES every 250 ms). Built-in traces are synthesized at the
+// ~10 kHz rate analogRead() manages; a recorded trace can be given as a 16-bit
+// mono PCM WAV, which is scaled to 12-bit ADC codes around a mid-rail bias.
+// For every trace the smoothed level and the volume a chime configured at 50
+// (bounds 20-100) would play at are printed, then the estimator's cost.
+//
+// The built-in traces are also checked: night must play at 30 or below, party
+// at 70 or above, living in between, and after the step the volume must be
+// back within one of the quiet volume in three release time constants
+// (BURST_INTERVAL_S / AMBIENT_RELEASE each). Exits non-zero when one fails.
+
+#include "ambient.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#define BURST_SAMPLES 128
+#define BURST_INTERVAL_S 0.25
+#define SAMPLE_RATE 10000
+#define MIC_BIAS 1900           // Preamp bias lands a little below mid-rail
+#define BASE_VOLUME 50
+#define MIN_VOLUME 20
+#define MAX_VOLUME 100
+#define STEP_START_S 20
+#define STEP_END_S 40
+#define NIGHT_MAX_VOLUME 30
+#define PARTY_MIN_VOLUME 70
+#define RELEASE_S (3 * BURST_INTERVAL_S / AMBIENT_RELEASE)
+
+// Produces the samples of one burst starting at time t (seconds)
+typedef void (*TraceFn)(double t, std::mt19937& rng, uint16_t* out);
+
+static uint16_t adcCode(double v) {
+    long code = lround(MIC_BIAS + v);
+    return code < 0 ? 0 : code > 4095 ? 4095 : code;
+}
+
+static void noiseBurst(double t, double sigma, double toneAmplitude, double toneHz, std::mt19937& rng, uint16_t* out) {
+    std::normal_distribution<double> noise(0, sigma);
+    for (int i = 0; i < BURST_SAMPLES; i++) {
+        double s = t + (double)i / SAMPLE_RATE;
+        out[i] = adcCode(noise(rng) + toneAmplitude * sin(2 * M_PI * toneHz * s));
+    }
+}
+
+// Quiet flat at night: ADC noise and a fridge hum
+static void nightTrace(double t, std::mt19937& rng, uint16_t* out) {
+    noiseBurst(t, 3, 2, 50, rng, out);
+}
+
+// Living room: background noise with speech-like tone bursts every few seconds
+static void livingTrace(double t, std::mt19937& rng, uint16_t* out) {
+    bool talking = fmod(t, 5.0) < 2.0;
+    noiseBurst(t, 20, talking ? 120 : 0, 220, rng, out);
+}
+
+// Hallway with music playing
+static void partyTrace(double t, std::mt19937& rng, uint16_t* out) {
+    noiseBurst(t, 150, 400, 110 + 40 * sin(t), rng, out);
+}
+
+// Quiet, a vacuum cleaner running from 20 s to 40 s, quiet again
+static void stepTrace(double t, std::mt19937& rng, uint16_t* out) {
+    noiseBurst(t, t >= STEP_START_S && t < STEP_END_S ? 250 : 3, 0, 0, rng, out);
+}
+
+struct Result {
+    float minDb, maxDb, finalDb;
+    int finalVolume;
+    int quietVolume;            // Volume just before STEP_START_S
+    double settledAt;           // End of the last burst that played above quietVolume + 1
+};
+
+static Result run(const std::vector<std::vector<uint16_t>>& bursts, bool print) {
+    AmbientEstimator est;
+    ambientBegin(est);
+    Result r = {0, -200, 0, 0, 0, 0};
+    for (size_t b = 0; b < bursts.size(); b++) {
+        ambientBurst(est, bursts[b].data(), BURST_SAMPLES);
+        if (est.levelDb < r.minDb) r.minDb = est.levelDb;
+        if (est.levelDb > r.maxDb) r.maxDb = est.levelDb;
+        double end = (b + 1) * BURST_INTERVAL_S;
+        int volume = ambientVolume(est.levelDb, BASE_VOLUME, MIN_VOLUME, MAX_VOLUME);
+        if (end <= STEP_START_S) {
+            r.quietVolume = volume;
+        } else if (volume > r.quietVolume + 1) {
+            r.settledAt = end;
+        }
+        if (print && b % 20 == 19) {
+            printf("    t=%5.1f s  burst %6.1f dB  level %6.1f dB  volume %3d\n", end, est.lastBurstDb, est.levelDb,
+                   volume);
+        }
+    }
+    r.finalDb = est.levelDb;
+    r.finalVolume = ambientVolume(est.levelDb, BASE_VOLUME, MIN_VOLUME, MAX_VOLUME);
+    return r;
+}
+
+static std::vector<std::vector<uint16_t>> synthesize(TraceFn fn, double seconds) {
+    std::mt19937 rng(1);
+    std::vector<std::vector<uint16_t>> bursts;
+    for (double t = 0; t < seconds; t += BURST_INTERVAL_S) {
+        std::vector<uint16_t> burst(BURST_SAMPLES);
+        fn(t, rng, burst.data());
+        bursts.push_back(burst);
+    }
+    return bursts;
+}
+
+// 16-bit mono PCM only; returns no bursts if the file cannot be used
+static std::vector<std::vector<uint16_t>> loadWav(const char* path) {
+    std::vector<std::vector<uint16_t>> bursts;
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return bursts;
+    }
+    uint8_t header[44];
+    if (fread(header, 1, sizeof(header), f) != sizeof(header) || memcmp(header, "RIFF", 4) != 0 ||
+        memcmp(header + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "%s is not a WAV file\n", path);
+        fclose(f);
+        return bursts;
+    }
+    int channels = header[22] | (header[23] << 8);
+    long rate = header[24] | (header[25] << 8) | (header[26] << 16) | ((long)header[27] << 24);
+    int bits = header[34] | (header[35] << 8);
+    if (channels != 1 || bits != 16) {
+        fprintf(stderr, "%s: need 16-bit mono, got %d channels of %d bits\n", path, channels, bits);
+        fclose(f);
+        return bursts;
+    }
+    std::vector<int16_t> pcm;
+    int16_t sample;
+    while (fread(&sample, sizeof(sample), 1, f) == 1) {
+        pcm.push_back(sample);
+    }
+    fclose(f);
+
+    size_t step = (size_t)(rate * BURST_INTERVAL_S);
+    for (size_t start = 0; start + BURST_SAMPLES <= pcm.size(); start += step) {
+        std::vector<uint16_t> burst(BURST_SAMPLES);
+        for (int i = 0; i < BURST_SAMPLES; i++) {
+            burst[i] = adcCode(pcm[start + i] / 16.0);
+        }
+        bursts.push_back(burst);
+    }
+    printf("%s: %ld Hz, %.1f s, %zu bursts\n", path, rate, pcm.size() / (double)rate, bursts.size());
+    return bursts;
+}
+
+int main(int argc, char** argv) {
+    struct {
+        const char* name;
+        TraceFn fn;
+    } traces[] = {{"night", nightTrace}, {"living", livingTrace}, {"party", partyTrace}, {"step", stepTrace}};
+
+    printf("Chime volume %d, bounds %d-%d\n", BASE_VOLUME, MIN_VOLUME, MAX_VOLUME);
+    bool ok = true;
+    for (auto& trace : traces) {
+        bool step = strcmp(trace.name, "step") == 0;
+        printf("%-8s\n", trace.name);
+        Result r = run(synthesize(trace.fn, 60), step);
+        printf("    level %6.1f dB (range %6.1f to %6.1f)  volume %3d\n", r.finalDb, r.minDb, r.maxDb, r.finalVolume);
+
+        bool pass;
+        if (strcmp(trace.name, "night") == 0) {
+            pass = r.finalVolume <= NIGHT_MAX_VOLUME;
+            printf("    volume <= %d: %s\n", NIGHT_MAX_VOLUME, pass ? "ok" : "FAILED");
+        } else if (strcmp(trace.name, "party") == 0) {
+            pass = r.finalVolume >= PARTY_MIN_VOLUME;
+            printf("    volume >= %d: %s\n", PARTY_MIN_VOLUME, pass ? "ok" : "FAILED");
+        } else if (strcmp(trace.name, "living") == 0) {
+            pass = r.finalVolume > NIGHT_MAX_VOLUME && r.finalVolume < PARTY_MIN_VOLUME;
+            printf("    volume between %d and %d: %s\n", NIGHT_MAX_VOLUME, PARTY_MIN_VOLUME, pass ? "ok" : "FAILED");
+        } else {
+            double release = r.settledAt - STEP_END_S;
+            pass = r.quietVolume <= NIGHT_MAX_VOLUME && r.maxDb >= AMBIENT_LOUD_DB && release <= RELEASE_S;
+            printf("    back to volume %d+1 %.2f s after the step (limit %.1f s): %s\n", r.quietVolume, release,
+                   RELEASE_S, pass ? "ok" : "FAILED");
+        }
+        ok = ok && pass;
+    }
+    if (argc > 1) {
+        std::vector<std::vector<uint16_t>> bursts = loadWav(argv[1]);
+        if (!bursts.empty()) {
+            Result r = run(bursts, true);
+            printf("    level %6.1f dB (range %6.1f to %6.1f)  volume %3d\n", r.finalDb, r.minDb, r.maxDb, r.finalVolume);
+        }
+    }
+
+    // Estimator cost per burst; the ADC reads dominate on the device (~10 us each)
+    std::vector<std::vector<uint16_t>> bursts = synthesize(livingTrace, 60);
+    AmbientEstimator est;
+    ambientBegin(est);
+    const int rounds = 2000;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        for (auto& burst : bursts) {
+            ambientBurst(est, burst.data(), BURST_SAMPLES);
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    double perBurst = ns / (rounds * bursts.size());
+    printf("estimator: %.0f ns per burst, %.2f ns per sample (level %.1f dB)\n", perBurst, perBurst / BURST_SAMPLES,
+           est.levelDb);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+// Host benchmark for the fallback MQTT broker core (src/mini_broker.cpp).
+//
+//   g++ -O2 -std=gnu++17 -Isrc bench/broker_bench.cpp src/mini_broker.cpp -o broker_bench && ./broker_bench
+//
+// Clients are simulated in memory: packets are fed to brokerReceive() and
+// everything the broker sends is counted, so the numbers are the broker's own
+// CPU cost per message without any network stack.
+
+#include "mini_broker.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static size_t sentBytes[BROKER_MAX_CLIENTS];
+static std::vector<uint8_t> lastSent[BROKER_MAX_CLIENTS];
+static unsigned long fakeNow = 0;
+
+static size_t benchSend(uint8_t client, const uint8_t* data, size_t len) {
+    sentBytes[client] += len;
+    lastSent[client].assign(data, data + len);
+    return len;
+}
+static void benchClose(uint8_t) {}
+static unsigned long benchNow() { return fakeNow; }
+
+static void putString(std::vector<uint8_t>& out, const char* s) {
+    size_t n = strlen(s);
+    out.push_back(n >> 8);
+    out.push_back(n & 0xFF);
+    out.insert(out.end(), s, s + n);
+}
+
+static std::vector<uint8_t> packet(uint8_t header, const std::vector<uint8_t>& body) {
+    std::vector<uint8_t> out = {header};
+    size_t len = body.size();
+    do {
+        uint8_t digit = len % 128;
+        len /= 128;
+        out.push_back(digit | (len ? 0x80 : 0));
+    } while (len);
+    out.insert(out.end(), body.begin(), body.end());
+    return out;
+}
+
+static std::vector<uint8_t> connectPacket() {
+    std::vector<uint8_t> body;
+    putString(body, "MQTT");
+    body.insert(body.end(), {4, 0x02, 0, 60});  // Level 4, clean session, 60 s keep-alive
+    putString(body, "bench");
+    return packet(0x10, body);
+}
+
+static std::vector<uint8_t> subscribePacket(const char* filter) {
+    std::vector<uint8_t> body = {0, 1};
+    putString(body, filter);
+    body.push_back(1);
+    return packet(0x82, body);
+}
+
+static std::vector<uint8_t> publishPacket(const char* topic, size_t payloadLen, uint8_t qos) {
+    std::vector<uint8_t> body;
+    putString(body, topic);
+    if (qos) {
+        body.insert(body.end(), {0, 7});
+    }
+    body.insert(body.end(), payloadLen, 'x');
+    return packet(0x30 | (qos << 1), body);
+}
+
+// SUBSCRIBE with more filters than a client may hold: one return code per
+// filter, 0x80 for those that did not fit (MQTT 3.1.1 3.9.3)
+static bool checkSubackCodes() {
+    const int filters = BROKER_MAX_SUBS + 3;
+    std::vector<uint8_t> body = {0, 9};
+    for (int i = 0; i < filters; i++) {
+        char filter[16];
+        snprintf(filter, sizeof(filter), "bench/%d", i);
+        putString(body, filter);
+        body.push_back(1);
+    }
+    std::vector<uint8_t> conn = connectPacket();
+    std::vector<uint8_t> sub = packet(0x82, body);
+    int id = brokerAccept();
+    brokerReceive(id, conn.data(), conn.size());
+    brokerReceive(id, sub.data(), sub.size());
+    const std::vector<uint8_t>& suback = lastSent[id];
+    bool ok = suback.size() == 4 + (size_t)filters && suback[0] == 0x90 && suback[1] == 2 + filters &&
+              suback[2] == 0 && suback[3] == 9;
+    for (int i = 0; ok && i < filters; i++) {
+        ok = suback[4 + i] == (i < BROKER_MAX_SUBS ? 1 : 0x80);
+    }
+    printf("SUBACK for %d filters (table holds %d): %s\n", filters, BROKER_MAX_SUBS, ok ? "ok" : "WRONG");
+    return ok;
+}
+
+static double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main() {
+    BrokerIO io = {benchSend, benchClose, benchNow, NULL, NULL};
+    brokerBegin(io);
+    bool subackOk = checkSubackCodes();
+    brokerBegin(io);
+    printf("Static footprint: %zu bytes (%d clients, %d retained)\n",
+           brokerMemoryFootprint(), BROKER_MAX_CLIENTS, BROKER_MAX_RETAINED);
+
+    // Capacity: fill every slot, the next connection must be refused
+    std::vector<uint8_t> conn = connectPacket();
+    std::vector<uint8_t> sub = subscribePacket("doorbell/#");
+    for (int i = 0; i < BROKER_MAX_CLIENTS; i++) {
+        int id = brokerAccept();
+        brokerReceive(id, conn.data(), conn.size());
+        brokerReceive(id, sub.data(), sub.size());
+    }
+    printf("Capacity: %d connected, extra connection %s\n",
+           brokerClientCount(), brokerAccept() < 0 ? "refused" : "ACCEPTED (bug)");
+
+    const int messages = 200000;
+    uint8_t payload[128];
+    memset(payload, 'x', sizeof(payload));
+
+    // Fan-out from the device to every client
+    memset(sentBytes, 0, sizeof(sentBytes));
+    unsigned long before = brokerStats.messagesOut;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < messages; i++) {
+        brokerPublish("doorbell/event", payload, sizeof(payload), false);
+    }
+    double elapsed = seconds(start);
+    unsigned long delivered = brokerStats.messagesOut - before;
+    printf("Device publish, 128 B to %d subscribers: %.0f msg/s in, %.0f deliveries/s, %.2f us per delivery\n",
+           BROKER_MAX_CLIENTS, messages / elapsed, delivered / elapsed, elapsed * 1e6 / delivered);
+
+    // Client publishes at QoS 1 (PUBACK plus fan-out), arriving in 64-byte TCP segments
+    std::vector<uint8_t> stream;
+    std::vector<uint8_t> pub = publishPacket("doorbell/command", 32, 1);
+    for (int i = 0; i < 1000; i++) {
+        stream.insert(stream.end(), pub.begin(), pub.end());
+    }
+    before = brokerStats.messagesOut;
+    start = std::chrono::steady_clock::now();
+    int rounds = messages / 1000;
+    for (int r = 0; r < rounds; r++) {
+        for (size_t off = 0; off < stream.size(); off += 64) {
+            size_t n = stream.size() - off < 64 ? stream.size() - off : 64;
+            brokerReceive(0, stream.data() + off, n);
+        }
+    }
+    elapsed = seconds(start);
+    delivered = brokerStats.messagesOut - before;
+    printf("Client publish, QoS 1, 32 B: %.0f msg/s in, %.0f deliveries/s\n",
+           rounds * 1000 / elapsed, delivered / elapsed);
+
+    printf("Stats: connects=%lu rejected=%lu in=%lu out=%lu dropped=%lu\n",
+           brokerStats.connects, brokerStats.rejected, brokerStats.messagesIn,
+           brokerStats.messagesOut, brokerStats.dropped);
+    return subackOk && brokerClientCount() == BROKER_MAX_CLIENTS && brokerStats.dropped == 0 ? 0 : 1;
+}
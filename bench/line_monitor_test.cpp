@@ -0,0 +1,159 @@
+// Host check for the line fault monitor (src/line_monitor.cpp).
+//
+//   g++ -O2 -std=gnu++17 -Isrc bench/line_monitor_test.cpp src/line_monitor.cpp -o line_monitor_test && ./line_monitor_test
+//
+// Feeds one line with synthetic traces at the rates checkADC() samples it:
+// every ADC_IDLE_SAMPLE_INTERVAL while idle, every ADC_SAMPLE_INTERVAL above
+// ADC_APPROACH_LEVEL and for ADC_FAST_HOLD_MS after. After a minute of quiet
+// line (so the idle level is learned) each trace checks the fault raised and
+// whether the line is quarantined:
+// - a healthy line with a little noise raises nothing
+// - a button held twice as long as the longest session raises nothing
+// - a short to the supply raises stuck_high after LINE_STUCK_HIGH_MS, and the
+//   quarantine is lifted LINE_RECOVER_MS after the short is gone
+// - a floating line raises noisy; a line pinned to ground raises stuck_low
+//   (reported, not quarantined); an idle level that moves raises drift
+// It also measures the time constant of the idle level average against the
+// figure in line_monitor.h. The exit status is non-zero if any case differs.
+
+#include "input_config.h"
+#include "line_monitor.h"
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+#define IDLE_V 0.4
+#define PRESSED_V 3.3
+#define LEARN_MS 65000UL                // Quiet line before each trace, past LINE_IDLE_LEARN_MS
+#define IDLE_TAU_MS 20000.0             // Idle level time constant claimed in line_monitor.h
+#define IDLE_TAU_TOLERANCE 0.15
+
+// Line voltage at t ms into a trace (t counts from the end of the learning minute)
+typedef double (*TraceFn)(unsigned long t, std::mt19937& rng);
+
+struct Result {
+    LineFault fault;                    ///< Worst fault raised during the trace
+    bool quarantined;                   ///< Quarantined at any point
+    unsigned long raisedAfter;          ///< Trace time the worst fault was first raised
+    bool quarantinedAtEnd;
+    float idleLevel;
+};
+
+static double jitter(std::mt19937& rng, double amplitude) {
+    return std::uniform_real_distribution<double>(-amplitude, amplitude)(rng);
+}
+
+static Result run(TraceFn trace, unsigned long traceMs) {
+    std::mt19937 rng(7);
+    LineMonitor line;
+    lineMonitorBegin(line, 0);
+    Result result = {LINE_OK, false, 0, false, 0};
+    unsigned long fastUntil = 0;
+    unsigned long end = LEARN_MS + traceMs;
+    for (unsigned long now = 0; now < end;) {
+        double v = now < LEARN_MS ? IDLE_V + jitter(rng, 0.01) : trace(now - LEARN_MS, rng);
+        v = fmax(0.0, fmin(PRESSED_V, v));
+        lineMonitorUpdate(line, (float)v, ADC_THRESHOLD, ADC_THRESHOLD - ADC_HYSTERESIS, now);
+        if (now >= LEARN_MS) {
+            if (line.fault > result.fault) {
+                result.fault = line.fault;
+                result.raisedAfter = now - LEARN_MS;
+            }
+            result.quarantined = result.quarantined || line.quarantined;
+        }
+        if (v >= ADC_APPROACH_LEVEL) {
+            fastUntil = now + ADC_FAST_HOLD_MS;
+        }
+        now += now < fastUntil ? ADC_SAMPLE_INTERVAL : ADC_IDLE_SAMPLE_INTERVAL;
+    }
+    result.quarantinedAtEnd = line.quarantined;
+    result.idleLevel = line.idleLevel;
+    return result;
+}
+
+static double healthy(unsigned long, std::mt19937& rng) {
+    return IDLE_V + jitter(rng, 0.02);
+}
+
+// Held twice as long as a session can last, every 20 s
+static double longPress(unsigned long t, std::mt19937& rng) {
+    bool held = t % 20000 < 2 * MAX_SESSION_SAMPLES * ADC_SAMPLE_INTERVAL;
+    return held ? PRESSED_V - 0.05 + jitter(rng, 0.03) : healthy(t, rng);
+}
+
+#define SHORT_MS 45000UL
+static double shorted(unsigned long t, std::mt19937& rng) {
+    return t < SHORT_MS ? PRESSED_V - 0.02 + jitter(rng, 0.01) : healthy(t, rng);
+}
+
+static double floating(unsigned long, std::mt19937& rng) {
+    return 1.3 + jitter(rng, 1.2);
+}
+
+static double grounded(unsigned long, std::mt19937& rng) {
+    return fabs(jitter(rng, 0.01));
+}
+
+static double drifted(unsigned long, std::mt19937& rng) {
+    return IDLE_V + 0.8 + jitter(rng, 0.02);
+}
+
+// A small step of the idle level, to time the average
+#define STEP_V 0.2
+static double idleStep(unsigned long, std::mt19937& rng) {
+    return IDLE_V + STEP_V + jitter(rng, 0.01);
+}
+
+struct Case {
+    const char* name;
+    TraceFn trace;
+    unsigned long ms;
+    LineFault fault;
+    bool quarantined;                   ///< Expected at any point of the trace
+    bool quarantinedAtEnd;
+};
+
+static const Case cases[] = {
+    {"healthy", healthy, 600000, LINE_OK, false, false},
+    {"held 2x longest session", longPress, 600000, LINE_OK, false, false},
+    {"short, then healed", shorted, SHORT_MS + LINE_RECOVER_MS + 5000, LINE_STUCK_HIGH, true, false},
+    {"floating", floating, 60000, LINE_NOISY, true, true},
+    {"grounded", grounded, LINE_STUCK_LOW_MS + 60000, LINE_STUCK_LOW, false, false},
+    {"idle level moved", drifted, 180000, LINE_DRIFT, false, false},
+};
+
+int main() {
+    int failures = 0;
+    printf("Idle %d ms, fast %d ms, threshold %.1f V; stuck high after %d ms, longest session %d ms\n",
+           ADC_IDLE_SAMPLE_INTERVAL, ADC_SAMPLE_INTERVAL, ADC_THRESHOLD, LINE_STUCK_HIGH_MS,
+           MAX_SESSION_SAMPLES * ADC_SAMPLE_INTERVAL);
+    for (const Case& c : cases) {
+        Result r = run(c.trace, c.ms);
+        bool ok = r.fault == c.fault && r.quarantined == c.quarantined && r.quarantinedAtEnd == c.quarantinedAtEnd;
+        if (c.fault == LINE_STUCK_HIGH) {
+            // Raised one sample after the limit at most
+            ok = ok && r.raisedAfter >= LINE_STUCK_HIGH_MS && r.raisedAfter <= LINE_STUCK_HIGH_MS + ADC_SAMPLE_INTERVAL;
+        }
+        printf("  %-24s %-10s after %7lu ms  quarantined %-3s at end %-3s  %s\n", c.name, lineFaultName(r.fault),
+               r.raisedAfter, r.quarantined ? "yes" : "no", r.quarantinedAtEnd ? "yes" : "no", ok ? "ok" : "FAILED");
+        if (!ok) {
+            printf("    expected %s, quarantined %s, at end %s\n", lineFaultName(c.fault), c.quarantined ? "yes" : "no",
+                   c.quarantinedAtEnd ? "yes" : "no");
+            failures++;
+        }
+    }
+
+    // Time for the idle level to cover 1 - 1/e of a step
+    double target = IDLE_V + STEP_V * (1 - exp(-1.0));
+    unsigned long lo = 0, hi = 120000;
+    while (hi - lo > ADC_IDLE_SAMPLE_INTERVAL) {
+        unsigned long mid = (lo + hi) / 2;
+        (run(idleStep, mid).idleLevel < target ? lo : hi) = mid;
+    }
+    bool ok = fabs(hi - IDLE_TAU_MS) <= IDLE_TAU_TOLERANCE * IDLE_TAU_MS;
+    printf("  idle level time constant %.1f s (line_monitor.h: %.0f s)  %s\n", hi / 1000.0, IDLE_TAU_MS / 1000, ok ? "ok" : "FAILED");
+    failures += !ok;
+
+    printf("\n%s: %d failure%s\n", failures ? "FAILED" : "ok", failures, failures == 1 ? "" : "s");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,335 @@
+// Host check and benchmark for the MQTT codec (src/mqtt5.cpp), 3.1.1 against 5.
+//
+//   g++ -O2 -std=gnu++17 -Isrc bench/mqtt5_bench.cpp src/mqtt5.cpp -o mqtt5_bench && ./mqtt5_bench [host [port]]
+//
+// Without arguments it
+// - encodes a typical hour of the device's upstream traffic with both
+//   protocol levels and prints bytes per message per topic (level 5 with the
+//   broker allowing 16 topic aliases, as mosquitto does when configured with
+//   max_topic_alias 16; its default is 10)
+// - feeds level 5 packets from one client into another and checks that
+//   topics, aliases, message expiry, response topic and correlation data come
+//   through; the exit status is non-zero if anything differs
+//
+// With a broker host it also measures end-to-end command latency: a
+// controller session publishes a command to doorbell/play/1, a device session
+// answers it, and the controller times command to answer. On 3.1.1 the answer
+// goes to a fixed topic and carries the command's sequence number; on 5 it
+// goes to the command's Response Topic with its Correlation Data, as the
+// firmware does with FEATURE_MQTT5.
+
+#include "mqtt5.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#define LATENCY_COMMANDS 200
+#define LATENCY_TIMEOUT_MS 2000
+
+struct Traffic {
+    const char* topic;
+    int perHour;
+    int payloadBytes;
+};
+
+// Upstream publishes of an analog build with a few rings an hour
+static const Traffic hour[] = {
+    {"doorbell/latency/echo", 240, 60},
+    {"doorbell/health", 60, 560},
+    {"doorbell/wifi/power", 60, 300},
+    {"doorbell/line/health", 60, 420},
+    {"doorbell/maintenance", 60, 380},
+    {"doorbell/mqtt/stats", 60, 330},
+    {"doorbell/notifier", 60, 150},
+    {"doorbell/fallback_broker", 60, 200},
+    {"doorbell/event", 4, 120},
+    {"doorbell/session", 4, 260},
+    {"doorbell/status", 1, 500},
+};
+
+static unsigned long nowMs() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// --- Bytes per message: packets are counted, not sent anywhere ---
+
+static size_t discard(const uint8_t*, size_t len) { return len; }
+
+// What a broker would answer to CONNECT
+static void fakeConnack(Mqtt5Client& client, uint16_t aliasMax) {
+    uint8_t v311[] = {0x20, 0x02, 0x00, 0x00};
+    uint8_t v5[] = {0x20, 0x06, 0x00, 0x00, 0x03, 0x22, (uint8_t)(aliasMax >> 8), (uint8_t)aliasMax};
+    if (client.protocol == MQTT5_PROTOCOL_V5) {
+        mqtt5Receive(client, v5, sizeof(v5));
+    } else {
+        mqtt5Receive(client, v311, sizeof(v311));
+    }
+}
+
+static void compareBytes() {
+    Mqtt5IO io = {discard, nowMs, NULL};
+    static Mqtt5Client v311, v5;
+    mqtt5Begin(v311, io, MQTT5_PROTOCOL_V311);
+    mqtt5Begin(v5, io, MQTT5_PROTOCOL_V5);
+    mqtt5Connect(v311, "DoorBell-bench", "", "", 15, 0);
+    mqtt5Connect(v5, "DoorBell-bench", "", "", 15, 300);
+    fakeConnack(v311, 0);
+    fakeConnack(v5, 16);
+
+    printf("%-26s %6s %10s %10s %8s\n", "topic", "msgs", "3.1.1 B", "5 B", "saved");
+    std::vector<uint8_t> payload(1024, 'x');
+    unsigned long total311 = 0, total5 = 0, messages = 0;
+    for (const Traffic& t : hour) {
+        unsigned long before311 = v311.stats.bytesOut, before5 = v5.stats.bytesOut;
+        for (int i = 0; i < t.perHour; i++) {
+            mqtt5Publish(v311, t.topic, payload.data(), t.payloadBytes, false, NULL);
+            mqtt5Publish(v5, t.topic, payload.data(), t.payloadBytes, false, NULL);
+        }
+        double per311 = (v311.stats.bytesOut - before311) / (double)t.perHour;
+        double per5 = (v5.stats.bytesOut - before5) / (double)t.perHour;
+        printf("%-26s %6d %10.1f %10.1f %7.1f%%\n", t.topic, t.perHour, per311, per5, 100 * (1 - per5 / per311));
+        total311 += v311.stats.bytesOut - before311;
+        total5 += v5.stats.bytesOut - before5;
+        messages += t.perHour;
+    }
+    printf("%-26s %6lu %10.1f %10.1f %7.1f%%\n", "all (per message)", messages, total311 / (double)messages,
+           total5 / (double)messages, 100 * (1 - total5 / (double)total311));
+    printf("Alias hits %lu of %lu publishes\n\n", v5.stats.aliasHits, v5.stats.messagesOut);
+
+    // Commands: topic headers dominate, and the broker does not alias what it sends by default
+    const char* commands[] = {"doorbell/set/button/downstairs", "doorbell/play/3", "doorbell/get/status"};
+    const uint8_t correlation[] = {0, 0, 0, 42};
+    Mqtt5Properties request = {30, "controller/ack/1", correlation, sizeof(correlation)};
+    printf("%-32s %10s %18s\n", "inbound command (16 B payload)", "3.1.1 B", "5 B (expiry+reply)");
+    for (const char* topic : commands) {
+        unsigned long before = v5.stats.bytesOut;
+        mqtt5Publish(v5, topic, payload.data(), 16, false, &request);
+        printf("%-32s %10zu %18lu\n", topic, mqtt5V311PublishSize(strlen(topic), 16), v5.stats.bytesOut - before);
+    }
+    printf("\n");
+}
+
+// --- Loopback: level 5 packets of one client decoded by another ---
+
+static Mqtt5Client sender, receiver;
+static std::vector<std::string> receivedTopics;
+static Mqtt5Properties receivedProps;
+static std::string receivedResponse, receivedCorrelation, receivedPayload;
+
+static size_t toReceiver(const uint8_t* data, size_t len) {
+    mqtt5Receive(receiver, data, len);
+    return len;
+}
+
+static void collect(const char* topic, const uint8_t* payload, size_t len, const Mqtt5Properties& props) {
+    receivedTopics.push_back(topic);
+    receivedPayload.assign((const char*)payload, len);
+    receivedProps = props;
+    receivedResponse = props.responseTopic ? props.responseTopic : "";
+    receivedCorrelation.assign((const char*)props.correlation, props.correlation ? props.correlationLen : 0);
+}
+
+static int loopbackCheck() {
+    Mqtt5IO senderIO = {discard, nowMs, NULL};
+    Mqtt5IO receiverIO = {discard, nowMs, collect};
+    mqtt5Begin(sender, senderIO, MQTT5_PROTOCOL_V5);
+    mqtt5Begin(receiver, receiverIO, MQTT5_PROTOCOL_V5);
+    mqtt5Connect(sender, "sender", "", "", 0, 0);
+    mqtt5Connect(receiver, "receiver", "", "", 0, 0);
+    fakeConnack(sender, MQTT5_INBOUND_ALIASES);  // Sender aliases exactly what the receiver offered
+    fakeConnack(receiver, 0);
+    sender.io.send = toReceiver;
+
+    int failures = 0;
+    auto expect = [&](bool ok, const char* what) {
+        if (!ok) {
+            printf("  loopback: %s\n", what);
+            failures++;
+        }
+    };
+
+    const char* topics[] = {"doorbell/a", "doorbell/b", "doorbell/a", "doorbell/c", "doorbell/b"};
+    for (const char* topic : topics) {
+        mqtt5Publish(sender, topic, (const uint8_t*)"1", 1, false, NULL);
+    }
+    expect(receivedTopics.size() == 5, "message count");
+    for (size_t i = 0; i < receivedTopics.size() && i < 5; i++) {
+        expect(receivedTopics[i] == topics[i], "alias resolved to the wrong topic");
+    }
+    expect(receiver.stats.inboundAliasHits == 2 && sender.stats.aliasHits == 2, "alias hit counts");
+
+    const uint8_t correlation[] = {1, 2, 0, 4};
+    Mqtt5Properties request = {30, "controller/ack", correlation, sizeof(correlation)};
+    mqtt5Publish(sender, "doorbell/play/1", (const uint8_t*)"", 0, false, &request);
+    expect(receivedTopics.back() == "doorbell/play/1", "command topic");
+    expect(receivedProps.messageExpiryS == 30, "message expiry");
+    expect(receivedResponse == "controller/ack", "response topic");
+    expect(receivedCorrelation == std::string((const char*)correlation, sizeof(correlation)), "correlation data");
+    expect(receivedPayload.empty(), "empty payload");
+
+    // A packet split at every byte boundary
+    sender.io.send = [](const uint8_t* data, size_t len) -> size_t {
+        for (size_t i = 0; i < len; i++) {
+            mqtt5Receive(receiver, data + i, 1);
+        }
+        return len;
+    };
+    std::string big(900, 'y');
+    mqtt5Publish(sender, "doorbell/health", (const uint8_t*)big.data(), big.size(), true, NULL);
+    expect(receivedTopics.back() == "doorbell/health" && receivedPayload == big, "byte-wise delivery");
+    expect(receiver.stats.protocolErrors == 0, "protocol errors");
+
+    printf("Loopback check: %s\n\n", failures ? "FAILED" : "ok");
+    return failures;
+}
+
+// --- End-to-end command latency against a broker ---
+
+static int deviceFd = -1, controllerFd = -1;
+static Mqtt5Client device, controller;
+static bool answered;
+static uint32_t expectedSeq;
+
+static size_t sendDevice(const uint8_t* data, size_t len) { return write(deviceFd, data, len); }
+static size_t sendController(const uint8_t* data, size_t len) { return write(controllerFd, data, len); }
+
+// Firmware side: answer the command where the protocol allows
+static void deviceMessage(const char*, const uint8_t* payload, size_t len, const Mqtt5Properties& props) {
+    if (props.responseTopic) {
+        Mqtt5Properties reply = {0, NULL, props.correlation, props.correlationLen};
+        const char ack[] = "{\"status\":\"handled\"}";
+        mqtt5Publish(device, props.responseTopic, (const uint8_t*)ack, sizeof(ack) - 1, false, &reply);
+    } else {
+        mqtt5Publish(device, "bench/doorbell/ack", payload, len, false, NULL);
+    }
+}
+
+static void controllerMessage(const char*, const uint8_t* payload, size_t len, const Mqtt5Properties& props) {
+    uint32_t seq;
+    if (props.correlation && props.correlationLen == sizeof(seq)) {
+        memcpy(&seq, props.correlation, sizeof(seq));
+    } else if (len == sizeof(seq)) {
+        memcpy(&seq, payload, sizeof(seq));
+    } else {
+        return;
+    }
+    answered = answered || seq == expectedSeq;
+}
+
+static int openSocket(const char* host, const char* port) {
+    addrinfo hints = {}, *res;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        return -1;
+    }
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+// Read whatever arrives within waitMs and feed it to both sessions
+static void pump(int waitMs) {
+    pollfd fds[2] = {{deviceFd, POLLIN, 0}, {controllerFd, POLLIN, 0}};
+    if (poll(fds, 2, waitMs) <= 0) {
+        return;
+    }
+    uint8_t buffer[2048];
+    if (fds[0].revents & POLLIN) {
+        ssize_t n = read(deviceFd, buffer, sizeof(buffer));
+        if (n > 0) mqtt5Receive(device, buffer, n);
+    }
+    if (fds[1].revents & POLLIN) {
+        ssize_t n = read(controllerFd, buffer, sizeof(buffer));
+        if (n > 0) mqtt5Receive(controller, buffer, n);
+    }
+}
+
+static bool waitFor(bool (*done)(), int timeoutMs) {
+    unsigned long start = nowMs();
+    while (!done() && nowMs() - start < (unsigned long)timeoutMs) {
+        pump(10);
+    }
+    return done();
+}
+
+static bool bothConnected() { return device.state == MQTT5_CONNECTED && controller.state == MQTT5_CONNECTED; }
+static bool isAnswered() { return answered; }
+
+static bool measureLatency(const char* host, const char* port, uint8_t protocol) {
+    deviceFd = openSocket(host, port);
+    controllerFd = openSocket(host, port);
+    if (deviceFd < 0 || controllerFd < 0) {
+        printf("Cannot connect to %s:%s\n", host, port);
+        return false;
+    }
+    Mqtt5IO deviceIO = {sendDevice, nowMs, deviceMessage};
+    Mqtt5IO controllerIO = {sendController, nowMs, controllerMessage};
+    mqtt5Begin(device, deviceIO, protocol);
+    mqtt5Begin(controller, controllerIO, protocol);
+    mqtt5Connect(device, "bench-device", "", "", 30, 0);
+    mqtt5Connect(controller, "bench-controller", "", "", 30, 0);
+    if (!waitFor(bothConnected, 3000)) {
+        printf("Protocol level %u: CONNECT refused or timed out (reason %u / %u)\n", protocol, device.reason,
+               controller.reason);
+        close(deviceFd);
+        close(controllerFd);
+        return false;
+    }
+    mqtt5Subscribe(device, "doorbell/play/#", 0);
+    mqtt5Subscribe(controller, protocol == MQTT5_PROTOCOL_V5 ? "bench/controller/ack" : "bench/doorbell/ack", 0);
+    pump(200);
+
+    std::vector<double> latencies;
+    int lost = 0;
+    for (uint32_t seq = 1; seq <= LATENCY_COMMANDS; seq++) {
+        expectedSeq = seq;
+        answered = false;
+        Mqtt5Properties request = {30, "bench/controller/ack", (const uint8_t*)&seq, sizeof(seq)};
+        auto start = std::chrono::steady_clock::now();
+        mqtt5Publish(controller, "doorbell/play/1", (const uint8_t*)&seq, sizeof(seq), false,
+                     protocol == MQTT5_PROTOCOL_V5 ? &request : NULL);
+        if (waitFor(isAnswered, LATENCY_TIMEOUT_MS)) {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            latencies.push_back(std::chrono::duration<double, std::milli>(elapsed).count());
+        } else {
+            lost++;
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+    if (!latencies.empty()) {
+        printf("Protocol level %u: %zu commands, median %.2f ms, p95 %.2f ms, max %.2f ms, lost %d, "
+               "%.1f B/command out, %.1f B/answer out\n",
+               protocol, latencies.size(), latencies[latencies.size() / 2], latencies[latencies.size() * 95 / 100],
+               latencies.back(), lost, controller.stats.bytesOut / (double)controller.stats.messagesOut,
+               device.stats.bytesOut / (double)std::max(device.stats.messagesOut, 1UL));
+    }
+    mqtt5Disconnect(device);
+    mqtt5Disconnect(controller);
+    close(deviceFd);
+    close(controllerFd);
+    return lost == 0;
+}
+
+int main(int argc, char** argv) {
+    compareBytes();
+    int failures = loopbackCheck();
+    if (argc > 1) {
+        const char* port = argc > 2 ? argv[2] : "1883";
+        measureLatency(argv[1], port, MQTT5_PROTOCOL_V311);
+        measureLatency(argv[1], port, MQTT5_PROTOCOL_V5);
+    }
+    return failures ? 1 : 0;
+}
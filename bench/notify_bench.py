@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+"""Ring-to-notification latency: bridge vs direct push, against a local ntfy stand-in.
+
+    python3 bench/notify_bench.py [--rings 40] [--rtt-ms 40] [--service-ms 5] [--lan-ms 1] [--gap-ms 250]
+
+The stand-in answers POSTs as ntfy does (200 and a JSON body) over HTTP/1.1
+keep-alive. Distance to the real server is added on its side: every request
+costs one --rtt-ms, and the first request on a new connection three more (TCP
+handshake, then a full TLS 1.2 handshake), which is what an open connection
+saves.
+
+Paths, each timed from the ring to the 2xx response:
+    direct       the device notifier (src/notifier.cpp): POST on a connection
+                 kept open between rings (HTTPClient setReuse)
+    direct-cold  the same after the server closed the connection, e.g. rings
+                 further apart than its keep-alive timeout (no TLS session
+                 resumption, so a full handshake every time)
+    bridge       the device publishes, the broker forwards to the bridge, whose
+                 DeliveryQueue (bridge_queue.py) hands the ring to a worker that
+                 POSTs on a new connection each time, as requests.post in
+                 mqtt_to_ntfy.py does. The two MQTT hops run over loopback TCP
+                 through a relay thread standing in for the broker, each
+                 delayed by --lan-ms.
+
+Prints p50/p95/max per path. The exit status is non-zero if any ring was not
+delivered.
+"""
+
+import argparse
+import http.client
+import json
+import os
+import shutil
+import socket
+import sys
+import tempfile
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+from bridge_queue import DeliveryQueue  # noqa: E402
+
+MESSAGE = "Door bell rang"
+HEADERS = {"Title": "Doorbell", "Priority": "high", "Tags": "bell"}
+
+
+class NtfyStandIn(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    rtt = 0.0
+    service = 0.0
+
+    def setup(self):
+        super().setup()
+        self.fresh = True
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        delay = self.rtt + self.service + (3 * self.rtt if self.fresh else 0)
+        self.fresh = False
+        time.sleep(delay)
+        reply = json.dumps({"event": "message", "topic": self.path.strip("/"),
+                            "title": self.headers.get("Title"), "message": body.decode()}).encode()
+        self.send_response(200)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(reply)))
+        self.end_headers()
+        self.wfile.write(reply)
+
+    def log_message(self, *args):
+        pass
+
+
+def post(conn, path):
+    conn.request("POST", path, body=MESSAGE.encode(), headers=HEADERS)
+    response = conn.getresponse()
+    response.read()
+    return 200 <= response.status < 300
+
+
+def run_direct(port, rings, gap, reuse):
+    latencies = []
+    conn = None
+    for _ in range(rings):
+        ring = time.perf_counter()
+        if conn is None or not reuse:
+            if conn:
+                conn.close()
+            conn = http.client.HTTPConnection("127.0.0.1", port, timeout=10)
+        try:
+            ok = post(conn, "/doorbell")
+        except (http.client.HTTPException, OSError):
+            ok = False
+        if ok:
+            latencies.append(time.perf_counter() - ring)
+        time.sleep(gap)
+    conn.close()
+    return latencies
+
+
+def relay(source, sink, lan):
+    """Broker stand-in: forward each line from the device to the bridge"""
+    reader = source.makefile("rb")
+    for line in reader:
+        time.sleep(lan)
+        sink.sendall(line)
+
+
+def run_bridge(port, rings, gap, lan):
+    latencies = []
+    done = threading.Semaphore(0)
+
+    # Same request as send_notification in mqtt_to_ntfy.py: a new connection per POST
+    def send(item):
+        conn = http.client.HTTPConnection("127.0.0.1", port, timeout=10)
+        try:
+            ok = post(conn, "/doorbell")
+        finally:
+            conn.close()
+        if ok:
+            latencies.append(time.perf_counter() - item["ring"])
+            done.release()
+        return ok
+
+    spool = tempfile.mkdtemp(prefix="notify_bench_")
+    delivery = DeliveryQueue("ntfy", send, workers=2, queue_size=100, max_attempts=1, spool_dir=spool)
+
+    broker = socket.create_server(("127.0.0.1", 0))
+    bridge = socket.create_server(("127.0.0.1", 0))
+    device = socket.create_connection(broker.getsockname())
+    broker_in, _ = broker.accept()
+    broker_out = socket.create_connection(bridge.getsockname())
+    bridge_in, _ = bridge.accept()
+    for s in (device, broker_in, broker_out, bridge_in):
+        s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    threading.Thread(target=relay, args=(broker_in, broker_out, lan), daemon=True).start()
+
+    def on_message():
+        for line in bridge_in.makefile("rb"):
+            time.sleep(lan)
+            delivery.put(json.loads(line))
+    threading.Thread(target=on_message, daemon=True).start()
+
+    for _ in range(rings):
+        device.sendall((json.dumps({"ring": time.perf_counter()}) + "\n").encode())
+        if not done.acquire(timeout=10):
+            break
+        time.sleep(gap)
+
+    device.close()
+    delivery.stop()
+    shutil.rmtree(spool, ignore_errors=True)
+    return latencies
+
+
+def percentile(values, p):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(p / 100 * len(ordered)))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--rings", type=int, default=40)
+    parser.add_argument("--rtt-ms", type=float, default=40, help="round trip to the push server")
+    parser.add_argument("--service-ms", type=float, default=5, help="server time per request")
+    parser.add_argument("--lan-ms", type=float, default=1, help="delay of each MQTT hop")
+    parser.add_argument("--gap-ms", type=float, default=250, help="pause between rings")
+    args = parser.parse_args()
+
+    NtfyStandIn.rtt = args.rtt_ms / 1000
+    NtfyStandIn.service = args.service_ms / 1000
+    server = ThreadingHTTPServer(("127.0.0.1", 0), NtfyStandIn)
+    server.daemon_threads = True
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    port = server.server_address[1]
+    gap = args.gap_ms / 1000
+
+    print(f"ntfy stand-in on port {port}: rtt {args.rtt_ms:g} ms, service {args.service_ms:g} ms, "
+          f"{args.rings} rings per path")
+    results = [
+        ("direct", run_direct(port, args.rings, gap, reuse=True)),
+        ("direct-cold", run_direct(port, args.rings, gap, reuse=False)),
+        ("bridge", run_bridge(port, args.rings, gap, args.lan_ms / 1000)),
+    ]
+    server.shutdown()
+
+    failures = 0
+    for name, latencies in results:
+        missing = args.rings - len(latencies)
+        failures += missing
+        if not latencies:
+            print(f"  {name:12s} no deliveries")
+            continue
+        ms = [l * 1000 for l in latencies]
+        print(f"  {name:12s} p50 {percentile(ms, 50):7.1f} ms  p95 {percentile(ms, 95):7.1f} ms  "
+              f"max {max(ms):7.1f} ms  delivered {len(ms)}/{args.rings}")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
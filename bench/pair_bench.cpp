@@ -0,0 +1,596 @@
+// Two-unit simulator for the active/standby pair (src/pair.cpp).
+//
+//   g++ -O2 -std=gnu++17 -Isrc bench/pair_bench.cpp src/pair.cpp -o pair_bench && ./pair_bench [runs]
+//
+// Runs the real pair code of two units against a simulated clock and network
+// (1 ms steps; each unit polls every 20 ms like loop() does, has its own
+// millis() base, and sees a press 5-60 ms after it happens). Packets take
+// 2-15 ms and can be lost. Both units are connected to a broker that forwards
+// leases in 5-30 ms without loss, unless a scenario says otherwise. Per
+// scenario it prints the failover time (from the fault until the standby unit
+// has claimed), how long both units were active at once, and what became of
+// presses around the fault: rung once, lost (rung by nobody) or duplicated
+// (rung by both). Scenarios:
+// - crash:     the active unit dies; presses in the 3 s after
+// - stall:     the active unit blocks for 3 s (say, a TLS connect), then resumes
+// - partition: the units lose each other for 5 s while both keep their link;
+//              the broker lease keeps the standby from claiming
+// - no broker: the same with the broker unreachable too; both claim, which is
+//              the price of not losing rings
+// - same id:   both units get one node id; each must count the other's packets
+//              and leases as duplicate ids
+// - boot:      both start within 100 ms of each other; "failover" is the time
+//              until the first claim, and exactly one unit must end up active
+// - lossy:     an hour with 10 % and 30 % packet loss, with and without the
+//              broker; counts spurious takeovers
+// - forged:    packets and leases altered by a third host (a huge term, a
+//              rewritten settings block) and genuine packets replayed after
+//              the active unit died; a replay still echoes a recent packet of
+//              the standby for up to PAIR_LEASE_MS, so it may delay the
+//              takeover by that much, never more
+// It also measures warm-state replication: a settings change of a few bytes,
+// and a unit rejoining with blank settings. The exit status is non-zero if a
+// press was lost where a unit was able to ring it, a press was rung twice or a
+// unit took over spuriously anywhere but in a partition neither the LAN nor
+// the broker can arbitrate (no broker, and 30 % loss without the broker), a
+// duplicate id went unnoticed, a forged or replayed packet changed anything,
+// or replication never converged. Those two cases cannot meet "exactly one
+// unit rings": a unit cannot tell a dead peer from a lost path to it, and
+// waiting would lose the presses of a dead one, so both ring.
+
+#include "pair.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#define LOOP_MS 20
+#define SETTINGS_BYTES 114              // sizeof(PairSettings) of the firmware
+#define WARM_BYTES 48
+#define PAIR_TEST_KEY "bench key"
+#define NO_TIME ((unsigned long)-1)
+#define REPLAY_FAILOVER_MS (2 * PAIR_LEASE_MS + PAIR_GUARD_MS + 2 * LOOP_MS)
+
+struct Packet {
+    unsigned long deliverAt;
+    std::vector<uint8_t> bytes;
+    bool lease;                                 // Through the broker
+};
+
+// A press of the simulation, and the units' detections of it
+struct Press {
+    int button;
+    unsigned long at;
+    int rings;
+};
+
+struct Detection {
+    int press;
+    int button;
+    unsigned long localAt;
+};
+
+struct Unit {
+    PairNode pair;
+    unsigned long clockBase;
+    bool alive;
+    bool link;
+    bool broker;                                // Connected to the broker
+    unsigned long stalledUntil;
+    unsigned long nextLoop;
+    uint8_t settings[SETTINGS_BYTES];
+    uint8_t warm[WARM_BYTES];
+    std::vector<Packet> inbox;
+    std::vector<Detection> pendingDetections;   // Not yet seen by the unit's loop; localAt is simulated time
+    std::vector<Detection> detections;
+    unsigned long activeAt;                     // Simulated time it last became active
+    unsigned long regionAt[PAIR_MAX_REGIONS];   // Simulated time of the last onRegion
+};
+
+static std::mt19937 rng;
+static unsigned long simNow;
+static Unit units[2];
+static int current;                             // Unit whose pair code is running
+static std::vector<Press> presses;
+static double lossRate;
+static bool partitioned;
+static std::vector<uint8_t> activePacket;      // Last packet an active unit sent, for replays
+
+static int uniform(int low, int high) {
+    return std::uniform_int_distribution<int>(low, high)(rng);
+}
+
+static bool chance(double p) {
+    return std::uniform_real_distribution<double>(0, 1)(rng) < p;
+}
+
+static unsigned long localMillis(const Unit& unit) {
+    return unit.clockBase + simNow;
+}
+
+static bool simSend(const uint8_t* data, size_t len) {
+    Unit& peer = units[1 - current];
+    if (units[current].pair.role == PAIR_ACTIVE) {
+        activePacket.assign(data, data + len);
+    }
+    if (!units[current].link || !peer.link || partitioned || chance(lossRate)) {
+        return true;  // Gone on the air, as UDP would be
+    }
+    peer.inbox.push_back({simNow + uniform(2, 15), std::vector<uint8_t>(data, data + len), false});
+    return true;
+}
+
+static unsigned long simMillis() {
+    return localMillis(units[current]);
+}
+
+static bool simLinkUp() {
+    return units[current].link;
+}
+
+static void simRole(PairRole role, PairReason) {
+    units[current].activeAt = role == PAIR_ACTIVE ? simNow : NO_TIME;
+}
+
+static void simRegion(int region) {
+    units[current].regionAt[region] = simNow;
+}
+
+static void simCatchUp(int button, unsigned long at) {
+    for (const Detection& d : units[current].detections) {
+        if (d.button == button && d.localAt == at) {
+            presses[d.press].rings++;
+            return;
+        }
+    }
+}
+
+static bool simBrokerUp() {
+    return units[current].broker;
+}
+
+static bool simSendLease(const char* lease, size_t len) {
+    Unit& peer = units[1 - current];
+    if (!units[current].broker) {
+        return false;
+    }
+    if (peer.broker) {
+        peer.inbox.push_back({simNow + uniform(5, 30), std::vector<uint8_t>(lease, lease + len), true});
+    }
+    return true;
+}
+
+static const PairIO simIO = {simSend, simMillis, simLinkUp, simRole, simRegion, simCatchUp, simBrokerUp, simSendLease};
+
+static void boot(int index, bool blankConfig) {
+    Unit& unit = units[index];
+    current = index;
+    unit.alive = true;
+    unit.link = true;
+    unit.broker = true;
+    unit.stalledUntil = 0;
+    unit.nextLoop = simNow + uniform(0, LOOP_MS - 1);
+    unit.inbox.clear();
+    unit.pendingDetections.clear();
+    unit.detections.clear();
+    unit.activeAt = NO_TIME;
+    unit.regionAt[0] = unit.regionAt[1] = NO_TIME;
+    if (blankConfig) {
+        memset(unit.settings, 0xFF, sizeof(unit.settings));
+    }
+    pairBegin(unit.pair, simIO, 0x1000 + index * 0x111 + uniform(0, 0xFF), 0, PAIR_TEST_KEY, (uint32_t)rng());
+    pairAddRegion(unit.pair, "settings", unit.settings, sizeof(unit.settings));
+    pairAddRegion(unit.pair, "warm", unit.warm, sizeof(unit.warm));
+}
+
+static void reset() {
+    simNow = 0;
+    presses.clear();
+    lossRate = 0.01;
+    partitioned = false;
+    for (int i = 0; i < 2; i++) {
+        units[i].clockBase = uniform(0, 1000000);
+        for (int b = 0; b < SETTINGS_BYTES; b++) {
+            units[i].settings[b] = (uint8_t)(b * 7);
+        }
+        memset(units[i].warm, 0, sizeof(units[i].warm));
+    }
+    boot(0, false);
+    boot(1, false);
+}
+
+static bool running(const Unit& unit) {
+    return unit.alive && simNow >= unit.stalledUntil;
+}
+
+static bool isActive(int index) {
+    return units[index].alive && units[index].pair.role == PAIR_ACTIVE;
+}
+
+static int activeUnit() {
+    return isActive(0) ? 0 : isActive(1) ? 1 : -1;
+}
+
+static void press(int button) {
+    presses.push_back({button, simNow, 0});
+    for (int i = 0; i < 2; i++) {
+        if (units[i].alive) {
+            units[i].pendingDetections.push_back({(int)presses.size() - 1, button, simNow + uniform(5, 60)});
+        }
+    }
+}
+
+// Advance one millisecond; returns true while both units are active and running
+static bool step() {
+    simNow++;
+    for (int i = 0; i < 2; i++) {
+        Unit& unit = units[i];
+        if (!running(unit) || simNow < unit.nextLoop) {
+            continue;
+        }
+        unit.nextLoop = simNow + LOOP_MS;
+        current = i;
+        // What arrived since its last pass, including everything queued during a stall
+        std::vector<Packet> due;
+        for (auto it = unit.inbox.begin(); it != unit.inbox.end();) {
+            if (it->deliverAt <= simNow) {
+                due.push_back(*it);
+                it = unit.inbox.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        for (const Packet& packet : due) {
+            if (packet.lease) {
+                pairLeaseReceive(unit.pair, (const char*)packet.bytes.data(), packet.bytes.size());
+            } else {
+                pairReceive(unit.pair, packet.bytes.data(), packet.bytes.size());
+            }
+        }
+        for (auto it = unit.pendingDetections.begin(); it != unit.pendingDetections.end();) {
+            if (it->localAt > simNow) {
+                ++it;
+                continue;
+            }
+            Detection d = {it->press, it->button, localMillis(unit)};
+            unit.detections.push_back(d);
+            if (pairPress(unit.pair, d.button, d.localAt)) {
+                presses[d.press].rings++;
+            }
+            it = unit.pendingDetections.erase(it);
+        }
+        pairUpdate(unit.pair);
+    }
+    return running(units[0]) && running(units[1]) && isActive(0) && isActive(1);
+}
+
+static unsigned long runFor(unsigned long ms) {
+    unsigned long dual = 0;
+    for (unsigned long end = simNow + ms; simNow < end;) {
+        dual += step();
+    }
+    return dual;
+}
+
+static void settle() {
+    runFor(uniform(5000, 8000));
+}
+
+struct Outcome {
+    std::vector<double> failover;
+    std::vector<double> dual;
+    int once = 0, lost = 0, duplicated = 0, spurious = 0;
+};
+
+static void count(Outcome& outcome) {
+    for (const Press& p : presses) {
+        if (p.rings == 0) {
+            outcome.lost++;
+        } else if (p.rings == 1) {
+            outcome.once++;
+        } else {
+            outcome.duplicated++;
+        }
+    }
+}
+
+static void pressesOver(unsigned long ms, int count) {
+    for (int n = 0; n < count; n++) {
+        runFor(ms / count);
+        press(uniform(0, 1));
+    }
+}
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+static void report(const char* name, const Outcome& o, bool failover) {
+    printf("%-10s", name);
+    if (failover) {
+        printf("  failover ms p50 %5.0f p95 %5.0f max %5.0f", percentile(o.failover, 0.5),
+               percentile(o.failover, 0.95), percentile(o.failover, 1.0));
+    } else {
+        printf("  %45s", "");
+    }
+    printf("  dual-active ms p50 %5.0f max %5.0f  presses once %4d lost %3d dup %3d\n",
+           percentile(o.dual, 0.5), percentile(o.dual, 1.0), o.once, o.lost, o.duplicated);
+}
+
+static Outcome crashScenario(int runs) {
+    Outcome o;
+    for (int run = 0; run < runs; run++) {
+        reset();
+        settle();
+        int active = activeUnit();
+        presses.clear();
+        units[active].alive = false;
+        unsigned long crashedAt = simNow;
+        pressesOver(3000, 3);
+        runFor(1000);
+        o.failover.push_back(units[1 - active].activeAt == NO_TIME ? 1e9 : units[1 - active].activeAt - crashedAt);
+        o.dual.push_back(0);
+        count(o);
+    }
+    return o;
+}
+
+static Outcome stallScenario(int runs) {
+    Outcome o;
+    for (int run = 0; run < runs; run++) {
+        reset();
+        settle();
+        int active = activeUnit();
+        presses.clear();
+        units[active].stalledUntil = simNow + 3000;
+        unsigned long stalledAt = simNow;
+        pressesOver(3000, 3);
+        unsigned long dual = runFor(3000);
+        o.failover.push_back(units[1 - active].activeAt == NO_TIME ? 1e9 : units[1 - active].activeAt - stalledAt);
+        o.dual.push_back(dual);
+        count(o);
+    }
+    return o;
+}
+
+static Outcome partitionScenario(int runs, bool broker) {
+    Outcome o;
+    for (int run = 0; run < runs; run++) {
+        reset();
+        settle();
+        presses.clear();
+        partitioned = true;
+        units[0].broker = units[1].broker = broker;
+        unsigned long dual = 0;
+        for (int n = 0; n < 3; n++) {
+            dual += runFor(5000 / 3);
+            press(uniform(0, 1));
+        }
+        partitioned = false;
+        units[0].broker = units[1].broker = true;
+        dual += runFor(3000);
+        o.dual.push_back(dual);
+        count(o);
+    }
+    return o;
+}
+
+static Outcome bootScenario(int runs) {
+    Outcome o;
+    for (int run = 0; run < runs; run++) {
+        simNow = 0;
+        presses.clear();
+        lossRate = 0.01;
+        partitioned = false;
+        units[0].clockBase = uniform(0, 1000000);
+        units[1].clockBase = uniform(0, 1000000);
+        boot(0, false);
+        units[1].alive = false;
+        runFor(uniform(0, 100));
+        boot(1, false);
+        unsigned long dual = 0, firstActive = NO_TIME;
+        while (simNow < 6000) {
+            dual += step();
+            if (firstActive == NO_TIME && activeUnit() >= 0) {
+                firstActive = simNow;
+            }
+        }
+        bool one = isActive(0) != isActive(1);
+        o.failover.push_back(one ? firstActive : 1e9);
+        o.dual.push_back(dual);
+        press(uniform(0, 1));
+        runFor(1000);
+        count(o);
+    }
+    return o;
+}
+
+static unsigned long lossyScenario(double loss, bool broker) {
+    reset();
+    lossRate = loss;
+    units[0].broker = units[1].broker = broker;
+    settle();
+    unsigned long takeovers = units[0].pair.stats.takeovers + units[1].pair.stats.takeovers;
+    unsigned long dual = runFor(3600UL * 1000);
+    unsigned long after = units[0].pair.stats.takeovers + units[1].pair.stats.takeovers;
+    unsigned long gap = std::max(units[0].pair.stats.maxGapMs, units[1].pair.stats.maxGapMs);
+    unsigned long holds = units[0].pair.stats.brokerHolds + units[1].pair.stats.brokerHolds;
+    printf("lossy %2.0f%% %-10s 1 h: spurious takeovers %lu, dual-active %lu ms, longest heartbeat gap %lu ms, "
+           "held by broker lease %lu\n", loss * 100, broker ? "" : "no broker", after - takeovers, dual, gap, holds);
+    return after - takeovers;
+}
+
+// Both units with one node id; returns false unless each noticed the other
+static bool sameIdScenario(int runs) {
+    bool ok = true;
+    unsigned long noticed = 0;
+    for (int run = 0; run < runs; run++) {
+        reset();
+        uint32_t id = units[0].pair.nodeId;
+        for (int i = 0; i < 2; i++) {
+            units[i].pair.nodeId = id;
+        }
+        runFor(5000);
+        for (int i = 0; i < 2; i++) {
+            ok = ok && units[i].pair.stats.duplicateIds > 0;
+            noticed += units[i].pair.stats.duplicateIds;
+        }
+    }
+    printf("same id    duplicate ids counted %lu  %s\n", noticed, ok ? "noticed by both" : "FAILED");
+    return ok;
+}
+
+static void deliver(int index, const std::vector<uint8_t>& bytes) {
+    units[index].inbox.push_back({simNow + 1, bytes, false});
+}
+
+// Forged and replayed traffic from a third host; returns false if any of it had an effect
+static bool forgedScenario(int runs) {
+    bool ok = true;
+    std::vector<double> failover;
+    unsigned long rejected = 0, stale = 0;
+    for (int run = 0; run < runs; run++) {
+        reset();
+        settle();
+        int active = activeUnit();
+        int standby = 1 - active;
+        uint32_t term = units[active].pair.term;
+
+        // A genuine packet with an enormous term (bytes 8-11), and one with a settings byte changed
+        std::vector<uint8_t> forged = activePacket;
+        forged[8] = forged[9] = forged[10] = forged[11] = 0xFF;
+        deliver(active, forged);
+        deliver(standby, forged);
+        units[active].settings[0]++;
+        runFor(100);
+        forged = activePacket;
+        forged[forged.size() - PAIR_MAC_SIZE - 1] ^= 0x55;  // Block data when the packet carries a block
+        deliver(standby, forged);
+        // A genuine lease claiming a higher term
+        char lease[PAIR_LEASE_SIZE];
+        size_t len = pairLeaseMessage(units[standby].pair, true, lease, sizeof(lease));
+        std::string text(lease, len);
+        text.replace(text.find("\"term\":") + 7, 1, "9");
+        current = active;
+        pairLeaseReceive(units[active].pair, text.c_str(), text.size());
+        runFor(2000);
+        if (activeUnit() != active || units[active].pair.term != term || units[standby].pair.term != term ||
+            memcmp(units[0].settings, units[1].settings, SETTINGS_BYTES) != 0) {
+            ok = false;
+        }
+
+        // The active unit dies; its recorded packets are replayed to keep the standby waiting
+        std::vector<uint8_t> recorded = activePacket;
+        units[active].alive = false;
+        units[active].broker = false;
+        unsigned long crashedAt = simNow;
+        for (int n = 0; n < 40; n++) {
+            deliver(standby, recorded);
+            runFor(100);
+        }
+        unsigned long ms = units[standby].activeAt == NO_TIME ? NO_TIME : units[standby].activeAt - crashedAt;
+        if (ms > REPLAY_FAILOVER_MS) {
+            ok = false;
+        }
+        failover.push_back(ms == NO_TIME ? 1e9 : ms);
+        rejected += units[0].pair.stats.unauthenticated + units[1].pair.stats.unauthenticated;
+        stale += units[standby].pair.stats.stale;
+    }
+    printf("forged     failover under replay ms p50 %5.0f max %5.0f  rejected: %lu unauthenticated, %lu stale  %s\n",
+           percentile(failover, 0.5), percentile(failover, 1.0), rejected, stale, ok ? "no effect" : "FAILED");
+    return ok;
+}
+
+// Simulated ms until the standby has applied a change made on the active unit (NO_TIME = never)
+static unsigned long replicate(int changedBytes) {
+    int active = activeUnit();
+    int standby = 1 - active;
+    for (int n = 0; n < changedBytes; n++) {
+        units[active].settings[uniform(0, SETTINGS_BYTES - 1)]++;
+    }
+    unsigned long changedAt = simNow;
+    units[standby].regionAt[0] = NO_TIME;
+    while (simNow - changedAt < 10000) {
+        step();
+        if (units[standby].regionAt[0] != NO_TIME &&
+            memcmp(units[0].settings, units[1].settings, SETTINGS_BYTES) == 0) {
+            return simNow - changedAt;
+        }
+    }
+    return NO_TIME;
+}
+
+int main(int argc, char** argv) {
+    int runs = argc > 1 ? atoi(argv[1]) : 200;
+    rng.seed(12345);
+    printf("%d runs per scenario, %d ms loop, lease %d ms + guard %d ms, heartbeat %d ms\n\n",
+           runs, LOOP_MS, PAIR_LEASE_MS, PAIR_GUARD_MS, PAIR_HEARTBEAT_MS);
+
+    Outcome crash = crashScenario(runs);
+    Outcome stall = stallScenario(runs);
+    Outcome partition = partitionScenario(runs, true);
+    Outcome isolated = partitionScenario(runs, false);
+    Outcome bootRace = bootScenario(runs);
+    report("crash", crash, true);
+    report("stall", stall, true);
+    report("partition", partition, false);
+    report("no broker", isolated, false);
+    report("boot", bootRace, true);
+    unsigned long spurious = 0;
+    for (double loss : {0.10, 0.30}) {
+        spurious += lossyScenario(loss, true);
+        unsigned long isolatedSpurious = lossyScenario(loss, false);
+        if (loss < 0.3) {
+            spurious += isolatedSpurious;
+        }
+    }
+    bool forged = forgedScenario(runs / 10 + 1);
+    bool sameId = sameIdScenario(runs / 10 + 1);
+
+    std::vector<double> small, rejoin;
+    int never = 0;
+    size_t packetBytes = 0, packets = 0;
+    for (int run = 0; run < runs; run++) {
+        reset();
+        settle();
+        unsigned long ms = replicate(4);
+        if (ms == NO_TIME) {
+            never++;
+        } else {
+            small.push_back(ms);
+        }
+        // The standby reboots with a blank EEPROM
+        int standby = 1 - activeUnit();
+        boot(standby, true);
+        unsigned long rebootedAt = simNow;
+        while (simNow - rebootedAt < 10000 && memcmp(units[0].settings, units[1].settings, SETTINGS_BYTES) != 0) {
+            step();
+        }
+        if (memcmp(units[0].settings, units[1].settings, SETTINGS_BYTES) != 0) {
+            never++;
+        } else {
+            rejoin.push_back(simNow - rebootedAt);
+        }
+        packetBytes += units[0].pair.stats.bytesSent + units[1].pair.stats.bytesSent;
+        packets += units[0].pair.stats.packetsSent + units[1].pair.stats.packetsSent;
+    }
+    printf("\nreplication: 4 changed bytes applied in p50 %.0f ms p95 %.0f ms; "
+           "blank rejoin synced in p50 %.0f ms p95 %.0f ms; %d never; %.0f bytes per packet\n",
+           percentile(small, 0.5), percentile(small, 0.95), percentile(rejoin, 0.5), percentile(rejoin, 0.95),
+           never, packets ? (double)packetBytes / packets : 0);
+
+    // Where some unit was running and in touch with the network, no press may go unrung; except
+    // where neither the LAN nor the broker could arbitrate, none may ring twice
+    bool ok = crash.lost == 0 && stall.lost == 0 && bootRace.lost == 0 && isolated.lost == 0 && never == 0 &&
+              crash.duplicated == 0 && stall.duplicated == 0 && bootRace.duplicated == 0 &&
+              partition.duplicated == 0 && partition.lost == 0 && spurious == 0 && forged && sameId;
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
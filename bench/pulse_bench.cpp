@@ -0,0 +1,120 @@
+// Host check and benchmark for the pulse-coded line decoder (src/pulse_decoder.cpp).
+//
+//   g++ -O2 -std=gnu++17 -Isrc bench/pulse_bench.cpp src/pulse_decoder.cpp -o pulse_bench && ./pulse_bench [frames.txt]
+//
+// Frames are written as the device publishes them on doorbell/pulse/trace:
+// signed microseconds per segment, + at the active level and - idle, e.g.
+// "+40000 -35000 +40000". A trace file holds one frame per line (blank lines
+// and lines starting with # are skipped); save one from the device with
+//
+//   mosquitto_sub -t doorbell/pulse/trace | jq -r .trace >> frames.txt
+//
+// Without a file, built-in frames with known answers are decoded (clean
+// trains, contact bounce, long pulses, a held line, unknown codes), using the
+// firmware's default timings and codes plus a short-short-long code for the
+// door; the exit status is non-zero if any differs.
+
+#include "pulse_decoder.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Firmware defaults (PULSE_CODES and the PULSE_* timings in main.cpp), plus {3, 0x4, 1}
+static const PulseCode codes[] = {{1, 0x0, 0}, {2, 0x0, 1}, {3, 0x4, 1}};
+static const PulseTiming timing = {1, 1000, 60000, 200000};
+static const int codeCount = sizeof(codes) / sizeof(codes[0]);
+
+struct Expected {
+    const char* name;
+    const char* trace;
+    int button;
+    PulseError error;
+};
+
+static const Expected builtIn[] = {
+    {"one pulse", "+40000", 0, PULSE_OK},
+    {"two pulses", "+40000 -35000 +40000", 1, PULSE_OK},
+    {"short, short, long", "+40000 -35000 +40000 -35000 +90000", 1, PULSE_OK},
+    {"bounce on the edges", "+300 -200 +400 -150 +39000 -35000 +250 -300 +40000 -500 +200", 1, PULSE_OK},
+    {"dip inside a pulse", "+20000 -600 +20000 -35000 +40000", 1, PULSE_OK},
+    {"spike inside a gap", "+40000 -17000 +400 -17000 +40000", 1, PULSE_OK},
+    {"leading spike", "+500 -120000 +40000", 0, PULSE_OK},
+    {"line held active", "+240000", -1, PULSE_TOO_LONG},
+    {"three short pulses", "+40000 -35000 +40000 -35000 +40000", -1, PULSE_UNKNOWN},
+    {"only noise", "+300 -400 +200", -1, PULSE_EMPTY},
+    {"seventeen pulses",
+     "+5000 -5000 +5000 -5000 +5000 -5000 +5000 -5000 +5000 -5000 +5000 -5000 +5000 -5000 +5000 -5000 "
+     "+5000 -5000 +5000 -5000 +5000 -5000 +5000 -5000 +5000 -5000 +5000 -5000 +5000 -5000 +5000 -5000 +5000",
+     -1, PULSE_TOO_MANY},
+};
+
+static std::vector<PulseSegment> parseTrace(const char* text) {
+    std::vector<PulseSegment> segments;
+    const char* p = text;
+    while (*p) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p != '+' && *p != '-') break;
+        uint8_t level = *p == '+' ? timing.activeLevel : !timing.activeLevel;
+        char* end;
+        unsigned long us = strtoul(p + 1, &end, 10);
+        if (end == p + 1) break;
+        segments.push_back({level, (uint32_t)us});
+        p = end;
+    }
+    return segments;
+}
+
+static void printResult(const char* name, const PulseResult& r) {
+    printf("  %-22s button %2d  %-8s pulses %2u  long 0x%02x  glitches %2u  %6.1f ms\n", name, r.button,
+           pulseErrorName(r.error), r.pulses, r.longMask, r.glitches, r.durationUs / 1000.0);
+}
+
+static double decodeCostNs(const std::vector<PulseSegment>& segments) {
+    const int iterations = 200000;
+    volatile int sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        sink += pulseDecode(segments.data(), segments.size(), timing, codes, codeCount).button;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        FILE* f = fopen(argv[1], "r");
+        if (!f) {
+            fprintf(stderr, "Cannot open %s\n", argv[1]);
+            return 1;
+        }
+        char line[4096];
+        int frame = 0;
+        while (fgets(line, sizeof(line), f)) {
+            if (line[0] == '#' || line[0] == '\n') continue;
+            std::vector<PulseSegment> segments = parseTrace(line);
+            PulseResult r = pulseDecode(segments.data(), segments.size(), timing, codes, codeCount);
+            std::string name = "frame " + std::to_string(++frame);
+            printResult(name.c_str(), r);
+        }
+        fclose(f);
+        return 0;
+    }
+
+    int failures = 0;
+    for (const Expected& e : builtIn) {
+        std::vector<PulseSegment> segments = parseTrace(e.trace);
+        PulseResult r = pulseDecode(segments.data(), segments.size(), timing, codes, codeCount);
+        printResult(e.name, r);
+        if (r.button != e.button || r.error != e.error) {
+            printf("    expected button %d (%s)\n", e.button, pulseErrorName(e.error));
+            failures++;
+        }
+    }
+    printf("\n%d of %d frames decoded as expected\n", (int)(sizeof(builtIn) / sizeof(builtIn[0])) - failures,
+           (int)(sizeof(builtIn) / sizeof(builtIn[0])));
+    printf("Decode cost: %.0f ns for a bouncy two-pulse frame\n", decodeCostNs(parseTrace(builtIn[3].trace)));
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,263 @@
+// Host check for the automation rule VM (src/rule_vm.cpp).
+//
+//   g++ -O2 -std=gnu++17 -Isrc bench/rule_vm_test.cpp src/rule_vm.cpp -o rule_vm_test && ./rule_vm_test
+//
+// Loads hand-assembled rules (a 3-byte header, then bytecode as
+// rule_compiler.py emits it) and checks that the verifier rejects what it
+// must (unknown and truncated opcodes, jumps backwards or past the end, stack
+// overflow and underflow, operands out of range) with the expected reason,
+// and that accepted rules compute the right values and emit the right actions
+// through a stub environment, and that reloading the same rule keeps its
+// state. Rules planted past the verifier check the runtime backstops. The exit status is non-zero if any case differs.
+
+#include "rule_vm.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+struct Emitted {
+    uint8_t action;
+    int32_t arg;
+    uint8_t rule;
+};
+
+static std::vector<Emitted> emitted;
+static int32_t vars[RULE_VAR_COUNT];
+static unsigned long fakeMicros;
+
+static int32_t getVar(uint8_t var, int32_t eventArg) {
+    return var == RULE_VAR_ARG ? eventArg : vars[var];
+}
+
+static void action(uint8_t act, int32_t arg, uint8_t rule) {
+    emitted.push_back({act, arg, rule});
+}
+
+static unsigned long nowMicros() {
+    return fakeMicros += 3;
+}
+
+static const RuleEnv env = {getVar, action, nowMicros};
+
+#define HDR(event, arg) RULE_FORMAT_VERSION, event, arg
+
+struct Rejection {
+    const char* name;
+    std::vector<uint8_t> rule;
+    const char* error;
+};
+
+static const Rejection rejections[] = {
+    {"empty", {}, "bad header"},
+    {"wrong version", {2, RULE_EVT_BUTTON, 0, OP_END}, "bad header"},
+    {"unknown event", {RULE_FORMAT_VERSION, RULE_EVT_COUNT, 0, OP_END}, "unknown event"},
+    {"unknown opcode", {HDR(RULE_EVT_BUTTON, 0), OP_PUSH8, 1, 0x7F}, "unknown opcode"},
+    {"truncated push16", {HDR(RULE_EVT_BUTTON, 0), OP_PUSH16, 1}, "truncated instruction"},
+    // A compiler treating the offset as signed would mean -4: back to the push
+    {"backward jump", {HDR(RULE_EVT_BUTTON, 0), OP_PUSH8, 1, OP_JZ, 0xFC, OP_END}, "jump out of range"},
+    {"jump past the end", {HDR(RULE_EVT_BUTTON, 0), OP_JMP, 2, OP_END}, "jump out of range"},
+    {"underflow on add", {HDR(RULE_EVT_BUTTON, 0), OP_PUSH8, 1, OP_ADD}, "stack underflow"},
+    {"underflow on act", {HDR(RULE_EVT_BUTTON, 0), OP_ACT, RULE_ACT_NOTIFY}, "stack underflow"},
+    {"underflow on jz", {HDR(RULE_EVT_BUTTON, 0), OP_JZ, 0}, "stack underflow"},
+    {"overflow",
+     {HDR(RULE_EVT_BUTTON, 0), OP_PUSH8, 1, OP_PUSH8, 1, OP_PUSH8, 1, OP_PUSH8, 1, OP_PUSH8, 1, OP_PUSH8, 1,
+      OP_PUSH8, 1, OP_PUSH8, 1, OP_PUSH8, 1},
+     "stack overflow"},
+    {"action out of range", {HDR(RULE_EVT_BUTTON, 0), OP_PUSH8, 1, OP_ACT, RULE_ACT_COUNT}, "operand out of range"},
+    {"variable out of range", {HDR(RULE_EVT_BUTTON, 0), OP_GET, RULE_VAR_COUNT, OP_STORE, 0}, "operand out of range"},
+    {"slot out of range", {HDR(RULE_EVT_BUTTON, 0), OP_LOAD, RULE_SLOT_COUNT, OP_STORE, 0}, "operand out of range"},
+    // if arg: push 1 (else nothing) leaves 1 or 0 values where the paths meet
+    {"unbalanced branches", {HDR(RULE_EVT_BUTTON, 0), OP_GET, RULE_VAR_ARG, OP_JZ, 2, OP_PUSH8, 1, OP_END},
+     "inconsistent stack depth"},
+};
+
+struct Execution {
+    const char* name;
+    std::vector<uint8_t> rule;
+    uint8_t event;
+    std::vector<int32_t> args;          // One dispatch per argument
+    std::vector<Emitted> actions;       // Expected, in order over all dispatches
+    int32_t slot0;                      // Expected s0 afterwards
+};
+
+static const Execution executions[] = {
+    {"arithmetic",
+     {HDR(RULE_EVT_BUTTON, RULE_ANY_ARG), OP_PUSH16, 0xE8, 0x03, OP_PUSH8, 0xF6, OP_ADD, OP_PUSH8, 90, OP_SUB,
+      OP_STORE, 0},
+     RULE_EVT_BUTTON, {0}, {}, 1000 - 10 - 90},
+    {"comparisons",
+     // s0 = (3 < 5) + (5 <= 5) + (7 > 5) + (5 >= 6) + (4 == 4) + (4 != 4) + !0 + (1 and 0) + (1 or 0)
+     {HDR(RULE_EVT_BUTTON, RULE_ANY_ARG),
+      OP_PUSH8, 3, OP_PUSH8, 5, OP_LT, OP_PUSH8, 5, OP_PUSH8, 5, OP_LE, OP_ADD,
+      OP_PUSH8, 7, OP_PUSH8, 5, OP_GT, OP_ADD, OP_PUSH8, 5, OP_PUSH8, 6, OP_GE, OP_ADD,
+      OP_PUSH8, 4, OP_PUSH8, 4, OP_EQ, OP_ADD, OP_PUSH8, 4, OP_PUSH8, 4, OP_NE, OP_ADD,
+      OP_PUSH8, 0, OP_NOT, OP_ADD, OP_PUSH8, 1, OP_PUSH8, 0, OP_AND, OP_ADD,
+      OP_PUSH8, 1, OP_PUSH8, 0, OP_OR, OP_ADD, OP_STORE, 0},
+     RULE_EVT_BUTTON, {0}, {}, 6},
+    {"night volume",
+     // if hour >= 22 or hour < 7: set_volume(20)
+     {HDR(RULE_EVT_BUTTON, 0), OP_GET, RULE_VAR_HOUR, OP_PUSH8, 22, OP_GE, OP_GET, RULE_VAR_HOUR, OP_PUSH8, 7, OP_LT,
+      OP_OR, OP_JZ, 4, OP_PUSH8, 20, OP_ACT, RULE_ACT_SET_VOLUME},
+     RULE_EVT_BUTTON, {0, 0, 0}, {{RULE_ACT_SET_VOLUME, 20, 0}, {RULE_ACT_SET_VOLUME, 20, 0}}, 0},
+    {"double press",
+     // if s0 and uptime - s0 < 10: open_relay(); s0 = 0  else: s0 = uptime
+     {HDR(RULE_EVT_BUTTON, 1), OP_LOAD, 0, OP_GET, RULE_VAR_UPTIME, OP_LOAD, 0, OP_SUB, OP_PUSH8, 10, OP_LT, OP_AND,
+      OP_JZ, 10, OP_PUSH8, 0, OP_ACT, RULE_ACT_OPEN_RELAY, OP_PUSH8, 0, OP_STORE, 0, OP_JMP, 4, OP_GET,
+      RULE_VAR_UPTIME, OP_STORE, 0},
+     RULE_EVT_BUTTON, {1, 1}, {{RULE_ACT_OPEN_RELAY, 0, 0}}, 0},
+    {"end stops early",
+     {HDR(RULE_EVT_TIMER, RULE_ANY_ARG), OP_GET, RULE_VAR_ARG, OP_ACT, RULE_ACT_PLAY, OP_END, OP_PUSH8, 9, OP_ACT,
+      RULE_ACT_NOTIFY},
+     RULE_EVT_TIMER, {5}, {{RULE_ACT_PLAY, 5, 0}}, 0},
+};
+
+static bool sameActions(const std::vector<Emitted>& a, const std::vector<Emitted>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].action != b[i].action || a[i].arg != b[i].arg || a[i].rule != b[i].rule) return false;
+    }
+    return true;
+}
+
+static void printActions(const char* label, const std::vector<Emitted>& actions) {
+    printf("    %s:", label);
+    for (const Emitted& e : actions) {
+        printf(" act%u(%ld)@%u", e.action, (long)e.arg, e.rule);
+    }
+    printf("%s\n", actions.empty() ? " none" : "");
+}
+
+static int checkRejections() {
+    int failures = 0;
+    for (const Rejection& r : rejections) {
+        const char* error = nullptr;
+        bool loaded = ruleLoad(0, r.rule.data(), r.rule.size(), &error);
+        bool ok = !loaded && error && strcmp(error, r.error) == 0;
+        printf("  reject %-24s %-26s %s\n", r.name, loaded ? "(loaded)" : error, ok ? "ok" : "FAILED");
+        if (!ok) {
+            printf("    expected \"%s\"\n", r.error);
+            failures++;
+        }
+    }
+    const char* error = nullptr;
+    uint8_t endOnly[] = {HDR(RULE_EVT_BUTTON, 0), OP_END};
+    bool ok = !ruleLoad(RULE_MAX_RULES, endOnly, sizeof(endOnly), &error) && strcmp(error, "rule index out of range") == 0;
+    printf("  reject %-24s %-26s %s\n", "index out of range", error, ok ? "ok" : "FAILED");
+    failures += !ok;
+
+    // The longest legal rule loads, one byte more does not
+    std::vector<uint8_t> longest = {HDR(RULE_EVT_BUTTON, 0)};
+    longest.resize(RULE_HEADER_SIZE + RULE_MAX_CODE, OP_END);
+    ok = ruleLoad(0, longest.data(), longest.size(), &error);
+    longest.push_back(OP_END);
+    ok = ok && !ruleLoad(0, longest.data(), longest.size(), &error) && strcmp(error, "code too long") == 0;
+    printf("  reject %-24s %-26s %s\n", "code too long", error, ok ? "ok" : "FAILED");
+    failures += !ok;
+    ruleClear(0);
+    return failures;
+}
+
+static int checkExecutions() {
+    int failures = 0;
+    for (const Execution& x : executions) {
+        const char* error = nullptr;
+        ruleClear(0);
+        if (!ruleLoad(0, x.rule.data(), x.rule.size(), &error)) {
+            printf("  run    %-24s rejected: %s  FAILED\n", x.name, error);
+            failures++;
+            continue;
+        }
+        emitted.clear();
+        for (size_t i = 0; i < x.args.size(); i++) {
+            // Hour 23, then 12, then 6; uptime 100 then 105
+            vars[RULE_VAR_HOUR] = i == 0 ? 23 : i == 1 ? 12 : 6;
+            vars[RULE_VAR_UPTIME] = 100 + 5 * i;
+            ruleDispatch(x.event, x.args[i], env);
+        }
+        const Rule& rule = rules[0];
+        bool ok = sameActions(emitted, x.actions) && rule.slots[0] == x.slot0 && rule.lastStatus == RULE_STATUS_OK &&
+                  rule.runs == x.args.size() && rule.errors == 0 && rule.actions == x.actions.size();
+        printf("  run    %-24s s0 %-6ld actions %zu  runs %lu  %s\n", x.name, (long)rule.slots[0], emitted.size(),
+               rule.runs, ok ? "ok" : "FAILED");
+        if (!ok) {
+            printActions("got", emitted);
+            printActions("expected", x.actions);
+            printf("    expected s0 %ld, status %d, errors %lu\n", (long)x.slot0, rule.lastStatus, rule.errors);
+            failures++;
+        }
+    }
+    ruleClear(0);
+    return failures;
+}
+
+// Triggers, and the runtime checks behind the verifier
+static int checkDispatch() {
+    int failures = 0;
+    const char* error = nullptr;
+    uint8_t notifyArg[] = {HDR(RULE_EVT_RELAY, 1), OP_GET, RULE_VAR_ARG, OP_ACT, RULE_ACT_NOTIFY};
+    uint8_t notifyAny[] = {HDR(RULE_EVT_RELAY, RULE_ANY_ARG), OP_PUSH8, 7, OP_ACT, RULE_ACT_NOTIFY};
+    ruleLoad(2, notifyArg, sizeof(notifyArg), &error);
+    ruleLoad(5, notifyAny, sizeof(notifyAny), &error);
+    emitted.clear();
+    int offRuns = ruleDispatch(RULE_EVT_RELAY, 0, env);
+    int onRuns = ruleDispatch(RULE_EVT_RELAY, 1, env);
+    int otherRuns = ruleDispatch(RULE_EVT_BUTTON, 1, env);
+    std::vector<Emitted> expected = {{RULE_ACT_NOTIFY, 7, 5}, {RULE_ACT_NOTIFY, 1, 2}, {RULE_ACT_NOTIFY, 7, 5}};
+    bool ok = offRuns == 1 && onRuns == 2 && otherRuns == 0 && sameActions(emitted, expected) &&
+              rules[5].runs == 2 && rules[5].totalMicros == 2 * 3 && rules[5].maxMicros == 3;
+    printf("  trigger argument and any-argument rules %24s\n", ok ? "ok" : "FAILED");
+    if (!ok) {
+        printActions("got", emitted);
+        printActions("expected", expected);
+        failures++;
+    }
+
+    // A retained rule is delivered again on reconnect: the same bytes keep state, others reset it
+    rules[5].slots[1] = 42;
+    bool same = ruleLoad(5, notifyAny, sizeof(notifyAny), &error) && rules[5].runs == 2 && rules[5].slots[1] == 42;
+    bool changed = ruleLoad(5, notifyArg, sizeof(notifyArg), &error) && rules[5].runs == 0 && rules[5].slots[1] == 0;
+    ok = same && changed;
+    printf("  reload keeps state, a changed rule resets it %19s\n", ok ? "ok" : "FAILED");
+    failures += !ok;
+    ruleClear(2);
+    ruleClear(5);
+
+    // Planted without ruleLoad, as if the verifier had missed them
+    struct {
+        const char* name;
+        std::vector<uint8_t> code;
+        RuleStatus status;
+    } planted[] = {
+        {"runtime underflow", {OP_ADD}, RULE_STATUS_STACK},
+        {"runtime overflow", std::vector<uint8_t>(2 * (RULE_STACK_DEPTH + 1), OP_PUSH8), RULE_STATUS_STACK},
+        {"runtime bad slot", {OP_LOAD, RULE_SLOT_COUNT}, RULE_STATUS_BAD_OPERAND},
+        {"runtime bad opcode", {OP_PUSH8, 1, OP_PUSH8, 1, 0x7F}, RULE_STATUS_BAD_OPERAND},
+    };
+    for (auto& p : planted) {
+        Rule& rule = rules[0];
+        memset(&rule, 0, sizeof(rule));
+        rule.loaded = true;
+        rule.event = RULE_EVT_PLAYBACK_DONE;
+        rule.eventArg = RULE_ANY_ARG;
+        rule.codeLen = p.code.size();
+        memcpy(rule.code, p.code.data(), p.code.size());
+        ruleDispatch(RULE_EVT_PLAYBACK_DONE, 2, env);
+        ok = rule.lastStatus == p.status && rule.errors == 1;
+        printf("  %-24s status %d %32s\n", p.name, rule.lastStatus, ok ? "ok" : "FAILED");
+        failures += !ok;
+    }
+    ruleClear(0);
+    return failures;
+}
+
+int main() {
+    int failures = 0;
+    printf("Verifier\n");
+    failures += checkRejections();
+    printf("Execution\n");
+    failures += checkExecutions();
+    printf("Dispatch\n");
+    failures += checkDispatch();
+    printf("\n%s: %d failure%s\n", failures ? "FAILED" : "ok", failures, failures == 1 ? "" : "s");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,145 @@
+// Host check of the adaptive ADC sampler (src/adc_sampler.cpp) against known edges.
+//
+//   g++ -O2 -std=gnu++17 -Isrc bench/sampler_bench.cpp src/adc_sampler.cpp -o sampler_bench && ./sampler_bench
+//
+// Each case idles a line for 5 s, long enough to drop to the idle rate, then
+// raises it with a step or a linear ramp of a given rise time. The firmware
+// loop is modelled: the sampler is asked whether a sample is due at the
+// millisecond clock, the loop does 0-3 ms of other work, then sleeps for
+// samplerWait(). The session start is the first sample at or above
+// ADC_THRESHOLD, dated by samplerEdgeTime(). Every edge is swept across 80
+// phases (0.25 ms apart) relative to the sample clock. The reference is the
+// loop the sampler replaced: one sample per pass, the same work, then a fixed
+// delay(10), the sample time taken as the start. For every edge the worst
+// distance between the dated start and the true threshold crossing must be no
+// larger than that loop's worst. The error without dating (the sample time
+// itself) is shown for comparison, and the idle sample rate against the old
+// loop's. The exit status is non-zero if an edge fails.
+
+#include "adc_sampler.h"
+#include "input_config.h"
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+#define IDLE_V 0.3              // Line level at rest
+#define HIGH_V 3.3              // Level of a pressed line
+#define EDGE_AT_MS 5000.0
+#define PHASES 80
+#define PHASE_STEP_MS 0.25
+#define MAX_WORK_MS 3           // Loop work per iteration besides sampling
+#define FIXED_LOOP_DELAY_MS 10  // delay() at the end of every pass of the old fixed-rate loop
+
+struct Edge {
+    const char* name;
+    double riseMs;              // 0 = step
+};
+
+static const Edge edges[] = {
+    {"step", 0}, {"ramp 2 ms", 2}, {"ramp 10 ms", 10}, {"ramp 30 ms", 30}, {"ramp 100 ms", 100},
+};
+
+static double lineVoltage(const Edge& edge, double edgeAt, double t) {
+    if (t < edgeAt) return IDLE_V;
+    if (edge.riseMs <= 0 || t >= edgeAt + edge.riseMs) return HIGH_V;
+    return IDLE_V + (HIGH_V - IDLE_V) * (t - edgeAt) / edge.riseMs;
+}
+
+// When the line really crosses the trigger threshold
+static double crossingAt(const Edge& edge, double edgeAt) {
+    return edgeAt + edge.riseMs * (ADC_THRESHOLD - IDLE_V) / (HIGH_V - IDLE_V);
+}
+
+struct Detection {
+    bool found;
+    double dated;               // samplerEdgeTime()
+    double sampled;             // Time of the sample that saw it
+    unsigned long samplesBefore;
+};
+
+static Detection run(const Edge& edge, double edgeAt, const SamplerTiming& timing, std::mt19937& rng) {
+    std::uniform_int_distribution<int> work(0, MAX_WORK_MS);
+    AdcSampler sampler;
+    samplerBegin(sampler);
+    Detection d = {false, 0, 0, 0};
+    unsigned long now = 0;
+    while (now < edgeAt + 1000) {
+        if (samplerDue(sampler, timing, now)) {
+            float v = lineVoltage(edge, edgeAt, now);
+            samplerUpdate(sampler, timing, v, IDLE_V, false, now);
+            if (v >= ADC_THRESHOLD) {
+                d = {true, (double)samplerEdgeTime(sampler), (double)now, sampler.samples - 1};
+                return d;
+            }
+        }
+        now += work(rng);
+        now += samplerWait(sampler, timing, now);
+    }
+    return d;
+}
+
+// The old loop: sample every pass, then the work and a fixed delay
+static Detection runFixed(const Edge& edge, double edgeAt, std::mt19937& rng) {
+    std::uniform_int_distribution<int> work(0, MAX_WORK_MS);
+    Detection d = {false, 0, 0, 0};
+    unsigned long samples = 0;
+    for (unsigned long now = 0; now < edgeAt + 1000; now += work(rng) + FIXED_LOOP_DELAY_MS) {
+        if (lineVoltage(edge, edgeAt, now) >= ADC_THRESHOLD) {
+            d = {true, (double)now, (double)now, samples};
+            return d;
+        }
+        samples++;
+    }
+    return d;
+}
+
+int main() {
+    const SamplerTiming timing = {ADC_SAMPLE_INTERVAL, ADC_IDLE_SAMPLE_INTERVAL, ADC_FAST_HOLD_MS, ADC_APPROACH_LEVEL};
+    std::mt19937 rng(1);
+    int failures = 0;
+
+    printf("Fast %d ms, idle %d ms, approach %.1f V, threshold %.1f V; limit: worst of a fixed %d ms loop\n",
+           ADC_SAMPLE_INTERVAL, ADC_IDLE_SAMPLE_INTERVAL, ADC_APPROACH_LEVEL, ADC_THRESHOLD, FIXED_LOOP_DELAY_MS);
+    printf("  %-12s %22s %22s %12s\n", "edge", "dated: mean / worst", "undated: mean / worst", "fixed loop");
+    unsigned long idleSamples = 0, fixedSamples = 0;
+    for (const Edge& edge : edges) {
+        double datedSum = 0, datedWorst = 0, rawSum = 0, rawWorst = 0, limit = 0;
+        int missed = 0;
+        for (int p = 0; p < PHASES; p++) {
+            double edgeAt = EDGE_AT_MS + p * PHASE_STEP_MS;
+            Detection fixed = runFixed(edge, edgeAt, rng);
+            if (fixed.found) {
+                limit = fmax(limit, fixed.sampled - crossingAt(edge, edgeAt));
+            }
+            Detection d = run(edge, edgeAt, timing, rng);
+            if (!d.found) {
+                missed++;
+                continue;
+            }
+            if (edge.riseMs == 0) {
+                idleSamples = d.samplesBefore;
+                fixedSamples = fixed.samplesBefore;
+            }
+            double cross = crossingAt(edge, edgeAt);
+            double dated = fabs(d.dated - cross);
+            double raw = d.sampled - cross;
+            datedSum += dated;
+            rawSum += raw;
+            datedWorst = fmax(datedWorst, dated);
+            rawWorst = fmax(rawWorst, raw);
+        }
+        bool ok = missed == 0 && datedWorst <= limit;
+        int found = PHASES - missed;
+        printf("  %-12s %9.2f / %5.2f ms %10.2f / %5.2f ms %9.2f ms  %s\n", edge.name, found ? datedSum / found : 0,
+               datedWorst, found ? rawSum / found : 0, rawWorst, limit, ok ? "ok" : "FAILED");
+        if (missed) {
+            printf("    %d of %d edges not detected\n", missed, PHASES);
+        }
+        failures += !ok;
+    }
+
+    // Duty cycle while idle, against the old loop and sampling at the fast rate all the time
+    printf("Idle: %.0f samples/s (fixed loop: %.0f/s, fast rate: %.0f/s)\n", idleSamples * 1000.0 / EDGE_AT_MS,
+           fixedSamples * 1000.0 / EDGE_AT_MS, 1000.0 / ADC_SAMPLE_INTERVAL);
+    return failures ? 1 : 0;
+}
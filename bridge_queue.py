@@ -0,0 +1,239 @@
+#!/usr/bin/env python3
+"""Bounded, disk-spilling delivery queue shared by the notification bridges.
+
+on_message only enqueues, so a slow push API can no longer stall the paho
+network loop. Worker threads deliver with per-attempt timeouts (set by the
+caller's send function) and exponential backoff between attempts. A single
+worker (the default) delivers in FIFO order; with more workers items are sent
+in parallel and can arrive out of order.
+
+Every item is written to spool/<name>/ as one JSON file before put() returns,
+because paho acknowledges a QoS 1 message as soon as on_message returns. The
+file is removed once the item is delivered or given up on, so a bridge that
+crashes or is killed resends whatever it had acknowledged but not delivered.
+Up to queue_size items are also kept in memory; when that is full, new items
+are only on disk and keep going there until the spool is drained, so delivery
+order is preserved.
+"""
+
+import json
+import os
+import queue
+import threading
+import time
+
+
+class PermanentError(Exception):
+    """Raised by a send function for failures that retrying cannot fix (e.g. HTTP 4xx)"""
+
+
+class DeliveryQueue:
+    def __init__(self, name, send, workers=1, queue_size=100, max_attempts=5,
+                 backoff=1.0, max_backoff=60.0, on_give_up=None, spool_dir=None):
+        self.name = name
+        self.send = send
+        self.on_give_up = on_give_up
+        self.max_attempts = max_attempts
+        self.backoff = backoff
+        self.max_backoff = max_backoff
+        self.spool_dir = spool_dir or os.path.join("spool", name)
+        os.makedirs(self.spool_dir, exist_ok=True)
+
+        self._memory = queue.Queue(maxsize=queue_size)
+        self._lock = threading.Lock()
+        self._stop = threading.Event()
+        self._seq = 0
+        self._held = set()  # Keys in memory or being delivered; their files are only the journal
+        self._spooled = len(self._spool_files())
+        self._counters = {
+            "enqueued": 0,
+            "delivered": 0,
+            "failed": 0,
+            "retries": 0,
+            "spilled": 0,
+            "dropped": 0,
+        }
+        self._latency_total = 0.0
+        self._latency_max = 0.0
+        self._latency_last = 0.0
+
+        self._threads = [threading.Thread(target=self._worker, name=f"{name}-worker-{i}", daemon=True)
+                         for i in range(workers)]
+        for thread in self._threads:
+            thread.start()
+
+    # --- Producer side ---
+
+    def put(self, item):
+        """Queue a JSON-serializable dict; it is on disk when this returns"""
+        with self._lock:
+            self._seq += 1
+            entry = {"key": f"{time.time_ns():020d}-{self._seq:06d}", "enqueued": time.time(), "item": item}
+            self._counters["enqueued"] += 1
+            journaled = self._write(entry)
+            # Once spilling has started, everything goes to disk until it drains
+            if self._spooled == 0:
+                try:
+                    self._memory.put_nowait(entry)
+                    self._held.add(entry["key"])
+                    return
+                except queue.Full:
+                    pass
+            if journaled:
+                self._spooled += 1
+                self._counters["spilled"] += 1
+            else:
+                self._counters["dropped"] += 1
+
+    def stop(self, timeout=5.0):
+        """Stop the workers; undelivered items stay in the spool for the next run"""
+        self._stop.set()
+        for thread in self._threads:
+            thread.join(timeout)
+        with self._lock:
+            while True:
+                try:
+                    self._release(self._memory.get_nowait())
+                except queue.Empty:
+                    break
+
+    # --- Metrics ---
+
+    def depth(self):
+        return self._memory.qsize() + self._spooled
+
+    def stats(self):
+        with self._lock:
+            delivered = self._counters["delivered"]
+            return dict(self._counters,
+                        depth=self._memory.qsize() + self._spooled,
+                        in_memory=self._memory.qsize(),
+                        spooled=self._spooled,
+                        latency_last_ms=round(self._latency_last * 1000),
+                        latency_max_ms=round(self._latency_max * 1000),
+                        latency_avg_ms=round(self._latency_total * 1000 / delivered) if delivered else 0)
+
+    # --- Spool ---
+
+    def _spool_files(self):
+        return sorted(f for f in os.listdir(self.spool_dir) if f.endswith(".json"))
+
+    def _path(self, entry):
+        return os.path.join(self.spool_dir, entry["key"] + ".json")
+
+    def _write(self, entry):
+        """Write one entry to the spool and sync it; caller holds the lock"""
+        path = self._path(entry)
+        try:
+            with open(path + ".tmp", "w") as f:
+                json.dump(entry, f)
+                f.flush()
+                os.fsync(f.fileno())
+            os.replace(path + ".tmp", path)
+        except OSError as e:
+            print(f"[{self.name}] Spool write failed: {e}")
+            return False
+        return True
+
+    def _release(self, entry):
+        """Hand an undelivered entry back to the spool; caller holds the lock"""
+        self._held.discard(entry["key"])
+        if os.path.exists(self._path(entry)) or self._write(entry):
+            self._spooled += 1
+
+    def _done(self, entry):
+        """Delivered or given up on: drop its spool file"""
+        with self._lock:
+            self._held.discard(entry["key"])
+            try:
+                os.remove(self._path(entry))
+            except OSError:
+                pass
+
+    def _unspool(self):
+        """Claim the oldest spooled entry nobody holds, or None"""
+        with self._lock:
+            if self._spooled == 0:
+                return None
+            for name in self._spool_files():
+                if name[:-len(".json")] in self._held:
+                    continue
+                path = os.path.join(self.spool_dir, name)
+                try:
+                    with open(path) as f:
+                        entry = json.load(f)
+                except (OSError, ValueError) as e:
+                    print(f"[{self.name}] Discarding unreadable spool file {name}: {e}")
+                    try:
+                        os.remove(path)
+                    except OSError:
+                        pass
+                    self._spooled -= 1
+                    continue
+                self._held.add(entry["key"])
+                self._spooled -= 1
+                return entry
+            self._spooled = 0
+            return None
+
+    # --- Workers ---
+
+    def _next(self):
+        # Memory holds the oldest items; the spool only fills once memory is full
+        try:
+            return self._memory.get_nowait()
+        except queue.Empty:
+            pass
+        entry = self._unspool()
+        if entry is not None:
+            return entry
+        try:
+            return self._memory.get(timeout=0.5)
+        except queue.Empty:
+            return None
+
+    def _worker(self):
+        while not self._stop.is_set():
+            entry = self._next()
+            if entry is None:
+                continue
+            if self._deliver(entry):
+                self._done(entry)
+            else:
+                # Interrupted by shutdown; keep it for the next run
+                with self._lock:
+                    self._release(entry)
+
+    def _deliver(self, entry):
+        """Returns False only when delivery was interrupted by stop()"""
+        delay = self.backoff
+        for attempt in range(self.max_attempts):
+            if attempt > 0:
+                with self._lock:
+                    self._counters["retries"] += 1
+                if self._stop.wait(delay):
+                    return False
+                delay = min(delay * 2, self.max_backoff)
+            try:
+                if self.send(entry["item"]):
+                    self._record_success(entry)
+                    return True
+            except PermanentError as e:
+                print(f"[{self.name}] Giving up: {e}")
+                break
+            except Exception as e:
+                print(f"[{self.name}] Attempt {attempt + 1}/{self.max_attempts} failed: {e}")
+
+        with self._lock:
+            self._counters["failed"] += 1
+        if self.on_give_up:
+            self.on_give_up(entry["item"])
+        return True
+
+    def _record_success(self, entry):
+        latency = time.time() - entry["enqueued"]
+        with self._lock:
+            self._counters["delivered"] += 1
+            self._latency_last = latency
+            self._latency_total += latency
+            self._latency_max = max(self._latency_max, latency)
@@ -0,0 +1,300 @@
+#!/usr/bin/env python3
+# Generated by scripts/gen_schema.py from schema/doorbell.json - do not edit
+"""Doorbell message schema codec and JSON view, see README "Binary Encoding"."""
+
+SCHEMA = {
+    "version": 1,
+    "topic_prefix": "doorbell/cbor/",
+    "messages": [
+        {
+            "name": "ButtonEvent",
+            "id": 1,
+            "topic": "doorbell/event",
+            "direction": "out",
+            "json": {
+                "type": "button_press"
+            },
+            "fields": [
+                {
+                    "name": "button",
+                    "type": "enum",
+                    "values": [
+                        "downstairs",
+                        "door"
+                    ]
+                },
+                {
+                    "name": "status",
+                    "type": "enum",
+                    "values": [
+                        "played",
+                        "dropped",
+                        "queued",
+                        "coalesced",
+                        "escalated",
+                        "interrupted",
+                        "suppressed"
+                    ]
+                },
+                {
+                    "name": "track",
+                    "type": "u16"
+                },
+                {
+                    "name": "volume",
+                    "type": "u8"
+                },
+                {
+                    "name": "count",
+                    "type": "u16"
+                },
+                {
+                    "name": "press_id",
+                    "type": "str",
+                    "max": 16
+                },
+                {
+                    "name": "t_press",
+                    "type": "u64"
+                },
+                {
+                    "name": "ts",
+                    "type": "u64"
+                }
+            ]
+        },
+        {
+            "name": "TimerStatus",
+            "id": 2,
+            "topic": "doorbell/timer/status",
+            "direction": "out",
+            "fields": [
+                {
+                    "name": "status",
+                    "type": "enum",
+                    "values": [
+                        "started",
+                        "ended",
+                        "stopped",
+                        "error"
+                    ]
+                },
+                {
+                    "name": "seconds",
+                    "type": "u32"
+                },
+                {
+                    "name": "track",
+                    "type": "u16"
+                },
+                {
+                    "name": "volume",
+                    "type": "u8"
+                },
+                {
+                    "name": "message",
+                    "type": "str",
+                    "max": 32
+                }
+            ]
+        },
+        {
+            "name": "TimerSet",
+            "id": 16,
+            "topic": "doorbell/timer/set",
+            "direction": "in",
+            "fields": [
+                {
+                    "name": "seconds",
+                    "type": "u32"
+                },
+                {
+                    "name": "track",
+                    "type": "u16"
+                },
+                {
+                    "name": "volume",
+                    "type": "u8"
+                }
+            ]
+        },
+        {
+            "name": "Play",
+            "id": 17,
+            "topic": "doorbell/play",
+            "direction": "in",
+            "fields": [
+                {
+                    "name": "track",
+                    "type": "u16"
+                },
+                {
+                    "name": "volume",
+                    "type": "u8"
+                }
+            ]
+        },
+        {
+            "name": "Simulate",
+            "id": 18,
+            "topic": "doorbell/simulate",
+            "direction": "in",
+            "fields": [
+                {
+                    "name": "button",
+                    "type": "enum",
+                    "values": [
+                        "downstairs",
+                        "door"
+                    ]
+                }
+            ]
+        }
+    ]
+}
+
+
+MESSAGES_BY_ID = {m["id"]: m for m in SCHEMA["messages"]}
+MESSAGES_BY_NAME = {m["name"]: m for m in SCHEMA["messages"]}
+TOPIC_PREFIX = SCHEMA["topic_prefix"]
+CMD_TOPIC = TOPIC_PREFIX + "cmd"
+
+
+class SchemaError(Exception):
+    pass
+
+
+def _head(major, value):
+    if value < 24:
+        return bytes([major << 5 | value])
+    for info, size in ((24, 1), (25, 2), (26, 4), (27, 8)):
+        if value < 1 << (8 * size):
+            return bytes([major << 5 | info]) + value.to_bytes(size, "big")
+    raise SchemaError(f"value {value} too large")
+
+
+def encode(name, values):
+    """Encode a message from a dict; enum fields accept names or indexes"""
+    message = MESSAGES_BY_NAME[name]
+    out = bytearray(_head(4, len(message["fields"]) + 1))
+    out += _head(0, message["id"])
+    for field in message["fields"]:
+        value = values.get(field["name"], "" if field["type"] == "str" else 0)
+        if field["type"] == "str":
+            data = str(value).encode()[:field["max"]]
+            out += _head(3, len(data)) + data
+        else:
+            if field["type"] == "enum" and isinstance(value, str):
+                value = field["values"].index(value)
+            out += _head(0, int(value))
+    return bytes(out)
+
+
+def _read_head(data, pos):
+    if pos >= len(data):
+        raise SchemaError("truncated message")
+    major, info = data[pos] >> 5, data[pos] & 0x1F
+    pos += 1
+    if info < 24:
+        return major, info, pos
+    size = {24: 1, 25: 2, 26: 4, 27: 8}.get(info)
+    if size is None or pos + size > len(data):
+        raise SchemaError("unsupported or truncated item")
+    return major, int.from_bytes(data[pos:pos + size], "big"), pos + size
+
+
+def decode(data):
+    """Decode a message; returns (message name, dict with enum names resolved)"""
+    major, items, pos = _read_head(data, 0)
+    if major != 4 or items < 1:
+        raise SchemaError("not a schema message")
+    major, message_id, pos = _read_head(data, pos)
+    message = MESSAGES_BY_ID.get(message_id)
+    if major != 0 or message is None:
+        raise SchemaError(f"unknown message id {message_id}")
+    if items < len(message["fields"]) + 1:
+        raise SchemaError(f"{message['name']} has too few fields")
+    values = {}
+    for field in message["fields"]:
+        major, value, pos = _read_head(data, pos)
+        if field["type"] == "str":
+            if major != 3 or pos + value > len(data):
+                raise SchemaError(f"bad string field {field['name']}")
+            values[field["name"]] = data[pos:pos + value].decode(errors="replace")
+            pos += value
+        elif major != 0:
+            raise SchemaError(f"bad integer field {field['name']}")
+        elif field["type"] == "enum":
+            if value >= len(field["values"]):
+                raise SchemaError(f"bad enum value for {field['name']}")
+            values[field["name"]] = field["values"][value]
+        else:
+            values[field["name"]] = value
+    return message["name"], values
+
+
+def json_view(data):
+    """(JSON topic, JSON dict) equivalent of an encoded message"""
+    name, values = decode(data)
+    message = MESSAGES_BY_NAME[name]
+    view = dict(message.get("json", {}))
+    view.update(values)
+    return message["topic"], view
+
+
+def cbor_topic(json_topic):
+    """doorbell/event -> doorbell/cbor/event"""
+    return TOPIC_PREFIX + json_topic[len("doorbell/"):]
+
+
+def bench(iterations=20000):
+    """Compare size and per-message encode/decode time of JSON and the schema codec"""
+    import json
+    import time
+    event = {"type": "button_press", "button": "door", "status": "played", "track": 2, "volume": 80,
+             "count": 1, "press_id": "3f2a-17", "t_press": 1760000000123, "ts": 1760000000171}
+
+    def timed(fn):
+        start = time.perf_counter()
+        for _ in range(iterations):
+            fn()
+        return (time.perf_counter() - start) / iterations * 1e6
+
+    json_data = json.dumps(event, separators=(",", ":")).encode()
+    cbor_data = encode("ButtonEvent", event)
+    print(f"ButtonEvent, {iterations} iterations")
+    print(f"  {'':<6}{'bytes':>8}{'encode us':>12}{'decode us':>12}")
+    print(f"  {'json':<6}{len(json_data):>8}{timed(lambda: json.dumps(event, separators=(',', ':')).encode()):>12.2f}"
+          f"{timed(lambda: json.loads(json_data)):>12.2f}")
+    print(f"  {'cbor':<6}{len(cbor_data):>8}{timed(lambda: encode('ButtonEvent', event)):>12.2f}"
+          f"{timed(lambda: decode(cbor_data)):>12.2f}")
+
+
+def send(name, values):
+    """Publish an inbound command to the device using mqtt_config.ini"""
+    import configparser
+    import paho.mqtt.client as mqtt
+    config = configparser.ConfigParser()
+    config.read("mqtt_config.ini")
+    client = mqtt.Client()
+    if config["MQTT"].get("username") and config["MQTT"].get("password"):
+        client.username_pw_set(config["MQTT"]["username"], config["MQTT"]["password"])
+    client.connect(config["MQTT"]["broker"], int(config["MQTT"]["port"]), 60)
+    client.loop_start()
+    client.publish(CMD_TOPIC, encode(name, values), qos=1).wait_for_publish()
+    client.loop_stop()
+    client.disconnect()
+
+
+if __name__ == "__main__":
+    import sys
+    if len(sys.argv) >= 3 and sys.argv[1] == "send":
+        fields = dict(arg.split("=", 1) for arg in sys.argv[3:])
+        fields = {k: int(v) if v.isdigit() else v for k, v in fields.items()}
+        send(sys.argv[2], fields)
+        print(f"Sent {sys.argv[2]} {fields} to {CMD_TOPIC}")
+    elif len(sys.argv) == 2 and sys.argv[1] == "bench":
+        bench()
+    else:
+        print("usage: doorbell_schema.py bench | send <Message> field=value ...")
+        sys.exit(1)
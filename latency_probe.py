@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+"""Broker-to-device latency probes.
+
+Publishes the current epoch ms to doorbell/latency/probe every 15 seconds,
+the way a command would reach the device: from the outside, whatever the
+power-save mode of its radio. The device files the one-way delay under the
+mode it was in (doorbell/wifi/power) and echoes the probe on
+doorbell/latency/echo with its receive time and mode. This script collects
+the echoes and prints per-mode percentiles on exit.
+
+    python3 latency_probe.py            # probe until Ctrl-C
+    python3 latency_probe.py 120        # probe for 120 seconds
+
+Stages:
+    inbound  t -> rx        broker hop to the device, modem sleep included
+    round    t -> echo      inbound plus the echo back to this host
+
+inbound needs both clocks NTP-synced; round uses this host's clock only.
+"""
+
+import configparser
+import json
+import sys
+import threading
+import time
+
+import paho.mqtt.client as mqtt
+
+from latency_trace import now_ms, percentile
+
+PROBE_INTERVAL = 15
+
+
+def main():
+    duration = float(sys.argv[1]) if len(sys.argv) > 1 else None
+    config = configparser.ConfigParser()
+    config.read('mqtt_config.ini')
+
+    samples = {}  # mode -> {"inbound": [...], "round": [...]}
+    lock = threading.Lock()
+
+    def on_connect(client, userdata, flags, rc):
+        client.subscribe("doorbell/latency/echo")
+
+    def on_message(client, userdata, msg):
+        received = now_ms()
+        try:
+            echo = json.loads(msg.payload)
+        except ValueError:
+            return
+        with lock:
+            mode = samples.setdefault(echo.get("mode", "unknown"), {"inbound": [], "round": []})
+            mode["round"].append(received - echo["t"])
+            if echo.get("rx"):
+                mode["inbound"].append(echo["rx"] - echo["t"])
+
+    client = mqtt.Client()
+    if config['MQTT'].get('username') and config['MQTT'].get('password'):
+        client.username_pw_set(config['MQTT']['username'], config['MQTT']['password'])
+    client.on_connect = on_connect
+    client.on_message = on_message
+    client.connect(config['MQTT']['broker'], int(config['MQTT']['port']), 60)
+    client.loop_start()
+
+    started = time.time()
+    try:
+        while duration is None or time.time() - started < duration:
+            client.publish("doorbell/latency/probe", str(now_ms()))
+            time.sleep(PROBE_INTERVAL)
+    except KeyboardInterrupt:
+        pass
+    client.loop_stop()
+    client.disconnect()
+
+    print(f"  {'mode':<11}{'stage':<9}{'n':>6}{'p50':>9}{'p95':>9}{'p99':>9}   ms")
+    for mode, stages in sorted(samples.items()):
+        for stage in ("inbound", "round"):
+            values = sorted(stages[stage])
+            if not values:
+                print(f"  {mode:<11}{stage:<9}{0:>6}{'-':>9}{'-':>9}{'-':>9}")
+                continue
+            print(f"  {mode:<11}{stage:<9}{len(values):>6}{percentile(values, 50):>9}"
+                  f"{percentile(values, 95):>9}{percentile(values, 99):>9}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+"""Ring-to-notification latency tracing.
+
+The device stamps every doorbell/event with a press id, the time the press was
+detected (t_press) and the time the event was published (ts), both epoch ms from
+its SNTP-synced clock. The bridges call record() with their own receive time and
+the time the upstream push API completed, one JSON line per press in
+traces/<bridge>.jsonl.
+
+    python3 latency_trace.py            # p50/p95/p99 per stage for every bridge
+
+Stages:
+    device    t_press  -> ts         detection, classification and publish on the device
+    transit   ts       -> received   broker hop to the bridge
+    upstream  received -> completed  push API call made by the bridge
+    total     t_press  -> completed  what the visitor waits for
+
+Device and bridge clocks must both be NTP-synced for transit and total to be meaningful.
+"""
+
+import json
+import math
+import os
+import threading
+import time
+
+TRACES_DIR = "traces"
+STAGES = [
+    ("device", "t_press", "ts"),
+    ("transit", "ts", "received"),
+    ("upstream", "received", "completed"),
+    ("total", "t_press", "completed"),
+]
+
+_lock = threading.Lock()
+
+
+def now_ms():
+    return int(time.time() * 1000)
+
+
+def record(bridge, event, received, completed=None):
+    """Append one trace line for a traced doorbell/event payload (dict)"""
+    if not isinstance(event, dict) or "press_id" not in event:
+        return
+    entry = {
+        "press_id": event["press_id"],
+        "status": event.get("status", "played"),
+        "t_press": event.get("t_press") or None,  # 0 means the device clock was not synced
+        "ts": event.get("ts") or None,
+        "received": received,
+        "completed": completed,
+    }
+    os.makedirs(TRACES_DIR, exist_ok=True)
+    with _lock:
+        with open(os.path.join(TRACES_DIR, f"{bridge}.jsonl"), "a") as f:
+            f.write(json.dumps(entry) + "\n")
+
+
+def percentile(values, p):
+    """Nearest-rank percentile of a sorted list"""
+    rank = max(1, math.ceil(p / 100.0 * len(values)))
+    return values[rank - 1]
+
+
+def report(traces_dir=TRACES_DIR):
+    if not os.path.isdir(traces_dir):
+        print(f"No traces in {traces_dir}/")
+        return
+    for name in sorted(os.listdir(traces_dir)):
+        if not name.endswith(".jsonl"):
+            continue
+        with open(os.path.join(traces_dir, name)) as f:
+            entries = [json.loads(line) for line in f if line.strip()]
+        print(f"{name[:-6]} ({len(entries)} presses)")
+        print(f"  {'stage':<10}{'n':>6}{'p50':>9}{'p95':>9}{'p99':>9}   ms")
+        for stage, start, end in STAGES:
+            samples = sorted(e[end] - e[start] for e in entries if e.get(start) and e.get(end))
+            if not samples:
+                print(f"  {stage:<10}{0:>6}{'-':>9}{'-':>9}{'-':>9}")
+                continue
+            print(f"  {stage:<10}{len(samples):>6}{percentile(samples, 50):>9}"
+                  f"{percentile(samples, 95):>9}{percentile(samples, 99):>9}")
+
+
+if __name__ == "__main__":
+    report()
@@ -6,6 +6,10 @@ import json
 from datetime import datetime
 import configparser
 import os
+import time
+import latency_trace
+import doorbell_schema
+from bridge_queue import DeliveryQueue, PermanentError
 
 # Create config file if it doesn't exist
 def create_default_config():
@@ -20,6 +24,13 @@ def create_default_config():
         'topic': 'exclusdoor'
     }
     
+    config['BRIDGE'] = {
+        'workers': '1',
+        'queue_size': '100',
+        'max_attempts': '5',
+        'http_timeout': '10',
+    }
+    
     with open('mqtt_config.ini', 'w') as configfile:
         config.write(configfile)
     return config
@@ -39,6 +50,20 @@ MQTT_PASSWORD = config['MQTT']['password']
 MQTT_TOPICS = [
     "doorbell/#"  # This will subscribe to all topics under doorbell/
 ]
+# Device measurement traffic that should never turn into a notification
+IGNORED_TOPIC_PREFIXES = [
+    "doorbell/latency/",
+    "doorbell/bridge/",
+]
+MQTT_CLIENT_ID = "doorbell-ntfy-bridge"  # Fixed so the broker keeps the session across restarts
+MQTT_QOS = 1
+
+# Delivery Configuration (optional [BRIDGE] section)
+WORKERS = config.getint('BRIDGE', 'workers', fallback=1)
+QUEUE_SIZE = config.getint('BRIDGE', 'queue_size', fallback=100)
+MAX_ATTEMPTS = config.getint('BRIDGE', 'max_attempts', fallback=5)
+HTTP_TIMEOUT = (3.05, config.getfloat('BRIDGE', 'http_timeout', fallback=10))  # (connect, read) seconds
+STATS_INTERVAL = 60  # Seconds between doorbell/bridge/<name>/stats publishes
 
 # ntfy Configuration
 NTFY_TOPIC = config['NTFY']['topic']
@@ -48,18 +73,40 @@ def on_connect(client, userdata, flags, rc):
     print(f"Connected to MQTT broker with result code {rc}")
     # Subscribe to all topics
     for topic in MQTT_TOPICS:
-        client.subscribe(topic)
+        client.subscribe(topic, qos=MQTT_QOS)
         print(f"Subscribed to {topic}")
 
 def on_message(client, userdata, msg):
-    topic = msg.topic
+    # Runs on the paho network thread: only filter and enqueue
+    topic, payload = msg.topic, msg.payload
+    if any(topic.startswith(prefix) for prefix in IGNORED_TOPIC_PREFIXES):
+        return
+    if topic.startswith(doorbell_schema.TOPIC_PREFIX):
+        # Schema-encoded (CBOR) messages are notified as their JSON view
+        try:
+            topic, view = doorbell_schema.json_view(payload)
+        except doorbell_schema.SchemaError as e:
+            print(f"Ignoring undecodable message on {msg.topic}: {e}")
+            return
+        payload = json.dumps(view).encode()
+    delivery.put({
+        "topic": topic,
+        "payload": payload.decode(errors='replace'),
+        "received": latency_trace.now_ms(),
+    })
+
+def parse_payload(item):
     try:
         # Try to parse the payload as JSON
-        payload = json.loads(msg.payload.decode())
-        message = json.dumps(payload, indent=2)
+        payload = json.loads(item["payload"])
+        return payload, json.dumps(payload, indent=2)
     except:
         # If not JSON, use raw payload
-        message = msg.payload.decode()
+        return None, item["payload"]
+
+def send_notification(item):
+    topic = item["topic"]
+    payload, message = parse_payload(item)
 
     # Create notification message
     notification = f"Topic: {topic}\n{message}"
@@ -71,18 +118,35 @@ def on_message(client, userdata, msg):
         "Tags": "bell"
     }
     
-    try:
-        response = requests.post(
-            NTFY_URL,
-            data=notification.encode(encoding='utf-8'),
-            headers=headers
-        )
-        print(f"Notification sent for topic {topic}. Status: {response.status_code}")
-    except Exception as e:
-        print(f"Error sending notification: {e}")
+    response = requests.post(
+        NTFY_URL,
+        data=notification.encode(encoding='utf-8'),
+        headers=headers,
+        timeout=HTTP_TIMEOUT
+    )
+    if 400 <= response.status_code < 500 and response.status_code != 429:
+        raise PermanentError(f"ntfy rejected {topic}: {response.status_code}")
+    if not response.ok:
+        print(f"Error sending notification for topic {topic}. Status: {response.status_code}")
+        return False
+
+    print(f"Notification sent for topic {topic}. Status: {response.status_code}")
+    if topic == "doorbell/event":
+        latency_trace.record("ntfy", payload, item["received"], latency_trace.now_ms())
+    return True
+
+def give_up(item):
+    if item["topic"] == "doorbell/event":
+        latency_trace.record("ntfy", parse_payload(item)[0], item["received"])
+
+delivery = None
 
 def main():
-    client = mqtt.Client()
+    global delivery
+    delivery = DeliveryQueue("ntfy", send_notification, workers=WORKERS, queue_size=QUEUE_SIZE,
+                             max_attempts=MAX_ATTEMPTS, on_give_up=give_up)
+
+    client = mqtt.Client(client_id=MQTT_CLIENT_ID, clean_session=False)
     client.on_connect = on_connect
     client.on_message = on_message
 
@@ -92,12 +156,21 @@ def main():
     try:
         client.connect(MQTT_BROKER, MQTT_PORT, 60)
         print("Starting MQTT to ntfy bridge...")
-        client.loop_forever()
+        client.loop_start()
+        while True:
+            time.sleep(STATS_INTERVAL)
+            stats = delivery.stats()
+            print(f"Delivery stats: {stats}")
+            client.publish("doorbell/bridge/ntfy/stats", json.dumps(stats), retain=True)
     except KeyboardInterrupt:
         print("\nExiting...")
-        client.disconnect()
     except Exception as e:
         print(f"Error: {e}")
+    finally:
+        client.loop_stop()
+        client.disconnect()
+        delivery.stop()
+        print(f"{delivery.depth()} undelivered notification(s) kept in {delivery.spool_dir}/")
 
 if __name__ == "__main__":
     main()
@@ -6,6 +6,10 @@ import json
 from datetime import datetime
 import configparser
 import os
+import time
+import latency_trace
+import doorbell_schema
+from bridge_queue import DeliveryQueue, PermanentError
 
 # Create config file if it doesn't exist
 def create_default_config():
@@ -21,6 +25,13 @@ def create_default_config():
         'api_token': ''
     }
     
+    config['BRIDGE'] = {
+        'workers': '1',
+        'queue_size': '100',
+        'max_attempts': '5',
+        'http_timeout': '10',
+    }
+    
     with open('mqtt_config.ini', 'w') as configfile:
         config.write(configfile)
     return config
@@ -40,6 +51,20 @@ MQTT_PASSWORD = config['MQTT']['password']
 MQTT_TOPICS = [
     "doorbell/#"  # This will subscribe to all topics under doorbell/
 ]
+# Device measurement traffic that should never turn into a notification
+IGNORED_TOPIC_PREFIXES = [
+    "doorbell/latency/",
+    "doorbell/bridge/",
+]
+MQTT_CLIENT_ID = "doorbell-pushover-bridge"  # Fixed so the broker keeps the session across restarts
+MQTT_QOS = 1
+
+# Delivery Configuration (optional [BRIDGE] section)
+WORKERS = config.getint('BRIDGE', 'workers', fallback=1)
+QUEUE_SIZE = config.getint('BRIDGE', 'queue_size', fallback=100)
+MAX_ATTEMPTS = config.getint('BRIDGE', 'max_attempts', fallback=5)
+HTTP_TIMEOUT = (3.05, config.getfloat('BRIDGE', 'http_timeout', fallback=10))  # (connect, read) seconds
+STATS_INTERVAL = 60  # Seconds between doorbell/bridge/<name>/stats publishes
 
 # Pushover Configuration
 PUSHOVER_USER_KEY = config['PUSHOVER']['user_key']
@@ -50,18 +75,40 @@ def on_connect(client, userdata, flags, rc):
     print(f"Connected to MQTT broker with result code {rc}")
     # Subscribe to all topics
     for topic in MQTT_TOPICS:
-        client.subscribe(topic)
+        client.subscribe(topic, qos=MQTT_QOS)
         print(f"Subscribed to {topic}")
 
 def on_message(client, userdata, msg):
-    topic = msg.topic
+    # Runs on the paho network thread: only filter and enqueue
+    topic, payload = msg.topic, msg.payload
+    if any(topic.startswith(prefix) for prefix in IGNORED_TOPIC_PREFIXES):
+        return
+    if topic.startswith(doorbell_schema.TOPIC_PREFIX):
+        # Schema-encoded (CBOR) messages are notified as their JSON view
+        try:
+            topic, view = doorbell_schema.json_view(payload)
+        except doorbell_schema.SchemaError as e:
+            print(f"Ignoring undecodable message on {msg.topic}: {e}")
+            return
+        payload = json.dumps(view).encode()
+    delivery.put({
+        "topic": topic,
+        "payload": payload.decode(errors='replace'),
+        "received": latency_trace.now_ms(),
+    })
+
+def parse_payload(item):
     try:
         # Try to parse the payload as JSON
-        payload = json.loads(msg.payload.decode())
-        message = json.dumps(payload, indent=2)
+        payload = json.loads(item["payload"])
+        return payload, json.dumps(payload, indent=2)
     except:
         # If not JSON, use raw payload
-        message = msg.payload.decode()
+        return None, item["payload"]
+
+def send_notification(item):
+    topic = item["topic"]
+    payload, message = parse_payload(item)
 
     # Create notification message
     notification = f"Topic: {topic}\n{message}"
@@ -76,22 +123,37 @@ def on_message(client, userdata, msg):
         "sound": "bell"  # Use bell sound for notifications
     }
     
-    try:
-        response = requests.post(PUSHOVER_API_URL, data=data)
-        if response.status_code == 200:
-            print(f"Notification sent for topic {topic}. Status: {response.status_code}")
-        else:
-            print(f"Error sending notification: {response.text}")
-    except Exception as e:
-        print(f"Error sending notification: {e}")
+    response = requests.post(PUSHOVER_API_URL, data=data, timeout=HTTP_TIMEOUT)
+    # Pushover: 4xx means the request itself is invalid and must not be retried
+    if 400 <= response.status_code < 500 and response.status_code != 429:
+        raise PermanentError(f"Pushover rejected {topic}: {response.text}")
+    if response.status_code != 200:
+        print(f"Error sending notification: {response.text}")
+        return False
+
+    print(f"Notification sent for topic {topic}. Status: {response.status_code}")
+    if topic == "doorbell/event":
+        latency_trace.record("pushover", payload, item["received"], latency_trace.now_ms())
+    return True
+
+def give_up(item):
+    if item["topic"] == "doorbell/event":
+        latency_trace.record("pushover", parse_payload(item)[0], item["received"])
+
+delivery = None
 
 def main():
+    global delivery
+
     # Verify Pushover configuration
     if not PUSHOVER_USER_KEY or not PUSHOVER_API_TOKEN:
         print("Error: Pushover user key and API token must be configured in mqtt_config.ini")
         return
 
-    client = mqtt.Client()
+    delivery = DeliveryQueue("pushover", send_notification, workers=WORKERS, queue_size=QUEUE_SIZE,
+                             max_attempts=MAX_ATTEMPTS, on_give_up=give_up)
+
+    client = mqtt.Client(client_id=MQTT_CLIENT_ID, clean_session=False)
     client.on_connect = on_connect
     client.on_message = on_message
 
@@ -101,12 +163,21 @@ def main():
     try:
         client.connect(MQTT_BROKER, MQTT_PORT, 60)
         print("Starting MQTT to Pushover bridge...")
-        client.loop_forever()
+        client.loop_start()
+        while True:
+            time.sleep(STATS_INTERVAL)
+            stats = delivery.stats()
+            print(f"Delivery stats: {stats}")
+            client.publish("doorbell/bridge/pushover/stats", json.dumps(stats), retain=True)
     except KeyboardInterrupt:
         print("\nExiting...")
-        client.disconnect()
     except Exception as e:
         print(f"Error: {e}")
+    finally:
+        client.loop_stop()
+        client.disconnect()
+        delivery.stop()
+        print(f"{delivery.depth()} undelivered notification(s) kept in {delivery.spool_dir}/")
 
 if __name__ == "__main__":
     main()
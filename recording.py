@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+"""Dump the device's inbound traffic recording and replay it.
+
+    recording.py dump incident.jsonl      # save the ring (doorbell/get/recording)
+    recording.py show incident.jsonl      # print it with relative times
+    recording.py replay incident.jsonl    # load it into the device and replay it
+    recording.py replay                   # replay what the device recorded itself
+    recording.py replay --discard f.jsonl # load over the device's own recording
+
+A replay feeds every record back through the firmware's MQTT callback (or
+button path, for ADC sessions) at its recorded offset from the first one.
+Live commands and presses are ignored until the replay ends. Loading a file
+is refused while the device holds its own recording; dump it first, then
+pass --discard to drop it.
+"""
+
+import argparse
+import configparser
+import json
+import sys
+import threading
+
+import paho.mqtt.client as mqtt
+
+DUMP_TIMEOUT = 10
+
+
+def connect():
+    config = configparser.ConfigParser()
+    config.read('mqtt_config.ini')
+    client = mqtt.Client()
+    if config['MQTT'].get('username') and config['MQTT'].get('password'):
+        client.username_pw_set(config['MQTT']['username'], config['MQTT']['password'])
+    client.connect(config['MQTT']['broker'], int(config['MQTT']['port']), 60)
+    client.loop_start()
+    return client
+
+
+def dump(path):
+    records = []
+    info = {}
+    done = threading.Event()
+
+    def on_message(client, userdata, msg):
+        data = json.loads(msg.payload)
+        if msg.topic == "doorbell/recording/record":
+            records.append(data)
+        else:
+            info.update(data)
+            done.set()
+
+    client = connect()
+    client.on_message = on_message
+    client.subscribe([("doorbell/recording/record", 1), ("doorbell/recording/info", 1)])
+    client.publish("doorbell/get/recording", "", qos=1).wait_for_publish()
+    received = done.wait(DUMP_TIMEOUT)
+    client.loop_stop()
+    client.disconnect()
+    if not received:
+        print("No answer from the device", file=sys.stderr)
+        sys.exit(1)
+
+    records.sort(key=lambda r: r["seq"])
+    with open(path, "w") as f:
+        for record in records:
+            f.write(json.dumps(record) + "\n")
+    print(f"{len(records)} of {info.get('records')} records written to {path} "
+          f"({info.get('overwritten', 0)} overwritten, {info.get('truncated', 0)} truncated since boot)")
+
+
+def load(path):
+    with open(path) as f:
+        return [json.loads(line) for line in f if line.strip()]
+
+
+def show(path):
+    records = load(path)
+    if not records:
+        return
+    base = records[0]["t"]
+    for record in records:
+        payload = bytes.fromhex(record["payload"])
+        try:
+            text = payload.decode()
+        except UnicodeDecodeError:
+            text = f"<{len(payload)} bytes> {record['payload']}"
+        flag = " (truncated)" if record.get("truncated") else ""
+        print(f"+{record['t'] - base:>8} ms  {record['kind']:<8} {record['topic']}  {text}{flag}")
+
+
+def replay(path, discard=False):
+    client = connect()
+    if path:
+        records = load(path)
+        client.publish("doorbell/replay/clear", "discard" if discard else "", qos=1).wait_for_publish()
+        for record in records:
+            client.publish("doorbell/replay/load", json.dumps(record, separators=(",", ":")), qos=1).wait_for_publish()
+        print(f"Loaded {len(records)} records")
+    client.publish("doorbell/replay/start", "", qos=1).wait_for_publish()
+    client.loop_stop()
+    client.disconnect()
+    print("Replay started; progress is reported on doorbell/recording/info")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Dump and replay the doorbell's inbound traffic recording")
+    sub = parser.add_subparsers(dest="command", required=True)
+    sub.add_parser("dump", help="save the device's recording").add_argument("file")
+    sub.add_parser("show", help="print a saved recording").add_argument("file")
+    replay_parser = sub.add_parser("replay", help="replay a saved recording, or the device's own")
+    replay_parser.add_argument("file", nargs="?")
+    replay_parser.add_argument("--discard", action="store_true", help="drop the device's own recording to load the file")
+    args = parser.parse_args()
+
+    if args.command == "dump":
+        dump(args.file)
+    elif args.command == "show":
+        show(args.file)
+    else:
+        replay(args.file, args.discard)
+
+
+if __name__ == "__main__":
+    main()
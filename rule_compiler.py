@@ -0,0 +1,250 @@
+#!/usr/bin/env python3
+"""Compile doorbell automation rules to device bytecode.
+
+A rule file has a trigger line followed by a Python-like body:
+
+    # Door button twice within 10 s sends an urgent notification
+    on button door
+    if s0 and uptime - s0 < 10:
+        notify(1)
+        s0 = 0
+    else:
+        s0 = uptime
+
+Triggers:  on button door|downstairs|any
+           on timer <track>|any
+           on relay on|off|any
+           on playback_done door|downstairs|other|any
+Variables: arg, uptime, hour, minute, playing, relay (read only), s0..s3 (persistent)
+Actions:   open_relay(), play(track), set_volume(percent), suppress(), notify(code)
+Operators: + - < <= > >= == != and or not, if/elif/else
+
+open_relay() is refused in rules on the door button (or any button): the
+visitor outside presses it, so such a rule would open the door to anyone.
+
+The compiled rule is printed as hex; with --publish it is sent retained to
+doorbell/set/rule/<slot> so the device reloads it after every reconnect.
+"""
+
+import argparse
+import ast
+import configparser
+import sys
+
+FORMAT_VERSION = 1
+MAX_CODE = 64
+STACK_DEPTH = 8
+ANY_ARG = 0xFF
+
+# Must match src/rule_vm.h
+EVENTS = {
+    "button": (0, {"downstairs": 0, "door": 1}),
+    "timer": (1, {}),
+    "relay": (2, {"off": 0, "on": 1}),
+    "playback_done": (3, {"downstairs": 0, "door": 1, "other": 2}),
+}
+VARIABLES = {"arg": 0, "uptime": 1, "hour": 2, "minute": 3, "playing": 4, "relay": 5}
+SLOTS = {"s0": 0, "s1": 1, "s2": 2, "s3": 3}
+CONSTANTS = {"downstairs": 0, "door": 1, "True": 1, "False": 0}
+ACTIONS = {"open_relay": (0, 0), "play": (1, 1), "set_volume": (2, 1), "suppress": (3, 0), "notify": (4, 1)}
+
+OP_PUSH8, OP_PUSH16, OP_GET, OP_LOAD, OP_STORE = 0x01, 0x02, 0x03, 0x04, 0x05
+OP_JZ, OP_JMP, OP_ACT, OP_NOT, OP_AND, OP_OR = 0x20, 0x21, 0x30, 0x1A, 0x18, 0x19
+BINARY_OPS = {ast.Add: 0x10, ast.Sub: 0x11}
+COMPARE_OPS = {ast.Lt: 0x12, ast.LtE: 0x13, ast.Gt: 0x14, ast.GtE: 0x15, ast.Eq: 0x16, ast.NotEq: 0x17}
+
+
+class RuleError(Exception):
+    pass
+
+
+class Compiler:
+    def __init__(self):
+        self.code = bytearray()
+        self.depth = 0
+        self.max_depth = 0
+
+    def emit(self, *data, stack=0):
+        self.code.extend(data)
+        self.depth += stack
+        self.max_depth = max(self.max_depth, self.depth)
+
+    def push(self, value):
+        if -128 <= value <= 127:
+            self.emit(OP_PUSH8, value & 0xFF, stack=1)
+        elif -32768 <= value <= 32767:
+            self.emit(OP_PUSH16, value & 0xFF, (value >> 8) & 0xFF, stack=1)
+        else:
+            raise RuleError(f"constant {value} does not fit in 16 bits")
+
+    def jump(self, op):
+        """Emit a forward jump and return the position of its offset byte"""
+        self.emit(op, 0, stack=-1 if op == OP_JZ else 0)
+        return len(self.code) - 1
+
+    def patch(self, position):
+        offset = len(self.code) - (position + 1)
+        if offset > 255:
+            raise RuleError("jump too far")
+        self.code[position] = offset
+
+    def expression(self, node):
+        if isinstance(node, ast.Constant) and isinstance(node.value, (int, bool)):
+            self.push(int(node.value))
+        elif isinstance(node, ast.Name):
+            if node.id in VARIABLES:
+                self.emit(OP_GET, VARIABLES[node.id], stack=1)
+            elif node.id in SLOTS:
+                self.emit(OP_LOAD, SLOTS[node.id], stack=1)
+            elif node.id in CONSTANTS:
+                self.push(CONSTANTS[node.id])
+            else:
+                raise RuleError(f"unknown name '{node.id}'")
+        elif isinstance(node, ast.UnaryOp) and isinstance(node.op, ast.USub):
+            if isinstance(node.operand, ast.Constant):
+                self.push(-int(node.operand.value))
+            else:
+                self.push(0)
+                self.expression(node.operand)
+                self.emit(BINARY_OPS[ast.Sub], stack=-1)
+        elif isinstance(node, ast.UnaryOp) and isinstance(node.op, ast.Not):
+            self.expression(node.operand)
+            self.emit(OP_NOT)
+        elif isinstance(node, ast.BinOp) and type(node.op) in BINARY_OPS:
+            self.expression(node.left)
+            self.expression(node.right)
+            self.emit(BINARY_OPS[type(node.op)], stack=-1)
+        elif isinstance(node, ast.BoolOp):
+            op = OP_AND if isinstance(node.op, ast.And) else OP_OR
+            self.expression(node.values[0])
+            for value in node.values[1:]:
+                self.expression(value)
+                self.emit(op, stack=-1)
+        elif isinstance(node, ast.Compare):
+            # a < b < c becomes (a < b) and (b < c)
+            left = node.left
+            for i, (op, right) in enumerate(zip(node.ops, node.comparators)):
+                if type(op) not in COMPARE_OPS:
+                    raise RuleError("unsupported comparison")
+                self.expression(left)
+                self.expression(right)
+                self.emit(COMPARE_OPS[type(op)], stack=-1)
+                if i > 0:
+                    self.emit(OP_AND, stack=-1)
+                left = right
+        else:
+            raise RuleError(f"unsupported expression: {ast.dump(node)}")
+
+    def statement(self, node):
+        if isinstance(node, ast.If):
+            self.expression(node.test)
+            skip_body = self.jump(OP_JZ)
+            self.block(node.body)
+            if node.orelse:
+                skip_else = self.jump(OP_JMP)
+                self.patch(skip_body)
+                self.block(node.orelse)
+                self.patch(skip_else)
+            else:
+                self.patch(skip_body)
+        elif isinstance(node, ast.Assign):
+            if len(node.targets) != 1 or not isinstance(node.targets[0], ast.Name) \
+                    or node.targets[0].id not in SLOTS:
+                raise RuleError("only s0..s3 can be assigned")
+            self.expression(node.value)
+            self.emit(OP_STORE, SLOTS[node.targets[0].id], stack=-1)
+        elif isinstance(node, ast.Expr) and isinstance(node.value, ast.Call) \
+                and isinstance(node.value.func, ast.Name):
+            name = node.value.func.id
+            if name not in ACTIONS:
+                raise RuleError(f"unknown action '{name}'")
+            action, argc = ACTIONS[name]
+            if len(node.value.args) != argc:
+                raise RuleError(f"{name}() takes {argc} argument(s)")
+            if argc:
+                self.expression(node.value.args[0])
+            else:
+                self.push(0)
+            self.emit(OP_ACT, action, stack=-1)
+        elif isinstance(node, ast.Pass):
+            pass
+        else:
+            raise RuleError(f"unsupported statement: {ast.dump(node)}")
+
+    def block(self, nodes):
+        for node in nodes:
+            self.statement(node)
+
+
+def parse_trigger(line):
+    parts = line.split()
+    if len(parts) not in (2, 3) or parts[0] != "on" or parts[1] not in EVENTS:
+        raise RuleError(f"bad trigger line: '{line}'")
+    event, names = EVENTS[parts[1]]
+    if len(parts) == 2 or parts[2] == "any":
+        return event, ANY_ARG
+    if parts[2] in names:
+        return event, names[parts[2]]
+    if parts[2].isdigit() and int(parts[2]) < ANY_ARG:
+        return event, int(parts[2])
+    raise RuleError(f"bad trigger argument: '{parts[2]}'")
+
+
+def compile_rule(source):
+    lines = [line for line in source.splitlines() if line.strip() and not line.strip().startswith("#")]
+    if not lines:
+        raise RuleError("empty rule")
+    event, event_arg = parse_trigger(lines[0].strip())
+
+    body = ast.parse("\n".join(lines[1:]))
+    if event == EVENTS["button"][0] and event_arg in (EVENTS["button"][1]["door"], ANY_ARG) and any(
+            isinstance(node, ast.Call) and isinstance(node.func, ast.Name) and node.func.id == "open_relay"
+            for node in ast.walk(body)):
+        raise RuleError("open_relay() on the door button would let anyone at the door open it")
+
+    compiler = Compiler()
+    compiler.block(body.body)
+    if len(compiler.code) > MAX_CODE:
+        raise RuleError(f"rule is {len(compiler.code)} bytes, limit is {MAX_CODE}")
+    if compiler.max_depth > STACK_DEPTH:
+        raise RuleError(f"rule needs {compiler.max_depth} stack entries, limit is {STACK_DEPTH}")
+    return bytes([FORMAT_VERSION, event, event_arg]) + bytes(compiler.code)
+
+
+def publish(slot, payload):
+    import paho.mqtt.client as mqtt
+    config = configparser.ConfigParser()
+    config.read('mqtt_config.ini')
+    client = mqtt.Client()
+    if config['MQTT'].get('username') and config['MQTT'].get('password'):
+        client.username_pw_set(config['MQTT']['username'], config['MQTT']['password'])
+    client.connect(config['MQTT']['broker'], int(config['MQTT']['port']), 60)
+    client.loop_start()
+    client.publish(f"doorbell/set/rule/{slot}", payload, qos=1, retain=True).wait_for_publish()
+    client.loop_stop()
+    client.disconnect()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compile a doorbell automation rule")
+    parser.add_argument("rule", help="rule source file")
+    parser.add_argument("--slot", type=int, default=0, help="rule slot on the device (0-7)")
+    parser.add_argument("--publish", action="store_true", help="publish the rule (retained) via mqtt_config.ini")
+    args = parser.parse_args()
+
+    with open(args.rule) as f:
+        source = f.read()
+    try:
+        bytecode = compile_rule(source)
+    except (RuleError, SyntaxError) as e:
+        print(f"Error: {e}", file=sys.stderr)
+        sys.exit(1)
+
+    print(f"{len(bytecode)} bytes: {bytecode.hex()}")
+    if args.publish:
+        publish(args.slot, bytecode.hex())
+        print(f"Published to doorbell/set/rule/{args.slot}")
+
+
+if __name__ == "__main__":
+    main()
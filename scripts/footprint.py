@@ -0,0 +1,165 @@
+"""Per-module flash/RAM breakdown of a firmware build.
+
+Runs as a PlatformIO post script: the link writes a map file next to the
+firmware, and after every link the input sections in it are summed per module
+and written to footprint.json in the build directory, with a table on the
+console. Standalone:
+
+    python3 scripts/footprint.py .pio/build/full-analog/firmware.map
+    python3 scripts/footprint.py --compare     # every variant built so far
+
+Modules are the project's own source files (main, mini_broker, ...), the
+libraries (lib:PubSubClient, lib:WiFi, ...; header-only ArduinoJson counts
+toward the file using it), the Arduino core and the SDK archives (sdk:lwip, ...). Flash counts everything stored in
+the image (code, read-only data and the initial values of .data); RAM counts
+static DRAM (.data and .bss) and IRAM code separately. The OTA estimate is
+the image size over OTA_KBPS, the throughput of a weak link; the device
+reports the real transfer time of the last update in doorbell/status.
+"""
+
+import glob
+import json
+import os
+import re
+import sys
+
+OTA_KBPS = 200          # Assumed OTA throughput in kbit/s for the estimate
+
+# Output sections of the ESP32 linker script, by where their contents live
+FLASH_SECTIONS = {".flash.text", ".flash.rodata", ".flash.appdesc", ".flash.rodata_noload"}
+IRAM_SECTIONS = {".iram0.vectors", ".iram0.text"}
+DATA_SECTIONS = {".dram0.data", ".rtc.data", ".rtc.text"}
+BSS_SECTIONS = {".dram0.bss", ".noinit", ".rtc.bss", ".rtc_noinit"}
+
+INPUT_LINE = re.compile(r"^\s+(\S+)?\s*0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$")
+
+
+def module_name(obj):
+    """Group an object path from the map into a module."""
+    obj = obj.strip().replace("\\", "/")
+    archive = re.match(r"(?:.*/)?lib([^/(]+)\.a\(.+\)$", obj)
+    if archive:
+        lib = archive.group(1)
+        if "/tools/sdk/" in obj:
+            return "sdk:" + lib
+        if "toolchain" in obj:
+            return "toolchain:" + lib
+        return "arduino:core" if lib == "FrameworkArduino" else "lib:" + lib
+    source = re.search(r"/src/(.+?)\.(?:c|cpp|S)\.o$", obj)
+    if source:
+        return source.group(1)
+    return "toolchain" if "toolchain" in obj else "other"
+
+
+def parse_map(path):
+    """Sum input section sizes per module and memory kind."""
+    modules = {}
+    output = None
+    in_memory_map = False
+    with open(path, errors="replace") as f:
+        for line in f:
+            if not in_memory_map:
+                in_memory_map = line.startswith("Linker script and memory map")
+                continue
+            line = line.rstrip("\n")
+            if not line:
+                continue
+            if not line[0].isspace():
+                output = line.split()[0]
+                continue
+            # Input sections: " .name addr size object", the name may be on the line before
+            match = INPUT_LINE.match(line)
+            if output is None or not match or line.strip().startswith("*"):
+                continue
+            size = int(match.group(3), 16)
+            obj = match.group(4).strip()
+            if size == 0 or not (obj.endswith(")") or obj.endswith(".o")):
+                continue
+            kind = ("flash" if output in FLASH_SECTIONS else
+                    "iram" if output in IRAM_SECTIONS else
+                    "data" if output in DATA_SECTIONS else
+                    "bss" if output in BSS_SECTIONS else None)
+            if kind is None:
+                continue
+            entry = modules.setdefault(module_name(obj), {"flash": 0, "iram": 0, "data": 0, "bss": 0})
+            entry[kind] += size
+    return modules
+
+
+def summarize(modules, variant):
+    rows = []
+    for name, s in modules.items():
+        rows.append({"module": name,
+                     "flash": s["flash"] + s["iram"] + s["data"],
+                     "ram": s["data"] + s["bss"],
+                     "iram": s["iram"]})
+    rows.sort(key=lambda r: r["flash"], reverse=True)
+    flash = sum(r["flash"] for r in rows)
+    return {"variant": variant,
+            "flash": flash,
+            "ram": sum(r["ram"] for r in rows),
+            "iram": sum(r["iram"] for r in rows),
+            "ota_estimate_s": round(flash * 8 / 1000 / OTA_KBPS, 1),
+            "modules": rows}
+
+
+def print_report(report, limit=25):
+    print(f"Footprint of {report['variant']}: flash {report['flash']} B, static RAM {report['ram']} B, "
+          f"IRAM {report['iram']} B, OTA ~{report['ota_estimate_s']} s at {OTA_KBPS} kbit/s")
+    print(f"  {'module':<32}{'flash':>10}{'ram':>10}{'iram':>10}")
+    for row in report["modules"][:limit]:
+        print(f"  {row['module']:<32}{row['flash']:>10}{row['ram']:>10}{row['iram']:>10}")
+    rest = report["modules"][limit:]
+    if rest:
+        print(f"  {'(' + str(len(rest)) + ' more)':<32}{sum(r['flash'] for r in rest):>10}"
+              f"{sum(r['ram'] for r in rest):>10}{sum(r['iram'] for r in rest):>10}")
+
+
+def report_build(map_path, variant):
+    report = summarize(parse_map(map_path), variant)
+    with open(os.path.join(os.path.dirname(map_path), "footprint.json"), "w") as f:
+        json.dump(report, f, indent=2)
+    print_report(report)
+
+
+def compare(project_dir):
+    """Side by side totals and the project modules of every variant built so far."""
+    reports = []
+    for path in sorted(glob.glob(os.path.join(project_dir, ".pio", "build", "*", "footprint.json"))):
+        with open(path) as f:
+            reports.append(json.load(f))
+    if not reports:
+        print("No footprint.json found; build some variants first")
+        return
+    own = sorted({r["module"] for rep in reports for r in rep["modules"] if ":" not in r["module"]
+                  and r["module"] not in ("other", "toolchain")})
+    print(f"{'':<22}" + "".join(f"{rep['variant']:>18}" for rep in reports))
+    for label, key in (("flash", "flash"), ("static RAM", "ram"), ("IRAM", "iram"), ("OTA estimate s", "ota_estimate_s")):
+        print(f"{label:<22}" + "".join(f"{rep[key]:>18}" for rep in reports))
+    for module in own:
+        cells = []
+        for rep in reports:
+            row = next((r for r in rep["modules"] if r["module"] == module), None)
+            cells.append(f"{row['flash']}/{row['ram']}" if row else "-")
+        print(f"  {module:<20}" + "".join(f"{c:>18}" for c in cells))
+    print("(module cells are flash/RAM bytes)")
+
+
+try:
+    Import("env")
+
+    MAP_PATH = os.path.join(env.subst("$BUILD_DIR"), env.subst("${PROGNAME}") + ".map")
+    env.Append(LINKFLAGS=["-Wl,-Map," + MAP_PATH])
+
+    def after_link(source, target, env):
+        report_build(MAP_PATH, env.subst("$PIOENV"))
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", after_link)
+except NameError:
+    if __name__ == "__main__":
+        if len(sys.argv) > 1 and sys.argv[1] == "--compare":
+            compare(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+        elif len(sys.argv) > 1:
+            report_build(sys.argv[1], os.path.basename(os.path.dirname(os.path.abspath(sys.argv[1]))))
+        else:
+            print(__doc__)
@@ -0,0 +1,320 @@
+"""Generate the message codecs from schema/doorbell.json.
+
+Writes src/doorbell_schema.h (zero-allocation CBOR encoders/decoders for the
+firmware) and doorbell_schema.py (the same codec plus the JSON view for the
+host tools). Runs as a PlatformIO pre-build script and standalone:
+
+    python3 scripts/gen_schema.py
+
+Every message is a CBOR array [id, field1, field2, ...] in schema order.
+Fields may only be appended, so older decoders skip what they do not know.
+"""
+
+import json
+import os
+import re
+
+try:
+    Import("env")
+    PROJECT_DIR = env.get('PROJECT_DIR')
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+SCHEMA_PATH = os.path.join(PROJECT_DIR, 'schema', 'doorbell.json')
+HEADER_PATH = os.path.join(PROJECT_DIR, 'src', 'doorbell_schema.h')
+PYTHON_PATH = os.path.join(PROJECT_DIR, 'doorbell_schema.py')
+
+C_TYPES = {"u8": "uint8_t", "u16": "uint16_t", "u32": "uint32_t", "u64": "uint64_t", "enum": "uint8_t"}
+MAX_VALUES = {"u8": 0xFF, "u16": 0xFFFF, "u32": 0xFFFFFFFF, "u64": 0xFFFFFFFFFFFFFFFF}
+ENCODED_SIZE = {"u8": 2, "u16": 3, "u32": 5, "u64": 9, "enum": 2}
+
+
+def snake_upper(name):
+    return re.sub(r'(?<!^)(?=[A-Z])', '_', name).upper()
+
+
+def field_max(field):
+    if field["type"] == "enum":
+        return len(field["values"]) - 1
+    return MAX_VALUES[field["type"]]
+
+
+def field_size(field):
+    if field["type"] == "str":
+        return (1 if field["max"] < 24 else 2) + field["max"]
+    return ENCODED_SIZE[field["type"]]
+
+
+def message_size(message):
+    # Array head, message id, fields
+    return 1 + 1 + sum(field_size(f) for f in message["fields"])
+
+
+def generate_header(schema):
+    out = []
+    emit = out.append
+    emit("// Generated by scripts/gen_schema.py from schema/doorbell.json - do not edit")
+    emit("#ifndef DOORBELL_SCHEMA_H")
+    emit("#define DOORBELL_SCHEMA_H")
+    emit("")
+    emit('#include "cbor_lite.h"')
+    emit("")
+    emit(f"#define SCHEMA_VERSION {schema['version']}")
+    emit(f"#define SCHEMA_TOPIC_PREFIX \"{schema['topic_prefix']}\"")
+    emit(f"#define SCHEMA_CMD_TOPIC \"{schema['topic_prefix']}cmd\"")
+    emit(f"#define SCHEMA_MAX_MESSAGE_SIZE {max(message_size(m) for m in schema['messages'])}")
+    emit("")
+    emit("enum SchemaMessageId : uint8_t {")
+    for message in schema["messages"]:
+        emit(f"    MSG_{snake_upper(message['name'])} = {message['id']},")
+    emit("};")
+
+    for message in schema["messages"]:
+        name = message["name"]
+        upper = snake_upper(name)
+        fields = message["fields"]
+        emit("")
+        emit(f"// {name}: {message['topic']} ({message['direction']})")
+        for field in fields:
+            if field["type"] == "enum":
+                values = ", ".join(f'"{v}"' for v in field["values"])
+                constants = ", ".join(f"{upper}_{field['name'].upper()}_{v.upper()}" for v in field["values"])
+                emit(f"enum {{{constants}}};")
+                emit(f"#define {upper}_{field['name'].upper()}_COUNT {len(field['values'])}")
+                emit(f"static const char* const {name}_{field['name']}_names[] = {{{values}}};")
+        emit(f"struct {name}Msg {{")
+        for field in fields:
+            if field["type"] == "str":
+                emit(f"    char {field['name']}[{field['max'] + 1}];")
+            else:
+                emit(f"    {C_TYPES[field['type']]} {field['name']};")
+        emit("};")
+        emit("")
+        emit(f"inline size_t encode{name}(const {name}Msg& msg, uint8_t* buf, size_t cap) {{")
+        emit("    CborWriter w = {buf, cap, 0, false};")
+        emit(f"    cborPutArray(w, {len(fields) + 1});")
+        emit(f"    cborPutUint(w, MSG_{upper});")
+        for field in fields:
+            if field["type"] == "str":
+                emit(f"    cborPutText(w, msg.{field['name']}, {field['max']});")
+            else:
+                emit(f"    cborPutUint(w, msg.{field['name']});")
+        emit("    return w.overflow ? 0 : w.pos;")
+        emit("}")
+        emit("")
+        emit(f"inline bool decode{name}(const uint8_t* buf, size_t len, {name}Msg& msg) {{")
+        emit("    CborReader r = {buf, len, 0, false};")
+        emit("    uint64_t items = 0;")
+        emit(f"    if (!cborGetHead(r, CBOR_MAJOR_ARRAY, items) || items < {len(fields) + 1} ||")
+        emit(f"        cborGetUint(r, 0xFF) != MSG_{upper}) {{")
+        emit("        return false;")
+        emit("    }")
+        for field in fields:
+            if field["type"] == "str":
+                emit(f"    cborGetText(r, msg.{field['name']}, sizeof(msg.{field['name']}));")
+            else:
+                emit(f"    msg.{field['name']} = cborGetUint(r, {field_max(field):#x}ULL);")
+        emit(f"    for (uint64_t i = {len(fields) + 1}; i < items && !r.error; i++) {{")
+        emit("        cborSkip(r);")
+        emit("    }")
+        emit("    return !r.error;")
+        emit("}")
+
+    emit("")
+    emit("// Message id of an encoded message, -1 if it is not a schema message")
+    emit("inline int schemaMessageId(const uint8_t* buf, size_t len) {")
+    emit("    CborReader r = {buf, len, 0, false};")
+    emit("    uint64_t items = 0;")
+    emit("    if (!cborGetHead(r, CBOR_MAJOR_ARRAY, items) || items < 1) {")
+    emit("        return -1;")
+    emit("    }")
+    emit("    uint64_t id = cborGetUint(r, 0xFF);")
+    emit("    return r.error ? -1 : (int)id;")
+    emit("}")
+    emit("")
+    emit("// Index of a name in a generated enum table, -1 if unknown")
+    emit("inline int schemaEnumIndex(const char* const* names, int count, const char* name) {")
+    emit("    for (int i = 0; i < count; i++) {")
+    emit("        if (strcmp(names[i], name) == 0) {")
+    emit("            return i;")
+    emit("        }")
+    emit("    }")
+    emit("    return -1;")
+    emit("}")
+    emit("")
+    emit("#endif // DOORBELL_SCHEMA_H")
+    return "\n".join(out) + "\n"
+
+
+PYTHON_CODEC = '''
+
+MESSAGES_BY_ID = {m["id"]: m for m in SCHEMA["messages"]}
+MESSAGES_BY_NAME = {m["name"]: m for m in SCHEMA["messages"]}
+TOPIC_PREFIX = SCHEMA["topic_prefix"]
+CMD_TOPIC = TOPIC_PREFIX + "cmd"
+
+
+class SchemaError(Exception):
+    pass
+
+
+def _head(major, value):
+    if value < 24:
+        return bytes([major << 5 | value])
+    for info, size in ((24, 1), (25, 2), (26, 4), (27, 8)):
+        if value < 1 << (8 * size):
+            return bytes([major << 5 | info]) + value.to_bytes(size, "big")
+    raise SchemaError(f"value {value} too large")
+
+
+def encode(name, values):
+    """Encode a message from a dict; enum fields accept names or indexes"""
+    message = MESSAGES_BY_NAME[name]
+    out = bytearray(_head(4, len(message["fields"]) + 1))
+    out += _head(0, message["id"])
+    for field in message["fields"]:
+        value = values.get(field["name"], "" if field["type"] == "str" else 0)
+        if field["type"] == "str":
+            data = str(value).encode()[:field["max"]]
+            out += _head(3, len(data)) + data
+        else:
+            if field["type"] == "enum" and isinstance(value, str):
+                value = field["values"].index(value)
+            out += _head(0, int(value))
+    return bytes(out)
+
+
+def _read_head(data, pos):
+    if pos >= len(data):
+        raise SchemaError("truncated message")
+    major, info = data[pos] >> 5, data[pos] & 0x1F
+    pos += 1
+    if info < 24:
+        return major, info, pos
+    size = {24: 1, 25: 2, 26: 4, 27: 8}.get(info)
+    if size is None or pos + size > len(data):
+        raise SchemaError("unsupported or truncated item")
+    return major, int.from_bytes(data[pos:pos + size], "big"), pos + size
+
+
+def decode(data):
+    """Decode a message; returns (message name, dict with enum names resolved)"""
+    major, items, pos = _read_head(data, 0)
+    if major != 4 or items < 1:
+        raise SchemaError("not a schema message")
+    major, message_id, pos = _read_head(data, pos)
+    message = MESSAGES_BY_ID.get(message_id)
+    if major != 0 or message is None:
+        raise SchemaError(f"unknown message id {message_id}")
+    if items < len(message["fields"]) + 1:
+        raise SchemaError(f"{message['name']} has too few fields")
+    values = {}
+    for field in message["fields"]:
+        major, value, pos = _read_head(data, pos)
+        if field["type"] == "str":
+            if major != 3 or pos + value > len(data):
+                raise SchemaError(f"bad string field {field['name']}")
+            values[field["name"]] = data[pos:pos + value].decode(errors="replace")
+            pos += value
+        elif major != 0:
+            raise SchemaError(f"bad integer field {field['name']}")
+        elif field["type"] == "enum":
+            if value >= len(field["values"]):
+                raise SchemaError(f"bad enum value for {field['name']}")
+            values[field["name"]] = field["values"][value]
+        else:
+            values[field["name"]] = value
+    return message["name"], values
+
+
+def json_view(data):
+    """(JSON topic, JSON dict) equivalent of an encoded message"""
+    name, values = decode(data)
+    message = MESSAGES_BY_NAME[name]
+    view = dict(message.get("json", {}))
+    view.update(values)
+    return message["topic"], view
+
+
+def cbor_topic(json_topic):
+    """doorbell/event -> doorbell/cbor/event"""
+    return TOPIC_PREFIX + json_topic[len("doorbell/"):]
+
+
+def bench(iterations=20000):
+    """Compare size and per-message encode/decode time of JSON and the schema codec"""
+    import json
+    import time
+    event = {"type": "button_press", "button": "door", "status": "played", "track": 2, "volume": 80,
+             "count": 1, "press_id": "3f2a-17", "t_press": 1760000000123, "ts": 1760000000171}
+
+    def timed(fn):
+        start = time.perf_counter()
+        for _ in range(iterations):
+            fn()
+        return (time.perf_counter() - start) / iterations * 1e6
+
+    json_data = json.dumps(event, separators=(",", ":")).encode()
+    cbor_data = encode("ButtonEvent", event)
+    print(f"ButtonEvent, {iterations} iterations")
+    print(f"  {'':<6}{'bytes':>8}{'encode us':>12}{'decode us':>12}")
+    print(f"  {'json':<6}{len(json_data):>8}{timed(lambda: json.dumps(event, separators=(',', ':')).encode()):>12.2f}"
+          f"{timed(lambda: json.loads(json_data)):>12.2f}")
+    print(f"  {'cbor':<6}{len(cbor_data):>8}{timed(lambda: encode('ButtonEvent', event)):>12.2f}"
+          f"{timed(lambda: decode(cbor_data)):>12.2f}")
+
+
+def send(name, values):
+    """Publish an inbound command to the device using mqtt_config.ini"""
+    import configparser
+    import paho.mqtt.client as mqtt
+    config = configparser.ConfigParser()
+    config.read("mqtt_config.ini")
+    client = mqtt.Client()
+    if config["MQTT"].get("username") and config["MQTT"].get("password"):
+        client.username_pw_set(config["MQTT"]["username"], config["MQTT"]["password"])
+    client.connect(config["MQTT"]["broker"], int(config["MQTT"]["port"]), 60)
+    client.loop_start()
+    client.publish(CMD_TOPIC, encode(name, values), qos=1).wait_for_publish()
+    client.loop_stop()
+    client.disconnect()
+
+
+if __name__ == "__main__":
+    import sys
+    if len(sys.argv) >= 3 and sys.argv[1] == "send":
+        fields = dict(arg.split("=", 1) for arg in sys.argv[3:])
+        fields = {k: int(v) if v.isdigit() else v for k, v in fields.items()}
+        send(sys.argv[2], fields)
+        print(f"Sent {sys.argv[2]} {fields} to {CMD_TOPIC}")
+    elif len(sys.argv) == 2 and sys.argv[1] == "bench":
+        bench()
+    else:
+        print("usage: doorbell_schema.py bench | send <Message> field=value ...")
+        sys.exit(1)
+'''
+
+
+def generate_python(schema):
+    return ("#!/usr/bin/env python3\n"
+            "# Generated by scripts/gen_schema.py from schema/doorbell.json - do not edit\n"
+            '"""Doorbell message schema codec and JSON view, see README "Binary Encoding"."""\n\n'
+            f"SCHEMA = {json.dumps(schema, indent=4)}\n"
+            + PYTHON_CODEC)
+
+
+def write_if_changed(path, content):
+    # Leave the file alone when nothing changed so the firmware is not rebuilt
+    if os.path.exists(path):
+        with open(path) as f:
+            if f.read() == content:
+                return
+    with open(path, 'w') as f:
+        f.write(content)
+    print(f"[Schema] Generated {os.path.relpath(path, PROJECT_DIR)}")
+
+
+with open(SCHEMA_PATH) as f:
+    schema = json.load(f)
+write_if_changed(HEADER_PATH, generate_header(schema))
+write_if_changed(PYTHON_PATH, generate_python(schema))
@@ -0,0 +1,327 @@
+#!/usr/bin/env python3
+"""Per-device session files behind sharded writer threads.
+
+Several doorbells can stream debug samples to the same logger. Each message is
+routed by its device id (the topic level after doorbell/, or a "device" field in
+the payload) to one of N writer shards; a device always lands on the same shard,
+so its samples stay in order and its files are only touched by one thread.
+
+Messages without a device id all land in sessions/default/. If two untagged
+doorbells share the broker, their session ids stop increasing and sessions
+start while another is open; those messages are counted as "interleaved" in
+the stats (and warned about once) instead of merging silently.
+
+The MQTT network thread only routes and enqueues; it never waits. Shard
+queues are bounded: samples are dropped (and counted) when a shard is full,
+while session starts, ends, summaries and dump chunks go to the shard's
+backlog, because losing one would leave a device's session open or its dump
+incomplete. While a backlog is not empty, everything newer for that shard goes
+behind it (samples are dropped), so each device's messages stay in order; the
+writer takes the backlog once its queue is drained. Writers flush once their
+queue is drained instead of after every line.
+
+    sessions/<device>/session_<start>.csv    samples of one debug session
+    sessions/<device>/summaries.csv          doorbell/session summaries
+    sessions/<device>/session_<time>_<id>.csv  requested raw dumps
+"""
+
+import json
+import os
+import collections
+import queue
+import re
+import threading
+import time
+import zlib
+from datetime import datetime
+
+DEFAULT_DEVICE = "default"      # Devices on the single-device topics without a "device" field
+CONTROL_BACKLOG = 10000         # Non-sample messages a full shard sets aside before dropping them too
+
+# Per-session feature summaries published on doorbell/session
+SUMMARY_FIELDS = ["id", "button", "line", "duration_ms", "samples", "rise_ms", "peak_v", "plateau_v",
+                  "ripple_v", "dropouts", "longest_dropout_ms", "correlation", "confidence"]
+
+# doorbell/<kind> or doorbell/<device>/<kind>
+KINDS = {"debug": "debug", "session": "summary", "session/dump": "dump"}
+_DEVICE_FIELD = re.compile(rb'"device"\s*:\s*"([^"]{1,64})"')
+_ANSI_ESCAPE = re.compile(r'\x1B(?:[@-Z\\-_]|\[[0-?]*[ -/]*[@-~])')
+
+
+def strip_ansi(text):
+    """Remove ANSI escape sequences from text"""
+    return _ANSI_ESCAPE.sub('', text)
+
+
+def route(topic, payload):
+    """(device, kind) for a logger topic, or None for other topics"""
+    parts = topic.split("/", 2)
+    if len(parts) < 2 or parts[0] != "doorbell":
+        return None
+    rest = topic[len("doorbell/"):]
+    if rest in KINDS:
+        # Only the single-device topics need the payload, and only a regex over the raw bytes
+        match = _DEVICE_FIELD.search(payload)
+        device = match.group(1).decode(errors='replace') if match else DEFAULT_DEVICE
+        return safe_device(device), KINDS[rest]
+    if len(parts) == 3 and parts[2] in KINDS:
+        return safe_device(parts[1]), KINDS[parts[2]]
+    return None
+
+
+def safe_device(device):
+    """Device id usable as a directory name"""
+    return re.sub(r'[^A-Za-z0-9_.-]', '_', device) or DEFAULT_DEVICE
+
+
+class DeviceSessions:
+    """Files of one device; only ever used by the device's shard thread"""
+
+    def __init__(self, device, directory, on_session):
+        self.device = device
+        self.directory = directory
+        self.on_session = on_session
+        self.session_file = None
+        self.session_start = None
+        self.dumps = {}  # session id -> readings received so far
+        self.sessions = 0
+        self.last_ids = {}  # message kind -> last session id, untagged streams only
+        self.interleaved = 0
+        os.makedirs(directory, exist_ok=True)
+
+    def handle(self, kind, payload):
+        """Returns True when a file was written"""
+        if kind == "summary":
+            data = json.loads(payload)
+            self.check_order("summary", data.get("id"))
+            self.log_summary(data)
+            return True
+        if kind == "dump":
+            self.log_dump_chunk(json.loads(payload))
+            return True
+        try:
+            data = json.loads(strip_ansi(payload.decode()))
+        except (json.JSONDecodeError, UnicodeDecodeError):
+            return False  # Plain debug text
+        if not isinstance(data, dict):
+            return False
+        if data.get("status") == "started":
+            self.check_order("started", data.get("id"), self.session_file is not None)
+            self.start_session()
+        elif data.get("status") == "ended":
+            self.end_session()
+        elif "adc1_v" in data and "adc2_v" in data and self.session_file:
+            self.session_file.write(f"{data['delta']},{data['adc1_v']},{data['adc2_v']}\n")
+            return True
+        return False
+
+    def check_order(self, kind, session_id, overlapping=False):
+        """Count messages of an untagged stream that only fit several devices"""
+        if self.device != DEFAULT_DEVICE:
+            return
+        last = self.last_ids.get(kind)
+        if isinstance(session_id, int):
+            self.last_ids[kind] = session_id
+            # Ids restart at 1 after a reboot
+            if last is not None and session_id <= last and session_id != 1:
+                overlapping = True
+        if not overlapping:
+            return
+        if not self.interleaved:
+            print(f"[{self.device}] Warning: untagged session messages from more than one device? "
+                  f"Session ids out of order or overlapping; give each doorbell its own device id")
+        self.interleaved += 1
+
+    def start_session(self):
+        self.end_session(notify=False)  # The end of the previous session was lost
+        self.session_start = datetime.now()
+        filename = f"session_{self.session_start.strftime('%Y%m%d_%H%M%S_%f')}.csv"
+        self.session_file = open(os.path.join(self.directory, filename), 'w')
+        self.session_file.write("delta_ms,adc1_v,adc2_v\n")
+        self.sessions += 1
+        self.on_session(self.device, "started", None)
+
+    def end_session(self, notify=True):
+        if not self.session_file:
+            return
+        self.session_file.close()
+        self.session_file = None
+        if notify:
+            self.on_session(self.device, "ended", datetime.now() - self.session_start)
+
+    def flush(self):
+        if self.session_file:
+            self.session_file.flush()
+
+    def log_summary(self, data):
+        path = os.path.join(self.directory, "summaries.csv")
+        new_file = not os.path.exists(path)
+        with open(path, 'a') as f:
+            if new_file:
+                f.write("received," + ",".join(SUMMARY_FIELDS) + "\n")
+            f.write(datetime.now().isoformat(timespec='seconds') + "," +
+                    ",".join(str(data.get(field, "")) for field in SUMMARY_FIELDS) + "\n")
+
+    def log_dump_chunk(self, data):
+        # Chunks of one session arrive in order; write the file once all readings are in
+        readings = self.dumps.setdefault(data["id"], [])
+        readings.extend(data["readings"])
+        if len(readings) < data["total"]:
+            return
+        del self.dumps[data["id"]]
+        filename = f"session_{datetime.now().strftime('%Y%m%d_%H%M%S')}_{data['id']}.csv"
+        with open(os.path.join(self.directory, filename), 'w') as f:
+            f.write("delta_ms,adc1_v,adc2_v\n")
+            for delta, v1, v2 in readings:
+                f.write(f"{delta},{v1},{v2}\n")
+        print(f"[{self.device}] Session {data['id']} dump saved to {filename}")
+
+
+class Shard:
+    def __init__(self, index, queue_size):
+        self.index = index
+        self.queue = queue.Queue(maxsize=queue_size)
+        self.backlog = collections.deque()  # Newer than anything in the queue
+        self.backlog_lock = threading.Lock()
+        self.devices = {}
+        self.lock = threading.Lock()  # Counters only
+        self.counters = {"received": 0, "written": 0, "dropped": 0, "errors": 0}
+        self.max_depth = 0
+
+
+class SessionIngest:
+    def __init__(self, sessions_dir="sessions", writers=4, queue_size=1000, on_session=None):
+        self.sessions_dir = sessions_dir
+        self.on_session = on_session or (lambda device, event, duration: None)
+        self._shards = [Shard(i, queue_size) for i in range(writers)]
+        self._stop = threading.Event()
+        self._started = time.monotonic()
+        self._last_stats = (self._started, 0, 0)
+        self._threads = [threading.Thread(target=self._writer, args=(shard,), name=f"session-writer-{shard.index}",
+                                          daemon=True)
+                         for shard in self._shards]
+        for thread in self._threads:
+            thread.start()
+
+    # --- Producer side (MQTT network thread) ---
+
+    def submit(self, topic, payload):
+        """Route one message; returns False for topics the logger does not handle"""
+        routed = route(topic, payload)
+        if routed is None:
+            return False
+        device, kind = routed
+        shard = self._shards[zlib.crc32(device.encode()) % len(self._shards)]
+        item = (device, kind, payload)
+        sample = kind == "debug" and b'"status"' not in payload
+        with shard.backlog_lock:
+            queued = False
+            if not shard.backlog:
+                try:
+                    shard.queue.put_nowait(item)
+                    queued = True
+                except queue.Full:
+                    pass
+            if not queued and not sample and len(shard.backlog) < CONTROL_BACKLOG:
+                shard.backlog.append(item)
+                queued = True
+        if not queued:
+            with shard.lock:
+                shard.counters["dropped"] += 1
+            return True
+        with shard.lock:
+            shard.counters["received"] += 1
+            shard.max_depth = max(shard.max_depth, shard.queue.qsize())
+        return True
+
+    def stop(self, timeout=5.0):
+        """Write out what is queued, then close every open session file"""
+        self._stop.set()
+        for thread in self._threads:
+            thread.join(timeout)
+
+    # --- Metrics ---
+
+    def stats(self):
+        """Totals, per-shard queues and the ingest rate since the previous call"""
+        now = time.monotonic()
+        shards = []
+        totals = {"received": 0, "written": 0, "dropped": 0, "errors": 0}
+        devices = sessions = open_sessions = interleaved = 0
+        for shard in self._shards:
+            with shard.lock:
+                counters = dict(shard.counters)
+                max_depth = shard.max_depth
+                shard.max_depth = 0
+                device_list = list(shard.devices.values())
+            for key in totals:
+                totals[key] += counters[key]
+            devices += len(device_list)
+            sessions += sum(d.sessions for d in device_list)
+            open_sessions += sum(1 for d in device_list if d.session_file)
+            interleaved += sum(d.interleaved for d in device_list)
+            shards.append({"depth": shard.queue.qsize(), "max_depth": max_depth, "backlog": len(shard.backlog),
+                           **counters})
+
+        then, received, written = self._last_stats
+        interval = max(now - then, 1e-6)
+        self._last_stats = (now, totals["received"], totals["written"])
+        return dict(totals,
+                    devices=devices,
+                    sessions=sessions,
+                    open_sessions=open_sessions,
+                    unidentified_interleaved=interleaved,
+                    ingest_per_s=round((totals["received"] - received) / interval, 1),
+                    written_per_s=round((totals["written"] - written) / interval, 1),
+                    uptime_s=round(now - self._started),
+                    shards=shards)
+
+    # --- Writers ---
+
+    def _device(self, shard, device):
+        sessions = shard.devices.get(device)
+        if sessions is None:
+            sessions = DeviceSessions(device, os.path.join(self.sessions_dir, device), self.on_session)
+            with shard.lock:
+                shard.devices[device] = sessions
+        return sessions
+
+    def _next(self, shard):
+        """Next message of a shard: its queue first, then the backlog queued behind it"""
+        try:
+            return shard.queue.get_nowait()
+        except queue.Empty:
+            pass
+        with shard.backlog_lock:
+            if shard.backlog:
+                return shard.backlog.popleft()
+        return shard.queue.get(timeout=0.5)
+
+    def _writer(self, shard):
+        dirty = set()
+        while True:
+            try:
+                device, kind, payload = self._next(shard)
+            except queue.Empty:
+                if self._stop.is_set():
+                    break
+                continue
+            sessions = self._device(shard, device)
+            try:
+                written = sessions.handle(kind, payload)
+            except Exception as e:
+                print(f"[{device}] Error processing {kind} message: {e}")
+                written = False
+                with shard.lock:
+                    shard.counters["errors"] += 1
+            if written:
+                dirty.add(sessions)
+                with shard.lock:
+                    shard.counters["written"] += 1
+            # Flush once the burst is written, not per line
+            if shard.queue.empty() and not shard.backlog:
+                for sessions in dirty:
+                    sessions.flush()
+                dirty.clear()
+        for sessions in shard.devices.values():
+            sessions.end_session(notify=False)
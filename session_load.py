@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+"""Synthetic multi-device load for session_logger.py.
+
+Every simulated doorbell runs debug sessions back to back: {"status":"started"},
+samples at --rate per second for --session-ms, {"status":"ended"}, a short
+pause, and a doorbell/<device>/session summary per session.
+
+    python3 session_load.py --devices 50 --rate 100 --duration 30            # in-process
+    python3 session_load.py --devices 50 --rate 100 --broker localhost:1883  # over MQTT
+
+In-process, messages go straight to SessionIngest.submit() (what on_message
+does), so the run measures the ingest path without a broker; --rate 0 submits
+as fast as possible. It then checks every session file: a file holds the
+samples of exactly one device's session, in order, with dropped samples the
+only gaps. Over MQTT it only publishes; watch doorbell/bridge/session_logger/stats.
+"""
+
+import argparse
+import csv
+import json
+import os
+import shutil
+import sys
+import tempfile
+import time
+
+from session_ingest import SessionIngest
+
+
+class Device:
+    def __init__(self, index, samples_per_session, pause_samples):
+        self.name = f"bell{index:03d}"
+        self.index = index
+        self.samples_per_session = samples_per_session
+        self.pause_samples = pause_samples
+        self.step = 0
+        self.sessions = 0
+
+    def next_messages(self):
+        """Messages for one sample period: (topic, payload) tuples"""
+        cycle = self.samples_per_session + self.pause_samples
+        position = self.step % cycle
+        self.step += 1
+        debug = f"doorbell/{self.name}/debug"
+        if position == 0:
+            self.sessions += 1
+            return [(debug, b'{"status":"started"}'), (debug, self.sample(0))]
+        if position < self.samples_per_session:
+            return [(debug, self.sample(position))]
+        if position == self.samples_per_session:
+            summary = {"id": self.sessions, "button": self.index % 2, "samples": self.samples_per_session}
+            return [(debug, b'{"status":"ended"}'),
+                    (f"doorbell/{self.name}/session", json.dumps(summary).encode())]
+        return []
+
+    def sample(self, position):
+        # delta counts samples and adc1_v carries the device index, so files can be checked
+        return f'{{"delta":{position},"adc1_v":{self.index},"adc2_v":1.25}}'.encode()
+
+
+def check_files(sessions_dir, devices):
+    """(files checked, samples found, problems) for the written session files"""
+    files = samples = 0
+    problems = []
+    for device in devices:
+        directory = os.path.join(sessions_dir, device.name)
+        for name in sorted(os.listdir(directory)) if os.path.isdir(directory) else []:
+            if not name.startswith("session_"):
+                continue
+            files += 1
+            with open(os.path.join(directory, name)) as f:
+                rows = list(csv.DictReader(f))
+            samples += len(rows)
+            last = -1
+            for row in rows:
+                if int(float(row["adc1_v"])) != device.index:
+                    problems.append(f"{device.name}/{name}: sample of another device")
+                    break
+                if int(row["delta_ms"]) <= last:
+                    problems.append(f"{device.name}/{name}: samples out of order")
+                    break
+                last = int(row["delta_ms"])
+        if device.sessions and not os.path.isdir(directory):
+            problems.append(f"{device.name}: no session files")
+    return files, samples, problems
+
+
+def run_local(args, devices):
+    sessions_dir = tempfile.mkdtemp(prefix="session_load_")
+    ingest = SessionIngest(sessions_dir, writers=args.writers, queue_size=args.queue_size)
+    period = 1.0 / args.rate if args.rate else 0
+    offered = 0
+    start = time.monotonic()
+    next_tick = start
+    next_report = start + 5
+    while time.monotonic() - start < args.duration:
+        for device in devices:
+            for topic, payload in device.next_messages():
+                ingest.submit(topic, payload)
+                offered += 1
+        if period:
+            next_tick += period
+            delay = next_tick - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+        if time.monotonic() >= next_report:
+            stats = ingest.stats()
+            depth = max(shard["depth"] for shard in stats["shards"])
+            print(f"  {stats['uptime_s']:4d} s  ingest {stats['ingest_per_s']:9.1f} msg/s  "
+                  f"written {stats['written_per_s']:9.1f}/s  deepest queue {depth:5d}  dropped {stats['dropped']}")
+            next_report += 5
+    elapsed = time.monotonic() - start
+    ingest.stop(timeout=30)
+    stats = ingest.stats()
+
+    files, samples, problems = check_files(sessions_dir, devices)
+    print(f"\n{len(devices)} devices, {args.writers} writers, queue {args.queue_size}: "
+          f"offered {offered} msgs in {elapsed:.1f} s ({offered / elapsed:.0f} msg/s)")
+    print(f"received {stats['received']}, written {stats['written']}, dropped {stats['dropped']}, "
+          f"errors {stats['errors']}, sessions {stats['sessions']}")
+    print(f"{files} session files with {samples} samples checked: "
+          f"{'ok' if not problems else f'{len(problems)} problem(s)'}")
+    for problem in problems[:10]:
+        print(f"  {problem}")
+    if args.keep:
+        print(f"Files kept in {sessions_dir}")
+    else:
+        shutil.rmtree(sessions_dir)
+    return 1 if problems or stats["errors"] else 0
+
+
+def run_broker(args, devices):
+    import paho.mqtt.client as mqtt
+    host, _, port = args.broker.partition(":")
+    client = mqtt.Client()
+    client.connect(host, int(port or 1883), 60)
+    client.loop_start()
+    period = 1.0 / (args.rate or 100)
+    published = 0
+    start = next_tick = time.monotonic()
+    while time.monotonic() - start < args.duration:
+        for device in devices:
+            for topic, payload in device.next_messages():
+                client.publish(topic, payload)
+                published += 1
+        next_tick += period
+        delay = next_tick - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+    elapsed = time.monotonic() - start
+    client.loop_stop()
+    client.disconnect()
+    print(f"Published {published} messages for {len(devices)} devices in {elapsed:.1f} s "
+          f"({published / elapsed:.0f} msg/s)")
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--devices", type=int, default=20)
+    parser.add_argument("--rate", type=int, default=100, help="samples per second per device, 0 = unpaced")
+    parser.add_argument("--duration", type=float, default=20, help="seconds")
+    parser.add_argument("--session-ms", type=int, default=2000)
+    parser.add_argument("--pause-ms", type=int, default=500)
+    parser.add_argument("--writers", type=int, default=4)
+    parser.add_argument("--queue-size", type=int, default=1000)
+    parser.add_argument("--broker", help="host[:port]; publish over MQTT instead of in-process")
+    parser.add_argument("--keep", action="store_true", help="keep the session files of an in-process run")
+    args = parser.parse_args()
+
+    sample_ms = 1000 / (args.rate or 100)
+    devices = [Device(i, max(1, round(args.session_ms / sample_ms)), max(1, round(args.pause_ms / sample_ms)))
+               for i in range(args.devices)]
+    return run_broker(args, devices) if args.broker else run_local(args, devices)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -2,18 +2,17 @@
 
 import paho.mqtt.client as mqtt
 import json
-import os
 import time
-from datetime import datetime
 import configparser
 import http.client
 import urllib.parse
 import sys
-import re
+import latency_trace
+import doorbell_schema
+from bridge_queue import DeliveryQueue
+from session_ingest import SessionIngest
 
-# Create sessions directory if it doesn't exist
 SESSIONS_DIR = "sessions"
-os.makedirs(SESSIONS_DIR, exist_ok=True)
 
 # Read configuration
 config = configparser.ConfigParser()
@@ -29,96 +28,65 @@ MQTT_PASSWORD = config['MQTT'].get('password')
 PUSHOVER_USER_KEY = config['PUSHOVER']['user_key']
 PUSHOVER_API_TOKEN = config['PUSHOVER']['api_token']
 
-def strip_ansi(text):
-    """Remove ANSI escape sequences from text"""
-    ansi_escape = re.compile(r'\x1B(?:[@-Z\\-_]|\[[0-?]*[ -/]*[@-~])')
-    return ansi_escape.sub('', text)
-
-class SessionLogger:
-    def __init__(self):
-        self.current_session_file = None
-        self.session_start_time = None
-        
-    def send_pushover_notification(self, message, title="Doorbell Session"):
-        conn = http.client.HTTPSConnection("api.pushover.net:443")
-        conn.request("POST", "/1/messages.json",
-                    urllib.parse.urlencode({
-                        "token": PUSHOVER_API_TOKEN,
-                        "user": PUSHOVER_USER_KEY,
-                        "title": title,
-                        "message": message,
-                    }), {"Content-type": "application/x-www-form-urlencoded"})
-        conn.getresponse()
-
-    def start_session(self):
-        self.session_start_time = datetime.now()
-        filename = f"session_{self.session_start_time.strftime('%Y%m%d_%H%M%S')}.csv"
-        self.current_session_file = open(os.path.join(SESSIONS_DIR, filename), 'w')
-        self.current_session_file.write("delta_ms,adc1_v,adc2_v\n")
-        
-        # Send Pushover notification
-        self.send_pushover_notification("Doorbell session started", "🔔 Session Start")
-
-    def end_session(self):
-        if self.current_session_file:
-            self.current_session_file.close()
-            self.current_session_file = None
-            
-            # Calculate session duration
-            if self.session_start_time is not None:
-                duration = datetime.now() - self.session_start_time
-                duration_str = str(duration).split('.')[0]  # Remove microseconds
-                
-                # Send Pushover notification
-                self.send_pushover_notification(
-                    f"Session ended (Duration: {duration_str})",
-                    "🔔 Session End"
-                )
-
-    def log_adc_data(self, data):
-        if self.current_session_file:
-            self.current_session_file.write(f"{data['delta']},{data['adc1_v']},{data['adc2_v']}\n")
-            self.current_session_file.flush()  # Ensure data is written immediately
+# Ingest settings (optional [SESSION_LOGGER] section)
+WRITERS = config.getint('SESSION_LOGGER', 'writers', fallback=4)
+QUEUE_SIZE = config.getint('SESSION_LOGGER', 'queue_size', fallback=1000)
+STATS_INTERVAL = 60  # Seconds between doorbell/bridge/session_logger/stats publishes
+
+# Single-device topics, and the same under doorbell/<device>/ for several doorbells
+SESSION_TOPICS = [
+    "doorbell/debug", "doorbell/+/debug",
+    # Session summaries, and raw readings requested through doorbell/get/session_dump
+    "doorbell/session", "doorbell/+/session",
+    "doorbell/session/dump", "doorbell/+/session/dump",
+]
+
+def send_pushover_notification(item):
+    conn = http.client.HTTPSConnection("api.pushover.net:443", timeout=10)
+    conn.request("POST", "/1/messages.json",
+                urllib.parse.urlencode({
+                    "token": PUSHOVER_API_TOKEN,
+                    "user": PUSHOVER_USER_KEY,
+                    "title": item["title"],
+                    "message": item["message"],
+                }), {"Content-type": "application/x-www-form-urlencoded"})
+    return conn.getresponse().status == 200
+
+def session_event(device, event, duration):
+    # Called on a writer thread: notifications go through their own queue
+    if event == "started":
+        notifications.put({"title": "🔔 Session Start", "message": f"Doorbell session started ({device})"})
+    else:
+        duration_str = str(duration).split('.')[0]  # Remove microseconds
+        notifications.put({"title": "🔔 Session End",
+                           "message": f"Session ended on {device} (Duration: {duration_str})"})
 
 def on_connect(client, userdata, flags, rc):
     print("Connected to MQTT broker with result code " + str(rc))
-    # Subscribe to debug topics
-    client.subscribe("doorbell/debug")
+    for topic in SESSION_TOPICS:
+        client.subscribe(topic)
+    # Ring events, for latency tracing
+    client.subscribe("doorbell/event")
+    client.subscribe(doorbell_schema.cbor_topic("doorbell/event"))
 
 def on_message(client, userdata, msg):
-    raw_payload = None
-    cleaned_payload = None
+    # Runs on the paho network thread: trace events, route everything else to a writer
+    received = latency_trace.now_ms()
     try:
-        raw_payload = msg.payload.decode()
-        # Strip ANSI escape sequences before parsing JSON
-        cleaned_payload = strip_ansi(raw_payload)
-        
-        # Try to parse as JSON first
-        try:
-            data = json.loads(cleaned_payload)
-            
-            # Check if it's a session status message
-            if "status" in data:
-                if data["status"] == "started":
-                    session_logger.start_session()
-                elif data["status"] == "ended":
-                    session_logger.end_session()
-            
-            # Check if it's ADC data (contains adc1_v and adc2_v)
-            elif "adc1_v" in data and "adc2_v" in data:
-                session_logger.log_adc_data(data)
-                
-        except json.JSONDecodeError:
-            # If it's not JSON, it's a plain debug message - ignore it
-            pass
-            
+        if msg.topic == "doorbell/event":
+            # No upstream call is made per press here, only the receive time is traced
+            latency_trace.record("session_logger", json.loads(msg.payload.decode()), received)
+            return
+        if msg.topic.startswith(doorbell_schema.TOPIC_PREFIX):
+            latency_trace.record("session_logger", doorbell_schema.json_view(msg.payload)[1], received)
+            return
+        ingest.submit(msg.topic, msg.payload)
     except Exception as e:
-        print(f"Error processing message: {e}", file=sys.stderr)
-        print(f"Raw message: {raw_payload}", file=sys.stderr)
-        print(f"Cleaned message: {cleaned_payload}", file=sys.stderr)
+        print(f"Error processing message on {msg.topic}: {e}", file=sys.stderr)
 
 if __name__ == "__main__":
-    session_logger = SessionLogger()
+    notifications = DeliveryQueue("session_logger", send_pushover_notification, workers=1)
+    ingest = SessionIngest(SESSIONS_DIR, writers=WRITERS, queue_size=QUEUE_SIZE, on_session=session_event)
 
     client = mqtt.Client()
     client.on_connect = on_connect
@@ -131,12 +99,21 @@ if __name__ == "__main__":
     try:
         client.connect(MQTT_BROKER, MQTT_PORT, 60)
         print(f"Connected to MQTT broker at {MQTT_BROKER}:{MQTT_PORT}")
-        print(f"Logging sessions to directory: {SESSIONS_DIR}")
-        client.loop_forever()
+        print(f"Logging sessions to {SESSIONS_DIR}/<device>/ with {WRITERS} writer(s)")
+        client.loop_start()
+        while True:
+            time.sleep(STATS_INTERVAL)
+            stats = ingest.stats()
+            print(f"Ingest: {stats['ingest_per_s']} msg/s, {stats['devices']} device(s), "
+                  f"{stats['open_sessions']} open session(s), {stats['dropped']} dropped")
+            client.publish("doorbell/bridge/session_logger/stats", json.dumps(stats), retain=True)
     except KeyboardInterrupt:
         print("\nExiting...")
-        if session_logger.current_session_file:
-            session_logger.current_session_file.close()
     except Exception as e:
         print(f"Error: {e}", file=sys.stderr)
         sys.exit(1)
+    finally:
+        client.loop_stop()
+        client.disconnect()
+        ingest.stop()
+        notifications.stop()
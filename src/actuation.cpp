@@ -0,0 +1,51 @@
+#include "actuation.h"
+#include <string.h>
+
+static const char* const modeNames[FEEDBACK_MODE_COUNT] = {"none", "current", "contact"};
+static const char* const resultNames[ACTUATION_RESULT_COUNT] = {
+    "pending", "confirmed", "failed", "unverified", "superseded"
+};
+
+void actuationBegin(ActuationCheck& check, uint16_t threshold, uint8_t debounce) {
+    memset(&check, 0, sizeof(ActuationCheck));
+    check.threshold = threshold;
+    check.debounce = debounce > 0 ? debounce : 1;
+}
+
+void actuationEnergized(ActuationCheck& check, unsigned long nowUs) {
+    if (check.energized) {
+        return;
+    }
+    check.energized = true;
+    check.energizedUs = nowUs;
+}
+
+bool actuationSample(ActuationCheck& check, uint16_t level, unsigned long nowUs) {
+    if (check.confirmed || !check.energized) {
+        return check.confirmed;
+    }
+    check.samples++;
+    if (level > check.peak) {
+        check.peak = level;
+    }
+    if (level < check.threshold) {
+        check.run = 0;
+        return false;
+    }
+    if (check.run == 0) {
+        check.runStartUs = nowUs;
+    }
+    if (++check.run >= check.debounce) {
+        check.confirmed = true;
+        check.latencyUs = check.runStartUs - check.energizedUs;
+    }
+    return check.confirmed;
+}
+
+const char* feedbackModeName(FeedbackMode mode) {
+    return mode < FEEDBACK_MODE_COUNT ? modeNames[mode] : "unknown";
+}
+
+const char* actuationResultName(ActuationResult result) {
+    return result < ACTUATION_RESULT_COUNT ? resultNames[result] : "unknown";
+}
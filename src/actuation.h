@@ -0,0 +1,56 @@
+#ifndef ACTUATION_H
+#define ACTUATION_H
+
+#include <stdint.h>
+
+// Confirmation of a relay actuation from a feedback input: strike current
+// (ADC reading) or a door contact (0/1). Each attempt starts when the relay
+// is first energized; it is confirmed by a run of consecutive asserted
+// samples, and its latency is the time from energizing to the start of that
+// run. Samples taken before the relay is energized never confirm.
+
+/// @brief Feedback input fitted to a relay
+enum FeedbackMode : uint8_t {
+    FEEDBACK_NONE = 0,
+    FEEDBACK_CURRENT,               ///< Current sense on an ADC pin, asserted at or above the threshold
+    FEEDBACK_CONTACT,               ///< Door contact on a digital pin, asserted while open
+    FEEDBACK_MODE_COUNT
+};
+
+/// @brief Outcome of an actuation (all of its attempts)
+enum ActuationResult : uint8_t {
+    ACTUATION_PENDING = 0,
+    ACTUATION_CONFIRMED,
+    ACTUATION_FAILED,               ///< No feedback after the last retry
+    ACTUATION_UNVERIFIED,           ///< No feedback input fitted
+    ACTUATION_SUPERSEDED,           ///< A new actuation started before this one finished
+    ACTUATION_RESULT_COUNT
+};
+
+/// @brief One attempt being verified; written by the sampler, read by the caller
+struct ActuationCheck {
+    uint16_t threshold;
+    uint8_t debounce;               ///< Consecutive asserted samples that confirm
+    bool energized;
+    bool confirmed;
+    uint8_t run;                    ///< Current run of asserted samples
+    unsigned long energizedUs;
+    unsigned long runStartUs;
+    unsigned long latencyUs;        ///< Valid once confirmed
+    uint16_t peak;                  ///< Highest sample since energizing
+    unsigned long samples;
+};
+
+/// @brief Prepare an attempt (relay not yet energized)
+void actuationBegin(ActuationCheck& check, uint16_t threshold, uint8_t debounce);
+
+/// @brief The relay was energized; later calls of the same attempt are ignored
+void actuationEnergized(ActuationCheck& check, unsigned long nowUs);
+
+/// @brief Add one feedback sample; returns true once the attempt is confirmed
+bool actuationSample(ActuationCheck& check, uint16_t level, unsigned long nowUs);
+
+const char* feedbackModeName(FeedbackMode mode);
+const char* actuationResultName(ActuationResult result);
+
+#endif // ACTUATION_H
@@ -0,0 +1,49 @@
+#include "adc_sampler.h"
+#include <string.h>
+
+void samplerBegin(AdcSampler& sampler) {
+    memset(&sampler, 0, sizeof(AdcSampler));
+}
+
+static unsigned long currentInterval(const AdcSampler& sampler, const SamplerTiming& timing) {
+    return sampler.fast ? timing.fastMs : timing.idleMs;
+}
+
+bool samplerDue(AdcSampler& sampler, const SamplerTiming& timing, unsigned long now) {
+    if (sampler.started && now - sampler.lastRead < currentInterval(sampler, timing)) {
+        return false;
+    }
+    sampler.lastElapsed = sampler.started ? now - sampler.lastRead : 0;
+    if (sampler.fast) {
+        sampler.fastMs += sampler.lastElapsed;
+    }
+    sampler.lastRead = now;
+    sampler.started = true;
+    sampler.samples++;
+    return true;
+}
+
+void samplerUpdate(AdcSampler& sampler, const SamplerTiming& timing, float voltage1, float voltage2,
+                   bool inSession, unsigned long now) {
+    if (voltage1 >= timing.approachLevel || voltage2 >= timing.approachLevel || inSession) {
+        sampler.lastFastTrigger = now;
+        sampler.fast = true;
+    } else if (sampler.fast && now - sampler.lastFastTrigger >= timing.holdMs) {
+        sampler.fast = false;
+    }
+}
+
+unsigned long samplerWait(const AdcSampler& sampler, const SamplerTiming& timing, unsigned long now) {
+    unsigned long interval = currentInterval(sampler, timing);
+    unsigned long since = now - sampler.lastRead;
+    return since < interval ? interval - since : 0;
+}
+
+unsigned long samplerEdgeTime(const AdcSampler& sampler) {
+    return sampler.lastRead - sampler.lastElapsed / 2;
+}
+
+void samplerResetStats(AdcSampler& sampler) {
+    sampler.fastMs = 0;
+    sampler.samples = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef ADC_SAMPLER_H
+#define ADC_SAMPLER_H
+
+#include <stdint.h>
+
+// Adaptive sample rate of the analog doorbell lines: slow while both lines are
+// idle, fast once either nears the trigger band and during a session. An edge
+// first seen in a sample is dated half-way back to the previous sample, so a
+// session start is off by at most half the idle interval however fast the
+// line rose (checked against step and ramp edges by bench/sampler_bench.cpp).
+
+/// @brief Sampling parameters (ADC_* in input_config.h)
+struct SamplerTiming {
+    unsigned long fastMs;           ///< Interval near the trigger band and in a session
+    unsigned long idleMs;           ///< Interval while both lines are idle
+    unsigned long holdMs;           ///< Stay fast this long after the last approach or session
+    float approachLevel;            ///< Voltage on either line that switches to the fast rate
+};
+
+struct AdcSampler {
+    bool started;                   ///< A sample has been taken
+    bool fast;
+    unsigned long lastRead;         ///< Time of the latest sample
+    unsigned long lastElapsed;      ///< Time between the latest sample and the one before
+    unsigned long lastFastTrigger;
+    unsigned long fastMs;           ///< Time spent at the fast rate since samplerResetStats()
+    unsigned long samples;          ///< Samples taken since samplerResetStats()
+};
+
+/// @brief Start at the idle rate with a sample due immediately
+void samplerBegin(AdcSampler& sampler);
+
+/// @brief Whether a sample is due at now; a due sample is counted
+bool samplerDue(AdcSampler& sampler, const SamplerTiming& timing, unsigned long now);
+
+/// @brief Pick the rate for the next interval from the voltages just read
+void samplerUpdate(AdcSampler& sampler, const SamplerTiming& timing, float voltage1, float voltage2,
+                   bool inSession, unsigned long now);
+
+/// @brief Time until the next sample is due (0 if already due)
+unsigned long samplerWait(const AdcSampler& sampler, const SamplerTiming& timing, unsigned long now);
+
+/// @brief Estimated time of an edge first seen in the latest sample
+unsigned long samplerEdgeTime(const AdcSampler& sampler);
+
+/// @brief Restart the duty cycle counters (fastMs, samples)
+void samplerResetStats(AdcSampler& sampler);
+
+#endif // ADC_SAMPLER_H
@@ -0,0 +1,59 @@
+#include "ambient.h"
+#include <math.h>
+
+void ambientBegin(AmbientEstimator& estimator) {
+    estimator.levelDb = AMBIENT_FLOOR_DB;
+    estimator.lastBurstDb = AMBIENT_FLOOR_DB;
+    estimator.bursts = 0;
+}
+
+float ambientBurst(AmbientEstimator& estimator, const uint16_t* samples, int count) {
+    if (count <= 0) {
+        return estimator.lastBurstDb;
+    }
+
+    // One integer pass: the variance is the mean square with the DC offset
+    // (the mic bias) removed
+    uint32_t sum = 0;
+    uint64_t sumSquares = 0;
+    for (int i = 0; i < count; i++) {
+        sum += samples[i];
+        sumSquares += (uint32_t)samples[i] * samples[i];
+    }
+    float mean = (float)sum / count;
+    float variance = (float)sumSquares / count - mean * mean;
+    float rms = variance > 0 ? sqrtf(variance) : 0;
+
+    float burstDb = rms > 0 ? 20.0f * log10f(rms / AMBIENT_FULL_SCALE) : AMBIENT_FLOOR_DB;
+    if (burstDb < AMBIENT_FLOOR_DB) {
+        burstDb = AMBIENT_FLOOR_DB;
+    }
+
+    if (estimator.bursts == 0) {
+        estimator.levelDb = burstDb;
+    } else {
+        float weight = burstDb > estimator.levelDb ? AMBIENT_ATTACK : AMBIENT_RELEASE;
+        estimator.levelDb += weight * (burstDb - estimator.levelDb);
+    }
+    estimator.lastBurstDb = burstDb;
+    estimator.bursts++;
+    return burstDb;
+}
+
+uint8_t ambientVolume(float levelDb, uint8_t baseVolume, uint8_t minVolume, uint8_t maxVolume) {
+    float t = (levelDb - AMBIENT_QUIET_DB) / (AMBIENT_LOUD_DB - AMBIENT_QUIET_DB);
+    if (t < 0) {
+        t = 0;
+    } else if (t > 1) {
+        t = 1;
+    }
+    float scale = AMBIENT_SCALE_QUIET + t * (AMBIENT_SCALE_LOUD - AMBIENT_SCALE_QUIET);
+    float volume = baseVolume * scale;
+    if (volume < minVolume) {
+        volume = minVolume;
+    }
+    if (volume > maxVolume) {
+        volume = maxVolume;
+    }
+    return (uint8_t)(volume + 0.5f);
+}
@@ -0,0 +1,35 @@
+#ifndef AMBIENT_H
+#define AMBIENT_H
+
+#include <stdint.h>
+
+// Ambient loudness from short bursts of microphone samples, and the chime
+// volume it calls for. Each burst gives one RMS level (DC removed) in dB
+// relative to ADC full scale; levels are smoothed with a fast attack, so a
+// busy hallway is picked up quickly, and a slow release.
+#define AMBIENT_FULL_SCALE 2048.0       // Half the 12-bit ADC range
+#define AMBIENT_FLOOR_DB -80.0          // Reported for silence
+#define AMBIENT_ATTACK 0.5              // Smoothing weight of a burst louder than the level
+#define AMBIENT_RELEASE 0.05            // ... and of a quieter one (~5 s at 4 bursts per second)
+#define AMBIENT_QUIET_DB -55.0          // At or below this the chime plays at its lowest scale
+#define AMBIENT_LOUD_DB -25.0           // At or above this the chime plays at its highest scale
+#define AMBIENT_SCALE_QUIET 0.5         // Volume factor at AMBIENT_QUIET_DB
+#define AMBIENT_SCALE_LOUD 1.5          // Volume factor at AMBIENT_LOUD_DB
+
+/// @brief Smoothed loudness
+struct AmbientEstimator {
+    float levelDb;                      ///< Smoothed level, valid once bursts > 0
+    float lastBurstDb;
+    unsigned long bursts;
+};
+
+/// @brief Reset the estimate
+void ambientBegin(AmbientEstimator& estimator);
+
+/// @brief Fold one burst of raw 12-bit samples into the estimate; returns the burst level
+float ambientBurst(AmbientEstimator& estimator, const uint16_t* samples, int count);
+
+/// @brief Scale a configured volume for the ambient level, clamped to [minVolume, maxVolume]
+uint8_t ambientVolume(float levelDb, uint8_t baseVolume, uint8_t minVolume, uint8_t maxVolume);
+
+#endif // AMBIENT_H
@@ -0,0 +1,143 @@
+#ifndef CBOR_LITE_H
+#define CBOR_LITE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// The subset of CBOR (RFC 8949) used by the generated schema codecs:
+// unsigned integers (major type 0), text strings (3) and definite arrays (4).
+// Nothing is allocated; writers stop at the end of the buffer and flag overflow,
+// readers flag any malformed or out-of-range item.
+
+#define CBOR_MAJOR_UINT 0
+#define CBOR_MAJOR_TEXT 3
+#define CBOR_MAJOR_ARRAY 4
+
+struct CborWriter {
+    uint8_t* buf;
+    size_t cap;
+    size_t pos;
+    bool overflow;
+};
+
+struct CborReader {
+    const uint8_t* buf;
+    size_t len;
+    size_t pos;
+    bool error;
+};
+
+inline void cborPutHead(CborWriter& w, uint8_t major, uint64_t value) {
+    uint8_t head[9];
+    size_t n;
+    uint8_t type = major << 5;
+    if (value < 24) {
+        head[0] = type | (uint8_t)value;
+        n = 1;
+    } else if (value <= 0xFF) {
+        head[0] = type | 24;
+        n = 2;
+    } else if (value <= 0xFFFF) {
+        head[0] = type | 25;
+        n = 3;
+    } else if (value <= 0xFFFFFFFFULL) {
+        head[0] = type | 26;
+        n = 5;
+    } else {
+        head[0] = type | 27;
+        n = 9;
+    }
+    // Big-endian argument after the initial byte
+    for (size_t i = n - 1; i > 0; i--) {
+        head[i] = (uint8_t)value;
+        value >>= 8;
+    }
+    if (w.pos + n > w.cap) {
+        w.overflow = true;
+        return;
+    }
+    memcpy(w.buf + w.pos, head, n);
+    w.pos += n;
+}
+
+inline void cborPutUint(CborWriter& w, uint64_t value) {
+    cborPutHead(w, CBOR_MAJOR_UINT, value);
+}
+
+inline void cborPutArray(CborWriter& w, size_t count) {
+    cborPutHead(w, CBOR_MAJOR_ARRAY, count);
+}
+
+inline void cborPutText(CborWriter& w, const char* text, size_t maxLen) {
+    size_t n = strnlen(text, maxLen);
+    cborPutHead(w, CBOR_MAJOR_TEXT, n);
+    if (w.overflow || w.pos + n > w.cap) {
+        w.overflow = true;
+        return;
+    }
+    memcpy(w.buf + w.pos, text, n);
+    w.pos += n;
+}
+
+inline bool cborGetHead(CborReader& r, uint8_t major, uint64_t& value) {
+    if (r.error || r.pos >= r.len || (r.buf[r.pos] >> 5) != major) {
+        r.error = true;
+        return false;
+    }
+    uint8_t info = r.buf[r.pos++] & 0x1F;
+    if (info < 24) {
+        value = info;
+        return true;
+    }
+    size_t n = info == 24 ? 1 : info == 25 ? 2 : info == 26 ? 4 : info == 27 ? 8 : 0;
+    if (n == 0 || r.pos + n > r.len) {
+        r.error = true;  // Indefinite lengths and reserved values are not part of the profile
+        return false;
+    }
+    value = 0;
+    for (size_t i = 0; i < n; i++) {
+        value = (value << 8) | r.buf[r.pos++];
+    }
+    return true;
+}
+
+inline uint64_t cborGetUint(CborReader& r, uint64_t max) {
+    uint64_t value = 0;
+    if (cborGetHead(r, CBOR_MAJOR_UINT, value) && value > max) {
+        r.error = true;
+    }
+    return value;
+}
+
+// Copy a text string into a fixed buffer; too long for the buffer is an error
+inline void cborGetText(CborReader& r, char* out, size_t size) {
+    uint64_t n = 0;
+    out[0] = '\0';
+    if (!cborGetHead(r, CBOR_MAJOR_TEXT, n)) {
+        return;
+    }
+    if (n >= size || r.pos + n > r.len) {
+        r.error = true;
+        return;
+    }
+    memcpy(out, r.buf + r.pos, n);
+    out[n] = '\0';
+    r.pos += n;
+}
+
+// Skip a trailing field appended by a newer schema version
+inline void cborSkip(CborReader& r) {
+    uint64_t value = 0;
+    if (r.pos < r.len && (r.buf[r.pos] >> 5) == CBOR_MAJOR_TEXT) {
+        if (cborGetHead(r, CBOR_MAJOR_TEXT, value) && r.pos + value <= r.len) {
+            r.pos += value;
+        } else {
+            r.error = true;
+        }
+    } else {
+        cborGetHead(r, CBOR_MAJOR_UINT, value);
+    }
+}
+
+#endif // CBOR_LITE_H
@@ -0,0 +1,230 @@
+// Generated by scripts/gen_schema.py from schema/doorbell.json - do not edit
+#ifndef DOORBELL_SCHEMA_H
+#define DOORBELL_SCHEMA_H
+
+#include "cbor_lite.h"
+
+#define SCHEMA_VERSION 1
+#define SCHEMA_TOPIC_PREFIX "doorbell/cbor/"
+#define SCHEMA_CMD_TOPIC "doorbell/cbor/cmd"
+#define SCHEMA_MAX_MESSAGE_SIZE 49
+
+enum SchemaMessageId : uint8_t {
+    MSG_BUTTON_EVENT = 1,
+    MSG_TIMER_STATUS = 2,
+    MSG_TIMER_SET = 16,
+    MSG_PLAY = 17,
+    MSG_SIMULATE = 18,
+};
+
+// ButtonEvent: doorbell/event (out)
+enum {BUTTON_EVENT_BUTTON_DOWNSTAIRS, BUTTON_EVENT_BUTTON_DOOR};
+#define BUTTON_EVENT_BUTTON_COUNT 2
+static const char* const ButtonEvent_button_names[] = {"downstairs", "door"};
+enum {BUTTON_EVENT_STATUS_PLAYED, BUTTON_EVENT_STATUS_DROPPED, BUTTON_EVENT_STATUS_QUEUED, BUTTON_EVENT_STATUS_COALESCED, BUTTON_EVENT_STATUS_ESCALATED, BUTTON_EVENT_STATUS_INTERRUPTED, BUTTON_EVENT_STATUS_SUPPRESSED};
+#define BUTTON_EVENT_STATUS_COUNT 7
+static const char* const ButtonEvent_status_names[] = {"played", "dropped", "queued", "coalesced", "escalated", "interrupted", "suppressed"};
+struct ButtonEventMsg {
+    uint8_t button;
+    uint8_t status;
+    uint16_t track;
+    uint8_t volume;
+    uint16_t count;
+    char press_id[17];
+    uint64_t t_press;
+    uint64_t ts;
+};
+
+inline size_t encodeButtonEvent(const ButtonEventMsg& msg, uint8_t* buf, size_t cap) {
+    CborWriter w = {buf, cap, 0, false};
+    cborPutArray(w, 9);
+    cborPutUint(w, MSG_BUTTON_EVENT);
+    cborPutUint(w, msg.button);
+    cborPutUint(w, msg.status);
+    cborPutUint(w, msg.track);
+    cborPutUint(w, msg.volume);
+    cborPutUint(w, msg.count);
+    cborPutText(w, msg.press_id, 16);
+    cborPutUint(w, msg.t_press);
+    cborPutUint(w, msg.ts);
+    return w.overflow ? 0 : w.pos;
+}
+
+inline bool decodeButtonEvent(const uint8_t* buf, size_t len, ButtonEventMsg& msg) {
+    CborReader r = {buf, len, 0, false};
+    uint64_t items = 0;
+    if (!cborGetHead(r, CBOR_MAJOR_ARRAY, items) || items < 9 ||
+        cborGetUint(r, 0xFF) != MSG_BUTTON_EVENT) {
+        return false;
+    }
+    msg.button = cborGetUint(r, 0x1ULL);
+    msg.status = cborGetUint(r, 0x6ULL);
+    msg.track = cborGetUint(r, 0xffffULL);
+    msg.volume = cborGetUint(r, 0xffULL);
+    msg.count = cborGetUint(r, 0xffffULL);
+    cborGetText(r, msg.press_id, sizeof(msg.press_id));
+    msg.t_press = cborGetUint(r, 0xffffffffffffffffULL);
+    msg.ts = cborGetUint(r, 0xffffffffffffffffULL);
+    for (uint64_t i = 9; i < items && !r.error; i++) {
+        cborSkip(r);
+    }
+    return !r.error;
+}
+
+// TimerStatus: doorbell/timer/status (out)
+enum {TIMER_STATUS_STATUS_STARTED, TIMER_STATUS_STATUS_ENDED, TIMER_STATUS_STATUS_STOPPED, TIMER_STATUS_STATUS_ERROR};
+#define TIMER_STATUS_STATUS_COUNT 4
+static const char* const TimerStatus_status_names[] = {"started", "ended", "stopped", "error"};
+struct TimerStatusMsg {
+    uint8_t status;
+    uint32_t seconds;
+    uint16_t track;
+    uint8_t volume;
+    char message[33];
+};
+
+inline size_t encodeTimerStatus(const TimerStatusMsg& msg, uint8_t* buf, size_t cap) {
+    CborWriter w = {buf, cap, 0, false};
+    cborPutArray(w, 6);
+    cborPutUint(w, MSG_TIMER_STATUS);
+    cborPutUint(w, msg.status);
+    cborPutUint(w, msg.seconds);
+    cborPutUint(w, msg.track);
+    cborPutUint(w, msg.volume);
+    cborPutText(w, msg.message, 32);
+    return w.overflow ? 0 : w.pos;
+}
+
+inline bool decodeTimerStatus(const uint8_t* buf, size_t len, TimerStatusMsg& msg) {
+    CborReader r = {buf, len, 0, false};
+    uint64_t items = 0;
+    if (!cborGetHead(r, CBOR_MAJOR_ARRAY, items) || items < 6 ||
+        cborGetUint(r, 0xFF) != MSG_TIMER_STATUS) {
+        return false;
+    }
+    msg.status = cborGetUint(r, 0x3ULL);
+    msg.seconds = cborGetUint(r, 0xffffffffULL);
+    msg.track = cborGetUint(r, 0xffffULL);
+    msg.volume = cborGetUint(r, 0xffULL);
+    cborGetText(r, msg.message, sizeof(msg.message));
+    for (uint64_t i = 6; i < items && !r.error; i++) {
+        cborSkip(r);
+    }
+    return !r.error;
+}
+
+// TimerSet: doorbell/timer/set (in)
+struct TimerSetMsg {
+    uint32_t seconds;
+    uint16_t track;
+    uint8_t volume;
+};
+
+inline size_t encodeTimerSet(const TimerSetMsg& msg, uint8_t* buf, size_t cap) {
+    CborWriter w = {buf, cap, 0, false};
+    cborPutArray(w, 4);
+    cborPutUint(w, MSG_TIMER_SET);
+    cborPutUint(w, msg.seconds);
+    cborPutUint(w, msg.track);
+    cborPutUint(w, msg.volume);
+    return w.overflow ? 0 : w.pos;
+}
+
+inline bool decodeTimerSet(const uint8_t* buf, size_t len, TimerSetMsg& msg) {
+    CborReader r = {buf, len, 0, false};
+    uint64_t items = 0;
+    if (!cborGetHead(r, CBOR_MAJOR_ARRAY, items) || items < 4 ||
+        cborGetUint(r, 0xFF) != MSG_TIMER_SET) {
+        return false;
+    }
+    msg.seconds = cborGetUint(r, 0xffffffffULL);
+    msg.track = cborGetUint(r, 0xffffULL);
+    msg.volume = cborGetUint(r, 0xffULL);
+    for (uint64_t i = 4; i < items && !r.error; i++) {
+        cborSkip(r);
+    }
+    return !r.error;
+}
+
+// Play: doorbell/play (in)
+struct PlayMsg {
+    uint16_t track;
+    uint8_t volume;
+};
+
+inline size_t encodePlay(const PlayMsg& msg, uint8_t* buf, size_t cap) {
+    CborWriter w = {buf, cap, 0, false};
+    cborPutArray(w, 3);
+    cborPutUint(w, MSG_PLAY);
+    cborPutUint(w, msg.track);
+    cborPutUint(w, msg.volume);
+    return w.overflow ? 0 : w.pos;
+}
+
+inline bool decodePlay(const uint8_t* buf, size_t len, PlayMsg& msg) {
+    CborReader r = {buf, len, 0, false};
+    uint64_t items = 0;
+    if (!cborGetHead(r, CBOR_MAJOR_ARRAY, items) || items < 3 ||
+        cborGetUint(r, 0xFF) != MSG_PLAY) {
+        return false;
+    }
+    msg.track = cborGetUint(r, 0xffffULL);
+    msg.volume = cborGetUint(r, 0xffULL);
+    for (uint64_t i = 3; i < items && !r.error; i++) {
+        cborSkip(r);
+    }
+    return !r.error;
+}
+
+// Simulate: doorbell/simulate (in)
+enum {SIMULATE_BUTTON_DOWNSTAIRS, SIMULATE_BUTTON_DOOR};
+#define SIMULATE_BUTTON_COUNT 2
+static const char* const Simulate_button_names[] = {"downstairs", "door"};
+struct SimulateMsg {
+    uint8_t button;
+};
+
+inline size_t encodeSimulate(const SimulateMsg& msg, uint8_t* buf, size_t cap) {
+    CborWriter w = {buf, cap, 0, false};
+    cborPutArray(w, 2);
+    cborPutUint(w, MSG_SIMULATE);
+    cborPutUint(w, msg.button);
+    return w.overflow ? 0 : w.pos;
+}
+
+inline bool decodeSimulate(const uint8_t* buf, size_t len, SimulateMsg& msg) {
+    CborReader r = {buf, len, 0, false};
+    uint64_t items = 0;
+    if (!cborGetHead(r, CBOR_MAJOR_ARRAY, items) || items < 2 ||
+        cborGetUint(r, 0xFF) != MSG_SIMULATE) {
+        return false;
+    }
+    msg.button = cborGetUint(r, 0x1ULL);
+    for (uint64_t i = 2; i < items && !r.error; i++) {
+        cborSkip(r);
+    }
+    return !r.error;
+}
+
+// Message id of an encoded message, -1 if it is not a schema message
+inline int schemaMessageId(const uint8_t* buf, size_t len) {
+    CborReader r = {buf, len, 0, false};
+    uint64_t items = 0;
+    if (!cborGetHead(r, CBOR_MAJOR_ARRAY, items) || items < 1) {
+        return -1;
+    }
+    uint64_t id = cborGetUint(r, 0xFF);
+    return r.error ? -1 : (int)id;
+}
+
+// Index of a name in a generated enum table, -1 if unknown
+inline int schemaEnumIndex(const char* const* names, int count, const char* name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+#endif // DOORBELL_SCHEMA_H
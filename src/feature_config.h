@@ -0,0 +1,33 @@
+#ifndef FEATURE_CONFIG_H
+#define FEATURE_CONFIG_H
+
+// Optional feature modules, all on unless a PlatformIO environment turns one
+// off with -DFEATURE_<NAME>=0 in build_flags. The environment should also drop
+// the module's source file with build_src_filter (see platformio.ini) so its
+// code and static tables stay out of the image. The Config layout does not
+// change with the selection, so any variant can be flashed over any other.
+#ifndef FEATURE_FALLBACK_BROKER
+#define FEATURE_FALLBACK_BROKER 1   // LAN MQTT broker during upstream outages (mini_broker.cpp)
+#endif
+#ifndef FEATURE_RECORDER
+#define FEATURE_RECORDER 1          // Inbound traffic recorder and replay (recorder.cpp)
+#endif
+#ifndef FEATURE_NOTIFIER
+#define FEATURE_NOTIFIER 1          // Direct push over HTTPS (notifier.cpp, pulls in HTTPClient and TLS)
+#endif
+#ifndef FEATURE_AMBIENT
+#define FEATURE_AMBIENT 1           // Ambient-noise chime volume (ambient.cpp)
+#endif
+
+// Opt-in: upstream MQTT 5 client (mqtt5.cpp, mqtt5_client.cpp) instead of
+// PubSubClient's 3.1.1; needs a broker that speaks MQTT 5
+#ifndef FEATURE_MQTT5
+#define FEATURE_MQTT5 0
+#endif
+
+// Name of the build, reported in doorbell/status
+#ifndef FIRMWARE_VARIANT
+#define FIRMWARE_VARIANT "custom"
+#endif
+
+#endif // FEATURE_CONFIG_H
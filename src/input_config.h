@@ -1,36 +1,64 @@
 #ifndef INPUT_CONFIG_H
 #define INPUT_CONFIG_H
 
-// Input mode selection (uncomment only one)
-// #define INPUT_MODE_DIGITAL
+// Input mode selection: -DINPUT_MODE_DIGITAL or -DINPUT_MODE_ANALOG in the
+// PlatformIO environment's build_flags; analog when neither is given
+#if !defined(INPUT_MODE_DIGITAL) && !defined(INPUT_MODE_ANALOG)
 #define INPUT_MODE_ANALOG
+#endif
 
 // ADC Configuration
 #ifdef INPUT_MODE_ANALOG
+    #include "session_features.h"
+    
     #define MIN_SESSION_DURATION 200    // Minimum valid session duration in ms
     #define ADC_THRESHOLD 3.0          // Voltage threshold for button detection (3.0V)
     #define ADC_HYSTERESIS 0.3         // Voltage hysteresis to prevent bouncing (0.3V)
-    #define ADC_SAMPLE_INTERVAL 5      // How often to sample ADC in milliseconds
+    #define ADC_SAMPLE_INTERVAL 5      // How often to sample ADC in milliseconds near/inside a session
+    #define ADC_IDLE_SAMPLE_INTERVAL 20 // How often to sample ADC while both lines are idle; an edge is dated within half of it,
+                                        // no worse than the fixed 10 ms loop sampled before (bench/sampler_bench.cpp)
+    #define ADC_APPROACH_LEVEL 2.0     // Voltage on either line that switches to the fast rate
+    #define ADC_FAST_HOLD_MS 1000      // Stay at the fast rate this long after the last approach/session
     #define MAX_SESSION_SAMPLES 1000   // Maximum number of samples per session
     #define ADC_DROPOUT_TOLERANCE 15   // Maximum time in ms to tolerate voltage drops
     
-    /// @brief Structure to store a single ADC reading with voltage values and visualization
+    #define SESSION_DUMP_CHUNK 32      // Readings per doorbell/session/dump message
+    
+    /// @brief Structure to store a single ADC reading with voltage values
     struct ADCReading {
         float voltage1;                 ///< Voltage reading from ADC1 (0-3.3V)
         float voltage2;                 ///< Voltage reading from ADC2 (0-3.3V)
         unsigned long delta;            ///< Time since session start in milliseconds
-        char graph[42];                ///< ANSI-colored bar graph representation (41 chars + null)
     };
     
-    /// @brief Structure to store complete session data including all readings
+    #define SESSION_POOL_SIZE 4        // Number of session descriptors sharing the sample arena
+    #define SESSION_ARENA_SAMPLES MAX_SESSION_SAMPLES  // Readings shared by all in-flight sessions
+    
+    /// @brief Lifecycle of a session descriptor in the pool
+    enum SessionState : uint8_t {
+        SESSION_FREE = 0,               ///< Descriptor is unused
+        SESSION_CAPTURING,              ///< Samples are being appended by checkADC()
+        SESSION_READY                   ///< Capture finished, waiting for background analysis
+    };
+    
+    /// @brief Structure to store complete session data; readings live in the shared sample arena
     struct ADCSession {
+        unsigned long id;               ///< Sequence number, shared by the summary and dump messages
         unsigned long startTime;        ///< Session start timestamp
         unsigned long endTime;          ///< Session end timestamp
-        bool isActive;                  ///< Whether session is currently active
         float maxVoltage;              ///< Maximum voltage recorded during session
         int buttonDetected;            ///< Which button was detected (-1=none, 0=DOWNSTAIRS, 1=DOOR)
         int numReadings;               ///< Number of readings stored in the session
-        struct ADCReading readings[MAX_SESSION_SAMPLES];  ///< Array of all readings during session
+        int firstReading;              ///< Arena index of the first reading (wraps around the arena)
+        SessionFeatures features;      ///< Summary features, updated with every reading
+        bool dump;                     ///< Publish the raw readings (requested through doorbell/get/session_dump)
+        volatile SessionState state;   ///< Current lifecycle state of this descriptor
+    };
+    
+    /// @brief Result handed back from the analysis task to the main loop
+    struct SessionResult {
+        int slot;                       ///< Index of the analyzed descriptor in the session pool
+        int button;                     ///< Button to trigger (-1=none, 0=DOWNSTAIRS, 1=DOOR)
     };
 #endif
 
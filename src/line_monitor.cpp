@@ -0,0 +1,99 @@
+#include "line_monitor.h"
+#include <math.h>
+#include <string.h>
+
+static const char* const faultNames[LINE_FAULT_COUNT] = {"ok", "drift", "stuck_low", "noisy", "stuck_high"};
+
+void lineMonitorBegin(LineMonitor& line, unsigned long now) {
+    memset(&line, 0, sizeof(LineMonitor));
+    line.startedAt = now;
+    line.idleLevel = -1.0;  // Seeded by the first idle sample
+    line.lastVoltage = -1.0;
+    lineMonitorResetWindow(line);
+}
+
+void lineMonitorResetWindow(LineMonitor& line) {
+    line.windowMin = 99.0;
+    line.windowMax = -1.0;
+}
+
+const char* lineFaultName(LineFault fault) {
+    return fault < LINE_FAULT_COUNT ? faultNames[fault] : "unknown";
+}
+
+// The fault the statistics point to right now, most severe first
+static LineFault detectFault(const LineMonitor& line, unsigned long now) {
+    if (line.high && now - line.highSince >= LINE_STUCK_HIGH_MS) {
+        return LINE_STUCK_HIGH;
+    }
+    if (line.noise > LINE_NOISE_V) {
+        return LINE_NOISY;
+    }
+    if (line.learned && line.learnedLevel >= LINE_IDLE_MIN_V &&
+        line.grounded && now - line.groundSince >= LINE_STUCK_LOW_MS) {
+        return LINE_STUCK_LOW;
+    }
+    if (line.learned && fabsf(line.idleLevel - line.learnedLevel) > LINE_DRIFT_V) {
+        return LINE_DRIFT;
+    }
+    return LINE_OK;
+}
+
+bool lineMonitorUpdate(LineMonitor& line, float voltage, float threshold, float releaseLevel, unsigned long now) {
+    line.samples++;
+    if (voltage < line.windowMin) {
+        line.windowMin = voltage;
+    }
+    if (voltage > line.windowMax) {
+        line.windowMax = voltage;
+    }
+
+    // Runs above the threshold and at ground
+    bool high = voltage >= threshold;
+    if (high && !line.high) {
+        line.highSince = now;
+    }
+    line.high = high;
+    bool grounded = voltage < LINE_GROUND_V;
+    if (grounded && !line.grounded) {
+        line.groundSince = now;
+    }
+    line.grounded = grounded;
+
+    // Idle level and jitter only from idle samples, so the edges of a press do
+    // not count as noise; a floating line still jumps around inside the idle band
+    if (voltage < releaseLevel) {
+        if (line.idleLevel < 0) {
+            line.idleLevel = voltage;
+        } else {
+            line.idleLevel += LINE_IDLE_ALPHA * (voltage - line.idleLevel);
+        }
+        if (line.lastVoltage >= 0 && line.lastVoltage < releaseLevel) {
+            line.noise += LINE_NOISE_ALPHA * (fabsf(voltage - line.lastVoltage) - line.noise);
+        }
+    }
+    line.lastVoltage = voltage;
+
+    if (!line.learned && now - line.startedAt >= LINE_IDLE_LEARN_MS && line.idleLevel >= 0) {
+        line.learned = true;
+        line.learnedLevel = line.idleLevel;
+    }
+
+    LineFault detected = detectFault(line, now);
+    if (detected != LINE_OK) {
+        line.lastBadAt = now;
+        if (detected > line.fault) {
+            line.fault = detected;
+            line.raised[detected]++;
+            line.quarantined = detected >= LINE_NOISY;
+            return true;
+        }
+        return false;
+    }
+    if (line.fault != LINE_OK && now - line.lastBadAt >= LINE_RECOVER_MS) {
+        line.fault = LINE_OK;
+        line.quarantined = false;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,67 @@
+#ifndef LINE_MONITOR_H
+#define LINE_MONITOR_H
+
+#include <stdint.h>
+
+// Continuous health statistics for one analog doorbell line. Every ADC sample
+// is fed in; a line that is shorted high or floating is quarantined so it can
+// no longer start sessions, and released once it has looked healthy for a while.
+#define LINE_STUCK_HIGH_MS 30000        // Above the trigger threshold this long is a short, not a press
+                                        // (6x the longest session, MAX_SESSION_SAMPLES x ADC_SAMPLE_INTERVAL)
+#define LINE_STUCK_LOW_MS 600000        // Pinned to ground this long, on a line that idles above it
+#define LINE_GROUND_V 0.05              // Readings below this count as pinned to ground
+#define LINE_IDLE_LEARN_MS 60000        // The idle level is learned over this long after boot
+#define LINE_IDLE_MIN_V 0.2             // Learned idle level needed before ground counts as a fault
+#define LINE_IDLE_ALPHA 0.001           // EWMA weight of the idle level (1000 samples, ~20 s at the 20 ms idle interval)
+#define LINE_DRIFT_V 0.5                // Idle level moved this far from the learned level
+#define LINE_NOISE_ALPHA 0.02           // EWMA weight of the sample-to-sample jitter
+#define LINE_NOISE_V 0.25               // Idle jitter above this means a floating or noisy line
+#define LINE_RECOVER_MS 30000           // Fault condition absent this long clears the fault
+
+/// @brief Line faults, in increasing severity
+enum LineFault : uint8_t {
+    LINE_OK = 0,
+    LINE_DRIFT,                 ///< Idle level moved away from the learned one (reported only)
+    LINE_STUCK_LOW,             ///< Pinned to ground, presses cannot be seen (reported only)
+    LINE_NOISY,                 ///< Idle jitter too high, e.g. an open wire (quarantined)
+    LINE_STUCK_HIGH,            ///< Above the trigger threshold far longer than a press (quarantined)
+    LINE_FAULT_COUNT
+};
+
+/// @brief Running statistics and fault state of one line
+struct LineMonitor {
+    float idleLevel;            ///< Slow average while below the release level
+    float learnedLevel;         ///< idleLevel at the end of the learning period
+    float noise;                ///< Average absolute change between idle samples
+    float lastVoltage;
+    float windowMin;            ///< Extremes since lineMonitorResetWindow()
+    float windowMax;
+    unsigned long startedAt;
+    unsigned long highSince;    ///< Start of the current run above the threshold
+    unsigned long groundSince;  ///< Start of the current run at ground
+    unsigned long lastBadAt;    ///< Last sample where a fault condition held
+    unsigned long samples;
+    unsigned long raised[LINE_FAULT_COUNT];  ///< Times each fault was raised
+    bool learned;
+    bool high;
+    bool grounded;
+    LineFault fault;
+    bool quarantined;
+};
+
+/// @brief Reset all statistics; learning starts at now
+void lineMonitorBegin(LineMonitor& line, unsigned long now);
+
+/// @brief Feed one sample
+/// @param threshold Voltage that starts a session
+/// @param releaseLevel Voltage below which the line counts as idle
+/// @return true when the fault or quarantine state changed
+bool lineMonitorUpdate(LineMonitor& line, float voltage, float threshold, float releaseLevel, unsigned long now);
+
+/// @brief Start a new min/max reporting window
+void lineMonitorResetWindow(LineMonitor& line);
+
+/// @brief Lower-case fault name for MQTT messages
+const char* lineFaultName(LineFault fault);
+
+#endif // LINE_MONITOR_H
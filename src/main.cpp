@@ -1,6 +1,5 @@
 #include <Arduino.h>
 #include <WiFi.h>
-#include <PubSubClient.h>
 #include <DFRobotDFPlayerMini.h>
 #include <ArduinoJson.h>
 #include <EEPROM.h>
@@ -10,8 +9,30 @@
 #include "esp_task_wdt.h"
 #include "esp_pm.h"
 #include "esp_wifi.h"
+#include "driver/rmt.h"
+#include "driver/pcnt.h"
 #include "config.h"
 #include "input_config.h"
+#include "feature_config.h"
+#if FEATURE_MQTT5
+#include "mqtt5_client.h"
+#endif
+#include <PubSubClient.h>             // Main connection without FEATURE_MQTT5, pair lease connection always
+#include "rule_vm.h"
+#include "notifier.h"
+#include "doorbell_schema.h"
+#include "mini_broker.h"
+#include "mqtt_connect.h"
+#include "line_monitor.h"
+#include "adc_sampler.h"
+#include "recorder.h"
+#include "outputs.h"
+#include "ambient.h"
+#include "actuation.h"
+#include "maintenance.h"
+#include "pulse_decoder.h"
+#include "pair.h"
+#include "mdns.h"
 
 // Debug macros
 #ifdef DEBUG_ENABLE
@@ -28,6 +49,26 @@
     #define MQTT_DEBUG_F(...)
 #endif
 
+// Clock used for local time in automation rules (override in config.h)
+#ifndef NTP_SERVER
+#define NTP_SERVER "pool.ntp.org"
+#endif
+#ifndef TIME_ZONE
+#define TIME_ZONE "UTC0"             // POSIX TZ string, e.g. "CET-1CEST,M3.5.0,M10.5.0/3"
+#endif
+#define CLOCK_VALID_EPOCH 1600000000 // Earlier wall-clock times mean SNTP has not synced yet
+
+#define CODEC_BENCH_ITERATIONS 200   // Messages per codec in doorbell/get/codec_bench
+
+// Fallback broker for LAN clients while the upstream broker is unreachable
+#define BROKER_FALLBACK_DELAY_MS 60000  // Upstream must be down this long before the broker starts
+#define BROKER_IDLE_STOP_MS 60000       // After upstream returns, stop once no LAN client is left this long
+#define BROKER_HANDBACK_MAX_MS 300000   // ... or this long after it returned, closing the clients left
+#define BROKER_READ_CHUNKS 4            // Reads of up to 128 bytes per client per loop
+#define OUTAGE_QUEUE_SIZE 16            // Messages held for upstream during an outage
+#define OUTAGE_TOPIC_SIZE 64
+#define OUTAGE_PAYLOAD_SIZE 256
+
 // Pin definitions
 const int BUTTON_DOWNSTAIRS = 27;  // GPIO27 for downstairs button
 const int BUTTON_DOOR = 14;         // GPIO14 for door button
@@ -39,10 +80,105 @@ const int ADC_PIN2 = 33;           // GPIO33 for ADC reading
 const int DOOR_RELAY = 4;          // GPIO4 for front door relay control
 // Built-in LED pin is already defined in framework
 
+// Optional outputs, -1 = not fitted (override in config.h)
+#ifndef GATE_RELAY_PIN
+#define GATE_RELAY_PIN -1
+#endif
+#ifndef HALL_LIGHT_PIN
+#define HALL_LIGHT_PIN -1
+#endif
+#ifndef EXTERNAL_BELL_PIN
+#define EXTERNAL_BELL_PIN -1
+#endif
+#define OUTPUT_PWM_FREQ 5000         // LEDC frequency for dimmable outputs
+#define OUTPUT_PWM_BITS 8            // LEDC resolution, matches the 0-255 output levels
+#define EXTERNAL_BELL_PULSE_MS 500   // Strike of the external chime on every ring
+
+// Optional ambient microphone (electret + preamp, biased to mid-rail), -1 = not fitted.
+// Must be an ADC1 pin (32-39): ADC2 cannot be read while WiFi is on.
+#ifndef AMBIENT_MIC_PIN
+#define AMBIENT_MIC_PIN -1
+#endif
+#define AMBIENT_BURST_SAMPLES 128      // Samples per loudness burst (~13 ms at the analogRead rate)
+#define AMBIENT_BURST_INTERVAL_MS 250  // Time between bursts
+#define AMBIENT_CHIME_HOLDOFF_MS 1000  // Bursts skipped after a chime so it does not raise its own volume
+
+// Optional door relay feedback, -1 = not fitted (override in config.h).
+// Current mode: strike current sense on an ADC1 pin. Contact mode: door contact to GND,
+// closed while the door is shut (the pin is pulled up, so open reads HIGH).
+#ifndef DOOR_FEEDBACK_PIN
+#define DOOR_FEEDBACK_PIN -1
+#endif
+#ifndef DOOR_FEEDBACK_MODE
+#define DOOR_FEEDBACK_MODE FEEDBACK_CURRENT
+#endif
+#ifndef DOOR_FEEDBACK_THRESHOLD
+#define DOOR_FEEDBACK_THRESHOLD 600    // Raw 12-bit ADC level that means strike current flows
+#endif
+#define DOOR_FEEDBACK_DEBOUNCE 3       // Consecutive asserted samples that confirm
+#define DOOR_FEEDBACK_SAMPLE_MS 1      // Sampling period while an actuation is verified
+#define DOOR_CURRENT_CONFIRM_MS 300    // Current must flow this soon after energizing (current mode)
+#define DOOR_RETRY_MAX 2               // Retry pulses after a failed attempt
+
+// Optional pulse-coded intercom line, -1 = not fitted (override in config.h).
+// The RMT peripheral captures edge timings and PCNT counts pulses in hardware;
+// the CPU only sees finished frames. PULSE_CODES maps {pulses, long-pulse mask,
+// button} with button 0 = downstairs, 1 = door. A frame ends after
+// PULSE_FRAME_GAP_US without an edge, so every pulse and gap must be shorter.
+#ifndef PULSE_INPUT_PIN
+#define PULSE_INPUT_PIN -1
+#endif
+#ifndef PULSE_ACTIVE_LEVEL
+#define PULSE_ACTIVE_LEVEL 1           // Line level during a pulse
+#endif
+#ifndef PULSE_CODES
+#define PULSE_CODES {1, 0x0, 0}, {2, 0x0, 1}
+#endif
+#ifndef PULSE_LONG_US
+#define PULSE_LONG_US 60000            // Pulses at least this long are long
+#endif
+#ifndef PULSE_GLITCH_US
+#define PULSE_GLITCH_US 1000           // Shorter levels are bounce or noise
+#endif
+#define PULSE_MAX_US 200000            // Longest pulse that can be part of a code
+#define PULSE_FRAME_GAP_US 250000      // Idle time that ends a frame
+#define PULSE_TICK_US 10               // RMT resolution (1 MHz REF_TICK / 10); 15-bit durations reach 327 ms
+#define PULSE_RMT_CHANNEL RMT_CHANNEL_0
+#define PULSE_PCNT_UNIT PCNT_UNIT_0
+#define PULSE_PCNT_LIMIT 32767         // PCNT wraps to 0 here
+#define PULSE_QUEUE_DEPTH 4            // Decoded frames waiting for the loop task
+
+// Optional redundant pair: two units on the same inputs, one rings and talks to
+// the broker, the other stands by with a warm copy of its state (src/pair.h).
+// Both units need the same port and the same PAIR_KEY, -1 = single unit
+// (override in config.h). The higher priority claims first when both start together.
+#ifndef PAIR_UDP_PORT
+#define PAIR_UDP_PORT -1
+#endif
+#ifndef PAIR_PRIORITY
+#define PAIR_PRIORITY 0
+#endif
+#ifndef PAIR_KEY
+#if PAIR_UDP_PORT >= 0
+#error "PAIR_UDP_PORT needs PAIR_KEY, a secret shared by both units (config.h)"
+#endif
+#define PAIR_KEY ""
+#endif
+#define PAIR_MAX_CATCHUPS 4            // Missed presses a new active unit rings in one go
+#define PAIR_CATCHUP_HOLD_MS 5000      // Longest wait for the broker before ringing them anyway
+#define PAIR_LEASE_TOPIC "doorbell/pair/lease"
+#define PAIR_LEASE_CONNECT_MS 250      // Lease connection attempts stay well inside PAIR_LEASE_MS
+#define PAIR_LEASE_RETRY_MS 5000
+#define PAIR_LEASE_KEEPALIVE_S 5       // The broker publishes the released lease 1.5 keep-alives after a silent death
+
 // EEPROM size and addresses
-#define EEPROM_SIZE 512
+#define EEPROM_SIZE 1024
 #define EEPROM_VALID_ADDR 0
 #define EEPROM_CONFIG_ADDR 1
+#define EEPROM_REVISION_ADDR (EEPROM_SIZE - 1)
+
+// Config layout revision; bump when fields are appended to Config and extend migrateConfig()
+#define CONFIG_REVISION 4
 
 // Configuration structure
 struct Config {
@@ -63,14 +199,32 @@ struct Config {
     uint16_t button_cooldown_ms;   // Cooldown period in milliseconds (default 15000)
     uint16_t volume_reset_ms;      // Time after which volume resets to 0 (default 60000)
     bool debug_enabled;            // MQTT-controlled debug flag
+    // Revision 1
+    uint16_t downstairs_cooldown_ms; // Per-button cooldown in milliseconds
+    uint16_t door_cooldown_ms;
+    uint8_t downstairs_policy;     // PressPolicy applied to repeat/busy presses
+    uint8_t door_policy;
+    // Revision 2
+    char ntfy_url[NOTIFY_URL_SIZE]; // Direct push endpoint (empty = disabled)
+    // Revision 3
+    bool cbor_enabled;             // Publish events and timer status as schema CBOR instead of JSON
+    // Revision 4
+    bool ambient_enabled;          // Scale chime volume with the ambient microphone level
+    uint8_t ambient_min_volume;    // Bounds of the scaled volume in percentage (0-100)
+    uint8_t ambient_max_volume;
 };
 
 Config config;
 
 // Global objects
 WiFiClient espClient;
+#if FEATURE_MQTT5
+Mqtt5PubSub mqtt(espClient);
+#else
 PubSubClient mqtt(espClient);
+#endif
 DFRobotDFPlayerMini dfPlayer;
+char deviceId[24] = "";             // "DoorBell-" and the 48-bit efuse MAC; tags session messages, MQTT 5 client ID
 HardwareSerial dfPlayerSerial(2); // Using UART2
 
 // Global variables for button states and timing
@@ -80,6 +234,7 @@ struct ButtonState {
     unsigned long pressStartTime;
     unsigned long lastValidPressTime;
     bool isValidPress;
+    bool handled;                  // Valid press already dispatched (cleared on release)
 };
 
 ButtonState buttonStates[2];  // Index 0 for DOWNSTAIRS, 1 for DOOR
@@ -91,15 +246,79 @@ unsigned long ledStartTime = 0;
 unsigned long lastAdcRead = 0;      // Timestamp for last ADC reading
 unsigned long currentTime = 0;      // Current time in milliseconds
 unsigned long lastPlaybackCheck = 0;  // New variable to track last playback check
-unsigned long doorRelayStartTime = 0;  // Timestamp when door relay was activated
 unsigned long lastMemoryCheck = 0;  // For memory monitoring
-unsigned long lastWiFiCheck = 0;    // For WiFi stability checking
 unsigned long lastMQTTReconnect = 0; // To prevent rapid MQTT reconnection attempts
-unsigned long lastSystemCheck = 0;  // For system health monitoring
 bool isPlaying = false;
 bool normalLedOn = false;
-bool doorRelayActive = false;       // Flag to track if door relay is currently active
 bool systemStable = true;           // System stability flag
+int lastPlayButton = -1;            // Button that started the current/last chime (-1 = none)
+
+// Time after starting a track before the BUSY pin is trusted to report playback state
+#define PLAYBACK_SETTLE_MS 500
+
+// Presses seen while a chime is playing, dispatched once playback finishes
+struct QueuedPress {
+    bool pending;
+    int count;                      // Presses coalesced into this entry
+    unsigned long firstPressTime;   // Time of the first queued press
+    uint8_t volume;                 // Volume to ring with once dispatched
+    uint32_t pressId;               // Trace id of the first queued press
+    unsigned long pressMillis;      // When the first queued press was detected
+};
+
+QueuedPress queuedPresses[2];  // Index 0 for DOWNSTAIRS, 1 for DOOR
+
+// Per-button policy for presses that cannot simply start a new chime
+enum PressPolicy : uint8_t {
+    POLICY_DROP = 0,        // Ignore repeats within the cooldown
+    POLICY_COALESCE,        // Fold repeats into a "pressed N times" event
+    POLICY_ESCALATE,        // Raise the volume of the ring with each repeat
+    POLICY_INTERRUPT,       // Restart/replace whatever is playing
+    POLICY_COUNT
+};
+
+// What is going on when a press arrives
+enum PressSituation : uint8_t {
+    SITUATION_READY = 0,    // Button is out of cooldown and nothing is playing
+    SITUATION_REPEAT,       // Button is still within its own cooldown
+    SITUATION_BUSY,         // Another chime is playing
+    SITUATION_COUNT
+};
+
+enum PressAction : uint8_t {
+    ACTION_PLAY = 0,
+    ACTION_DROP,
+    ACTION_QUEUE,
+    ACTION_COALESCE,
+    ACTION_ESCALATE,
+    ACTION_INTERRUPT,
+    ACTION_COUNT
+};
+
+// Policy evaluation is a single lookup: policy x situation -> action
+const PressAction policyTable[POLICY_COUNT][SITUATION_COUNT] = {
+    //                 READY        REPEAT            BUSY
+    /* drop      */ { ACTION_PLAY, ACTION_DROP,      ACTION_QUEUE },
+    /* coalesce  */ { ACTION_PLAY, ACTION_COALESCE,  ACTION_QUEUE },
+    /* escalate  */ { ACTION_PLAY, ACTION_ESCALATE,  ACTION_QUEUE },
+    /* interrupt */ { ACTION_PLAY, ACTION_INTERRUPT, ACTION_INTERRUPT },
+};
+
+const char* policyNames[POLICY_COUNT] = {"drop", "coalesce", "escalate", "interrupt"};
+const char* actionNames[ACTION_COUNT] = {"played", "dropped", "queued", "coalesced", "escalated", "interrupted"};
+
+#define ESCALATE_VOLUME_STEP 20     // Volume increase in percent per escalated press
+
+// Per-button ring state used for cooldowns and coalescing
+struct RingState {
+    bool hasRung;                   // lastRingTime is valid
+    unsigned long lastRingTime;     // Start of the button's last chime (cooldown anchor)
+    int pressCount;                 // Presses folded into the current ring
+    uint8_t volume;                 // Volume of the current ring in percent
+};
+
+RingState ringStates[2];  // Index 0 for DOWNSTAIRS, 1 for DOOR
+unsigned long actionCounters[2][ACTION_COUNT];  // Presses handled by each action, per button
 
 // Add structure for pending play requests
 struct PlayRequest {
@@ -117,18 +336,345 @@ struct Timer {
     int volume;
 } timer = {false, 0, 0, 0, 0};
 
+// Topics the device subscribes to upstream; LAN publishes to these run as commands in fallback mode
+const char* const deviceSubscriptions[] = {
+    "doorbell/set/#",           // Set commands (require JSON)
+    "doorbell/get/#",           // Get commands (no JSON)
+    "doorbell/simulate/#",      // Simulation commands (no JSON)
+    "doorbell/play/#",          // Play commands (no JSON)
+    "doorbell/system/#",        // System commands
+    "doorbell/timer/set",       // Timer commands (but not status)
+    "doorbell/timer/stop",
+    "doorbell/command",
+    "doorbell/latency/probe",
+    "doorbell/replay/#",        // Recorder replay control
+    SCHEMA_CMD_TOPIC            // Schema-encoded commands (binary payload)
+};
+const int deviceSubscriptionCount = sizeof(deviceSubscriptions) / sizeof(deviceSubscriptions[0]);
+
+bool fallbackBrokerActive = false;     // Always false without FEATURE_FALLBACK_BROKER
+
+// Redundant pair; a single unit (PAIR_UDP_PORT < 0) is always active
+WiFiUDP pairUdp;
+PairNode pairNode;
+IPAddress pairPeerIp;                   // Unicast once the peer has been heard, broadcast before
+bool pairWarmValid = false;             // Standby: pairWarm has matched the active copy at least once
+int pairSettingsRegion = -1;
+int pairWarmRegion = -1;
+PairPress pairCatchUps[PAIR_MAX_CATCHUPS];  // Presses handed back on a takeover, rung after the reconnect
+int pairCatchUpCount = 0;
+unsigned long pairCatchUpsAt = 0;       // When the first of them was handed back
+unsigned long pairRoleSince = 0;
+// Lease on the primary broker, on a connection of its own so the standby can
+// watch it while the main connection belongs to the active unit
+WiFiClient pairLeaseClient;
+PubSubClient pairLeaseMqtt(pairLeaseClient);
+PairRole pairLeaseRole = PAIR_STANDBY;  // Role the lease connection's last will was set for
+unsigned long pairLeaseAttemptAt = 0;
+
+// Settings a standby unit takes over from the active one; WiFi and broker
+// addresses and credentials stay with each unit and never leave it
+struct PairSettings {
+    uint8_t downstairs_track;
+    uint8_t door_track;
+    uint8_t downstairs_volume;
+    uint8_t door_volume;
+    uint16_t button_cooldown_ms;
+    uint16_t volume_reset_ms;
+    uint16_t downstairs_cooldown_ms;
+    uint16_t door_cooldown_ms;
+    uint8_t downstairs_policy;
+    uint8_t door_policy;
+    bool cbor_enabled;
+    bool ambient_enabled;
+    uint8_t ambient_min_volume;
+    uint8_t ambient_max_volume;
+    char ntfy_url[NOTIFY_URL_SIZE];
+};
+
+PairSettings pairSettings;
+
+// State a standby unit takes over with, kept current by the active unit; times
+// are in the millis() of the unit that wrote it
+struct PairWarmState {
+    Timer timer;
+    RingState rings[2];
+};
+
+PairWarmState pairWarm;
+
+#if FEATURE_FALLBACK_BROKER
+// Message published while upstream was down, replayed when it returns
+struct OutageMessage {
+    char topic[OUTAGE_TOPIC_SIZE];
+    uint8_t payload[OUTAGE_PAYLOAD_SIZE];
+    uint16_t length;
+    bool retain;
+};
+
+WiFiServer brokerServer(BROKER_PORT);
+WiFiClient brokerClients[BROKER_MAX_CLIENTS];
+bool brokerSlotOpen[BROKER_MAX_CLIENTS];  // brokerClients[i] belongs to broker slot i
+bool upstreamLost = false;
+unsigned long upstreamLostAt = 0;
+unsigned long upstreamBackAt = 0;
+unsigned long brokerIdleSince = 0;
+unsigned long fallbackActivations = 0;
+OutageMessage outageQueue[OUTAGE_QUEUE_SIZE];
+int outageHead = 0;                      // Oldest queued message
+int outageCount = 0;
+unsigned long outageDropped = 0;         // Overwritten while full, or too large to queue
+unsigned long outageFlushed = 0;
+#endif
+
+// Outputs driven by the output manager; the order matches outputPins[]
+enum OutputId : uint8_t {
+    OUTPUT_DOOR = 0,
+    OUTPUT_LED,
+    OUTPUT_GATE,
+    OUTPUT_HALL_LIGHT,
+    OUTPUT_BELL,
+    OUTPUT_ID_COUNT
+};
+
+struct OutputPin {
+    const char* name;
+    int pin;                         // -1 = not fitted
+    bool activeLow;
+    int ledcChannel;                 // LEDC channel for dimmable outputs, -1 = on/off only
+    OutputLimits limits;
+};
+
+const OutputPin outputPins[OUTPUT_ID_COUNT] = {
+    {"door", DOOR_RELAY, true, -1, {10000, 100}},           // Door strike is never held longer than 10 s
+    {"led", LED_BUILTIN, false, 0, {0, 0}},
+    {"gate", GATE_RELAY_PIN, true, -1, {10000, 100}},
+    {"hall_light", HALL_LIGHT_PIN, false, 1, {600000, 0}},  // Dimmable, off after 10 minutes at most
+    {"bell", EXTERNAL_BELL_PIN, false, -1, {3000, 1000}}    // Solenoid chime: short strikes with time to cool
+};
+
+// Two short pulses, then held for the release window (the relay is active low)
+const OutputStep doorOpenPattern[] = {
+    {OUTPUT_LEVEL_ON, 200}, {0, 200}, {OUTPUT_LEVEL_ON, 200}, {0, 200}, {OUTPUT_LEVEL_ON, 5000}
+};
+
+// Retry after a failed attempt: release first so the strike sees a fresh, longer pulse
+const OutputStep doorRetryPattern[] = {
+    {0, 200}, {OUTPUT_LEVEL_ON, 500}, {0, 200}, {OUTPUT_LEVEL_ON, 5000}
+};
+
+// Door actuation verification; the feedback task samples while doorCheckSampling is set
+ActuationCheck doorCheck;
+portMUX_TYPE doorCheckMux = portMUX_INITIALIZER_UNLOCKED;
+TaskHandle_t doorFeedbackTask = NULL;
+volatile bool doorCheckSampling = false;
+uint32_t actuationId = 0;
+uint8_t actuationAttempt = 0;            // Attempts made by the running actuation (0 = none running)
+const char* actuationSource = "";
+unsigned long actuationStartedAt = 0;
+unsigned long actuationsConfirmed = 0;
+unsigned long actuationsFailed = 0;
+unsigned long actuationRetries = 0;
+
+#if FEATURE_RECORDER
+// Inbound traffic recorder; a replay feeds the records back through callback()
+enum ReplayMode : uint8_t {
+    REPLAY_OFF = 0,
+    REPLAY_LOADING,                      // Ring cleared, records arriving on doorbell/replay/load
+    REPLAY_RUNNING
+};
+const char* replayModeNames[] = {"off", "loading", "running"};
+bool recorderEnabled = true;
+bool recorderSessions = false;           // Also record analyzed ADC sessions
+ReplayMode replayMode = REPLAY_OFF;
+bool replayDispatching = false;          // Feeding a record back in; it is not recorded again
+int replayNext = 0;                      // Next record to replay
+unsigned long replayStartedAt = 0;
+uint32_t replayBaseMs = 0;               // Arrival time of the first replayed record
+unsigned long replayed = 0;
+unsigned long replayIgnored = 0;         // Live inputs held off while loading or replaying
+unsigned long replaySkipped = 0;         // Truncated records, which cannot be replayed
+unsigned long replayMaxLateMs = 0;       // Worst delay of a replayed record against its recorded offset
+unsigned long replayLoadAt = 0;          // Last clear or load while loading
+unsigned long replayDryRuns = 0;         // Effects of replayed records reported instead of carried out
+Config replayConfig;                     // Config before the replay, restored when it ends
+RingState replayRings[2];                // Ring state before the replay, restored when it ends
+QueuedPress replayQueued[2];
+bool replayInjected = false;             // The ring holds loaded records, not the device's own
+#define REPLAY_LOAD_TIMEOUT_MS 30000     // Loading without a load or start this long falls back to off
+#endif
+
+// Upstream connect metrics, published retained on doorbell/mqtt/connect
+const char* connectTargetNames[CONNECT_TARGETS] = {"primary", "backup"};
+const char* dnsSourceNames[] = {"none", "literal", "hit", "stale", "lookup"};
+ConnectTiming lastConnectTiming;
+unsigned long lastConnectMqttMs = 0;    // CONNECT sent to CONNACK on the winning socket
+unsigned long connectWins[CONNECT_TARGETS];
+unsigned long connectFailures = 0;      // Reconnect attempts that found no usable broker
+
+// Upstream connect in progress. While the fallback broker serves LAN clients it
+// is advanced a step per loop instead of blocking until it is decided.
+#define MQTT_CONNACK_WAIT_S 15          // PubSubClient's default socket timeout
+#define BROKER_CONNACK_WAIT_S 1         // CONNACK wait while LAN clients are served
+ConnectRace upstreamRace;
+ConnectTiming upstreamTiming;
+bool upstreamRacing = false;
+uint8_t upstreamSkipMask = 0;           // Brokers that refused CONNECT in this attempt
+char upstreamClientId[24];
+int reconnectAttempts = 0;
+
+// Build, boot and OTA facts reported in doorbell/status
+#define OTA_RECORD_MAGIC 0x07A5EC0D
+struct OtaRecord {
+    uint32_t magic;                     // OTA_RECORD_MAGIC once a transfer has completed
+    uint32_t bytes;
+    uint32_t ms;
+};
+RTC_NOINIT_ATTR OtaRecord lastOta;      // Survives the restart that follows an update
+unsigned long otaStartedAt = 0;
+uint32_t otaBytes = 0;
+unsigned long bootMs = 0;               // Duration of setup(), WiFi and MQTT included
+
+// Press tracing: every handled press gets an id and device timestamps on doorbell/event
+uint16_t bootNonce = 0;             // Random per boot so press ids stay unique across reboots
+uint32_t pressCounter = 0;          // Presses handled since boot
+uint32_t currentPressId = 0;        // Press being handled or played
+unsigned long currentPressMillis = 0;  // When that press was first detected
+unsigned long pressDetectedAt = 0;  // Detection time set by the input path (0 = now)
+
+// Automation rule effects on the event currently being dispatched
+int ruleVolumeOverride = -1;        // Volume set by a rule for the ring being handled (-1 = none)
+bool ruleSuppressRing = false;      // A rule asked not to chime for the press being handled
+bool ruleDispatching = false;       // Guards against rules triggering events recursively
+
+#if FEATURE_AMBIENT
+// Ambient microphone, sampled by a core 0 task; the loop task only reads the estimate
+AmbientEstimator ambient;
+portMUX_TYPE ambientMux = portMUX_INITIALIZER_UNLOCKED;
+unsigned long ambientSkipped = 0;        // Bursts skipped while or just after a chime played
+unsigned long ambientWindowBursts = 0;   // Bursts since the previous health report
+unsigned long ambientWindowUs = 0;       // Time spent sampling and estimating in them
+unsigned long ambientWindowEstimateUs = 0; // ... of which in the estimator
+unsigned long ambientStatsStart = 0;
+unsigned long ambientAdjusted = 0;       // Rings whose volume was scaled
+uint8_t ambientLastBase = 0;             // Configured and scaled volume of the last scaled ring
+uint8_t ambientLastVolume = 0;
+#endif
+
+// WiFi power-save policy: power save is off while latency matters, max modem sleep otherwise
+#define WIFI_BOOST_HOLD_MS 5000          // Keep power save off this long after a command arrives
+#define LATENCY_BUCKET_COUNT 6
+
+// Upper bounds of the latency histogram buckets in ms; the last bucket catches the rest
+const unsigned long latencyBucketMs[LATENCY_BUCKET_COUNT - 1] = {20, 50, 100, 200, 500};
+const char* wifiPsNames[3] = {"none", "min_modem", "max_modem"};
+
+// Time spent and probe latencies observed in one power-save mode
+struct WiFiPowerStats {
+    unsigned long timeMs;
+    unsigned long probes;
+    unsigned long totalLatencyMs;
+    unsigned long maxLatencyMs;
+    unsigned long buckets[LATENCY_BUCKET_COUNT];
+};
+
+WiFiPowerStats wifiPowerStats[3];               // Indexed by wifi_ps_type_t
+wifi_ps_type_t wifiPsMode = WIFI_PS_MIN_MODEM;  // Mode currently applied to the radio
+unsigned long wifiPsModeSince = 0;              // When wifiPsMode was last accounted
+unsigned long wifiPsSwitchedAt = 0;             // When wifiPsMode last changed
+unsigned long lastCommandTime = 0;              // Arrival of the last inbound command
+bool commandSeen = false;
+
+// Idle-time maintenance: chores wait for the device to be idle this long, and
+// run regardless once they have waited their slack
+#define MAINTENANCE_IDLE_SETTLE_MS 250
+#define HEALTH_INTERVAL_MS 60000
+#define HEALTH_SLACK_MS 30000
+#define WIFI_SIGNAL_INTERVAL_MS 30000
+#define WIFI_SIGNAL_SLACK_MS 30000
+#define CONFIG_FLUSH_SLACK_MS 10000              // A changed config reaches EEPROM within this long
+
+MaintenanceScheduler maintenance;
+int configFlushJob = -1;                        // Triggered by requestConfigSave()
+unsigned long idleSince = 0;                    // Start of the current idle window (0 = busy)
+
+// Idempotent commands: set commands are diffed against the stored config, and
+// retained ones the broker replays right after a (re)subscribe are dropped when
+// their payload is the one last applied on that topic. Every retained set topic
+// has a slot of its own: buttons, config and recorder, then rules, then outputs.
+#define COMMAND_DIGEST_RULES 4                   // Slot of doorbell/set/rule/0
+#define COMMAND_DIGEST_OUTPUTS (COMMAND_DIGEST_RULES + RULE_MAX_RULES)  // Slot of output 0
+#define COMMAND_DIGEST_SLOTS (COMMAND_DIGEST_OUTPUTS + OUTPUT_MAX)
+#define RETAINED_REPLAY_WINDOW_MS 3000           // Retained messages arrive this soon after subscribing
+
+/// @brief Last payload applied on one set topic
+struct CommandDigest {
+    bool applied;                               ///< A payload has been applied on the topic
+    uint32_t payload;                           ///< FNV-1a of the payload
+};
+
+Config storedConfig;                            // What the EEPROM holds
+unsigned long configWrites = 0;                 // EEPROM commits since boot
+unsigned long configWritesSkipped = 0;          // Config commands that changed nothing
+CommandDigest commandDigests[COMMAND_DIGEST_SLOTS];
+unsigned long lastSubscribeAt = 0;
+unsigned long commandReplaysSkipped = 0;        // Retained set commands dropped as replays
+
 // Global variables for session tracking
 #ifdef INPUT_MODE_ANALOG
-ADCSession currentSession = {0, 0, false, 0.0, -1, 0};
+ADCSession sessionPool[SESSION_POOL_SIZE];          // Session descriptors (capture + pending analysis)
+ADCReading sessionArena[SESSION_ARENA_SAMPLES];     // Shared sample storage for all sessions
+ADCSession* currentSession = NULL;                  // Session currently being captured (NULL if idle)
+int arenaHead = 0;                                  // Next free reading slot in the arena
+int arenaUsed = 0;                                  // Readings held by capturing/ready sessions
+unsigned long sessionsDropped = 0;                  // Sessions lost because the pool was exhausted
+QueueHandle_t sessionQueue = NULL;                  // Pool slots waiting for analysis
+QueueHandle_t sessionResultQueue = NULL;            // Analysis results waiting for the main loop
 unsigned long lastValidVoltage = 0;  // Timestamp of last valid voltage reading
+const SamplerTiming adcTiming = {ADC_SAMPLE_INTERVAL, ADC_IDLE_SAMPLE_INTERVAL, ADC_FAST_HOLD_MS, ADC_APPROACH_LEVEL};
+AdcSampler adcSampler;              // Sample rate and duty cycle since adcStatsStart
+unsigned long adcStatsStart = 0;    // Start of the current duty cycle window
+unsigned long sessionsTruncated = 0; // Sessions that ran out of sample space before the minimum duration
+LineMonitor lineMonitors[2];        // Line diagnostics: 0 = ADC1 (downstairs), 1 = ADC2 (door)
+#if LINE_STUCK_HIGH_MS <= MAX_SESSION_SAMPLES * ADC_SAMPLE_INTERVAL
+#error "LINE_STUCK_HIGH_MS must exceed the longest session, or a held button is quarantined as a short"
+#endif
+unsigned long lineIdleAt[2] = {0, 0}; // Last sample each line was below ADC_APPROACH_LEVEL
+unsigned long sessionCount = 0;     // Sessions started since boot; numbers the summaries
+int sessionDumpsRequested = 0;      // Upcoming sessions to publish raw readings for
 #endif
 
+// Pulse-coded intercom input
+/// @brief A decoded frame handed from the capture task to the loop task
+struct PulseFrame {
+    PulseResult result;
+    unsigned long startedAt;            ///< millis() at the first edge
+    uint8_t rawPulses;                  ///< Pulses before glitch removal
+    int16_t counted;                    ///< Pulses PCNT counted while the frame was captured
+    uint8_t segmentCount;
+    PulseSegment segments[PULSE_MAX_SEGMENTS];  ///< Kept for doorbell/pulse/trace
+};
+
+const PulseCode pulseCodes[] = { PULSE_CODES };
+const PulseTiming pulseTiming = {PULSE_ACTIVE_LEVEL, PULSE_GLITCH_US, PULSE_LONG_US, PULSE_MAX_US};
+QueueHandle_t pulseQueue = NULL;
+volatile unsigned long pulseFramesDropped = 0;  // Queue full (written by the capture task only)
+unsigned long pulseFrames = 0;
+unsigned long pulseErrors[PULSE_ERROR_COUNT] = {0};
+unsigned long pulseGlitches = 0;
+unsigned long pulseCounted = 0;                 // PCNT total
+unsigned long pulseMismatches = 0;              // Frames where PCNT and RMT disagree
+bool pulseTraceRequested = false;
+
 // Function declarations
 void setupWiFi();
 void setupMQTT();
 void setupDFPlayer();
 void callback(char* topic, byte* payload, unsigned int length);
 void reconnect();
+bool startUpstreamRace();
+void stepUpstreamConnect();
+void finishUpstreamConnect(bool connected);
 void loadConfig();
 void saveConfig();
 void publishConfig();
@@ -136,11 +682,92 @@ void clearEEPROM();
 void publishDeviceStatus();
 void checkButtons();
 void handleNormalDoorbell(int buttonIndex);
+void playDoorbell(int buttonIndex, uint8_t volume);
+void publishPolicyStats();
+uint16_t buttonCooldown(int buttonIndex);
+uint8_t buttonPolicy(int buttonIndex);
+uint8_t buttonVolume(int buttonIndex);
+uint8_t parsePolicy(const char* name);
+void dispatchQueuedPresses();
+void publishButtonEvent(int buttonIndex, const char* status, int count);
+void appendPressTrace(char* buffer, size_t size);
+void publishCborEvent(int buttonIndex, const char* status, int track, int volume, int count);
+void publishTimerStatus(uint8_t status, unsigned long seconds, int track, int volume, const char* message);
+void startTimer(int seconds, int track, int volume);
+void requestPlay(int track, int volume);
+void handleCborCommand(const uint8_t* payload, unsigned int length);
+void runCodecBenchmark();
 void handleSimulatedButton(int button);
 void checkADC();
+void setupSessionPipeline();
+void processSessionResults();
+int dispatchDetectedPress(int button, unsigned long detectedAt, const char* source);
+void setupPulseInput();
+void processPulseFrames();
+void publishPulseStats();
+#ifdef INPUT_MODE_ANALOG
+void publishLineFault(int line);
+void publishLineHealth();
+void publishSessionSummary(const ADCSession& session, int button);
+void publishSessionDump(const ADCSession& session);
+#endif
+void setupAmbient();
+uint8_t ambientAdjustedVolume(uint8_t volume);
+void publishAmbientStats();
 void checkSystemHealth();
 void performMemoryCleanup();
 bool checkWiFiStability();
+void checkWiFiSignal();
+bool latencyCritical();
+void setupMaintenance();
+void runMaintenance();
+void requestConfigSave();
+bool configChanged();
+bool isRetainedReplay(const char* topic, const uint8_t* payload, unsigned int length);
+void flushConfig();
+void publishMaintenanceStats();
+void updateWiFiPowerSave();
+void handleLatencyProbe(const char* message);
+void publishWiFiPowerStats();
+void publishNotifierStats();
+bool publishMessage(const char* topic, const uint8_t* payload, unsigned int length, bool retain = false);
+bool publishMessage(const char* topic, const char* payload, bool retain = false);
+void setupFallbackBroker();
+void updateFallbackBroker();
+void publishBrokerStats();
+void publishConnectStats();
+void publishMqttStats();
+void setupOutputs();
+void handleOutputCommand(const char* name, const char* message);
+void publishOutputs();
+void recordInbound(const char* topic, const uint8_t* payload, unsigned int length);
+void handleReplayCommand(const char* command, const char* message);
+void handleRecorderSettings(const char* message);
+void updateReplay();
+void endReplay();
+bool replayRunning();
+bool replayDryRun(const char* effect, const char* detail);
+void publishRecording();
+void publishRecorderInfo();
+void queueOutageMessage(const char* topic, const uint8_t* payload, unsigned int length, bool retain);
+void flushOutageQueue();
+void startFallbackBroker();
+void stopFallbackBroker();
+void serviceFallbackBroker();
+void openFrontDoor(const char* source);
+void startDoorAttempt(const OutputStep* steps, int count);
+void publishActuation(ActuationResult result);
+void setupDoorFeedback();
+void updateDoorActuation();
+void dispatchRuleEvent(uint8_t event, int32_t arg);
+void handleRuleCommand(const char* topic, const char* message);
+void publishRuleStats();
+void setupPair();
+void updatePair();
+void updatePairLease();
+bool pairActive();
+void dispatchPairCatchUps();
+void publishPairStatus();
 
 // Helper function to convert percentage volume to DFPlayer volume (0-30)
 uint8_t percentToVolume(uint8_t percent) {
@@ -166,6 +793,7 @@ bool isValidButtonPress(ButtonState& state, unsigned long currentTime) {
         // Button was released
         state.wasPressed = false;
         state.isValidPress = false;
+        state.handled = false;
     }
     
     return state.isValidPress;
@@ -200,6 +828,9 @@ void checkButtons() {
 
 void setup() {
     Serial.begin(115200);
+    // All 48 bits: units of one batch share the OUI and often the first NIC byte
+    uint64_t mac = ESP.getEfuseMac();
+    snprintf(deviceId, sizeof(deviceId), "DoorBell-%04x%08lx", (unsigned)(mac >> 32) & 0xFFFF, (unsigned long)(uint32_t)mac);
 
     // Initialize watchdog: restart if loop is blocked for over 10 seconds
     esp_task_wdt_init(10, true);
@@ -212,7 +843,7 @@ void setup() {
     pm_config.light_sleep_enable = true; // Enable light sleep to save power
     esp_pm_configure(&pm_config);
 
-    // Configure WiFi power saving
+    // Configure WiFi power saving; updateWiFiPowerSave() adapts it once running
     esp_wifi_set_ps(WIFI_PS_MIN_MODEM); // Enable minimal power saving
     
     MQTT_DEBUG_F("Starting Doorbell with thermal protection...");
@@ -223,9 +854,9 @@ void setup() {
     // Setup hardware
     pinMode(BUTTON_DOWNSTAIRS, INPUT_PULLDOWN);
     pinMode(BUTTON_DOOR, INPUT_PULLDOWN);
-    pinMode(LED_BUILTIN, OUTPUT);
     pinMode(DFPLAYER_BUSY, INPUT);  // Configure BUSY pin as input
-    digitalWrite(LED_BUILTIN, LOW);
+    setupOutputs();                 // Door relay, LED and optional outputs, all off
+    setupDoorFeedback();            // Door relay confirmation (only with a feedback input fitted)
     
     // Configure ADC resolution
     analogReadResolution(12);  // Set ADC resolution to 12 bits
@@ -233,11 +864,11 @@ void setup() {
     // Configure ADC pins
     pinMode(ADC_PIN1, INPUT);
     pinMode(ADC_PIN2, INPUT);
-    
-    // Configure door relay pin
-    // pinMode(DOOR_RELAY, INPUT_PULLUP);
-    pinMode(DOOR_RELAY, OUTPUT);
-    digitalWrite(DOOR_RELAY, HIGH);  // Ensure relay is off
+#ifdef INPUT_MODE_ANALOG
+    lineMonitorBegin(lineMonitors[0], millis());
+    lineMonitorBegin(lineMonitors[1], millis());
+    samplerBegin(adcSampler);
+#endif
     
     // Check if both buttons are pressed during startup to reset config
     if (digitalRead(BUTTON_DOWNSTAIRS) == HIGH && digitalRead(BUTTON_DOOR) == HIGH) {
@@ -249,6 +880,27 @@ void setup() {
     // Load configuration
     loadConfig();
     
+    // Start background session analysis before any samples are captured
+    setupSessionPipeline();
+    
+    // Periodic chores run in idle windows from now on
+    setupMaintenance();
+    
+    // Start ambient noise sampling (only with a microphone fitted)
+    setupAmbient();
+    
+    // Start pulse capture (only with a pulse-coded line fitted)
+    setupPulseInput();
+    
+#if FEATURE_NOTIFIER
+    // Start the direct push notifier (idle unless ntfy_url is configured)
+    notifierBegin();
+    notifierConfigure(config.ntfy_url);
+#endif
+    
+    // Fallback broker tables (the server only listens during an upstream outage)
+    setupFallbackBroker();
+    
     // Initialize DFPlayer
     dfPlayerSerial.begin(9600, SERIAL_8N1, DFPLAYER_RX, DFPLAYER_TX);
     delay(200);  // Give DFPlayer time to initialize
@@ -276,6 +928,10 @@ void setup() {
     // Setup WiFi and MQTT
     setupWiFi();
     
+    // Local time for automation rules and press tracing; syncs in the background once WiFi is up
+    configTzTime(TIME_ZONE, NTP_SERVER);
+    bootNonce = random(0x10000);
+    
     // Give some time for WiFi to fully stabilize
     delay(500);
     
@@ -293,13 +949,19 @@ void setup() {
             type = "filesystem";
         }
         MQTT_DEBUG_F("Start updating %s", type);
+        flushConfig();
+        otaStartedAt = millis();
     });
     
     ArduinoOTA.onEnd([]() {
         MQTT_DEBUG_F("\nEnd");
+        lastOta.magic = OTA_RECORD_MAGIC;
+        lastOta.bytes = otaBytes;
+        lastOta.ms = millis() - otaStartedAt;
     });
     
     ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
+        otaBytes = total;
         // MQTT_DEBUG_F("Progress: %u%%\r", (progress / (total / 100)));
     });
     
@@ -336,7 +998,11 @@ void setup() {
     
     setupMQTT();
     
+    // Redundant pair (only with PAIR_UDP_PORT set): every unit starts as standby
+    setupPair();
+    
     // Publish initial device status
+    bootMs = millis();
     publishDeviceStatus();
 }
 
@@ -350,39 +1016,37 @@ void loop() {
     // Feed watchdog to prevent unwanted resets
     esp_task_wdt_reset();
     
-    // Check system health (includes memory monitoring)
-    checkSystemHealth();
-    
     // Check WiFi stability with improved logic
     if (!checkWiFiStability()) {
         setupWiFi();
         delay(1000);  // Brief pause after WiFi setup
     }
 
-    // Check MQTT connection with rate limiting
-    if (!mqtt.connected()) {
+    // Pair heartbeats and replication; decides whether this unit is the active one
+    updatePair();
+
+    // Check MQTT connection with rate limiting; the standby unit of a pair only keeps its lease connection
+    if (!mqtt.connected() && pairActive()) {
         reconnect();
     }
     mqtt.loop();
-
-    // Check door relay state (only when active to save CPU)
-    if (doorRelayActive) {
-        unsigned long timeDiff;
-        if (currentTime >= doorRelayStartTime) {  // Handle normal case
-            timeDiff = currentTime - doorRelayStartTime;
-        } else {  // Handle millis() overflow
-            timeDiff = (0xFFFFFFFF - doorRelayStartTime) + currentTime;
-        }
-        
-        if (timeDiff >= 5000) {  // 5 seconds timeout
-            digitalWrite(DOOR_RELAY, HIGH);
-            doorRelayActive = false;
-            MQTT_DEBUG_F("Front door relay deactivated after %lu ms", timeDiff);
-            if (mqtt.connected()) {
-                mqtt.publish("doorbell/status", "Door relay deactivated");
-            }
-        }
+    
+    // Ring presses a failed active unit missed, now that their events can be published
+    dispatchPairCatchUps();
+    
+    // Serve LAN clients during an upstream outage and hand back once it returns
+    if (pairActive()) {
+        updateFallbackBroker();
     }
+    
+    // Feed recorded inputs back in at their original spacing
+    updateReplay();
+
+    // Advance output patterns and enforce their limits (one comparison until something is due)
+    outputsUpdate();
+    
+    // Confirm, retry or report the running door actuation
+    updateDoorActuation();
 
     // Current time already updated at loop start
 
@@ -393,17 +1057,12 @@ void loop() {
             timer.active = false;
             
             // Play the specified track
-            playRequest.pending = true;
-            playRequest.track = timer.track;
-            playRequest.volume = timer.volume;
+            requestPlay(timer.track, timer.volume);
             
             // Publish timer ended message
-            char endMsg[128];
-            snprintf(endMsg, sizeof(endMsg), 
-                    "{\"status\":\"ended\",\"seconds\":%lu,\"track\":%d,\"volume\":%d}", 
-                    timer.durationMs/1000, timer.track, timer.volume);
-            mqtt.publish("doorbell/timer/status", endMsg);
+            publishTimerStatus(TIMER_STATUS_STATUS_ENDED, timer.durationMs / 1000, timer.track, timer.volume, NULL);
             MQTT_DEBUG("Timer ended, playing track");
+            dispatchRuleEvent(RULE_EVT_TIMER, timer.track);
         }
     }
 
@@ -414,12 +1073,15 @@ void loop() {
         
         bool isBusy = digitalRead(DFPLAYER_BUSY);
         
-        if (isBusy && isPlaying) {  // If HIGH (not busy) and was playing, playback has finished
+        // If HIGH (not busy) and was playing, playback has finished; the BUSY pin
+        // needs a moment after play() before it reflects the new track
+        if (isBusy && isPlaying && currentTime - lastPlayTime >= PLAYBACK_SETTLE_MS) {
             MQTT_DEBUG_F("Playback finished (BUSY pin HIGH)");
             isPlaying = false;
-            digitalWrite(LED_BUILTIN, LOW);  // Turn off LED
+            outputStop(OUTPUT_LED);
             dfPlayer.volume(0);  // Reset volume after playback
             MQTT_DEBUG("Ready for next playback");
+            dispatchRuleEvent(RULE_EVT_PLAYBACK_DONE, lastPlayButton >= 0 ? lastPlayButton : 2);
         }
     }
     
@@ -430,37 +1092,61 @@ void loop() {
         MQTT_DEBUG("Volume set");
         dfPlayer.play(playRequest.track);
         MQTT_DEBUG("Track played");
-        delay(500);
         lastPlayTime = currentTime;
+        lastPlayButton = -1;
         volumeResetTimer = currentTime;
         isPlaying = true;
-        digitalWrite(LED_BUILTIN, HIGH);
+        outputSet(OUTPUT_LED, OUTPUT_LEVEL_ON, 0);
         playRequest.pending = false;
         MQTT_DEBUG("Playback started");
     }
 
-    // Check and handle buttons (only if not playing to reduce CPU load)
-    if (!isPlaying) {
+    // Check and handle buttons; input is captured during playback too so that
+    // presses while a chime plays are queued instead of never being seen
 #ifdef INPUT_MODE_DIGITAL
-        checkButtons();
+    checkButtons();
 #else
-        checkADC();
+    checkADC();
 #endif
 
-        // Handle button actions
-        if (buttonStates[0].isValidPress) {  // Downstairs button
-            handleNormalDoorbell(0);
-        }
-        if (buttonStates[1].isValidPress) {  // Door button
-            handleNormalDoorbell(1);
+    // Handle button actions once per press
+    for (int i = 0; i < 2; i++) {  // 0 = Downstairs, 1 = Door
+        if (buttonStates[i].isValidPress && !buttonStates[i].handled) {
+            buttonStates[i].handled = true;
+            pressDetectedAt = buttonStates[i].pressStartTime;
+            handleNormalDoorbell(i);
         }
     }
     
+    // Act on sessions classified by the background analysis task
+    processSessionResults();
+    
+    // Act on pulse frames captured and decoded in the background
+    processPulseFrames();
+    
+    // Play presses that arrived during the previous chime; ones queued by a replay
+    // are dropped when it ends
+    if (!isPlaying && !replayRunning()) {
+        dispatchQueuedPresses();
+    }
+    
+    // Pick the WiFi power-save mode for what is happening right now
+    updateWiFiPowerSave();
+    
+    // Health reports, signal checks and config flushes, preferably while idle
+    runMaintenance();
+    
     // Brief yield to allow other tasks to run and prevent overheating
     yield();
     
-    // Small delay to prevent tight loop and reduce CPU usage
+    // Small delay to prevent tight loop and reduce CPU usage. In analog mode the
+    // loop follows the ADC rate so idle periods can be spent in light sleep.
+#ifdef INPUT_MODE_ANALOG
+    // The wait is to the next sample, so the loop's own work does not stretch the interval.
+    delay(samplerWait(adcSampler, adcTiming, millis()));
+#else
     delay(10);
+#endif
 }
 
 void setupWiFi() {
@@ -512,6 +1198,14 @@ void setupWiFi() {
         MQTT_DEBUG_F("\nFailed to connect to any WiFi network");
         MQTT_DEBUG_F("Device will continue to work in offline mode");
     }
+    
+    // WiFi.mode() resets power save to min modem sleep; record that so
+    // updateWiFiPowerSave() reapplies the policy on the next loop
+    unsigned long now = millis();
+    wifiPowerStats[wifiPsMode].timeMs += now - wifiPsModeSince;
+    wifiPsModeSince = now;
+    wifiPsMode = WIFI_PS_MIN_MODEM;
+    wifiPsSwitchedAt = now;
     MQTT_DEBUG_F("=================\n");
 }
 
@@ -520,6 +1214,9 @@ void setupMQTT() {
     MQTT_DEBUG_F("Connecting to MQTT server: %s:%s\n", config.mqtt_server, config.mqtt_port);
     mqtt.setServer(config.mqtt_server, atoi(config.mqtt_port));
     mqtt.setCallback(callback);
+    dnsBegin();
+    // Default 256-byte packets are too small for config/status/policy documents
+    mqtt.setBufferSize(1024);
 }
 
 void setupDFPlayer() {
@@ -564,6 +1261,45 @@ void callback(char* topic, byte* payload, unsigned int length) {
     memcpy(message, payload, length);
     message[length] = '\0';
     
+    // Latency probes are measurement traffic, not commands
+    if (strcmp(topic_copy, "doorbell/latency/probe") == 0) {
+        handleLatencyProbe(message);
+        return;
+    }
+    
+    // Retained set commands come back after every reconnect; drop those already applied
+    if (isRetainedReplay(topic_copy, payload, length)) {
+        commandReplaysSkipped++;
+        return;
+    }
+    
+    // Replay control runs even during a replay; other live input is held off so the
+    // replay sees exactly the recorded sequence
+#if FEATURE_RECORDER
+    if (strncmp(topic_copy, "doorbell/replay/", 16) == 0) {
+        handleReplayCommand(topic_copy + 16, message);
+        return;
+    }
+    if (!replayDispatching) {
+        if (replayMode != REPLAY_OFF) {
+            replayIgnored++;
+            return;
+        }
+        recordInbound(topic_copy, payload, length);
+    }
+#endif
+    
+    // Keep the radio awake for follow-up commands
+    lastCommandTime = millis();
+    commandSeen = true;
+    updateWiFiPowerSave();
+    
+    // Schema-encoded commands are binary; dispatch them before the payload is logged as text
+    if (strcmp(topic_copy, SCHEMA_CMD_TOPIC) == 0) {
+        handleCborCommand(payload, length);
+        return;
+    }
+    
     // Debug message
     MQTT_DEBUG_F("Received on topic '%s': %s", topic_copy, message);
 
@@ -573,6 +1309,13 @@ void callback(char* topic, byte* payload, unsigned int length) {
         "doorbell/simulate/downstairs",
         "doorbell/get/config",
         "doorbell/get/all",
+        "doorbell/get/policy",
+        "doorbell/get/rules",
+        "doorbell/get/codec_bench",
+        "doorbell/get/recording",
+        "doorbell/get/outputs",
+        "doorbell/get/session_dump",
+        "doorbell/get/pulse_trace",
         "doorbell/timer/stop"
     };
     const int noJsonCommandsCount = sizeof(noJsonCommands) / sizeof(noJsonCommands[0]);
@@ -592,7 +1335,11 @@ void callback(char* topic, byte* payload, unsigned int length) {
     if (strcmp(topic_copy, "doorbell/system/reboot") == 0) {
         isCommand = true;
         if (strcmp(message, "REBOOT") == 0) {
+            if (replayDryRun("reboot", "")) {
+                return;
+            }
             MQTT_DEBUG("Rebooting device...");
+            flushConfig();
             mqtt.loop();
             delay(100);
             ESP.restart();
@@ -602,6 +1349,30 @@ void callback(char* topic, byte* payload, unsigned int length) {
         return;
     }
     
+    if (strncmp(topic_copy, "doorbell/set/output/", 20) == 0) {
+        if (!replayDryRun("output", topic_copy + 20)) {
+            handleOutputCommand(topic_copy + 20, message);
+        }
+        return;
+    }
+    
+#if FEATURE_RECORDER
+    if (strcmp(topic_copy, "doorbell/set/recorder") == 0) {
+        if (!replayDryRun("recorder", "")) {
+            handleRecorderSettings(message);
+        }
+        return;
+    }
+#endif
+    
+    // Handle automation rule upload (topic carries the slot, payload is hex bytecode)
+    if (strncmp(topic_copy, "doorbell/set/rule/", 18) == 0) {
+        if (!replayDryRun("rule", topic_copy + 18)) {
+            handleRuleCommand(topic_copy + 18, message);
+        }
+        return;
+    }
+
     // Handle play command (special format)
     if (strncmp(topic_copy, "doorbell/play/", 14) == 0) {
         isCommand = true;
@@ -612,9 +1383,7 @@ void callback(char* topic, byte* payload, unsigned int length) {
         MQTT_DEBUG(debug_msg);
         if (track > 0) {
             MQTT_DEBUG("Queueing track to play");
-            playRequest.pending = true;
-            playRequest.track = track;
-            playRequest.volume = 100; // max volume in percentage
+            requestPlay(track, 100);  // max volume in percentage
         }
         return;
     }
@@ -641,13 +1410,48 @@ void callback(char* topic, byte* payload, unsigned int length) {
                 publishConfig();
                 publishDeviceStatus();
             }
+            else if (strcmp(noJsonCommands[i], "doorbell/get/rules") == 0) {
+                MQTT_DEBUG("Getting rule stats");
+                publishRuleStats();
+            }
+            else if (strcmp(noJsonCommands[i], "doorbell/get/policy") == 0) {
+                MQTT_DEBUG("Getting policy stats");
+                publishPolicyStats();
+            }
+            else if (strcmp(noJsonCommands[i], "doorbell/get/codec_bench") == 0) {
+                MQTT_DEBUG("Running codec benchmark");
+                runCodecBenchmark();
+            }
+            else if (strcmp(noJsonCommands[i], "doorbell/get/outputs") == 0) {
+                MQTT_DEBUG("Getting outputs");
+                publishOutputs();
+            }
+#ifdef INPUT_MODE_ANALOG
+            else if (strcmp(noJsonCommands[i], "doorbell/get/session_dump") == 0) {
+                // Each request arms one upcoming session
+                if (sessionDumpsRequested < SESSION_POOL_SIZE) {
+                    sessionDumpsRequested++;
+                }
+                MQTT_DEBUG_F("Dumping the next %d session(s)", sessionDumpsRequested);
+            }
+#endif
+            else if (strcmp(noJsonCommands[i], "doorbell/get/pulse_trace") == 0) {
+                MQTT_DEBUG("Tracing the next pulse frame");
+                pulseTraceRequested = true;
+            }
+#if FEATURE_RECORDER
+            else if (strcmp(noJsonCommands[i], "doorbell/get/recording") == 0) {
+                MQTT_DEBUG("Dumping recorded traffic");
+                publishRecording();
+            }
+#endif
             else if (strcmp(noJsonCommands[i], "doorbell/timer/stop") == 0) {
                 if (timer.active) {
                     timer.active = false;
-                    mqtt.publish("doorbell/timer/status", "{\"status\":\"stopped\"}");
+                    publishTimerStatus(TIMER_STATUS_STATUS_STOPPED, 0, 0, 0, NULL);
                     MQTT_DEBUG("Timer stopped");
                 } else {
-                    mqtt.publish("doorbell/timer/status", "{\"status\":\"error\",\"message\":\"No active timer\"}");
+                    publishTimerStatus(TIMER_STATUS_STATUS_ERROR, 0, 0, 0, "No active timer");
                     MQTT_DEBUG("Error: No active timer to stop");
                 }
             }
@@ -674,36 +1478,17 @@ void callback(char* topic, byte* payload, unsigned int length) {
             // Handle JSON commands
             if (strcmp(topic_copy, "doorbell/timer/set") == 0) {
                 if (timer.active) {
-                    mqtt.publish("doorbell/timer/status", "{\"status\":\"error\",\"message\":\"Timer already active\"}");
+                    publishTimerStatus(TIMER_STATUS_STATUS_ERROR, 0, 0, 0, "Timer already active");
                     MQTT_DEBUG("Error: Timer already active");
                     return;
                 }
 
                 if (!doc.containsKey("seconds") || !doc.containsKey("track") || !doc.containsKey("volume")) {
-                    mqtt.publish("doorbell/timer/status", "{\"status\":\"error\",\"message\":\"Missing required fields\"}");
+                    publishTimerStatus(TIMER_STATUS_STATUS_ERROR, 0, 0, 0, "Missing required fields");
                     MQTT_DEBUG("Error: Missing required timer fields");
                     return;
                 }
-
-                int seconds = doc["seconds"].as<int>();
-                if (seconds <= 0) {
-                    mqtt.publish("doorbell/timer/status", "{\"status\":\"error\",\"message\":\"Invalid duration\"}");
-                    MQTT_DEBUG("Error: Invalid timer duration");
-                    return;
-                }
-
-                timer.active = true;
-                timer.startTime = millis();
-                timer.durationMs = (unsigned long)seconds * 1000;
-                timer.track = doc["track"].as<int>();
-                timer.volume = doc["volume"].as<int>();
-
-                char statusMsg[128];
-                snprintf(statusMsg, sizeof(statusMsg), 
-                        "{\"status\":\"started\",\"seconds\":%d,\"track\":%d,\"volume\":%d}", 
-                        seconds, timer.track, timer.volume);
-                mqtt.publish("doorbell/timer/status", statusMsg);
-                MQTT_DEBUG_F("Timer started for %d seconds", seconds);
+                startTimer(doc["seconds"].as<int>(), doc["track"].as<int>(), doc["volume"].as<int>());
             }
             else if (strcmp(topic_copy, "doorbell/set/button/downstairs") == 0) {
                 MQTT_DEBUG("Setting downstairs button config");
@@ -719,7 +1504,20 @@ void callback(char* topic, byte* payload, unsigned int length) {
                     snprintf(debug_msg, sizeof(debug_msg), "Set downstairs volume to %d%%", config.downstairs_volume);
                     MQTT_DEBUG(debug_msg);
                 }
-                saveConfig();
+                if (doc.containsKey("cooldown_ms")) {
+                    config.downstairs_cooldown_ms = doc["cooldown_ms"];
+                    MQTT_DEBUG_F("Set downstairs cooldown to %u ms", config.downstairs_cooldown_ms);
+                }
+                if (doc.containsKey("policy")) {
+                    uint8_t policy = parsePolicy(doc["policy"]);
+                    if (policy < POLICY_COUNT) {
+                        config.downstairs_policy = policy;
+                        MQTT_DEBUG_F("Set downstairs policy to %s", policyNames[policy]);
+                    } else {
+                        MQTT_DEBUG("Error: Unknown policy (use drop, coalesce, escalate or interrupt)");
+                    }
+                }
+                requestConfigSave();
             }
             else if (strcmp(topic_copy, "doorbell/set/button/door") == 0) {
                 MQTT_DEBUG("Setting door button config");
@@ -735,7 +1533,20 @@ void callback(char* topic, byte* payload, unsigned int length) {
                     snprintf(debug_msg, sizeof(debug_msg), "Set door volume to %d%%", config.door_volume);
                     MQTT_DEBUG(debug_msg);
                 }
-                saveConfig();
+                if (doc.containsKey("cooldown_ms")) {
+                    config.door_cooldown_ms = doc["cooldown_ms"];
+                    MQTT_DEBUG_F("Set door cooldown to %u ms", config.door_cooldown_ms);
+                }
+                if (doc.containsKey("policy")) {
+                    uint8_t policy = parsePolicy(doc["policy"]);
+                    if (policy < POLICY_COUNT) {
+                        config.door_policy = policy;
+                        MQTT_DEBUG_F("Set door policy to %s", policyNames[policy]);
+                    } else {
+                        MQTT_DEBUG("Error: Unknown policy (use drop, coalesce, escalate or interrupt)");
+                    }
+                }
+                requestConfigSave();
             }
             else if (strcmp(topic_copy, "doorbell/set/config") == 0) {
                 MQTT_DEBUG("Setting device config");
@@ -767,13 +1578,41 @@ void callback(char* topic, byte* payload, unsigned int length) {
                     strlcpy(config.backup_mqtt_port, doc["backup_mqtt_port"], sizeof(config.backup_mqtt_port));
                 }
                 
+                // Update direct push endpoint
+                if (doc.containsKey("ntfy_url") && strcmp(config.ntfy_url, doc["ntfy_url"] | "") != 0) {
+                    strlcpy(config.ntfy_url, doc["ntfy_url"] | "", sizeof(config.ntfy_url));
+#if FEATURE_NOTIFIER
+                    notifierConfigure(config.ntfy_url);
+#endif
+                }
+                
                 // Update debug setting
                 if (doc.containsKey("debug_enabled")) {
                     config.debug_enabled = doc["debug_enabled"].as<bool>();
                     MQTT_DEBUG_F("Debug mode %s", config.debug_enabled ? "enabled" : "disabled");
                 }
                 
-                saveConfig();
+                // Update wire format
+                if (doc.containsKey("cbor_enabled")) {
+                    config.cbor_enabled = doc["cbor_enabled"].as<bool>();
+                    MQTT_DEBUG_F("CBOR encoding %s", config.cbor_enabled ? "enabled" : "disabled");
+                }
+                
+                // Update ambient volume scaling
+                if (doc.containsKey("ambient_enabled")) {
+                    config.ambient_enabled = doc["ambient_enabled"].as<bool>();
+                }
+                if (doc.containsKey("ambient_min_volume")) {
+                    config.ambient_min_volume = constrain(doc["ambient_min_volume"].as<int>(), 0, 100);
+                }
+                if (doc.containsKey("ambient_max_volume")) {
+                    config.ambient_max_volume = constrain(doc["ambient_max_volume"].as<int>(), 0, 100);
+                }
+                if (config.ambient_min_volume > config.ambient_max_volume) {
+                    config.ambient_min_volume = config.ambient_max_volume;
+                }
+                
+                requestConfigSave();
             }
             return;
         }
@@ -782,22 +1621,7 @@ void callback(char* topic, byte* payload, unsigned int length) {
     // Handle door command
     if (strcmp(topic_copy, "doorbell/command") == 0) {
         if (strcmp(message, "open_front_door") == 0) {
-            // Activate door relay
-            digitalWrite(DOOR_RELAY, LOW);
-            delay(200);
-            digitalWrite(DOOR_RELAY, HIGH);
-            delay(200);
-            digitalWrite(DOOR_RELAY, LOW);
-            delay(200);
-            digitalWrite(DOOR_RELAY, HIGH);
-            delay(200);
-            digitalWrite(DOOR_RELAY, LOW);
-
-
-            doorRelayActive = true;
-            doorRelayStartTime = millis();
-            MQTT_DEBUG_F("Front door relay activated at time: %lu", doorRelayStartTime);
-            mqtt.publish("doorbell/status", "Door relay activated");
+            openFrontDoor("mqtt");
             isCommand = true;
         }
     }
@@ -811,6 +1635,12 @@ void callback(char* topic, byte* payload, unsigned int length) {
 }
 
 void reconnect() {
+    // A race started while LAN clients were being served is advanced a step per loop
+    if (upstreamRacing) {
+        stepUpstreamConnect();
+        return;
+    }
+    
     unsigned long now = millis();
     
     // Prevent rapid reconnection attempts (wait at least 30 seconds)
@@ -820,7 +1650,6 @@ void reconnect() {
     lastMQTTReconnect = now;
     
     // Only try to reconnect a few times, then give up temporarily
-    static int reconnectAttempts = 0;
     if (reconnectAttempts >= 3) {
         MQTT_DEBUG("Too many MQTT reconnect attempts, waiting longer...");
         reconnectAttempts = 0;
@@ -831,45 +1660,125 @@ void reconnect() {
         MQTT_DEBUG_F("Attempting MQTT connection... (attempt %d)", reconnectAttempts + 1);
         reconnectAttempts++;
         
+#if FEATURE_MQTT5
+        // A stable ID, so the broker resumes the session and its queued commands
+        strlcpy(upstreamClientId, deviceId, sizeof(upstreamClientId));
+#else
         // Create a random client ID
-        String clientId = "DoorBell-";
-        clientId += String(random(0xffff), HEX);
+        snprintf(upstreamClientId, sizeof(upstreamClientId), "DoorBell-%lx", (unsigned long)random(0xffff));
+#endif
         
-        // Attempt to connect with timeout
-        if (mqtt.connect(clientId.c_str(), config.mqtt_user, config.mqtt_password)) {
-            reconnectAttempts = 0;  // Reset counter on successful connection
-            MQTT_DEBUG_F("Connected to MQTT");
-            
-            // Subscribe to all set commands (require JSON)
-            mqtt.subscribe("doorbell/set/#");
-            // Subscribe to all get commands (no JSON)
-            mqtt.subscribe("doorbell/get/#");
-            // Subscribe to all simulation commands (no JSON)
-            mqtt.subscribe("doorbell/simulate/#");
-            // Subscribe to play commands (no JSON)
-            mqtt.subscribe("doorbell/play/#");
-            // Subscribe to system commands
-            mqtt.subscribe("doorbell/system/#");
-            // Subscribe to timer commands (but not status)
-            mqtt.subscribe("doorbell/timer/set");
-            mqtt.subscribe("doorbell/timer/stop");
-            mqtt.subscribe("doorbell/command");
-            
-            publishDeviceStatus();
-        } else {                
-            // Try backup MQTT server if configured
-            if (strlen(config.backup_mqtt_server) > 0) {
-                mqtt.setServer(config.backup_mqtt_server, atoi(config.backup_mqtt_port));
+        upstreamSkipMask = 0;
+        if (!startUpstreamRace()) {
+            finishUpstreamConnect(false);
+            return;
+        }
+        if (!fallbackBrokerActive) {
+            while (upstreamRacing) {
+                stepUpstreamConnect();
             }
-            
+        }
+    }
+}
+
+// Race primary and backup to an open TCP connection; false when neither has an
+// address. LAN clients of the fallback broker are not held up by a DNS lookup.
+bool startUpstreamRace() {
+    ConnectTarget targets[CONNECT_TARGETS] = {
+        {config.mqtt_server, (uint16_t)atoi(config.mqtt_port)},
+        {config.backup_mqtt_server, (uint16_t)atoi(config.backup_mqtt_port)}
+    };
+    upstreamRacing = connectRaceBegin(upstreamRace, targets, CONNECT_TARGETS, upstreamSkipMask, 
+                                      !fallbackBrokerActive, upstreamTiming);
+    return upstreamRacing;
+}
+
+// Advance the race and send CONNECT on the winner; a broker that refuses CONNECT
+// is left out of the rerun
+void stepUpstreamConnect() {
+    bool serving = fallbackBrokerActive;
+    int winner = connectRacePoll(upstreamRace, serving ? 0 : CONNECT_TIMEOUT_MS, espClient, upstreamTiming);
+    if (winner == CONNECT_PENDING) {
+        return;
+    }
+    upstreamRacing = false;
+    
+    bool connected = false;
+    if (winner >= 0) {
+        mqtt.setServer(upstreamTiming.address, upstreamRace.ports[winner]);
+        // A live broker answers within milliseconds; LAN clients wait no longer than this
+        mqtt.setSocketTimeout(serving ? BROKER_CONNACK_WAIT_S : MQTT_CONNACK_WAIT_S);
+        unsigned long mqttStart = millis();
+        connected = mqtt.connect(upstreamClientId, config.mqtt_user, config.mqtt_password);
+        mqtt.setSocketTimeout(MQTT_CONNACK_WAIT_S);
+        lastConnectTiming = upstreamTiming;
+        lastConnectMqttMs = millis() - mqttStart;
+        if (!connected) {
+            upstreamSkipMask |= 1 << winner;
+            espClient.stop();
+            if (startUpstreamRace()) {
+                return;
+            }
+        }
+    }
+    finishUpstreamConnect(connected);
+}
+
+void finishUpstreamConnect(bool connected) {
+    if (connected) {
+        reconnectAttempts = 0;  // Reset counter on successful connection
+        connectWins[lastConnectTiming.winner]++;
+        MQTT_DEBUG_F("Connected to MQTT (%s)", connectTargetNames[lastConnectTiming.winner]);
+        
+        for (int i = 0; i < deviceSubscriptionCount; i++) {
+            mqtt.subscribe(deviceSubscriptions[i]);
+        }
+        lastSubscribeAt = millis();
+        
+        publishDeviceStatus();
+        publishConnectStats();
+        publishPairStatus();
+    } else {
+        connectFailures++;
+        
+        // LAN clients of the fallback broker must not be starved by the back-off
+        if (!fallbackBrokerActive) {
             delay(5000);
         }
     }
 }
 
+// Fill in fields appended to Config after the stored revision
+void migrateConfig(uint8_t revision) {
+    MQTT_DEBUG_F("Migrating config from revision %d to %d", revision, CONFIG_REVISION);
+    if (revision < 1) {
+        config.downstairs_cooldown_ms = config.button_cooldown_ms;
+        config.door_cooldown_ms = config.button_cooldown_ms;
+        config.downstairs_policy = POLICY_COALESCE;
+        config.door_policy = POLICY_COALESCE;
+    }
+    if (revision < 2) {
+        config.ntfy_url[0] = '\0';
+    }
+    if (revision < 3) {
+        config.cbor_enabled = false;
+    }
+    if (revision < 4) {
+        config.ambient_enabled = false;
+        config.ambient_min_volume = 20;
+        config.ambient_max_volume = 100;
+    }
+    saveConfig();
+}
+
 void loadConfig() {
     if (EEPROM.read(EEPROM_VALID_ADDR) == 0xAA) {
         EEPROM.get(EEPROM_CONFIG_ADDR, config);
+        storedConfig = config;
+        uint8_t revision = EEPROM.read(EEPROM_REVISION_ADDR);
+        if (revision < CONFIG_REVISION) {
+            migrateConfig(revision);
+        }
     } else {
         // Set defaults
         strlcpy(config.wifi_ssid, WIFI_SSID, sizeof(config.wifi_ssid));
@@ -887,6 +1796,18 @@ void loadConfig() {
         
         config.debug_enabled = false; // Default debug mode
         
+        config.downstairs_cooldown_ms = config.button_cooldown_ms;
+        config.door_cooldown_ms = config.button_cooldown_ms;
+        config.downstairs_policy = POLICY_COALESCE;
+        config.door_policy = POLICY_COALESCE;
+        
+        config.ntfy_url[0] = '\0';
+        config.cbor_enabled = false;
+        
+        config.ambient_enabled = false;
+        config.ambient_min_volume = 20;
+        config.ambient_max_volume = 100;
+        
         saveConfig();
     }
 }
@@ -894,19 +1815,120 @@ void loadConfig() {
 void saveConfig() {
     EEPROM.write(EEPROM_VALID_ADDR, 0xAA);
     EEPROM.put(EEPROM_CONFIG_ADDR, config);
+    EEPROM.write(EEPROM_REVISION_ADDR, CONFIG_REVISION);
     EEPROM.commit();
+    storedConfig = config;
+    configWrites++;
 }
 
-void publishConfig() {
-    DynamicJsonDocument configObj(512);
-    
-    // WiFi settings (mask passwords)
-    configObj["wifi_ssid"] = config.wifi_ssid;
-    configObj["wifi_password"] = "********";
-    configObj["backup_wifi_ssid"] = config.backup_wifi_ssid;
-    configObj["backup_wifi_password"] = "********";
-    
-    // MQTT settings (mask password)
+// Commands change the config in RAM right away; the flash commit (tens of ms)
+// is left to the config flush job so it does not hold up the reply. A command
+// that leaves the config as stored (e.g. a retained one replayed on reconnect)
+// writes nothing.
+bool configDirty = false;
+
+bool configChanged() {
+    return memcmp(&config, &storedConfig, sizeof(Config)) != 0;
+}
+
+void requestConfigSave() {
+    if (replayDryRun("save_config", "")) {
+        return;  // The replayed change stays in RAM until endReplay() restores the config
+    }
+    if (!configChanged()) {
+        configDirty = false;  // Also covers a change that was set back before the flush
+        configWritesSkipped++;
+        return;
+    }
+    configDirty = true;
+    maintenanceTrigger(maintenance, configFlushJob, millis());
+}
+
+// Write a pending config change now (maintenance job; also before a restart)
+void flushConfig() {
+    if (!configDirty || replayRunning()) {
+        return;  // A change made before a replay is written once the replay has restored the config
+    }
+    configDirty = false;
+    if (!configChanged()) {
+        configWritesSkipped++;
+        return;
+    }
+    saveConfig();
+}
+
+uint32_t fnv1a(const uint8_t* data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Digest slot of a set topic, -1 for topics without one (unknown rule slot or output)
+int commandDigestSlot(const char* topic) {
+    const char* name = topic + 13;  // After "doorbell/set/"
+    if (strcmp(name, "button/downstairs") == 0) {
+        return 0;
+    }
+    if (strcmp(name, "button/door") == 0) {
+        return 1;
+    }
+    if (strcmp(name, "config") == 0) {
+        return 2;
+    }
+    if (strcmp(name, "recorder") == 0) {
+        return 3;
+    }
+    if (strncmp(name, "rule/", 5) == 0) {
+        char* end;
+        long slot = strtol(name + 5, &end, 10);
+        if (end == name + 5 || *end != '\0' || slot < 0 || slot >= RULE_MAX_RULES) {
+            return -1;
+        }
+        return COMMAND_DIGEST_RULES + slot;
+    }
+    if (strncmp(name, "output/", 7) == 0) {
+        int output = outputFind(name + 7);
+        return output < 0 ? -1 : COMMAND_DIGEST_OUTPUTS + output;
+    }
+    return -1;
+}
+
+// A set command arriving right after a subscribe with the payload last applied
+// on its topic is the broker replaying a retained message. Every set command
+// (replayed or not) becomes the topic's last applied payload.
+bool isRetainedReplay(const char* topic, const uint8_t* payload, unsigned int length) {
+    if (strncmp(topic, "doorbell/set/", 13) != 0) {
+        return false;
+    }
+#if FEATURE_RECORDER
+    if (replayDispatching) {
+        return false;  // Recorder replays are meant to be applied again
+    }
+#endif
+    int slot = commandDigestSlot(topic);
+    if (slot < 0) {
+        return false;  // Rejected by its handler anyway
+    }
+    CommandDigest& digest = commandDigests[slot];
+    uint32_t payloadHash = fnv1a(payload, length);
+    bool replay = digest.applied && digest.payload == payloadHash && millis() - lastSubscribeAt < RETAINED_REPLAY_WINDOW_MS;
+    digest.applied = true;
+    digest.payload = payloadHash;
+    return replay;
+}
+
+void publishConfig() {
+    DynamicJsonDocument configObj(1024);
+    
+    // WiFi settings (mask passwords)
+    configObj["wifi_ssid"] = config.wifi_ssid;
+    configObj["wifi_password"] = "********";
+    configObj["backup_wifi_ssid"] = config.backup_wifi_ssid;
+    configObj["backup_wifi_password"] = "********";
+    
+    // MQTT settings (mask password)
     configObj["mqtt_server"] = config.mqtt_server;
     configObj["mqtt_port"] = config.mqtt_port;
     configObj["backup_mqtt_server"] = config.backup_mqtt_server;
@@ -914,14 +1936,21 @@ void publishConfig() {
     configObj["mqtt_user"] = config.mqtt_user;
     configObj["mqtt_password"] = "********";
     
+    // Direct push endpoint (the ntfy topic acts as a password)
+    configObj["ntfy_url"] = config.ntfy_url[0] ? "********" : "";
+    
     // Button configurations
     JsonObject downstairsConfig = configObj.createNestedObject("downstairs");
     downstairsConfig["track"] = config.downstairs_track;
     downstairsConfig["volume"] = config.downstairs_volume;
+    downstairsConfig["cooldown_ms"] = config.downstairs_cooldown_ms;
+    downstairsConfig["policy"] = policyNames[buttonPolicy(0)];
     
     JsonObject doorConfig = configObj.createNestedObject("door");
     doorConfig["track"] = config.door_track;
     doorConfig["volume"] = config.door_volume;
+    doorConfig["cooldown_ms"] = config.door_cooldown_ms;
+    doorConfig["policy"] = policyNames[buttonPolicy(1)];
     
     // Timing configurations
     JsonObject timingConfig = configObj.createNestedObject("timing");
@@ -931,7 +1960,17 @@ void publishConfig() {
     // Debug configuration
     configObj["debug_enabled"] = config.debug_enabled;
     
-    char buffer[512];
+    // Wire format of events and timer status
+    configObj["cbor_enabled"] = config.cbor_enabled;
+    
+    // Ambient volume scaling
+    JsonObject ambientConfig = configObj.createNestedObject("ambient");
+    ambientConfig["enabled"] = config.ambient_enabled;
+    ambientConfig["min_volume"] = config.ambient_min_volume;
+    ambientConfig["max_volume"] = config.ambient_max_volume;
+    ambientConfig["mic_fitted"] = AMBIENT_MIC_PIN >= 0;
+    
+    char buffer[1024];
     ArduinoJson::serializeJson(configObj, buffer);
     
     if (mqtt.connected()) {
@@ -957,7 +1996,7 @@ void publishDeviceStatus() {
     }
     
     // Create a JSON document for device status
-    DynamicJsonDocument statusDoc(512);
+    DynamicJsonDocument statusDoc(1024);
     
     // Device information
     statusDoc["status"] = "online";
@@ -977,7 +2016,46 @@ void publishDeviceStatus() {
     configObj["downstairs_volume"] = config.downstairs_volume;
     configObj["door_volume"] = config.door_volume;
     
-    char buffer[512];
+    // Build variant and its cost on the device
+    statusDoc["variant"] = FIRMWARE_VARIANT;
+    JsonArray features = statusDoc.createNestedArray("features");
+#ifdef INPUT_MODE_ANALOG
+    features.add("analog");
+#else
+    features.add("digital");
+#endif
+#ifdef DEBUG_ENABLE
+    features.add("debug");
+#endif
+#if FEATURE_FALLBACK_BROKER
+    features.add("fallback_broker");
+#endif
+#if FEATURE_RECORDER
+    features.add("recorder");
+#endif
+#if FEATURE_NOTIFIER
+    features.add("notifier");
+#endif
+#if FEATURE_AMBIENT
+    features.add("ambient");
+#endif
+#if FEATURE_MQTT5
+    features.add("mqtt5");
+#endif
+#if PAIR_UDP_PORT >= 0
+    features.add("pair");
+#endif
+    statusDoc["image_bytes"] = ESP.getSketchSize();
+    statusDoc["free_heap"] = ESP.getFreeHeap();
+    statusDoc["boot_ms"] = bootMs;
+    if (lastOta.magic == OTA_RECORD_MAGIC) {
+        JsonObject ota = statusDoc.createNestedObject("last_ota");
+        ota["bytes"] = lastOta.bytes;
+        ota["ms"] = lastOta.ms;
+        ota["kbps"] = lastOta.ms ? lastOta.bytes * 8 / lastOta.ms : 0;
+    }
+    
+    char buffer[1024];
     ArduinoJson::serializeJson(statusDoc, buffer);
     
     // Publish to status topic
@@ -985,36 +2063,254 @@ void publishDeviceStatus() {
     MQTT_DEBUG("Published device status");
 }
 
+// Publish a button press that did not start a chime right away
+void publishButtonEvent(int buttonIndex, const char* status, int count) {
+    if (replayDryRun("event", status)) {
+        return;
+    }
+    if (config.cbor_enabled) {
+        publishCborEvent(buttonIndex, status, 0, 0, count);
+        return;
+    }
+    char eventMsg[256];
+    int len = snprintf(eventMsg, sizeof(eventMsg), 
+            "{\"type\":\"button_press\",\"button\":\"%s\",\"status\":\"%s\",\"count\":%d", 
+            buttonIndex == 0 ? "downstairs" : "door", status, count);
+    appendPressTrace(eventMsg + len, sizeof(eventMsg) - len);
+    publishMessage("doorbell/event", eventMsg);
+}
+
+// Wall-clock time in ms for a millis() timestamp, 0 if the clock is not synced
+uint64_t epochMillis(unsigned long atMillis) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if (now.tv_sec < CLOCK_VALID_EPOCH) {
+        return 0;
+    }
+    uint64_t nowMs = (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+    return nowMs - (millis() - atMillis);
+}
+
+// Finish an event JSON object with the trace fields of the current press:
+// press id, detection time (t_press) and publish time (ts), both epoch ms
+void appendPressTrace(char* buffer, size_t size) {
+    snprintf(buffer, size, ",\"press_id\":\"%04x-%lu\",\"t_press\":%llu,\"ts\":%llu}", 
+            bootNonce, (unsigned long)currentPressId, 
+            (unsigned long long)epochMillis(currentPressMillis), 
+            (unsigned long long)epochMillis(millis()));
+}
+
+// Per-button configuration accessors
+uint16_t buttonCooldown(int buttonIndex) {
+    return buttonIndex == 0 ? config.downstairs_cooldown_ms : config.door_cooldown_ms;
+}
+
+uint8_t buttonPolicy(int buttonIndex) {
+    uint8_t policy = buttonIndex == 0 ? config.downstairs_policy : config.door_policy;
+    return policy < POLICY_COUNT ? policy : POLICY_COALESCE;
+}
+
+uint8_t buttonVolume(int buttonIndex) {
+    return buttonIndex == 0 ? config.downstairs_volume : config.door_volume;
+}
+
+// Look up a policy by name, returns POLICY_COUNT if unknown
+uint8_t parsePolicy(const char* name) {
+    for (int i = 0; i < POLICY_COUNT; i++) {
+        if (name && strcmp(name, policyNames[i]) == 0) {
+            return i;
+        }
+    }
+    return POLICY_COUNT;
+}
+
 // Function to handle normal doorbell operation
 void handleNormalDoorbell(int buttonIndex) {
-    // Check if we're within cooldown period or if melody is already playing
-    if (isPlaying || (currentTime - lastPlayTime < config.button_cooldown_ms)) {
-        return;
-    }
-
-    if (buttonIndex == 0) {  // DOWNSTAIRS
-        dfPlayer.volume(percentToVolume(config.downstairs_volume));
-        dfPlayer.play(config.downstairs_track);
-        char eventMsg[128];
-        snprintf(eventMsg, sizeof(eventMsg), 
-                "{\"type\":\"button_press\",\"button\":\"downstairs\",\"track\":%d,\"volume\":%d}", 
-                config.downstairs_track, config.downstairs_volume);
-        mqtt.publish("doorbell/event", eventMsg);
-    } else {  // DOOR
-        dfPlayer.volume(percentToVolume(config.door_volume));
-        dfPlayer.play(config.door_track);
-        char eventMsg[128];
-        snprintf(eventMsg, sizeof(eventMsg), 
-                "{\"type\":\"button_press\",\"button\":\"door\",\"track\":%d,\"volume\":%d}", 
-                config.door_track, config.door_volume);
-        mqtt.publish("doorbell/event", eventMsg);
+    RingState& ring = ringStates[buttonIndex];
+    unsigned long detectedAt = pressDetectedAt ? pressDetectedAt : currentTime;
+    pressDetectedAt = 0;
+    
+    // In a pair the standby unit only notes the press; the active unit rings and announces it
+    if (PAIR_UDP_PORT >= 0 && !pairPress(pairNode, buttonIndex, detectedAt)) {
+        return;
     }
-    delay(500);
     
-    lastPlayTime = currentTime;
-    volumeResetTimer = currentTime;
-    isPlaying = true;
-    digitalWrite(LED_BUILTIN, HIGH);
+    // New press for tracing; detection time comes from the input path when known
+    currentPressId = ++pressCounter;
+    currentPressMillis = detectedAt;
+    
+    // Automation rules see the press first and may adjust or suppress the ring
+    ruleVolumeOverride = -1;
+    ruleSuppressRing = false;
+    dispatchRuleEvent(RULE_EVT_BUTTON, buttonIndex);
+    if (ruleSuppressRing) {
+        publishButtonEvent(buttonIndex, "suppressed", 1);
+        return;
+    }
+    uint8_t volume = ruleVolumeOverride >= 0 ? ruleVolumeOverride : ambientAdjustedVolume(buttonVolume(buttonIndex));
+    
+    PressSituation situation;
+    if (ring.hasRung && currentTime - ring.lastRingTime < buttonCooldown(buttonIndex)) {
+        situation = SITUATION_REPEAT;
+    } else if (isPlaying) {
+        situation = SITUATION_BUSY;
+    } else {
+        situation = SITUATION_READY;
+    }
+    
+    PressAction action = policyTable[buttonPolicy(buttonIndex)][situation];
+    actionCounters[buttonIndex][action]++;
+    
+    switch (action) {
+        case ACTION_PLAY:
+            ring.pressCount = 1;
+            ring.volume = volume;
+            playDoorbell(buttonIndex, ring.volume);
+            break;
+            
+        case ACTION_INTERRUPT:
+            // A repeat keeps counting into the same ring, anything else starts a new one
+            if (situation == SITUATION_REPEAT) {
+                ring.pressCount++;
+            } else {
+                ring.pressCount = 1;
+                ring.volume = volume;
+            }
+            MQTT_DEBUG_F("Interrupting playback for button %d", buttonIndex);
+            playDoorbell(buttonIndex, ring.volume);
+            break;
+            
+        case ACTION_QUEUE: {
+            // Remember the press and play it once the current chime finishes
+            QueuedPress& queued = queuedPresses[buttonIndex];
+            if (!queued.pending) {
+                queued.pending = true;
+                queued.count = 0;
+                queued.firstPressTime = currentTime;
+                queued.volume = volume;
+                queued.pressId = currentPressId;
+                queued.pressMillis = currentPressMillis;
+            }
+            queued.count++;
+            MQTT_DEBUG_F("Press queued during playback (button %d, count %d)", buttonIndex, queued.count);
+            publishButtonEvent(buttonIndex, actionNames[action], queued.count);
+            break;
+        }
+        
+        case ACTION_DROP:
+            publishButtonEvent(buttonIndex, actionNames[action], 1);
+            break;
+            
+        case ACTION_COALESCE:
+            ring.pressCount++;
+            publishButtonEvent(buttonIndex, actionNames[action], ring.pressCount);
+            break;
+            
+        case ACTION_ESCALATE:
+            ring.pressCount++;
+            ring.volume = min(100, ring.volume + ESCALATE_VOLUME_STEP);
+            if (isPlaying && lastPlayButton == buttonIndex) {
+                // Still ringing: just turn it up
+                if (!replayDryRun("chime", "volume")) {
+                    dfPlayer.volume(percentToVolume(ring.volume));
+                }
+            } else {
+                playDoorbell(buttonIndex, ring.volume);
+            }
+            publishButtonEvent(buttonIndex, actionNames[action], ring.pressCount);
+            break;
+            
+        default:
+            break;
+    }
+}
+
+// Start the chime for a button and announce it
+void playDoorbell(int buttonIndex, uint8_t volume) {
+    uint8_t track = buttonIndex == 0 ? config.downstairs_track : config.door_track;
+    const char* buttonName = buttonIndex == 0 ? "downstairs" : "door";
+    
+    // A replayed press still moves the ring state (restored when the replay ends)
+    // but is only reported on doorbell/recording/effect, not played or announced
+    bool dryRun = replayDryRun("chime", buttonName);
+    if (!dryRun) {
+        dfPlayer.volume(percentToVolume(volume));
+        dfPlayer.play(track);
+        if (config.cbor_enabled) {
+            publishCborEvent(buttonIndex, "played", track, volume, 1);
+        } else {
+            char eventMsg[256];
+            int len = snprintf(eventMsg, sizeof(eventMsg), 
+                    "{\"type\":\"button_press\",\"button\":\"%s\",\"track\":%d,\"volume\":%d", 
+                    buttonName, track, volume);
+            appendPressTrace(eventMsg + len, sizeof(eventMsg) - len);
+            publishMessage("doorbell/event", eventMsg);
+        }
+    }
+    
+    // Anything still queued for this button is answered by this chime
+    queuedPresses[buttonIndex].pending = false;
+    
+#if FEATURE_NOTIFIER
+    // Push straight to the phone as well, without waiting for the MQTT bridges
+    if (!replayDryRun("notify", buttonName)) {
+        notifierEnqueue("Doorbell", buttonIndex == 0 ? "Downstairs bell rang" : "Door bell rang", "bell");
+    }
+#endif
+    
+    ringStates[buttonIndex].hasRung = true;
+    ringStates[buttonIndex].lastRingTime = currentTime;
+    if (!dryRun) {
+        lastPlayTime = currentTime;
+        lastPlayButton = buttonIndex;
+        volumeResetTimer = currentTime;
+        isPlaying = true;
+        outputSet(OUTPUT_LED, OUTPUT_LEVEL_ON, 0);
+    }
+    if (outputPins[OUTPUT_BELL].pin >= 0 && !replayDryRun("output", "bell")) {
+        outputSet(OUTPUT_BELL, OUTPUT_LEVEL_ON, EXTERNAL_BELL_PULSE_MS);
+    }
+}
+
+// Play the oldest press queued while another chime was playing
+void dispatchQueuedPresses() {
+    int next = -1;
+    for (int i = 0; i < 2; i++) {
+        if (queuedPresses[i].pending &&
+            (next < 0 || queuedPresses[i].firstPressTime < queuedPresses[next].firstPressTime)) {
+            next = i;
+        }
+    }
+    
+    if (next >= 0) {
+        RingState& ring = ringStates[next];
+        ring.pressCount = queuedPresses[next].count;
+        ring.volume = queuedPresses[next].volume;
+        currentPressId = queuedPresses[next].pressId;
+        currentPressMillis = queuedPresses[next].pressMillis;
+        MQTT_DEBUG_F("Playing queued press (button %d, count %d)", next, ring.pressCount);
+        playDoorbell(next, ring.volume);
+    }
+}
+
+// Publish per-button policy settings and how many presses each action handled
+void publishPolicyStats() {
+    DynamicJsonDocument doc(512);
+    
+    for (int i = 0; i < 2; i++) {
+        JsonObject button = doc.createNestedObject(i == 0 ? "downstairs" : "door");
+        button["policy"] = policyNames[buttonPolicy(i)];
+        button["cooldown_ms"] = buttonCooldown(i);
+        JsonObject counters = button.createNestedObject("actions");
+        for (int a = 0; a < ACTION_COUNT; a++) {
+            counters[actionNames[a]] = actionCounters[i][a];
+        }
+    }
+    
+    char buffer[512];
+    ArduinoJson::serializeJson(doc, buffer);
+    mqtt.publish("doorbell/policy", buffer);
+    MQTT_DEBUG("Published policy stats");
 }
 
 // Function to handle simulated button presses from MQTT
@@ -1024,8 +2320,65 @@ void handleSimulatedButton(int button) {
 }
 
 #ifdef INPUT_MODE_ANALOG
-// Function to analyze the completed session and determine which button was pressed
-void analyzeSession(ADCSession& session) {
+// Access reading i of a session; readings wrap around the shared arena
+ADCReading& sessionReading(const ADCSession& session, int i) {
+    return sessionArena[(session.firstReading + i) % SESSION_ARENA_SAMPLES];
+}
+
+// Take a free descriptor from the pool and anchor it at the arena head
+ADCSession* acquireSession() {
+    for (int i = 0; i < SESSION_POOL_SIZE; i++) {
+        if (sessionPool[i].state == SESSION_FREE) {
+            ADCSession& session = sessionPool[i];
+            session.id = ++sessionCount;
+            session.startTime = 0;
+            session.endTime = 0;
+            session.maxVoltage = 0.0;
+            session.buttonDetected = -1;
+            session.numReadings = 0;
+            session.firstReading = arenaHead;
+            session.dump = sessionDumpsRequested > 0;
+            if (session.dump) {
+                sessionDumpsRequested--;
+            }
+            session.state = SESSION_CAPTURING;
+            return &session;
+        }
+    }
+    return NULL;
+}
+
+// Return a descriptor and its readings to the pool.
+// Analyzed sessions are released in FIFO order, so their readings are always the
+// oldest in the arena; an abandoned capture is always the newest, so the head rolls back.
+void releaseSession(ADCSession* session) {
+    if (session == currentSession) {
+        arenaHead = session->firstReading;
+        currentSession = NULL;
+        MQTT_DEBUG_F("{\"status\":\"ended\",\"device\":\"%s\",\"id\":%lu}", deviceId, session->id);
+    }
+    arenaUsed -= session->numReadings;
+    session->numReadings = 0;
+    session->state = SESSION_FREE;
+}
+
+// Hand a finished capture to the analysis task and free the capture slot
+void submitSession(ADCSession* session) {
+    int slot = session - sessionPool;
+    session->state = SESSION_READY;
+    if (xQueueSend(sessionQueue, &slot, 0) != pdTRUE) {
+        DEBUG_PRINTLN("Session queue full, dropping session");
+        sessionsDropped++;
+        releaseSession(session);
+        return;
+    }
+    currentSession = NULL;
+    MQTT_DEBUG_F("{\"status\":\"ended\",\"device\":\"%s\",\"id\":%lu}", deviceId, session->id);
+}
+
+// Function to analyze the completed session and determine which button was pressed.
+// Runs on the analysis task; only reads the session and reports back through result.
+void analyzeSession(const ADCSession& session, SessionResult& result) {
     if (session.numReadings == 0) {
         DEBUG_PRINTLN("Session has no readings, skipping analysis");
         return;
@@ -1040,47 +2393,332 @@ void analyzeSession(ADCSession& session) {
     // The button type was already determined at session start
     if (session.buttonDetected == 1) {
         DEBUG_PRINTLN("Triggering DOOR button (determined at session start)");
-        handleSimulatedButton(BUTTON_DOOR);
     } else if (session.buttonDetected == 0) {
         DEBUG_PRINTLN("Triggering DOWNSTAIRS button (determined at session start)");
-        handleSimulatedButton(BUTTON_DOWNSTAIRS);
     } else {
         DEBUG_PRINTLN("No button was detected at session start, ignoring");
     }
-    
-    // Create JSON array of all readings (reduced size for memory efficiency)
-    DynamicJsonDocument doc(8192); // Reduced from 16KB to 8KB
-    doc["status"] = "ended";
-    doc["duration"] = sessionDuration;
-    doc["max_voltage"] = session.maxVoltage;
-    doc["button"] = session.buttonDetected;
-    doc["num_readings"] = session.numReadings;
-    
-    JsonArray readings = doc.createNestedArray("readings");
-    for (int i = 0; i < session.numReadings; i++) {
-        JsonObject reading = readings.createNestedObject();
-        reading["v1"] = session.readings[i].voltage1;
-        reading["v2"] = session.readings[i].voltage2;
-        reading["delta"] = session.readings[i].delta;
-        reading["graph"] = session.readings[i].graph;
+    result.button = session.buttonDetected;
+}
+
+// Background task: classify finished sessions off the loop task
+void sessionAnalysisTask(void* param) {
+    int slot;
+    for (;;) {
+        if (xQueueReceive(sessionQueue, &slot, portMAX_DELAY) == pdTRUE) {
+            SessionResult result = {slot, -1};
+            analyzeSession(sessionPool[slot], result);
+            xQueueSend(sessionResultQueue, &result, portMAX_DELAY);
+        }
+    }
+}
+#endif
+
+// Create the session queues and start the analysis task
+void setupSessionPipeline() {
+#ifdef INPUT_MODE_ANALOG
+    sessionQueue = xQueueCreate(SESSION_POOL_SIZE, sizeof(int));
+    sessionResultQueue = xQueueCreate(SESSION_POOL_SIZE, sizeof(SessionResult));
+    // Core 0 keeps the analysis away from the loop task running on core 1
+    xTaskCreatePinnedToCore(sessionAnalysisTask, "session_analysis", 4096, NULL, 1, NULL, 0);
+#endif
+}
+
+#if FEATURE_AMBIENT
+// Background task: one burst of microphone samples every AMBIENT_BURST_INTERVAL_MS.
+// Bursts are skipped while the chime plays and shortly after, or it would raise its own volume.
+void ambientTask(void* param) {
+    static uint16_t samples[AMBIENT_BURST_SAMPLES];
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(AMBIENT_BURST_INTERVAL_MS));
+        if (isPlaying || millis() - lastPlayTime < AMBIENT_CHIME_HOLDOFF_MS) {
+            portENTER_CRITICAL(&ambientMux);
+            ambientSkipped++;
+            portEXIT_CRITICAL(&ambientMux);
+            continue;
+        }
+        unsigned long start = micros();
+        for (int i = 0; i < AMBIENT_BURST_SAMPLES; i++) {
+            samples[i] = analogRead(AMBIENT_MIC_PIN);
+        }
+        unsigned long sampled = micros();
+        AmbientEstimator next = ambient;
+        ambientBurst(next, samples, AMBIENT_BURST_SAMPLES);
+        unsigned long end = micros();
+        portENTER_CRITICAL(&ambientMux);
+        ambient = next;
+        ambientWindowBursts++;
+        ambientWindowUs += end - start;
+        ambientWindowEstimateUs += end - sampled;
+        portEXIT_CRITICAL(&ambientMux);
+    }
+}
+
+void setupAmbient() {
+    ambientBegin(ambient);
+    ambientStatsStart = millis();
+    if (AMBIENT_MIC_PIN < 0) {
+        return;
+    }
+    pinMode(AMBIENT_MIC_PIN, INPUT);
+    xTaskCreatePinnedToCore(ambientTask, "ambient", 2048, NULL, 1, NULL, 0);
+}
+
+// Configured volume scaled for the ambient level, or unchanged when scaling is off or has no estimate yet
+uint8_t ambientAdjustedVolume(uint8_t volume) {
+    if (AMBIENT_MIC_PIN < 0 || !config.ambient_enabled) {
+        return volume;
     }
+    portENTER_CRITICAL(&ambientMux);
+    float levelDb = ambient.levelDb;
+    unsigned long bursts = ambient.bursts;
+    portEXIT_CRITICAL(&ambientMux);
+    if (bursts == 0) {
+        return volume;
+    }
+    uint8_t scaled = ambientVolume(levelDb, volume, config.ambient_min_volume, config.ambient_max_volume);
+    ambientAdjusted++;
+    ambientLastBase = volume;
+    ambientLastVolume = scaled;
+    DEBUG_PRINTF("Ambient %.1f dBFS: volume %d -> %d\n", levelDb, volume, scaled);
+    return scaled;
+}
+
+// Ambient level and the sampling cost since the previous health report
+void publishAmbientStats() {
+    if (AMBIENT_MIC_PIN < 0) {
+        return;
+    }
+    portENTER_CRITICAL(&ambientMux);
+    AmbientEstimator snapshot = ambient;
+    unsigned long skipped = ambientSkipped;
+    unsigned long windowBursts = ambientWindowBursts;
+    unsigned long windowUs = ambientWindowUs;
+    unsigned long windowEstimateUs = ambientWindowEstimateUs;
+    ambientWindowBursts = 0;
+    ambientWindowUs = 0;
+    ambientWindowEstimateUs = 0;
+    portEXIT_CRITICAL(&ambientMux);
     
-    String output;
-    ArduinoJson::serializeJson(doc, output);
-    MQTT_DEBUG_F("Session data: %s", output.c_str());
+    unsigned long window = currentTime - ambientStatsStart;
+    ambientStatsStart = currentTime;
+    char msg[320];
+    snprintf(msg, sizeof(msg), 
+            "{\"enabled\":%s,\"level_db\":%.1f,\"last_burst_db\":%.1f,\"bursts\":%lu,\"skipped\":%lu,"
+            "\"us_per_burst\":%lu,\"estimate_us\":%lu,\"cpu_pct\":%.3f,\"adjusted\":%lu,\"last_base\":%d,\"last_volume\":%d}", 
+            config.ambient_enabled ? "true" : "false", snapshot.levelDb, snapshot.lastBurstDb, snapshot.bursts, skipped, 
+            windowBursts ? windowUs / windowBursts : 0, windowBursts ? windowEstimateUs / windowBursts : 0, 
+            window ? windowUs / (window * 10.0) : 0.0, ambientAdjusted, ambientLastBase, ambientLastVolume);
+    mqtt.publish("doorbell/ambient", msg);
+}
+
+#else
+void setupAmbient() {}
+
+uint8_t ambientAdjustedVolume(uint8_t volume) {
+    return volume;
+}
+
+void publishAmbientStats() {}
+#endif
+
+// Ring for a press detected in hardware (ADC session or pulse frame), traced from
+// its leading edge rather than from when it was decoded. Returns the button, or
+// -1 when a replay holds live presses off.
+int dispatchDetectedPress(int button, unsigned long detectedAt, const char* source) {
+#if FEATURE_RECORDER
+    if (replayMode != REPLAY_OFF) {
+        replayIgnored++;  // Live presses would disturb the replayed sequence
+        return -1;
+    }
+    if (recorderEnabled && recorderSessions) {
+        recorderAppend(RECORD_SESSION, millis(), source, (const uint8_t*)(button ? "1" : "0"), 1);
+        replayInjected = false;
+    }
+#endif
+    pressDetectedAt = detectedAt;
+    handleSimulatedButton(button ? BUTTON_DOOR : BUTTON_DOWNSTAIRS);
+    pressDetectedAt = 0;
+    return button;
 }
+
+// Trigger buttons and publish summaries (and requested dumps) for sessions the
+// analysis task has finished with.
+// MQTT and the DFPlayer are only touched from the loop task.
+void processSessionResults() {
+#ifdef INPUT_MODE_ANALOG
+    SessionResult result;
+    while (xQueueReceive(sessionResultQueue, &result, 0) == pdTRUE) {
+        if (result.button >= 0) {
+            result.button = dispatchDetectedPress(result.button, sessionPool[result.slot].startTime, "adc/session");
+        }
+        
+        ADCSession& session = sessionPool[result.slot];
+        publishSessionSummary(session, result.button);
+        if (session.dump) {
+            publishSessionDump(session);
+        }
+        
+        releaseSession(&sessionPool[result.slot]);
+    }
 #endif
+}
+
+// Background task: turn each RMT frame into segments and decode it. The task
+// sleeps on the ring buffer, so edges cost no CPU time until a frame ends.
+void pulseCaptureTask(void* param) {
+    static PulseFrame frame;
+    RingbufHandle_t ring = NULL;
+    rmt_get_ringbuf_handle(PULSE_RMT_CHANNEL, &ring);
+    rmt_rx_start(PULSE_RMT_CHANNEL, true);
+    int16_t lastCount = 0;
+    for (;;) {
+        size_t size = 0;
+        rmt_item32_t* items = (rmt_item32_t*)xRingbufferReceive(ring, &size, portMAX_DELAY);
+        if (!items) {
+            continue;
+        }
+        unsigned long now = millis();
+        
+        // Each item holds two segments; a zero duration marks the end of the frame
+        int count = 0;
+        uint32_t totalUs = 0;
+        for (size_t i = 0; i < size / sizeof(rmt_item32_t) && count < PULSE_MAX_SEGMENTS; i++) {
+            if (items[i].duration0 == 0) {
+                break;
+            }
+            frame.segments[count++] = {(uint8_t)items[i].level0, (uint32_t)items[i].duration0 * PULSE_TICK_US};
+            totalUs += items[i].duration0 * PULSE_TICK_US;
+            if (items[i].duration1 == 0 || count == PULSE_MAX_SEGMENTS) {
+                break;
+            }
+            frame.segments[count++] = {(uint8_t)items[i].level1, (uint32_t)items[i].duration1 * PULSE_TICK_US};
+            totalUs += items[i].duration1 * PULSE_TICK_US;
+        }
+        vRingbufferReturnItem(ring, items);
+        
+        int16_t counter = 0;
+        pcnt_get_counter_value(PULSE_PCNT_UNIT, &counter);
+        frame.counted = counter >= lastCount ? counter - lastCount : counter + PULSE_PCNT_LIMIT - lastCount;
+        lastCount = counter;
+        
+        frame.segmentCount = count;
+        frame.rawPulses = pulseRawCount(frame.segments, count, PULSE_ACTIVE_LEVEL);
+        frame.result = pulseDecode(frame.segments, count, pulseTiming, pulseCodes, sizeof(pulseCodes) / sizeof(pulseCodes[0]));
+        frame.startedAt = now - (totalUs + PULSE_FRAME_GAP_US) / 1000;
+        if (xQueueSend(pulseQueue, &frame, 0) != pdTRUE) {
+            pulseFramesDropped++;
+        }
+    }
+}
+
+void setupPulseInput() {
+    if (PULSE_INPUT_PIN < 0) {
+        return;
+    }
+    pulseQueue = xQueueCreate(PULSE_QUEUE_DEPTH, sizeof(PulseFrame));
+    
+    // REF_TICK clocking keeps timings exact while power management scales the APB clock
+    rmt_config_t rmt = {};
+    rmt.rmt_mode = RMT_MODE_RX;
+    rmt.channel = PULSE_RMT_CHANNEL;
+    rmt.gpio_num = (gpio_num_t)PULSE_INPUT_PIN;
+    rmt.clk_div = PULSE_TICK_US;
+    rmt.mem_block_num = 2;             // 128 items, so a frame of up to 256 segments fits
+    rmt.flags = RMT_CHANNEL_FLAGS_AWARE_DFS;
+    rmt.rx_config.filter_en = true;
+    rmt.rx_config.filter_ticks_thresh = 255;  // Drop spikes under ~3 us before they reach the decoder
+    rmt.rx_config.idle_threshold = PULSE_FRAME_GAP_US / PULSE_TICK_US;
+    rmt_config(&rmt);
+    rmt_driver_install(PULSE_RMT_CHANNEL, 2048, 0);
+    
+    // Count pulse starts on the same pin as a cross-check of the captured frames
+    pcnt_config_t pcnt = {};
+    pcnt.pulse_gpio_num = PULSE_INPUT_PIN;
+    pcnt.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+    pcnt.channel = PCNT_CHANNEL_0;
+    pcnt.unit = PULSE_PCNT_UNIT;
+    pcnt.pos_mode = PULSE_ACTIVE_LEVEL ? PCNT_COUNT_INC : PCNT_COUNT_DIS;
+    pcnt.neg_mode = PULSE_ACTIVE_LEVEL ? PCNT_COUNT_DIS : PCNT_COUNT_INC;
+    pcnt.lctrl_mode = PCNT_MODE_KEEP;
+    pcnt.hctrl_mode = PCNT_MODE_KEEP;
+    pcnt.counter_h_lim = PULSE_PCNT_LIMIT;
+    pcnt.counter_l_lim = 0;
+    pcnt_unit_config(&pcnt);
+    pcnt_set_filter_value(PULSE_PCNT_UNIT, 1023);  // Longest filter, ~13 us at 80 MHz
+    pcnt_filter_enable(PULSE_PCNT_UNIT);
+    pcnt_counter_clear(PULSE_PCNT_UNIT);
+    pcnt_counter_resume(PULSE_PCNT_UNIT);
+    
+    xTaskCreatePinnedToCore(pulseCaptureTask, "pulse_capture", 3072, NULL, 2, NULL, 0);
+}
+
+// Segments of a frame as signed microseconds (+ active level, - idle), the
+// trace format bench/pulse_bench.cpp reads
+void publishPulseTrace(const PulseFrame& frame) {
+    char msg[768];
+    int len = snprintf(msg, sizeof(msg), 
+            "{\"button\":%d,\"error\":\"%s\",\"pulses\":%u,\"long_mask\":%u,\"glitches\":%u,\"counted\":%d,\"trace\":\"", 
+            frame.result.button, pulseErrorName(frame.result.error), frame.result.pulses, frame.result.longMask, 
+            frame.result.glitches, frame.counted);
+    for (int i = 0; i < frame.segmentCount && len < (int)sizeof(msg) - 16; i++) {
+        len += snprintf(msg + len, sizeof(msg) - len, "%s%c%lu", i ? " " : "", 
+                frame.segments[i].level == PULSE_ACTIVE_LEVEL ? '+' : '-', (unsigned long)frame.segments[i].us);
+    }
+    snprintf(msg + len, sizeof(msg) - len, "\"}");
+    publishMessage("doorbell/pulse/trace", msg);
+}
+
+// Ring for decoded frames; undecodable ones are only counted
+void processPulseFrames() {
+    if (PULSE_INPUT_PIN < 0) {
+        return;
+    }
+    static PulseFrame frame;
+    while (xQueueReceive(pulseQueue, &frame, 0) == pdTRUE) {
+        pulseFrames++;
+        pulseErrors[frame.result.error]++;
+        pulseGlitches += frame.result.glitches;
+        pulseCounted += frame.counted;
+        if (frame.counted != frame.rawPulses) {
+            pulseMismatches++;
+        }
+        if (pulseTraceRequested) {
+            pulseTraceRequested = false;
+            publishPulseTrace(frame);
+        }
+        
+        if (frame.result.button >= 0) {
+            dispatchDetectedPress(frame.result.button, frame.startedAt, "pulse/frame");
+        } else {
+            MQTT_DEBUG_F("Pulse frame not decoded: %s (%u pulses, long mask 0x%x)", 
+                         pulseErrorName(frame.result.error), frame.result.pulses, frame.result.longMask);
+        }
+    }
+}
+
+// Frame counts since boot (pulse line fitted)
+void publishPulseStats() {
+    if (PULSE_INPUT_PIN < 0) {
+        return;
+    }
+    char msg[384];
+    int len = snprintf(msg, sizeof(msg), "{\"frames\":%lu,\"errors\":{", pulseFrames);
+    for (int e = 0; e < PULSE_ERROR_COUNT; e++) {
+        len += snprintf(msg + len, sizeof(msg) - len, "%s\"%s\":%lu", e ? "," : "", pulseErrorName((PulseError)e), pulseErrors[e]);
+    }
+    snprintf(msg + len, sizeof(msg) - len, "},\"glitches\":%lu,\"counted\":%lu,\"mismatches\":%lu,\"dropped\":%lu}", 
+            pulseGlitches, pulseCounted, pulseMismatches, pulseFramesDropped);
+    mqtt.publish("doorbell/pulse/stats", msg);
+}
 
 // Function to read and process ADC values
 void checkADC() {
 #ifdef INPUT_MODE_ANALOG
-    static unsigned long lastAdcRead = 0;
     static unsigned long lastDebugPrint = 0;
     currentTime = millis();
     
-    if (currentTime - lastAdcRead >= ADC_SAMPLE_INTERVAL) {
-        lastAdcRead = currentTime;
-        
+    if (samplerDue(adcSampler, adcTiming, currentTime)) {
         // Read ADC values (12-bit resolution: 0-4095)
         int adc1_value = analogRead(ADC_PIN1);
         int adc2_value = analogRead(ADC_PIN2);
@@ -1089,76 +2727,122 @@ void checkADC() {
         float voltage1 = (adc1_value * 3.3) / 4095.0;
         float voltage2 = (adc2_value * 3.3) / 4095.0;
         
+        // Line diagnostics see the raw voltages; a quarantined line is then read as
+        // idle so it can neither start sessions nor hold the fast sample rate
+        float voltages[2] = {voltage1, voltage2};
+        for (int i = 0; i < 2; i++) {
+            if (lineMonitorUpdate(lineMonitors[i], voltages[i], ADC_THRESHOLD, ADC_THRESHOLD - ADC_HYSTERESIS, currentTime)) {
+                publishLineFault(i);
+            }
+        }
+        if (lineMonitors[0].quarantined) {
+            voltage1 = 0.0;
+        }
+        if (lineMonitors[1].quarantined) {
+            voltage2 = 0.0;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (!currentSession && (i ? voltage2 : voltage1) < ADC_APPROACH_LEVEL) {
+                lineIdleAt[i] = currentTime;
+            }
+        }
+        if (currentSession && currentSession->buttonDetected >= 0 && lineMonitors[currentSession->buttonDetected].quarantined) {
+            DEBUG_PRINTLN("Session line quarantined, abandoning session");
+            releaseSession(currentSession);
+        }
+        
+        // Escalate to the fast rate when either line nears the trigger band or a
+        // session is running, and hold it for a while after things go quiet
+        samplerUpdate(adcSampler, adcTiming, voltage1, voltage2, currentSession != NULL, currentTime);
+        
         // Print debug info every 5 seconds when not in a session (reduced CPU load)
-        if (!currentSession.isActive && currentTime - lastDebugPrint >= 5000) {
+        if (!currentSession && currentTime - lastDebugPrint >= 5000) {
             DEBUG_PRINTF("ADC Values - ADC1: %d (%.2fV), ADC2: %d (%.2fV)\n", 
                         adc1_value, voltage1, adc2_value, voltage2);
             lastDebugPrint = currentTime;
         }
         
         // Check if we need to start a new session (using threshold)
-        if ((voltage1 >= ADC_THRESHOLD || voltage2 >= ADC_THRESHOLD) && !currentSession.isActive && !isPlaying) {
+        if ((voltage1 >= ADC_THRESHOLD || voltage2 >= ADC_THRESHOLD) && !currentSession) {
+            currentSession = acquireSession();
+            if (!currentSession) {
+                // Every descriptor is still waiting for analysis
+                sessionsDropped++;
+                return;
+            }
             DEBUG_PRINTF("Starting new session - ADC1: %.2fV, ADC2: %.2fV\n", voltage1, voltage2);
-            currentSession.startTime = currentTime;
-            currentSession.isActive = true;
-            currentSession.maxVoltage = max(voltage1, voltage2);
-            currentSession.numReadings = 0;
+            // The line crossed the threshold somewhere since the previous sample
+            currentSession->startTime = samplerEdgeTime(adcSampler);
+            currentSession->maxVoltage = max(voltage1, voltage2);
             
             // Determine button type based on which ADC started the session with >3V
             if (voltage2 >= ADC_THRESHOLD) {
-                currentSession.buttonDetected = 1; // DOOR takes priority if ADC2 is high
+                currentSession->buttonDetected = 1; // DOOR takes priority if ADC2 is high
                 DEBUG_PRINTLN("Session started by DOOR button (ADC2)");
             } else if (voltage1 >= ADC_THRESHOLD) {
-                currentSession.buttonDetected = 0; // DOWNSTAIRS only if ADC2 was not high
+                currentSession->buttonDetected = 0; // DOWNSTAIRS only if ADC2 was not high
                 DEBUG_PRINTLN("Session started by DOWNSTAIRS button (ADC1)");
             }
+            int line = currentSession->buttonDetected;
+            featuresBegin(currentSession->features, line, ADC_THRESHOLD, ADC_THRESHOLD - ADC_HYSTERESIS, 
+                          line >= 0 ? currentTime - lineIdleAt[line] : 0);
             
-            MQTT_DEBUG("Session started");
+            MQTT_DEBUG_F("{\"status\":\"started\",\"device\":\"%s\",\"id\":%lu}", deviceId, currentSession->id);
         }
         
         // Update session data if active
-        if (currentSession.isActive) {
-            if (currentSession.numReadings >= MAX_SESSION_SAMPLES) {
-                DEBUG_PRINTLN("Session buffer full, ending session");
-                currentSession.isActive = false;
+        if (currentSession) {
+            if (currentSession->numReadings >= MAX_SESSION_SAMPLES || arenaUsed >= SESSION_ARENA_SAMPLES) {
+                // Out of sample space: analyze what was captured rather than losing the press
+                currentSession->endTime = currentTime;
+                if (currentSession->endTime - currentSession->startTime >= MIN_SESSION_DURATION) {
+                    DEBUG_PRINTLN("Session buffer full, ending session");
+                    submitSession(currentSession);
+                } else {
+                    DEBUG_PRINTLN("Session buffer full before minimum duration, dropping session");
+                    sessionsTruncated++;
+                    releaseSession(currentSession);
+                }
                 return;
             }
             
-            currentSession.maxVoltage = max(currentSession.maxVoltage, max(voltage1, voltage2));
+            currentSession->maxVoltage = max(currentSession->maxVoltage, max(voltage1, voltage2));
             
-            // Create new reading
-            ADCReading& reading = currentSession.readings[currentSession.numReadings];
+            // Create new reading at the arena head
+            ADCReading& reading = sessionArena[arenaHead];
             reading.voltage1 = voltage1;
             reading.voltage2 = voltage2;
-            reading.delta = currentTime - currentSession.startTime;
-            
-            // Create bar graphs with different characters for each voltage
-            char* graph = reading.graph;
-            int v1_bars = (int)((voltage1 * 20) / 3.3); // Scale to 20 characters max
-            int v2_bars = (int)((voltage2 * 20) / 3.3);
-            
-            for(int i = 0; i < 20; i++) {
-                graph[i] = (i < v1_bars) ? '#' : '.';      // First voltage uses #
-                graph[i+21] = (i < v2_bars) ? '*' : '.';   // Second voltage uses *
-            }
-            graph[20] = ' '; // separator
-            graph[41] = '\0';
+            reading.delta = currentTime - currentSession->startTime;
+            featuresAdd(currentSession->features, voltage1, voltage2, reading.delta);
             
-            currentSession.numReadings++;
+            arenaHead = (arenaHead + 1) % SESSION_ARENA_SAMPLES;
+            arenaUsed++;
+            currentSession->numReadings++;
             
             // Print debug info every 500ms during session (reduced frequency to save CPU)
             if (currentTime - lastDebugPrint >= 500) {
                 DEBUG_PRINTF("Session ongoing - Readings: %d, ADC1: %.2fV, ADC2: %.2fV\n", 
-                            currentSession.numReadings, voltage1, voltage2);
+                            currentSession->numReadings, voltage1, voltage2);
                 lastDebugPrint = currentTime;
             }
             
             // Publish current reading for debug
             if (config.debug_enabled) {
+                // Bar graphs with different characters for each voltage
+                char graph[42];
+                int v1_bars = (int)((voltage1 * 20) / 3.3); // Scale to 20 characters max
+                int v2_bars = (int)((voltage2 * 20) / 3.3);
+                for (int i = 0; i < 20; i++) {
+                    graph[i] = (i < v1_bars) ? '#' : '.';      // First voltage uses #
+                    graph[i+21] = (i < v2_bars) ? '*' : '.';   // Second voltage uses *
+                }
+                graph[20] = ' '; // separator
+                graph[41] = '\0';
+                
                 char msg[256];
                 snprintf(msg, sizeof(msg), 
-                        "{\"adc1_v\":%.2f,\"adc2_v\":%.2f,\"delta\":%lu,\"graph\":\"\033[38;5;46m%.*s\033[0m \033[38;5;220m%s\033[0m\"}", 
-                        voltage1, voltage2, reading.delta, 20, graph, graph + 21);
+                        "{\"device\":\"%s\",\"adc1_v\":%.2f,\"adc2_v\":%.2f,\"delta\":%lu,\"graph\":\"\033[38;5;46m%.*s\033[0m \033[38;5;220m%s\033[0m\"}", 
+                        deviceId, voltage1, voltage2, reading.delta, 20, graph, graph + 21);
                 MQTT_DEBUG(msg);
             }
             
@@ -1172,34 +2856,23 @@ void checkADC() {
                 } else {
                     // Voltage has been low for too long, end the session
                     DEBUG_PRINTF("Ending session - Final voltages ADC1: %.2fV, ADC2: %.2fV\n", voltage1, voltage2);
-                    currentSession.endTime = currentTime;
+                    currentSession->endTime = currentTime;
                     
                     // Only analyze if session meets minimum duration
-                    if (currentSession.endTime - currentSession.startTime >= MIN_SESSION_DURATION) {
-                        // Analyze the completed session
-                        analyzeSession(currentSession);
+                    if (currentSession->endTime - currentSession->startTime >= MIN_SESSION_DURATION) {
+                        // Hand the completed session to the analysis task; capture continues
+                        submitSession(currentSession);
                     } else {
                         DEBUG_PRINTF("Session too short (%lu ms), ignoring\n", 
-                                   currentSession.endTime - currentSession.startTime);
+                                   currentSession->endTime - currentSession->startTime);
+                        releaseSession(currentSession);
                     }
-                    
-                    // Reset session
-                    currentSession.isActive = false;
-                    currentSession.maxVoltage = 0.0;
-                    currentSession.buttonDetected = -1;
-                    currentSession.numReadings = 0;
                 }
-            } else if (currentTime - currentSession.startTime >= MIN_SESSION_DURATION) {
+            } else if (currentTime - currentSession->startTime >= MIN_SESSION_DURATION) {
                 // Session has met minimum duration, end it
                 DEBUG_PRINTF("Session reached minimum duration (%d ms), ending\n", MIN_SESSION_DURATION);
-                currentSession.endTime = currentTime;
-                analyzeSession(currentSession);
-                
-                // Reset session
-                currentSession.isActive = false;
-                currentSession.maxVoltage = 0.0;
-                currentSession.buttonDetected = -1;
-                currentSession.numReadings = 0;
+                currentSession->endTime = currentTime;
+                submitSession(currentSession);
             } else {
                 // Update lastValidVoltage timestamp since we have good readings
                 if (voltage1 >= ADC_THRESHOLD || voltage2 >= ADC_THRESHOLD) {
@@ -1211,65 +2884,134 @@ void checkADC() {
 #endif
 }
 
-// System health monitoring function
+// Register the periodic chores; each first falls due one interval after boot
+void setupMaintenance() {
+    unsigned long now = millis();
+    maintenanceBegin(maintenance);
+    maintenanceAdd(maintenance, "health", checkSystemHealth, HEALTH_INTERVAL_MS, HEALTH_SLACK_MS, now);
+    maintenanceAdd(maintenance, "wifi_signal", checkWiFiSignal, WIFI_SIGNAL_INTERVAL_MS, WIFI_SIGNAL_SLACK_MS, now);
+    configFlushJob = maintenanceAdd(maintenance, "config_flush", flushConfig, 0, CONFIG_FLUSH_SLACK_MS, now);
+}
+
+// Run at most one due chore per loop pass: in an idle window, or regardless
+// once it has waited its slack
+void runMaintenance() {
+    unsigned long now = millis();
+    if (latencyCritical()) {
+        idleSince = 0;
+    } else if (idleSince == 0) {
+        idleSince = now;
+    }
+    bool idle = idleSince != 0 && now - idleSince >= MAINTENANCE_IDLE_SETTLE_MS;
+    
+    int id = maintenanceNext(maintenance, now, idle);
+    if (id < 0) {
+        return;
+    }
+    unsigned long started = micros();
+    maintenance.jobs[id].run();
+    maintenanceDone(maintenance, id, millis(), micros() - started, idle);
+}
+
+// Per-job run counts and timing since boot. "forced" runs overlapped a ring or
+// command because their slack ran out; "due_busy" runs fell due during one,
+// which is where the old fixed-interval schedule would have run them.
+void publishMaintenanceStats() {
+    char msg[768];
+    int len = snprintf(msg, sizeof(msg), "{\"overlap_us\":%lu,\"fixed_overlap_us\":%lu,\"jobs\":{", 
+            maintenance.overlapUs, maintenance.fixedOverlapUs);
+    for (int i = 0; i < maintenance.count; i++) {
+        const MaintenanceJob& job = maintenance.jobs[i];
+        len += snprintf(msg + len, sizeof(msg) - len, 
+                "%s\"%s\":{\"runs\":%lu,\"forced\":%lu,\"due_busy\":%lu,\"max_wait_ms\":%lu,\"avg_us\":%lu,\"max_us\":%lu}", 
+                i ? "," : "", job.name, job.runs, job.forced, job.dueWhileBusy, job.maxWaitMs, 
+                job.runs ? job.totalUs / job.runs : 0, job.maxUs);
+    }
+    snprintf(msg + len, sizeof(msg) - len, "}}");
+    mqtt.publish("doorbell/maintenance", msg);
+}
+
+// System health monitoring function (maintenance job): heap check, temperature
+// guard and the periodic reports
 void checkSystemHealth() {
     currentTime = millis();
     
-    // Check system health every 60 seconds
-    if (currentTime - lastSystemCheck >= 60000) {
-        lastSystemCheck = currentTime;
-        
-        // Get memory info
-        uint32_t freeHeap = ESP.getFreeHeap();
-        uint32_t minFreeHeap = ESP.getMinFreeHeap();
-        uint32_t heapSize = ESP.getHeapSize();
-        
-        // Check for memory issues
-        if (freeHeap < 10000) {  // Less than 10KB free
-            MQTT_DEBUG_F("LOW MEMORY WARNING: Free heap: %u bytes", freeHeap);
-            performMemoryCleanup();
-            systemStable = false;
-        } else {
-            systemStable = true;
-        }
-        
-        // Publish system health status
-        if (mqtt.connected()) {
-            char healthMsg[256];
-            snprintf(healthMsg, sizeof(healthMsg), 
-                    "{\"free_heap\":%u,\"min_free_heap\":%u,\"heap_size\":%u,\"uptime\":%lu,\"stable\":%s}", 
-                    freeHeap, minFreeHeap, heapSize, currentTime / 1000, systemStable ? "true" : "false");
-            mqtt.publish("doorbell/health", healthMsg);
-        }
-        
-        // Check CPU temperature (if available) and throttle if needed
-        #ifdef CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ
-        float temp = temperatureRead();
-        if (temp > 70.0) {  // If temperature is above 70°C
-            MQTT_DEBUG_F("HIGH TEMPERATURE WARNING: %.1f°C - reducing CPU frequency", temp);
-            // Reduce CPU frequency for thermal protection
-            esp_pm_config_esp32_t pm_config;
-            pm_config.max_freq_mhz = 80;   // Reduce to 80MHz
-            pm_config.min_freq_mhz = 40;
-            pm_config.light_sleep_enable = true;
-            esp_pm_configure(&pm_config);
-            systemStable = false;
-        } else if (temp > 50.0 && systemStable) {
-            // Return to normal frequency if temperature is acceptable
-            esp_pm_config_esp32_t pm_config;
-            pm_config.max_freq_mhz = 160;  // Return to 160MHz
-            pm_config.min_freq_mhz = 40;
-            pm_config.light_sleep_enable = true;
-            esp_pm_configure(&pm_config);
-        }
-        #endif
-        
-        // Reset ESP if memory is critically low
-        if (freeHeap < 5000) {
-            MQTT_DEBUG("CRITICAL: Memory exhausted, restarting...");
-            delay(1000);
-            ESP.restart();
-        }
+    // Get memory info
+    uint32_t freeHeap = ESP.getFreeHeap();
+    uint32_t minFreeHeap = ESP.getMinFreeHeap();
+    uint32_t heapSize = ESP.getHeapSize();
+    
+    // Check for memory issues
+    if (freeHeap < 10000) {  // Less than 10KB free
+        MQTT_DEBUG_F("LOW MEMORY WARNING: Free heap: %u bytes", freeHeap);
+        performMemoryCleanup();
+        systemStable = false;
+    } else {
+        systemStable = true;
+    }
+    
+    // Publish system health status
+    if (mqtt.connected()) {
+        char healthMsg[640];
+        int len = snprintf(healthMsg, sizeof(healthMsg), 
+                "{\"free_heap\":%u,\"min_free_heap\":%u,\"heap_size\":%u,\"uptime\":%lu,\"stable\":%s,"
+                "\"config_writes\":%lu,\"config_writes_skipped\":%lu,\"replays_skipped\":%lu", 
+                freeHeap, minFreeHeap, heapSize, currentTime / 1000, systemStable ? "true" : "false", 
+                configWrites, configWritesSkipped, commandReplaysSkipped);
+#ifdef INPUT_MODE_ANALOG
+        // ADC duty cycle since the previous health report
+        unsigned long statsWindow = currentTime - adcStatsStart;
+        float fastPct = statsWindow ? (adcSampler.fastMs * 100.0) / statsWindow : 0.0;
+        float sampleRate = statsWindow ? (adcSampler.samples * 1000.0) / statsWindow : 0.0;
+        len += snprintf(healthMsg + len, sizeof(healthMsg) - len, 
+                ",\"sessions_dropped\":%lu,\"sessions_truncated\":%lu,\"adc_fast_pct\":%.1f,\"adc_rate_hz\":%.1f", 
+                sessionsDropped, sessionsTruncated, fastPct, sampleRate);
+        adcStatsStart = currentTime;
+        samplerResetStats(adcSampler);
+#endif
+        snprintf(healthMsg + len, sizeof(healthMsg) - len, "}");
+        mqtt.publish("doorbell/health", healthMsg);
+        publishWiFiPowerStats();
+        publishNotifierStats();
+        publishBrokerStats();
+        publishAmbientStats();
+        publishMaintenanceStats();
+        publishPulseStats();
+        publishMqttStats();
+        publishPairStatus();
+#ifdef INPUT_MODE_ANALOG
+        publishLineHealth();
+#endif
+    }
+    
+    // Check CPU temperature (if available) and throttle if needed
+    #ifdef CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ
+    float temp = temperatureRead();
+    if (temp > 70.0) {  // If temperature is above 70°C
+        MQTT_DEBUG_F("HIGH TEMPERATURE WARNING: %.1f°C - reducing CPU frequency", temp);
+        // Reduce CPU frequency for thermal protection
+        esp_pm_config_esp32_t pm_config;
+        pm_config.max_freq_mhz = 80;   // Reduce to 80MHz
+        pm_config.min_freq_mhz = 40;
+        pm_config.light_sleep_enable = true;
+        esp_pm_configure(&pm_config);
+        systemStable = false;
+    } else if (temp > 50.0 && systemStable) {
+        // Return to normal frequency if temperature is acceptable
+        esp_pm_config_esp32_t pm_config;
+        pm_config.max_freq_mhz = 160;  // Return to 160MHz
+        pm_config.min_freq_mhz = 40;
+        pm_config.light_sleep_enable = true;
+        esp_pm_configure(&pm_config);
+    }
+    #endif
+    
+    // Reset ESP if memory is critically low
+    if (freeHeap < 5000) {
+        MQTT_DEBUG("CRITICAL: Memory exhausted, restarting...");
+        flushConfig();
+        delay(1000);
+        ESP.restart();
     }
 }
 
@@ -1282,10 +3024,10 @@ void performMemoryCleanup() {
     
     // Clear any large temporary objects
     #ifdef INPUT_MODE_ANALOG
-    if (!currentSession.isActive) {
-        // Reset session data if not active
-        memset(&currentSession, 0, sizeof(currentSession));
-        currentSession.buttonDetected = -1;
+    if (!currentSession && arenaUsed == 0) {
+        // Reset session arena if no session is being captured or analyzed
+        memset(sessionArena, 0, sizeof(sessionArena));
+        arenaHead = 0;
     }
     #endif
     
@@ -1300,23 +3042,1505 @@ void performMemoryCleanup() {
 
 // WiFi stability checking
 bool checkWiFiStability() {
-    currentTime = millis();
+    if (WiFi.status() != WL_CONNECTED) {
+        MQTT_DEBUG("WiFi disconnected - attempting reconnection");
+        return false;
+    }
+    return true;
+}
+
+// Report a weak signal (maintenance job)
+void checkWiFiSignal() {
+    if (WiFi.status() != WL_CONNECTED) {
+        return;
+    }
+    int rssi = WiFi.RSSI();
+    if (rssi < -80) {  // Very weak signal
+        MQTT_DEBUG_F("Weak WiFi signal: %d dBm", rssi);
+    }
+}
+
+// Latency matters while a press is being captured or handled, a chime plays,
+// the relay is driven or a command arrived recently
+bool latencyCritical() {
+    bool critical = isPlaying || playRequest.pending || outputActive(OUTPUT_DOOR) ||
+                    (commandSeen && millis() - lastCommandTime < WIFI_BOOST_HOLD_MS);
+#ifdef INPUT_MODE_ANALOG
+    critical = critical || currentSession != NULL;
+#endif
+    return critical;
+}
+
+// Switch WiFi power save off while latency matters and back to max modem
+// sleep once the device is idle
+void updateWiFiPowerSave() {
+    unsigned long now = millis();
+    
+    wifi_ps_type_t target = latencyCritical() ? WIFI_PS_NONE : WIFI_PS_MAX_MODEM;
+    
+    // Account time spent in the current mode
+    wifiPowerStats[wifiPsMode].timeMs += now - wifiPsModeSince;
+    wifiPsModeSince = now;
+    
+    if (target != wifiPsMode) {
+        if (esp_wifi_set_ps(target) == ESP_OK) {
+            MQTT_DEBUG_F("WiFi power save: %s -> %s", wifiPsNames[wifiPsMode], wifiPsNames[target]);
+            wifiPsMode = target;
+            wifiPsSwitchedAt = now;
+        }
+    }
+}
+
+// A probe is the epoch ms at which a host (latency_probe.py) published it. Its
+// one-way delay to the device is what an inbound command sees in the current
+// mode, modem sleep included; the echo gives the host the round trip as well.
+void handleLatencyProbe(const char* message) {
+    uint64_t sentAt = strtoull(message, NULL, 10);
+    uint64_t receivedAt = epochMillis(millis());
+    
+    char echo[96];
+    snprintf(echo, sizeof(echo), "{\"t\":%llu,\"rx\":%llu,\"mode\":\"%s\"}", 
+            (unsigned long long)sentAt, (unsigned long long)receivedAt, wifiPsNames[wifiPsMode]);
+    mqtt.publish("doorbell/latency/echo", echo);
+    
+    // Needs both clocks synced; a probe from before the last mode switch would
+    // mix both modes into one sample
+    if (sentAt == 0 || receivedAt == 0 || receivedAt < sentAt) {
+        return;
+    }
+    unsigned long latency = receivedAt - sentAt;
+    if (millis() - wifiPsSwitchedAt < latency) {
+        return;
+    }
+    
+    WiFiPowerStats& stats = wifiPowerStats[wifiPsMode];
+    stats.probes++;
+    stats.totalLatencyMs += latency;
+    stats.maxLatencyMs = max(stats.maxLatencyMs, latency);
+    
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKET_COUNT - 1 && latency > latencyBucketMs[bucket]) {
+        bucket++;
+    }
+    stats.buckets[bucket]++;
+}
+
+// Publish time per power-save mode and the probe latency distribution per mode
+void publishWiFiPowerStats() {
+    DynamicJsonDocument doc(1024);
+    doc["mode"] = wifiPsNames[wifiPsMode];
+    
+    JsonArray bounds = doc.createNestedArray("bucket_ms");
+    for (int i = 0; i < LATENCY_BUCKET_COUNT - 1; i++) {
+        bounds.add(latencyBucketMs[i]);
+    }
+    
+    JsonObject modes = doc.createNestedObject("modes");
+    for (int m = 0; m < 3; m++) {
+        const WiFiPowerStats& stats = wifiPowerStats[m];
+        JsonObject mode = modes.createNestedObject(wifiPsNames[m]);
+        mode["time_ms"] = stats.timeMs;
+        mode["probes"] = stats.probes;
+        mode["avg_ms"] = stats.probes ? stats.totalLatencyMs / stats.probes : 0;
+        mode["max_ms"] = stats.maxLatencyMs;
+        JsonArray buckets = mode.createNestedArray("hist");
+        for (int i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+            buckets.add(stats.buckets[i]);
+        }
+    }
+    
+    char buffer[1024];
+    ArduinoJson::serializeJson(doc, buffer);
+    mqtt.publish("doorbell/wifi/power", buffer);
+}
+
+// Pulse the front door relay, then hold it for the release window; the output
+// manager plays the pattern, so the loop is not blocked. With a feedback input
+// the actuation is verified and retried by updateDoorActuation().
+void openFrontDoor(const char* source) {
+    if (replayDryRun("open_front_door", source)) {
+        return;
+    }
+    if (actuationAttempt > 0) {
+        doorCheckSampling = false;
+        publishActuation(ACTUATION_SUPERSEDED);
+    }
+    actuationId++;
+    actuationSource = source;
+    actuationStartedAt = millis();
+    actuationAttempt = 0;
+    startDoorAttempt(doorOpenPattern, sizeof(doorOpenPattern) / sizeof(doorOpenPattern[0]));
+    if (DOOR_FEEDBACK_PIN < 0) {
+        publishActuation(ACTUATION_UNVERIFIED);
+        actuationAttempt = 0;
+    }
+}
+
+// Arm the feedback check before the pattern starts, so its first switch-on is seen
+void startDoorAttempt(const OutputStep* steps, int count) {
+    actuationAttempt++;
+    if (DOOR_FEEDBACK_PIN >= 0) {
+        portENTER_CRITICAL(&doorCheckMux);
+        actuationBegin(doorCheck, DOOR_FEEDBACK_THRESHOLD, DOOR_FEEDBACK_DEBOUNCE);
+        portEXIT_CRITICAL(&doorCheckMux);
+        doorCheckSampling = true;
+        xTaskNotifyGive(doorFeedbackTask);
+    }
+    outputPattern(OUTPUT_DOOR, steps, count, 1);
+}
+
+// Background task: sample the feedback input every DOOR_FEEDBACK_SAMPLE_MS while an attempt runs
+void doorFeedbackTaskLoop(void* param) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (doorCheckSampling) {
+            uint16_t level = DOOR_FEEDBACK_MODE == FEEDBACK_CURRENT ? analogRead(DOOR_FEEDBACK_PIN) 
+                                                                    : digitalRead(DOOR_FEEDBACK_PIN) == HIGH;
+            portENTER_CRITICAL(&doorCheckMux);
+            bool confirmed = actuationSample(doorCheck, level, micros());
+            portEXIT_CRITICAL(&doorCheckMux);
+            if (confirmed) {
+                break;  // The loop task reports it
+            }
+            vTaskDelay(pdMS_TO_TICKS(DOOR_FEEDBACK_SAMPLE_MS));
+        }
+    }
+}
+
+void setupDoorFeedback() {
+    if (DOOR_FEEDBACK_PIN < 0) {
+        return;
+    }
+    pinMode(DOOR_FEEDBACK_PIN, DOOR_FEEDBACK_MODE == FEEDBACK_CONTACT ? INPUT_PULLUP : INPUT);
+    xTaskCreatePinnedToCore(doorFeedbackTaskLoop, "door_feedback", 2048, NULL, 2, &doorFeedbackTask, 0);
+}
+
+// An attempt fails when its pattern ends without feedback, or in current mode when no
+// current flows within DOOR_CURRENT_CONFIRM_MS; up to DOOR_RETRY_MAX retries follow
+void updateDoorActuation() {
+    if (actuationAttempt == 0) {
+        return;
+    }
+    portENTER_CRITICAL(&doorCheckMux);
+    ActuationCheck check = doorCheck;
+    portEXIT_CRITICAL(&doorCheckMux);
+    
+    if (check.confirmed) {
+        doorCheckSampling = false;
+        actuationsConfirmed++;
+        publishActuation(ACTUATION_CONFIRMED);
+        actuationAttempt = 0;
+        return;
+    }
+    bool noCurrent = DOOR_FEEDBACK_MODE == FEEDBACK_CURRENT && check.energized && 
+                     micros() - check.energizedUs >= DOOR_CURRENT_CONFIRM_MS * 1000UL;
+    if (!noCurrent && outputActive(OUTPUT_DOOR)) {
+        return;
+    }
+    if (actuationAttempt <= DOOR_RETRY_MAX) {
+        actuationRetries++;
+        MQTT_DEBUG_F("Door actuation %lu: no feedback, retry %d", (unsigned long)actuationId, actuationAttempt);
+        startDoorAttempt(doorRetryPattern, sizeof(doorRetryPattern) / sizeof(doorRetryPattern[0]));
+        return;
+    }
+    doorCheckSampling = false;
+    actuationsFailed++;
+    publishActuation(ACTUATION_FAILED);
+    actuationAttempt = 0;
+}
+
+// One audit record per actuation, with the feedback of its last attempt
+void publishActuation(ActuationResult result) {
+    portENTER_CRITICAL(&doorCheckMux);
+    ActuationCheck check = doorCheck;
+    portEXIT_CRITICAL(&doorCheckMux);
+    
+    char latency[16] = "null";
+    if (check.confirmed) {
+        snprintf(latency, sizeof(latency), "%.1f", check.latencyUs / 1000.0);
+    }
+    char msg[320];
+    snprintf(msg, sizeof(msg), 
+            "{\"id\":%lu,\"action\":\"open_front_door\",\"source\":\"%s\",\"feedback\":\"%s\",\"result\":\"%s\","
+            "\"attempts\":%d,\"latency_ms\":%s,\"peak\":%u,\"samples\":%lu,\"duration_ms\":%lu}", 
+            (unsigned long)actuationId, actuationSource, 
+            feedbackModeName(DOOR_FEEDBACK_PIN >= 0 ? DOOR_FEEDBACK_MODE : FEEDBACK_NONE), actuationResultName(result), 
+            actuationAttempt, latency, check.peak, check.samples, millis() - actuationStartedAt);
+    publishMessage("doorbell/audit", msg);
+}
+
+// Values automation rules can read
+int32_t ruleGetVar(uint8_t var, int32_t eventArg) {
+    switch (var) {
+        case RULE_VAR_ARG:
+            return eventArg;
+        case RULE_VAR_UPTIME:
+            return millis() / 1000;
+        case RULE_VAR_HOUR:
+        case RULE_VAR_MINUTE: {
+            time_t now = time(NULL);
+            if (now < CLOCK_VALID_EPOCH) {  // Clock not synced yet
+                return -1;
+            }
+            struct tm local;
+            localtime_r(&now, &local);
+            return var == RULE_VAR_HOUR ? local.tm_hour : local.tm_min;
+        }
+        case RULE_VAR_PLAYING:
+            return isPlaying;
+        case RULE_VAR_RELAY:
+            return outputActive(OUTPUT_DOOR);
+        default:
+            return 0;
+    }
+}
+
+// Actions automation rules can take
+void ruleAction(uint8_t action, int32_t arg, uint8_t rule) {
+    MQTT_DEBUG_F("Rule %d action %d (%ld)", rule, action, (long)arg);
+    switch (action) {
+        case RULE_ACT_OPEN_RELAY:
+            openFrontDoor("rule");
+            break;
+        case RULE_ACT_PLAY:
+            if (arg > 0) {
+                requestPlay(arg, ruleVolumeOverride >= 0 ? ruleVolumeOverride : 100);
+            }
+            break;
+        case RULE_ACT_SET_VOLUME:
+            ruleVolumeOverride = constrain(arg, 0, 100);
+            break;
+        case RULE_ACT_SUPPRESS:
+            ruleSuppressRing = true;
+            break;
+        case RULE_ACT_NOTIFY: {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "{\"rule\":%d,\"code\":%ld}", rule, (long)arg);
+            if (!replayDryRun("rule_event", msg + 8)) {
+                publishMessage("doorbell/rule/event", msg);
+            }
+            break;
+        }
+    }
+}
+
+unsigned long ruleMicros() {
+    return micros();
+}
+
+// Run the rules triggered by an event. Events raised by rule actions themselves
+// (e.g. the relay opened by a rule) are not dispatched again to avoid loops.
+void dispatchRuleEvent(uint8_t event, int32_t arg) {
+    if (ruleDispatching) {
+        return;
+    }
+    static const RuleEnv env = {ruleGetVar, ruleAction, ruleMicros};
+    ruleDispatching = true;
+    ruleDispatch(event, arg, env);
+    ruleDispatching = false;
+}
+
+// Load (hex payload) or clear (empty payload) the rule in a slot
+void handleRuleCommand(const char* slotStr, const char* message) {
+    int slot = atoi(slotStr);
+    char errorMsg[128];
+    
+    if (slot < 0 || slot >= RULE_MAX_RULES || !isdigit((unsigned char)slotStr[0])) {
+        snprintf(errorMsg, sizeof(errorMsg), "{\"status\":\"error\",\"message\":\"Invalid rule slot: %s\"}", slotStr);
+        mqtt.publish("doorbell/error", errorMsg);
+        return;
+    }
+    
+    size_t hexLen = strlen(message);
+    if (hexLen == 0) {
+        ruleClear(slot);
+        MQTT_DEBUG_F("Rule %d cleared", slot);
+        return;
+    }
+    
+    uint8_t bytecode[RULE_HEADER_SIZE + RULE_MAX_CODE];
+    const char* error = NULL;
+    if (hexLen % 2 != 0 || hexLen / 2 > sizeof(bytecode)) {
+        error = "bad payload length";
+    } else {
+        for (size_t i = 0; i < hexLen / 2 && !error; i++) {
+            char byteStr[3] = {message[i * 2], message[i * 2 + 1], '\0'};
+            char* end;
+            bytecode[i] = strtoul(byteStr, &end, 16);
+            if (*end != '\0') {
+                error = "payload is not hex";
+            }
+        }
+    }
+    
+    if (!error && ruleLoad(slot, bytecode, hexLen / 2, &error)) {
+        MQTT_DEBUG_F("Rule %d loaded (%u bytes)", slot, (unsigned)(hexLen / 2));  // Or unchanged, state kept
+        return;
+    }
+    snprintf(errorMsg, sizeof(errorMsg), "{\"status\":\"error\",\"message\":\"Rule %d rejected: %s\"}", slot, error);
+    mqtt.publish("doorbell/error", errorMsg);
+}
+
+// Publish execution metrics for every loaded rule
+void publishRuleStats() {
+    DynamicJsonDocument doc(1024);
+    JsonArray list = doc.createNestedArray("rules");
+    
+    for (int i = 0; i < RULE_MAX_RULES; i++) {
+        const Rule& rule = rules[i];
+        if (!rule.loaded) {
+            continue;
+        }
+        JsonObject entry = list.createNestedObject();
+        entry["slot"] = i;
+        entry["event"] = rule.event;
+        entry["code_len"] = rule.codeLen;
+        entry["runs"] = rule.runs;
+        entry["actions"] = rule.actions;
+        entry["errors"] = rule.errors;
+        entry["avg_us"] = rule.runs ? rule.totalMicros / rule.runs : 0;
+        entry["max_us"] = rule.maxMicros;
+    }
+    
+    char buffer[1024];
+    ArduinoJson::serializeJson(doc, buffer);
+    mqtt.publish("doorbell/rules", buffer);
+}
+
+// Publish direct push delivery counters and latency
+void publishNotifierStats() {
+#if FEATURE_NOTIFIER
+    if (!notifierEnabled()) {
+        return;
+    }
+    NotifierStats stats;
+    notifierGetStats(stats);
+    char msg[256];
+    snprintf(msg, sizeof(msg), 
+            "{\"queued\":%lu,\"sent\":%lu,\"failed\":%lu,\"dropped\":%lu,\"retries\":%lu,\"depth\":%d,\"last_ms\":%lu,\"avg_ms\":%lu,\"max_ms\":%lu}", 
+            stats.queued, stats.sent, stats.failed, stats.dropped, 
+            stats.retries, notifierQueueDepth(), stats.lastLatencyMs, 
+            stats.sent ? stats.totalLatencyMs / stats.sent : 0, stats.maxLatencyMs);
+    mqtt.publish("doorbell/notify/stats", msg);
+#endif
+}
+
+// Schema-encoded doorbell/event; status is one of ButtonEvent_status_names
+void publishCborEvent(int buttonIndex, const char* status, int track, int volume, int count) {
+    ButtonEventMsg msg;
+    int statusIndex = schemaEnumIndex(ButtonEvent_status_names, BUTTON_EVENT_STATUS_COUNT, status);
+    if (statusIndex < 0) {
+        // Not in the schema: publishing it as another status would misreport the press
+        char errorMsg[128];
+        snprintf(errorMsg, sizeof(errorMsg), "{\"status\":\"error\",\"message\":\"Event status not in schema: %s\"}", status);
+        mqtt.publish("doorbell/error", errorMsg);
+        return;
+    }
+    msg.button = buttonIndex == 0 ? BUTTON_EVENT_BUTTON_DOWNSTAIRS : BUTTON_EVENT_BUTTON_DOOR;
+    msg.status = statusIndex;
+    msg.track = track;
+    msg.volume = volume;
+    msg.count = count;
+    snprintf(msg.press_id, sizeof(msg.press_id), "%04x-%lu", bootNonce, (unsigned long)currentPressId);
+    msg.t_press = epochMillis(currentPressMillis);
+    msg.ts = epochMillis(millis());
+    
+    uint8_t buffer[SCHEMA_MAX_MESSAGE_SIZE];
+    size_t len = encodeButtonEvent(msg, buffer, sizeof(buffer));
+    publishMessage(SCHEMA_TOPIC_PREFIX "event", buffer, len);
+}
+
+// Publish doorbell/timer/status in the configured wire format
+void publishTimerStatus(uint8_t status, unsigned long seconds, int track, int volume, const char* message) {
+    if (config.cbor_enabled) {
+        TimerStatusMsg msg;
+        msg.status = status;
+        msg.seconds = seconds;
+        msg.track = track;
+        msg.volume = volume;
+        strlcpy(msg.message, message ? message : "", sizeof(msg.message));
+        uint8_t buffer[SCHEMA_MAX_MESSAGE_SIZE];
+        size_t len = encodeTimerStatus(msg, buffer, sizeof(buffer));
+        publishMessage(SCHEMA_TOPIC_PREFIX "timer/status", buffer, len);
+        return;
+    }
+    
+    char statusMsg[128];
+    if (status == TIMER_STATUS_STATUS_STARTED || status == TIMER_STATUS_STATUS_ENDED) {
+        snprintf(statusMsg, sizeof(statusMsg), 
+                "{\"status\":\"%s\",\"seconds\":%lu,\"track\":%d,\"volume\":%d}", 
+                TimerStatus_status_names[status], seconds, track, volume);
+    } else if (message) {
+        snprintf(statusMsg, sizeof(statusMsg), "{\"status\":\"%s\",\"message\":\"%s\"}", 
+                TimerStatus_status_names[status], message);
+    } else {
+        snprintf(statusMsg, sizeof(statusMsg), "{\"status\":\"%s\"}", TimerStatus_status_names[status]);
+    }
+    publishMessage("doorbell/timer/status", statusMsg);
+}
+
+// Start the countdown timer (doorbell/timer/set or the TimerSet command)
+void startTimer(int seconds, int track, int volume) {
+    if (timer.active) {
+        publishTimerStatus(TIMER_STATUS_STATUS_ERROR, 0, 0, 0, "Timer already active");
+        MQTT_DEBUG("Error: Timer already active");
+        return;
+    }
+    if (seconds <= 0) {
+        publishTimerStatus(TIMER_STATUS_STATUS_ERROR, 0, 0, 0, "Invalid duration");
+        MQTT_DEBUG("Error: Invalid timer duration");
+        return;
+    }
+    
+    char detail[16];
+    snprintf(detail, sizeof(detail), "%d", seconds);
+    if (replayDryRun("timer", detail)) {
+        return;
+    }
+    
+    timer.active = true;
+    timer.startTime = millis();
+    timer.durationMs = (unsigned long)seconds * 1000;
+    timer.track = track;
+    timer.volume = volume;
+    
+    publishTimerStatus(TIMER_STATUS_STATUS_STARTED, seconds, timer.track, timer.volume, NULL);
+    MQTT_DEBUG_F("Timer started for %d seconds", seconds);
+}
+
+// Queue a track for the main loop to play once the player is free
+void requestPlay(int track, int volume) {
+    char detail[16];
+    snprintf(detail, sizeof(detail), "%d", track);
+    if (replayDryRun("chime", detail)) {
+        return;
+    }
+    playRequest.pending = true;
+    playRequest.track = track;
+    playRequest.volume = volume;
+}
+
+// Schema-encoded commands on doorbell/cbor/cmd; the message id selects the command
+void handleCborCommand(const uint8_t* payload, unsigned int length) {
+    switch (schemaMessageId(payload, length)) {
+        case MSG_TIMER_SET: {
+            TimerSetMsg msg;
+            if (decodeTimerSet(payload, length, msg)) {
+                startTimer(msg.seconds > INT32_MAX ? 0 : (int)msg.seconds, msg.track, msg.volume);
+                return;
+            }
+            break;
+        }
+        case MSG_PLAY: {
+            PlayMsg msg;
+            if (decodePlay(payload, length, msg) && msg.track > 0) {
+                requestPlay(msg.track, min((int)msg.volume, 100));
+                return;
+            }
+            break;
+        }
+        case MSG_SIMULATE: {
+            SimulateMsg msg;
+            if (decodeSimulate(payload, length, msg)) {
+                handleSimulatedButton(msg.button == SIMULATE_BUTTON_DOOR ? BUTTON_DOOR : BUTTON_DOWNSTAIRS);
+                return;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    mqtt.publish("doorbell/error", "{\"status\":\"error\",\"message\":\"Invalid CBOR command\"}");
+}
+
+// Time encoding and decoding of a typical doorbell/event as JSON (the current
+// snprintf/ArduinoJson path) and as schema CBOR, and publish per-message costs
+void runCodecBenchmark() {
+    ButtonEventMsg msg = {BUTTON_EVENT_BUTTON_DOOR, BUTTON_EVENT_STATUS_PLAYED, 2, 80, 1, "3f2a-17", 
+                          1760000000123ULL, 1760000000171ULL};
+    char json[256];
+    uint8_t cbor[SCHEMA_MAX_MESSAGE_SIZE];
+    int jsonLen = 0;
+    size_t cborLen = 0;
+    volatile bool ok = true;  // Keeps the decode loops from being optimized away
+    
+    unsigned long start = micros();
+    for (int i = 0; i < CODEC_BENCH_ITERATIONS; i++) {
+        jsonLen = snprintf(json, sizeof(json), 
+                "{\"type\":\"button_press\",\"button\":\"%s\",\"track\":%d,\"volume\":%d,\"press_id\":\"%s\",\"t_press\":%llu,\"ts\":%llu}", 
+                ButtonEvent_button_names[msg.button], msg.track, msg.volume, msg.press_id, 
+                (unsigned long long)msg.t_press, (unsigned long long)msg.ts);
+    }
+    unsigned long jsonEncodeUs = micros() - start;
+    
+    start = micros();
+    for (int i = 0; i < CODEC_BENCH_ITERATIONS; i++) {
+        DynamicJsonDocument doc(256);
+        ok = !deserializeJson(doc, (const char*)json) && ok;  // const: copy strings like the command path
+    }
+    unsigned long jsonDecodeUs = micros() - start;
+    
+    start = micros();
+    for (int i = 0; i < CODEC_BENCH_ITERATIONS; i++) {
+        cborLen = encodeButtonEvent(msg, cbor, sizeof(cbor));
+    }
+    unsigned long cborEncodeUs = micros() - start;
+    
+    start = micros();
+    for (int i = 0; i < CODEC_BENCH_ITERATIONS; i++) {
+        ButtonEventMsg decoded;
+        ok = decodeButtonEvent(cbor, cborLen, decoded) && ok;
+    }
+    unsigned long cborDecodeUs = micros() - start;
+    
+    char result[256];
+    snprintf(result, sizeof(result), 
+            "{\"iterations\":%d,\"json_bytes\":%d,\"cbor_bytes\":%u,\"json_encode_us\":%.2f,\"json_decode_us\":%.2f,"
+            "\"cbor_encode_us\":%.2f,\"cbor_decode_us\":%.2f,\"ok\":%s}", 
+            CODEC_BENCH_ITERATIONS, jsonLen, (unsigned)cborLen, 
+            (float)jsonEncodeUs / CODEC_BENCH_ITERATIONS, (float)jsonDecodeUs / CODEC_BENCH_ITERATIONS, 
+            (float)cborEncodeUs / CODEC_BENCH_ITERATIONS, (float)cborDecodeUs / CODEC_BENCH_ITERATIONS, 
+            ok ? "true" : "false");
+    mqtt.publish("doorbell/codec/bench", result);
+}
+
+// Publish device output upstream; during an outage it goes to LAN clients of the
+// fallback broker and is queued for upstream. While the broker is still bridging
+// after upstream returned, LAN clients get a copy as well.
+bool publishMessage(const char* topic, const uint8_t* payload, unsigned int length, bool retain) {
+#if FEATURE_FALLBACK_BROKER
+    if (fallbackBrokerActive) {
+        brokerPublish(topic, payload, length, retain);
+    }
+#endif
+    if (mqtt.connected()) {
+        return mqtt.publish(topic, payload, length, retain);
+    }
+#if FEATURE_FALLBACK_BROKER
+    if (fallbackBrokerActive) {
+        queueOutageMessage(topic, payload, length, retain);
+        return true;
+    }
+#endif
+    return false;
+}
+
+bool publishMessage(const char* topic, const char* payload, bool retain) {
+    return publishMessage(topic, (const uint8_t*)payload, strlen(payload), retain);
+}
+
+#if FEATURE_FALLBACK_BROKER
+// Hold a message for upstream; the oldest is overwritten when the queue is full
+void queueOutageMessage(const char* topic, const uint8_t* payload, unsigned int length, bool retain) {
+    if (strlen(topic) >= OUTAGE_TOPIC_SIZE || length > OUTAGE_PAYLOAD_SIZE) {
+        outageDropped++;
+        return;
+    }
+    if (outageCount == OUTAGE_QUEUE_SIZE) {
+        outageHead = (outageHead + 1) % OUTAGE_QUEUE_SIZE;
+        outageCount--;
+        outageDropped++;
+    }
+    OutageMessage& entry = outageQueue[(outageHead + outageCount) % OUTAGE_QUEUE_SIZE];
+    strlcpy(entry.topic, topic, sizeof(entry.topic));
+    memcpy(entry.payload, payload, length);
+    entry.length = length;
+    entry.retain = retain;
+    outageCount++;
+}
+
+// Replay queued messages upstream in order; stops at the first failed publish
+void flushOutageQueue() {
+    while (outageCount > 0 && mqtt.connected()) {
+        OutageMessage& entry = outageQueue[outageHead];
+        if (!mqtt.publish(entry.topic, entry.payload, entry.length, entry.retain)) {
+            break;
+        }
+        outageHead = (outageHead + 1) % OUTAGE_QUEUE_SIZE;
+        outageCount--;
+        outageFlushed++;
+    }
+}
+
+// Broker transport over the WiFiServer connections
+size_t brokerSend(uint8_t client, const uint8_t* data, size_t len) {
+    return brokerClients[client].write(data, len);
+}
+
+void brokerClose(uint8_t client) {
+    brokerClients[client].stop();
+    brokerSlotOpen[client] = false;
+}
+
+unsigned long brokerMillis() {
+    return millis();
+}
+
+// LAN clients use the same credentials as the upstream broker
+bool brokerAuthenticate(const char* user, const char* password) {
+    return config.mqtt_user[0] == '\0' || 
+           (strcmp(user, config.mqtt_user) == 0 && strcmp(password, config.mqtt_password) == 0);
+}
+
+// LAN client publish: device command topics run locally, everything else goes
+// upstream directly when it is back, or waits in the outage queue
+void onBrokerPublish(const char* topic, const uint8_t* payload, size_t length, bool retain) {
+    for (int i = 0; i < deviceSubscriptionCount; i++) {
+        if (brokerTopicMatches(deviceSubscriptions[i], topic)) {
+            callback((char*)topic, (byte*)payload, length);
+            return;
+        }
+    }
+    if (mqtt.connected()) {
+        mqtt.publish(topic, payload, length, retain);
+    } else {
+        queueOutageMessage(topic, payload, length, retain);
+    }
+}
+
+void setupFallbackBroker() {
+    BrokerIO io = {brokerSend, brokerClose, brokerMillis, brokerAuthenticate, onBrokerPublish};
+    brokerBegin(io);
+}
+
+void startFallbackBroker() {
+    brokerServer.begin();
+    brokerServer.setNoDelay(true);
+    MDNS.addService("mqtt", "tcp", BROKER_PORT);
+    fallbackBrokerActive = true;
+    fallbackActivations++;
+    brokerIdleSince = currentTime;
+    DEBUG_PRINTLN("Upstream MQTT unreachable, fallback broker started");
+}
+
+void stopFallbackBroker() {
+    brokerStop();  // Closes every client through brokerClose()
+    brokerServer.end();
+    mdns_service_remove("_mqtt", "_tcp");
+    fallbackBrokerActive = false;
+    MQTT_DEBUG_F("Fallback broker stopped, %lu messages replayed upstream", outageFlushed);
+}
+
+// Accept new LAN clients and feed received bytes to the broker core
+void serviceFallbackBroker() {
+    WiFiClient incoming = brokerServer.available();
+    if (incoming) {
+        int slot = brokerAccept();
+        if (slot < 0) {
+            incoming.stop();  // All slots taken
+        } else {
+            brokerClients[slot] = incoming;
+            brokerClients[slot].setNoDelay(true);
+            brokerSlotOpen[slot] = true;
+        }
+    }
     
-    // Check WiFi every 30 seconds
-    if (currentTime - lastWiFiCheck >= 30000) {
-        lastWiFiCheck = currentTime;
+    uint8_t buffer[128];
+    for (int i = 0; i < BROKER_MAX_CLIENTS; i++) {
+        for (int chunk = 0; chunk < BROKER_READ_CHUNKS && brokerSlotOpen[i]; chunk++) {
+            int available = brokerClients[i].available();
+            if (available <= 0) {
+                break;
+            }
+            int n = brokerClients[i].read(buffer, min(available, (int)sizeof(buffer)));
+            if (n > 0) {
+                brokerReceive(i, buffer, n);
+            }
+        }
+        if (brokerSlotOpen[i] && !brokerClients[i].connected()) {
+            brokerDisconnected(i);
+            brokerClients[i].stop();
+            brokerSlotOpen[i] = false;
+        }
+    }
+    brokerPoll();
+}
+
+void updateFallbackBroker() {
+    bool upstream = mqtt.connected();
+    if (upstream) {
+        if (upstreamLost) {
+            upstreamBackAt = currentTime;
+        }
+        upstreamLost = false;
+        if (outageCount > 0) {
+            flushOutageQueue();
+        }
+    } else if (!upstreamLost) {
+        upstreamLost = true;
+        upstreamLostAt = currentTime;
+    }
+    
+    if (!fallbackBrokerActive) {
+        if (upstreamLost && WiFi.status() == WL_CONNECTED && 
+            currentTime - upstreamLostAt >= BROKER_FALLBACK_DELAY_MS) {
+            startFallbackBroker();
+        }
+        return;
+    }
+    
+    serviceFallbackBroker();
+    
+    // Keep bridging while LAN clients remain, then hand everything back to upstream.
+    // Only device output and LAN publishes reach LAN clients, not upstream traffic,
+    // so clients that stay are closed after a while and reconnect upstream.
+    if (upstream && currentTime - upstreamBackAt >= BROKER_HANDBACK_MAX_MS) {
+        stopFallbackBroker();
+    } else if (!upstream || brokerClientCount() > 0) {
+        brokerIdleSince = currentTime;
+    } else if (currentTime - brokerIdleSince >= BROKER_IDLE_STOP_MS) {
+        stopFallbackBroker();
+    }
+}
+
+// Publish fallback broker counters (once it has been used)
+void publishBrokerStats() {
+    if (fallbackActivations == 0) {
+        return;
+    }
+    char msg[320];
+    snprintf(msg, sizeof(msg), 
+            "{\"active\":%s,\"activations\":%lu,\"clients\":%d,\"connects\":%lu,\"rejected\":%lu,\"in\":%lu,\"out\":%lu,"
+            "\"dropped\":%lu,\"queued\":%d,\"replayed\":%lu,\"queue_dropped\":%lu,\"memory\":%u}", 
+            fallbackBrokerActive ? "true" : "false", fallbackActivations, brokerClientCount(), 
+            brokerStats.connects, brokerStats.rejected, brokerStats.messagesIn, brokerStats.messagesOut, 
+            brokerStats.dropped, outageCount, outageFlushed, outageDropped, 
+            (unsigned)(brokerMemoryFootprint() + sizeof(outageQueue)));
+    mqtt.publish("doorbell/broker/stats", msg);
+}
+
+#else
+void setupFallbackBroker() {}
+void updateFallbackBroker() {}
+void publishBrokerStats() {}
+#endif
+
+// Where the last upstream connect went and how long each phase took
+void publishConnectStats() {
+    const ConnectTiming& timing = lastConnectTiming;
+    char msg[384];
+    snprintf(msg, sizeof(msg), 
+            "{\"server\":\"%s\",\"address\":\"%s\",\"dns\":\"%s\",\"dns_ms\":%lu,\"tcp_ms\":%lu,\"mqtt_ms\":%lu,"
+            "\"total_ms\":%lu,\"raced\":%d,\"wins\":{\"primary\":%lu,\"backup\":%lu},\"failures\":%lu,"
+            "\"dns_cache\":{\"hits\":%lu,\"stale\":%lu,\"misses\":%lu,\"refreshes\":%lu,\"failures\":%lu}}", 
+            connectTargetNames[timing.winner], timing.address.toString().c_str(), dnsSourceNames[timing.dnsSource], 
+            timing.dnsMs, timing.tcpMs, lastConnectMqttMs, timing.dnsMs + timing.tcpMs + lastConnectMqttMs, 
+            timing.attempted, connectWins[0], connectWins[1], connectFailures, 
+            dnsStats.hits, dnsStats.staleHits, dnsStats.misses, dnsStats.refreshes, dnsStats.failures);
+    mqtt.publish("doorbell/mqtt/connect", msg, true);
+}
+
+#if FEATURE_MQTT5
+// Protocol traffic since boot, against what the same messages cost in 3.1.1
+void publishMqttStats() {
+    const Mqtt5Client& session = mqtt.session();
+    const Mqtt5Stats& stats = session.stats;
+    char msg[512];
+    snprintf(msg, sizeof(msg), 
+            "{\"protocol\":%u,\"session_present\":%s,\"server_alias_max\":%u,\"aliases\":%u,"
+            "\"out\":{\"messages\":%lu,\"bytes\":%lu,\"v311_bytes\":%lu,\"alias_hits\":%lu},"
+            "\"in\":{\"messages\":%lu,\"bytes\":%lu,\"v311_bytes\":%lu,\"alias_hits\":%lu},"
+            "\"acks\":%lu,\"oversized\":%lu,\"errors\":%lu}", 
+            session.protocol, session.sessionPresent ? "true" : "false", session.serverAliasMax, session.aliasCount, 
+            stats.messagesOut, stats.bytesOut, stats.v311BytesOut, stats.aliasHits, 
+            stats.messagesIn, stats.bytesIn, stats.v311BytesIn, stats.inboundAliasHits, 
+            mqtt.acksSent(), stats.oversized, stats.protocolErrors);
+    mqtt.publish("doorbell/mqtt/stats", msg, true);
+}
+#else
+void publishMqttStats() {}
+#endif
+
+// Redundant pair: UDP transport, warm state and role changes for the pair core
+bool pairSend(const uint8_t* data, size_t len) {
+    if (WiFi.status() != WL_CONNECTED) {
+        return false;
+    }
+    // Broadcast until the peer answers, so neither unit needs the other's address
+    IPAddress target = (uint32_t)pairPeerIp ? pairPeerIp : IPAddress(255, 255, 255, 255);
+    if (!pairUdp.beginPacket(target, PAIR_UDP_PORT)) {
+        return false;
+    }
+    pairUdp.write(data, len);
+    return pairUdp.endPacket();
+}
+
+unsigned long pairMillis() {
+    return millis();
+}
+
+bool pairLinkUp() {
+    return WiFi.status() == WL_CONNECTED;
+}
+
+bool pairBrokerUp() {
+    return pairLeaseMqtt.connected();
+}
+
+bool pairSendLease(const char* lease, size_t len) {
+    return pairLeaseMqtt.publish(PAIR_LEASE_TOPIC, (const uint8_t*)lease, len, true);
+}
+
+void pairLeaseCallback(char* topic, byte* payload, unsigned int length) {
+    pairLeaseReceive(pairNode, (const char*)payload, length);
+}
+
+// Active: the copy of the settings the core replicates
+void pairSettingsFromConfig() {
+    pairSettings.downstairs_track = config.downstairs_track;
+    pairSettings.door_track = config.door_track;
+    pairSettings.downstairs_volume = config.downstairs_volume;
+    pairSettings.door_volume = config.door_volume;
+    pairSettings.button_cooldown_ms = config.button_cooldown_ms;
+    pairSettings.volume_reset_ms = config.volume_reset_ms;
+    pairSettings.downstairs_cooldown_ms = config.downstairs_cooldown_ms;
+    pairSettings.door_cooldown_ms = config.door_cooldown_ms;
+    pairSettings.downstairs_policy = config.downstairs_policy;
+    pairSettings.door_policy = config.door_policy;
+    pairSettings.cbor_enabled = config.cbor_enabled;
+    pairSettings.ambient_enabled = config.ambient_enabled;
+    pairSettings.ambient_min_volume = config.ambient_min_volume;
+    pairSettings.ambient_max_volume = config.ambient_max_volume;
+    memcpy(pairSettings.ntfy_url, config.ntfy_url, sizeof(pairSettings.ntfy_url));
+}
+
+// Standby: apply settings that replicated as a whole
+void pairSettingsToConfig() {
+    config.downstairs_track = pairSettings.downstairs_track;
+    config.door_track = pairSettings.door_track;
+    config.downstairs_volume = pairSettings.downstairs_volume;
+    config.door_volume = pairSettings.door_volume;
+    config.button_cooldown_ms = pairSettings.button_cooldown_ms;
+    config.volume_reset_ms = pairSettings.volume_reset_ms;
+    config.downstairs_cooldown_ms = pairSettings.downstairs_cooldown_ms;
+    config.door_cooldown_ms = pairSettings.door_cooldown_ms;
+    config.downstairs_policy = pairSettings.downstairs_policy;
+    config.door_policy = pairSettings.door_policy;
+    config.cbor_enabled = pairSettings.cbor_enabled;
+    config.ambient_enabled = pairSettings.ambient_enabled;
+    config.ambient_min_volume = pairSettings.ambient_min_volume;
+    config.ambient_max_volume = pairSettings.ambient_max_volume;
+    memcpy(config.ntfy_url, pairSettings.ntfy_url, sizeof(config.ntfy_url));
+    config.ntfy_url[sizeof(config.ntfy_url) - 1] = '\0';
+}
+
+void pairRoleChanged(PairRole role, PairReason reason) {
+    pairRoleSince = millis();
+    if (role == PAIR_ACTIVE) {
+        // Carry on with the failed unit's timer and cooldowns, converted to our clock
+        if (pairWarmValid) {
+            timer = pairWarm.timer;
+            timer.startTime = pairPeerToLocal(pairNode, pairWarm.timer.startTime);
+            for (int i = 0; i < 2; i++) {
+                ringStates[i] = pairWarm.rings[i];
+                ringStates[i].lastRingTime = pairPeerToLocal(pairNode, pairWarm.rings[i].lastRingTime);
+            }
+        }
+        // Connect right away rather than after the reconnect back-off
+        lastMQTTReconnect = millis() - 30000;
+        DEBUG_PRINTF("Pair: active in term %lu after %lu ms without an active unit\n", 
+                     (unsigned long)pairNode.term, pairNode.stats.lastTakeoverMs);
+        return;
+    }
+    // Outranked by the other active unit, which rings and talks to the broker from now on
+    DEBUG_PRINTF("Pair: standby, outranked in term %lu\n", (unsigned long)pairNode.term);
+    mqtt.disconnect();
+#if FEATURE_FALLBACK_BROKER
+    if (fallbackBrokerActive) {
+        stopFallbackBroker();
+    }
+#endif
+    timer.active = false;
+    pairWarmValid = false;
+    pairCatchUpCount = 0;
+}
+
+void pairRegionReplicated(int region) {
+    if (region == pairSettingsRegion) {
+        // The active unit's settings, stored like any other config change
+        pairSettingsToConfig();
+        requestConfigSave();
+#if FEATURE_NOTIFIER
+        notifierConfigure(config.ntfy_url);
+#endif
+    } else if (region == pairWarmRegion) {
+        pairWarmValid = true;
+    }
+}
+
+void pairCatchUp(int button, unsigned long at) {
+    if (pairCatchUpCount == 0) {
+        pairCatchUpsAt = millis();
+    }
+    if (pairCatchUpCount < PAIR_MAX_CATCHUPS) {
+        pairCatchUps[pairCatchUpCount].button = button;
+        pairCatchUps[pairCatchUpCount].at = at;
+        pairCatchUpCount++;
+    }
+}
+
+void setupPair() {
+    if (PAIR_UDP_PORT < 0) {
+        return;
+    }
+    static const PairIO io = {pairSend, pairMillis, pairLinkUp, pairRoleChanged, pairRegionReplicated, pairCatchUp, 
+                              pairBrokerUp, pairSendLease};
+    // NIC bytes of the MAC (bits 24-47); the low 32 bits are mostly the OUI, shared by a whole batch
+    pairBegin(pairNode, io, (uint32_t)(ESP.getEfuseMac() >> 16), PAIR_PRIORITY, PAIR_KEY, esp_random());
+    pairSettingsFromConfig();
+    pairSettingsRegion = pairAddRegion(pairNode, "settings", &pairSettings, sizeof(pairSettings));
+    pairWarmRegion = pairAddRegion(pairNode, "warm", &pairWarm, sizeof(pairWarm));
+    pairUdp.begin(PAIR_UDP_PORT);
+    pairLeaseMqtt.setCallback(pairLeaseCallback);
+    pairLeaseMqtt.setKeepAlive(PAIR_LEASE_KEEPALIVE_S);
+    pairLeaseMqtt.setSocketTimeout(1);
+    pairRoleSince = millis();
+}
+
+// Keep the lease connection up; an active unit leaves a released lease as its last will
+void updatePairLease() {
+    if (pairLeaseMqtt.connected()) {
+        if (pairLeaseRole == pairNode.role) {
+            pairLeaseMqtt.loop();
+            return;
+        }
+        if (pairLeaseRole == PAIR_ACTIVE) {
+            // Yielded: release our lease rather than leave it to age
+            char lease[PAIR_LEASE_SIZE];
+            size_t len = pairLeaseMessage(pairNode, false, lease, sizeof(lease));
+            if (len) {
+                pairSendLease(lease, len);
+            }
+        }
+        pairLeaseMqtt.disconnect();  // Reconnect with the last will of the new role
+    }
+    if (WiFi.status() != WL_CONNECTED || millis() - pairLeaseAttemptAt < PAIR_LEASE_RETRY_MS) {
+        return;
+    }
+    pairLeaseAttemptAt = millis();
+    // Cached address only; a miss queues a lookup for the next attempt
+    IPAddress address;
+    if (!dnsResolve(config.mqtt_server, address, false, NULL) || 
+        !pairLeaseClient.connect(address, (uint16_t)atoi(config.mqtt_port), PAIR_LEASE_CONNECT_MS)) {
+        return;
+    }
+    char clientId[32];
+    snprintf(clientId, sizeof(clientId), "%s-lease", deviceId);
+    char will[PAIR_LEASE_SIZE];
+    pairLeaseRole = pairNode.role;
+    bool connected;
+    if (pairLeaseRole == PAIR_ACTIVE && pairLeaseMessage(pairNode, false, will, sizeof(will))) {
+        connected = pairLeaseMqtt.connect(clientId, config.mqtt_user, config.mqtt_password, 
+                                          PAIR_LEASE_TOPIC, 0, true, will);
+    } else {
+        connected = pairLeaseMqtt.connect(clientId, config.mqtt_user, config.mqtt_password);
+    }
+    if (connected) {
+        pairLeaseMqtt.subscribe(PAIR_LEASE_TOPIC);
+    } else {
+        pairLeaseClient.stop();
+    }
+}
+
+bool pairActive() {
+    return PAIR_UDP_PORT < 0 || pairNode.role == PAIR_ACTIVE;
+}
+
+void updatePair() {
+    if (PAIR_UDP_PORT < 0) {
+        return;
+    }
+    uint8_t packet[PAIR_PACKET_SIZE];
+    while (pairUdp.parsePacket() > 0) {
+        int len = pairUdp.read(packet, sizeof(packet));
+        IPAddress from = pairUdp.remoteIP();
+        if (len > 0 && (uint32_t)from != (uint32_t)WiFi.localIP()) {
+            // Unicast to the sender only once the core accepted its packet
+            unsigned long received = pairNode.stats.packetsReceived;
+            pairReceive(pairNode, packet, len);
+            if (pairNode.stats.packetsReceived != received) {
+                pairPeerIp = from;
+            }
+        }
+    }
+    // Back to broadcast if the peer went quiet, in case it comes back on another address
+    if (pairNode.peerSeen && millis() - pairNode.peerHeardAt > PAIR_LEASE_MS) {
+        pairPeerIp = IPAddress();
+    }
+    updatePairLease();
+    // Keep the replicated copies current; the core sends the blocks that changed
+    if (pairNode.role == PAIR_ACTIVE) {
+        pairSettingsFromConfig();
+        pairWarm.timer = timer;
+        pairWarm.rings[0] = ringStates[0];
+        pairWarm.rings[1] = ringStates[1];
+    }
+    pairUpdate(pairNode);
+}
+
+void dispatchPairCatchUps() {
+    // Hold them until their events can be published, but ring them even if the broker stays away
+    if (pairCatchUpCount == 0 || (!mqtt.connected() && millis() - pairCatchUpsAt < PAIR_CATCHUP_HOLD_MS)) {
+        return;
+    }
+    for (int i = 0; i < pairCatchUpCount; i++) {
+        MQTT_DEBUG_F("Pair: ringing a press of button %d the failed unit missed (%lu ms ago)", 
+                     pairCatchUps[i].button, currentTime - pairCatchUps[i].at);
+        pressDetectedAt = pairCatchUps[i].at;
+        handleNormalDoorbell(pairCatchUps[i].button);
+    }
+    pairCatchUpCount = 0;
+}
+
+// Role, peer and replication counters of a redundant pair (published by the active unit)
+void publishPairStatus() {
+    if (PAIR_UDP_PORT < 0) {
+        return;
+    }
+    const PairStats& stats = pairNode.stats;
+    char msg[768];
+    snprintf(msg, sizeof(msg), 
+            "{\"role\":\"%s\",\"term\":%lu,\"priority\":%u,\"role_s\":%lu,"
+            "\"peer\":{\"seen\":%s,\"role\":\"%s\",\"heard_ms\":%lu},\"in_sync\":%s,"
+            "\"takeovers\":%lu,\"last_takeover_ms\":%lu,\"yields\":%lu,\"conflicts\":%lu,\"max_gap_ms\":%lu,"
+            "\"lease\":{\"connected\":%s,\"sent\":%lu,\"holds\":%lu},"
+            "\"presses_confirmed\":%lu,\"presses_caught_up\":%lu,\"blocks_sent\":%lu,\"blocks_applied\":%lu,"
+            "\"packets_sent\":%lu,\"packets_received\":%lu,\"bytes_sent\":%lu,\"mismatched\":%lu,\"malformed\":%lu,"
+            "\"unauthenticated\":%lu,\"stale\":%lu,\"duplicate_ids\":%lu}", 
+            pairRoleName(pairNode.role), (unsigned long)pairNode.term, pairNode.priority, (millis() - pairRoleSince) / 1000, 
+            pairNode.peerSeen ? "true" : "false", pairRoleName(pairNode.peerRole), 
+            pairNode.peerSeen ? millis() - pairNode.peerHeardAt : 0, pairInSync(pairNode) ? "true" : "false", 
+            stats.takeovers, stats.lastTakeoverMs, stats.yields, stats.conflicts, stats.maxGapMs, 
+            pairLeaseMqtt.connected() ? "true" : "false", stats.leasesSent, stats.brokerHolds, 
+            stats.confirmed, stats.caughtUp, stats.blocksSent, stats.blocksApplied, 
+            stats.packetsSent, stats.packetsReceived, stats.bytesSent, stats.mismatched, stats.malformed, 
+            stats.unauthenticated, stats.stale, stats.duplicateIds);
+    mqtt.publish("doorbell/pair", msg, true);
+}
+
+#ifdef INPUT_MODE_ANALOG
+// Report a line fault being raised or cleared
+void publishLineFault(int line) {
+    const LineMonitor& monitor = lineMonitors[line];
+    char msg[192];
+    snprintf(msg, sizeof(msg), 
+            "{\"line\":\"%s\",\"fault\":\"%s\",\"quarantined\":%s,\"voltage\":%.2f,\"idle_v\":%.2f,\"noise_v\":%.3f}", 
+            line == 0 ? "downstairs" : "door", lineFaultName(monitor.fault), monitor.quarantined ? "true" : "false", 
+            monitor.lastVoltage, monitor.idleLevel, monitor.noise);
+    publishMessage("doorbell/line/fault", msg);
+    DEBUG_PRINTF("Line %d fault: %s\n", line, lineFaultName(monitor.fault));
+}
+
+// Per-line statistics since the previous health report (retained)
+void publishLineHealth() {
+    char msg[640];
+    int len = snprintf(msg, sizeof(msg), "{");
+    for (int i = 0; i < 2; i++) {
+        LineMonitor& monitor = lineMonitors[i];
+        len += snprintf(msg + len, sizeof(msg) - len, 
+                "%s\"%s\":{\"fault\":\"%s\",\"quarantined\":%s,\"idle_v\":%.2f,\"learned_v\":%.2f,\"noise_v\":%.3f,"
+                "\"min_v\":%.2f,\"max_v\":%.2f,\"samples\":%lu,\"raised\":{", 
+                i ? "," : "", i == 0 ? "downstairs" : "door", lineFaultName(monitor.fault), 
+                monitor.quarantined ? "true" : "false", monitor.idleLevel, monitor.learnedLevel, monitor.noise, 
+                monitor.windowMin, monitor.windowMax, monitor.samples);
+        for (int f = LINE_OK + 1; f < LINE_FAULT_COUNT; f++) {
+            len += snprintf(msg + len, sizeof(msg) - len, "%s\"%s\":%lu", 
+                    f > LINE_OK + 1 ? "," : "", lineFaultName((LineFault)f), monitor.raised[f]);
+        }
+        len += snprintf(msg + len, sizeof(msg) - len, "}}");
+        lineMonitorResetWindow(monitor);
+    }
+    snprintf(msg + len, sizeof(msg) - len, "}");
+    mqtt.publish("doorbell/line/health", msg, true);
+}
+
+// Feature summary of a finished session; published for every analyzed session
+void publishSessionSummary(const ADCSession& session, int button) {
+    const SessionFeatures& f = session.features;
+    char msg[448];
+    snprintf(msg, sizeof(msg), 
+            "{\"device\":\"%s\",\"id\":%lu,\"button\":%d,\"line\":\"%s\",\"duration_ms\":%lu,\"samples\":%u,\"rise_ms\":%lu,"
+            "\"peak_v\":%.2f,\"plateau_v\":%.2f,\"ripple_v\":%.3f,\"dropouts\":%u,\"longest_dropout_ms\":%lu,"
+            "\"correlation\":%.2f,\"confidence\":%.2f,\"dump\":%s}", 
+            deviceId, session.id, button, f.line == 1 ? "door" : f.line == 0 ? "downstairs" : "none", 
+            session.endTime - session.startTime, f.samples, featuresRiseMs(f), f.peak, featuresPlateau(f), 
+            featuresRipple(f), f.dropouts, f.longestDropoutMs, featuresCorrelation(f), featuresConfidence(f), 
+            session.dump ? "true" : "false");
+    publishMessage("doorbell/session", msg);
+}
+
+// Raw readings of a session in chunks of [delta_ms, v1, v2] triples
+void publishSessionDump(const ADCSession& session) {
+    for (int offset = 0; offset < session.numReadings; offset += SESSION_DUMP_CHUNK) {
+        char msg[896];
+        int len = snprintf(msg, sizeof(msg), "{\"device\":\"%s\",\"id\":%lu,\"offset\":%d,\"total\":%d,\"readings\":[", 
+                deviceId, session.id, offset, session.numReadings);
+        for (int i = offset; i < session.numReadings && i < offset + SESSION_DUMP_CHUNK; i++) {
+            const ADCReading& sample = sessionReading(session, i);
+            len += snprintf(msg + len, sizeof(msg) - len, "%s[%lu,%.2f,%.2f]", 
+                    i > offset ? "," : "", sample.delta, sample.voltage1, sample.voltage2);
+        }
+        snprintf(msg + len, sizeof(msg) - len, "]}");
+        publishMessage("doorbell/session/dump", msg);
+    }
+}
+#endif
+
+#if FEATURE_RECORDER
+// Keep an inbound message for later dumps; dump requests themselves are left out
+void recordInbound(const char* topic, const uint8_t* payload, unsigned int length) {
+    if (!recorderEnabled || strcmp(topic, "doorbell/get/recording") == 0) {
+        return;
+    }
+    recorderAppend(RECORD_MQTT, millis(), topic, payload, length);
+    replayInjected = false;
+}
+
+// Recorder settings: {"enabled": true, "sessions": false}
+void handleRecorderSettings(const char* message) {
+    DynamicJsonDocument doc(128);
+    if (deserializeJson(doc, message)) {
+        mqtt.publish("doorbell/error", "{\"status\":\"error\",\"message\":\"Invalid recorder settings\"}");
+        return;
+    }
+    recorderEnabled = doc["enabled"] | recorderEnabled;
+    recorderSessions = doc["sessions"] | recorderSessions;
+    publishRecorderInfo();
+}
+
+// doorbell/replay/<command>: clear, load, start, stop
+void handleReplayCommand(const char* command, const char* message) {
+    char errorMsg[128];
+    if (strcmp(command, "clear") == 0) {
+        // Empty the ring and take records from doorbell/replay/load until start. Only
+        // loaded records are dropped silently; the device's own recording needs "discard".
+        if (recorderCount() > 0 && !replayInjected && strcmp(message, "discard") != 0) {
+            mqtt.publish("doorbell/error", "{\"status\":\"error\",\"message\":\"Ring holds the device's own recording: dump it, then clear with payload discard\"}");
+            return;
+        }
+        recorderClear();
+        replayInjected = true;
+        replayMode = REPLAY_LOADING;
+        replayLoadAt = millis();
+        MQTT_DEBUG("Replay: loading");
+    } else if (strcmp(command, "load") == 0) {
+        if (replayMode != REPLAY_LOADING) {
+            mqtt.publish("doorbell/error", "{\"status\":\"error\",\"message\":\"Send doorbell/replay/clear before loading\"}");
+            return;
+        }
+        replayLoadAt = millis();
+        DynamicJsonDocument doc(1024);
+        if (deserializeJson(doc, message)) {
+            mqtt.publish("doorbell/error", "{\"status\":\"error\",\"message\":\"Invalid replay record\"}");
+            return;
+        }
+        RecordKind kind = recordKindFromName(doc["kind"] | "mqtt");
+        const char* hex = doc["payload"] | "";
+        size_t hexLen = strlen(hex);
+        if (doc["truncated"] | false) {
+            replaySkipped++;
+            return;
+        }
+        uint8_t payload[RECORDER_DATA_SIZE];
+        bool valid = kind != RECORD_KIND_COUNT && hexLen % 2 == 0 && hexLen / 2 <= sizeof(payload);
+        for (size_t i = 0; valid && i < hexLen / 2; i++) {
+            char byteStr[3] = {hex[i * 2], hex[i * 2 + 1], '\0'};
+            char* end;
+            payload[i] = strtoul(byteStr, &end, 16);
+            valid = *end == '\0';
+        }
+        if (!valid) {
+            snprintf(errorMsg, sizeof(errorMsg), "{\"status\":\"error\",\"message\":\"Replay record %d rejected\"}", recorderCount());
+            mqtt.publish("doorbell/error", errorMsg);
+            return;
+        }
+        recorderAppend(kind, doc["t"] | 0UL, doc["topic"] | "", payload, hexLen / 2);
+    } else if (strcmp(command, "start") == 0) {
+        // Replays the loaded records, or what the device recorded itself
+        if (recorderCount() == 0) {
+            mqtt.publish("doorbell/error", "{\"status\":\"error\",\"message\":\"Nothing to replay\"}");
+            return;
+        }
+        replayMode = REPLAY_RUNNING;
+        replayNext = 0;
+        replayed = 0;
+        replayMaxLateMs = 0;
+        replayDryRuns = 0;
+        replayConfig = config;
+        memcpy(replayRings, ringStates, sizeof(replayRings));
+        memcpy(replayQueued, queuedPresses, sizeof(replayQueued));
+        replayBaseMs = recorderAt(0).timeMs;
+        replayStartedAt = millis();
+        MQTT_DEBUG_F("Replay: %d records over %lu ms", recorderCount(), 
+                     (unsigned long)(recorderAt(recorderCount() - 1).timeMs - replayBaseMs));
+    } else if (strcmp(command, "stop") == 0) {
+        endReplay();
+    } else {
+        snprintf(errorMsg, sizeof(errorMsg), "{\"status\":\"error\",\"message\":\"Unknown replay command: %s\"}", command);
+        mqtt.publish("doorbell/error", errorMsg);
+    }
+}
+
+// Dispatch every record whose offset from the first one has elapsed
+void updateReplay() {
+    if (replayMode == REPLAY_LOADING && millis() - replayLoadAt >= REPLAY_LOAD_TIMEOUT_MS) {
+        // An abandoned load must not hold live commands and presses off for good
+        MQTT_DEBUG("Replay: loading timed out");
+        endReplay();
+        return;
+    }
+    if (replayMode != REPLAY_RUNNING) {
+        return;
+    }
+    unsigned long elapsed = millis() - replayStartedAt;
+    while (replayNext < recorderCount()) {
+        const Record& record = recorderAt(replayNext);
+        unsigned long offset = record.timeMs - replayBaseMs;
+        if (offset > elapsed) {
+            return;
+        }
+        replayNext++;
+        replayMaxLateMs = max(replayMaxLateMs, elapsed - offset);
+        if (record.truncated) {
+            replaySkipped++;
+            continue;
+        }
         
-        if (WiFi.status() != WL_CONNECTED) {
-            MQTT_DEBUG("WiFi disconnected - attempting reconnection");
-            return false;
+        replayDispatching = true;
+        if (record.kind == RECORD_SESSION) {
+            pressDetectedAt = millis();
+            handleSimulatedButton(recordPayload(record)[0] == '1' ? BUTTON_DOOR : BUTTON_DOWNSTAIRS);
+            pressDetectedAt = 0;
+        } else {
+            // callback() takes mutable buffers
+            char topic[RECORDER_MAX_TOPIC + 1];
+            uint8_t payload[RECORDER_DATA_SIZE];
+            recordTopic(record, topic, sizeof(topic));
+            memcpy(payload, recordPayload(record), record.payloadLength);
+            callback(topic, payload, record.payloadLength);
+        }
+        replayDispatching = false;
+        replayed++;
+    }
+    MQTT_DEBUG("Replay finished");
+    endReplay();
+}
+
+// Back to live input. Config and ring state changed by replayed records only lived in RAM.
+void endReplay() {
+    if (replayMode == REPLAY_RUNNING) {
+        memcpy(ringStates, replayRings, sizeof(ringStates));
+        memcpy(queuedPresses, replayQueued, sizeof(queuedPresses));
+    }
+    if (replayMode == REPLAY_RUNNING && memcmp(&config, &replayConfig, sizeof(Config)) != 0) {
+        config = replayConfig;
+#if FEATURE_NOTIFIER
+        notifierConfigure(config.ntfy_url);
+#endif
+    }
+    replayMode = REPLAY_OFF;
+    publishRecorderInfo();
+}
+
+bool replayRunning() {
+    return replayMode == REPLAY_RUNNING;
+}
+
+// Replayed records are dry runs: door, outputs, reboots, pushes and stored
+// settings are reported on doorbell/recording/effect instead of carried out
+bool replayDryRun(const char* effect, const char* detail) {
+    if (!replayDispatching) {
+        return false;
+    }
+    replayDryRuns++;
+    char msg[128];
+    snprintf(msg, sizeof(msg), "{\"effect\":\"%s\",\"detail\":\"%s\",\"record\":%d}", effect, detail, replayNext - 1);
+    mqtt.publish("doorbell/recording/effect", msg);
+    return true;
+}
+
+// Recorder and replay counters
+void publishRecorderInfo() {
+    char msg[384];
+    snprintf(msg, sizeof(msg), 
+            "{\"records\":%d,\"enabled\":%s,\"sessions\":%s,\"recorded\":%lu,\"overwritten\":%lu,\"truncated\":%lu,"
+            "\"replay\":\"%s\",\"replayed\":%lu,\"skipped\":%lu,\"ignored\":%lu,\"dry_runs\":%lu,\"max_late_ms\":%lu,\"now\":%lu}", 
+            recorderCount(), recorderEnabled ? "true" : "false", recorderSessions ? "true" : "false", 
+            recorderStats.recorded, recorderStats.overwritten, recorderStats.truncated, 
+            replayModeNames[replayMode], replayed, replaySkipped, replayIgnored, replayDryRuns, replayMaxLateMs, millis());
+    mqtt.publish("doorbell/recording/info", msg);
+}
+
+// Dump the ring oldest first, one record per message, then the counters
+void publishRecording() {
+    char topic[RECORDER_MAX_TOPIC + 1];
+    char hex[RECORDER_DATA_SIZE * 2 + 1];
+    char buffer[1024];
+    for (int i = 0; i < recorderCount(); i++) {
+        const Record& record = recorderAt(i);
+        recordTopic(record, topic, sizeof(topic));
+        const uint8_t* payload = recordPayload(record);
+        for (int b = 0; b < record.payloadLength; b++) {
+            snprintf(hex + b * 2, 3, "%02x", payload[b]);
         }
+        hex[record.payloadLength * 2] = '\0';
         
-        // Check signal strength
-        int rssi = WiFi.RSSI();
-        if (rssi < -80) {  // Very weak signal
-            MQTT_DEBUG_F("Weak WiFi signal: %d dBm", rssi);
+        DynamicJsonDocument doc(1024);
+        doc["seq"] = i;
+        doc["t"] = record.timeMs;
+        doc["kind"] = recordKindName(record.kind);
+        doc["topic"] = topic;
+        doc["payload"] = hex;
+        if (record.truncated) {
+            doc["truncated"] = true;
+        }
+        ArduinoJson::serializeJson(doc, buffer, sizeof(buffer));
+        mqtt.publish("doorbell/recording/record", buffer);
+    }
+    publishRecorderInfo();
+}
+
+#else
+void updateReplay() {}
+
+bool replayRunning() {
+    return false;
+}
+
+bool replayDryRun(const char* effect, const char* detail) {
+    return false;
+}
+#endif
+
+// Output driver: polarity, LEDC and unfitted outputs are handled here
+void writeOutputPin(uint8_t output, uint8_t level) {
+    const OutputPin& out = outputPins[output];
+    if (out.pin < 0) {
+        return;
+    }
+    if (output == OUTPUT_DOOR && level > 0 && doorCheckSampling) {
+        portENTER_CRITICAL(&doorCheckMux);
+        actuationEnergized(doorCheck, micros());
+        portEXIT_CRITICAL(&doorCheckMux);
+    }
+    if (out.ledcChannel >= 0) {
+        ledcWrite(out.ledcChannel, out.activeLow ? OUTPUT_LEVEL_ON - level : level);
+    } else {
+        digitalWrite(out.pin, (level > 0) != out.activeLow ? HIGH : LOW);
+    }
+}
+
+unsigned long outputMillis() {
+    return millis();
+}
+
+// An output started or finished a pattern or hold
+void onOutputActive(uint8_t output, bool active) {
+    if (output == OUTPUT_DOOR) {
+        MQTT_DEBUG_F("Front door relay %s", active ? "activated" : "deactivated");
+        publishMessage("doorbell/status", active ? "Door relay activated" : "Door relay deactivated");
+        dispatchRuleEvent(RULE_EVT_RELAY, active ? 1 : 0);
+    } else if (output != OUTPUT_LED) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "{\"output\":\"%s\",\"active\":%s}", outputPins[output].name, active ? "true" : "false");
+        publishMessage("doorbell/output/state", msg);
+    }
+}
+
+void setupOutputs() {
+    OutputDriver driver = {writeOutputPin, outputMillis, onOutputActive};
+    outputsBegin(driver);
+    for (int i = 0; i < OUTPUT_ID_COUNT; i++) {
+        const OutputPin& out = outputPins[i];
+        if (out.pin >= 0 && out.ledcChannel >= 0) {
+            ledcSetup(out.ledcChannel, OUTPUT_PWM_FREQ, OUTPUT_PWM_BITS);
+            ledcAttachPin(out.pin, out.ledcChannel);
+        } else if (out.pin >= 0) {
+            // Set the off level first so an active-low relay does not click at boot
+            digitalWrite(out.pin, out.activeLow ? HIGH : LOW);
+            pinMode(out.pin, OUTPUT);
         }
+        outputAdd(out.name, out.limits);
+    }
+}
+
+// doorbell/set/output/<name>: {"level": 0-255, "ms": 2000} or {"pattern": [[255, 200], [0, 200]], "repeat": 3}
+void handleOutputCommand(const char* name, const char* message) {
+    char errorMsg[128];
+    int output = outputFind(name);
+    if (output < 0 || outputPins[output].pin < 0) {
+        snprintf(errorMsg, sizeof(errorMsg), "{\"status\":\"error\",\"message\":\"Output not fitted: %s\"}", name);
+        mqtt.publish("doorbell/error", errorMsg);
+        return;
     }
     
-    return WiFi.status() == WL_CONNECTED;
+    DynamicJsonDocument doc(512);
+    if (deserializeJson(doc, message)) {
+        mqtt.publish("doorbell/error", "{\"status\":\"error\",\"message\":\"Invalid output command\"}");
+        return;
+    }
+    
+    // Locks only open through open_front_door (confirmation, audit, rules); switching one off is allowed
+    bool off = !doc.containsKey("pattern") && (doc["level"] | 0) == 0;
+    if ((output == OUTPUT_DOOR || output == OUTPUT_GATE) && !off) {
+        snprintf(errorMsg, sizeof(errorMsg), 
+                 "{\"status\":\"error\",\"message\":\"Output %s is a lock: use open_front_door\"}", name);
+        mqtt.publish("doorbell/error", errorMsg);
+        return;
+    }
+    
+    bool accepted;
+    if (doc.containsKey("pattern")) {
+        JsonArray pattern = doc["pattern"];
+        OutputStep steps[OUTPUT_MAX_STEPS];
+        int count = 0;
+        for (JsonArray step : pattern) {
+            if (count == OUTPUT_MAX_STEPS) {
+                count = 0;  // Too long, rejected below
+                break;
+            }
+            steps[count].level = constrain(step[0] | 0, 0, OUTPUT_LEVEL_ON);
+            steps[count].ms = constrain(step[1] | 0L, 0L, 65535L);
+            count++;
+        }
+        accepted = outputPattern(output, steps, count, doc["repeat"] | 1);
+    } else if (off) {
+        outputStop(output);
+        accepted = true;
+    } else {
+        accepted = outputSet(output, constrain(doc["level"] | 0, 0, OUTPUT_LEVEL_ON), constrain(doc["ms"] | 0L, 0L, 65535L));
+    }
+    
+    if (!accepted) {
+        snprintf(errorMsg, sizeof(errorMsg), "{\"status\":\"error\",\"message\":\"Invalid pattern for output %s\"}", name);
+        mqtt.publish("doorbell/error", errorMsg);
+    }
+}
+
+// State, limits and counters of every output
+void publishOutputs() {
+    DynamicJsonDocument doc(1536);
+    for (int i = 0; i < outputCount(); i++) {
+        const OutputStats& stats = outputStats(i);
+        JsonObject out = doc.createNestedObject(outputName(i));
+        out["fitted"] = outputPins[i].pin >= 0;
+        out["level"] = outputLevel(i);
+        out["active"] = outputActive(i);
+        out["max_on_ms"] = outputLimits(i).maxOnMs;
+        out["min_off_ms"] = outputLimits(i).minOffMs;
+        out["activations"] = stats.activations;
+        out["on_ms"] = stats.onMs;
+        out["limited"] = stats.limited;
+        out["delayed"] = stats.delayed;
+    }
+    if (DOOR_FEEDBACK_PIN >= 0) {
+        JsonObject door = doc[outputName(OUTPUT_DOOR)];
+        door["confirmed"] = actuationsConfirmed;
+        door["failed"] = actuationsFailed;
+        door["retries"] = actuationRetries;
+    }
+    
+    char buffer[1024];
+    ArduinoJson::serializeJson(doc, buffer);
+    mqtt.publish("doorbell/outputs", buffer);
 }
@@ -0,0 +1,85 @@
+#include "maintenance.h"
+#include <string.h>
+
+void maintenanceBegin(MaintenanceScheduler& sched) {
+    memset(&sched, 0, sizeof(MaintenanceScheduler));
+}
+
+int maintenanceAdd(MaintenanceScheduler& sched, const char* name, void (*run)(),
+                   unsigned long intervalMs, unsigned long slackMs, unsigned long now) {
+    if (sched.count >= MAINTENANCE_MAX_JOBS) {
+        return -1;
+    }
+    MaintenanceJob& job = sched.jobs[sched.count];
+    memset(&job, 0, sizeof(MaintenanceJob));
+    job.name = name;
+    job.run = run;
+    job.intervalMs = intervalMs;
+    job.slackMs = slackMs;
+    job.armed = intervalMs > 0;
+    job.dueAt = now + intervalMs;
+    return sched.count++;
+}
+
+void maintenanceTrigger(MaintenanceScheduler& sched, int id, unsigned long now) {
+    MaintenanceJob& job = sched.jobs[id];
+    if (job.armed && (long)(job.dueAt - now) <= 0) {
+        return;
+    }
+    job.armed = true;
+    job.dueAt = now;
+    job.dueSeen = false;
+}
+
+int maintenanceNext(MaintenanceScheduler& sched, unsigned long now, bool idle) {
+    int best = -1;
+    bool bestForced = false;
+    unsigned long bestWait = 0;
+    for (int i = 0; i < sched.count; i++) {
+        MaintenanceJob& job = sched.jobs[i];
+        if (!job.armed || (long)(now - job.dueAt) < 0) {
+            continue;
+        }
+        if (!job.dueSeen) {
+            job.dueSeen = true;
+            job.dueBusy = !idle;
+        }
+        unsigned long wait = now - job.dueAt;
+        bool forced = wait >= job.slackMs;
+        if (!forced && !idle) {
+            continue;
+        }
+        // Overdue jobs go first, then whichever has waited longest
+        if (best < 0 || (forced && !bestForced) || (forced == bestForced && wait > bestWait)) {
+            best = i;
+            bestForced = forced;
+            bestWait = wait;
+        }
+    }
+    return best;
+}
+
+void maintenanceDone(MaintenanceScheduler& sched, int id, unsigned long now, unsigned long durationUs, bool idle) {
+    MaintenanceJob& job = sched.jobs[id];
+    unsigned long wait = now - job.dueAt;
+    job.runs++;
+    job.totalUs += durationUs;
+    if (durationUs > job.maxUs) {
+        job.maxUs = durationUs;
+    }
+    if (wait > job.maxWaitMs) {
+        job.maxWaitMs = wait;
+    }
+    if (!idle) {
+        job.forced++;
+        sched.overlapUs += durationUs;
+    }
+    if (job.dueBusy) {
+        job.dueWhileBusy++;
+        sched.fixedOverlapUs += durationUs;
+    }
+    job.dueSeen = false;
+    job.dueBusy = false;
+    job.armed = job.intervalMs > 0;
+    job.dueAt = now + job.intervalMs;
+}
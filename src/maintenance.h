@@ -0,0 +1,59 @@
+#ifndef MAINTENANCE_H
+#define MAINTENANCE_H
+
+#include <stdint.h>
+
+// Scheduler for non-urgent chores (health reports, signal checks, config
+// flushes). A job that is due waits for an idle window (no session, chime,
+// relay or recent command); once it has waited slackMs it runs anyway, so
+// every job still runs eventually. At most one job runs per loop pass.
+//
+// For the before/after comparison each run also records whether the device
+// was busy at the moment the job fell due, i.e. whether the old fixed-interval
+// schedule would have run it in the middle of latency-critical work.
+#define MAINTENANCE_MAX_JOBS 8
+
+/// @brief A periodic (intervalMs > 0) or triggered (intervalMs == 0) chore
+struct MaintenanceJob {
+    const char* name;
+    void (*run)();
+    unsigned long intervalMs;       ///< Period; 0 = runs only after maintenanceTrigger()
+    unsigned long slackMs;          ///< How long a due job may wait for an idle window
+    bool armed;                     ///< dueAt is valid
+    unsigned long dueAt;
+    bool dueSeen;                   ///< Already classified as due while idle/busy
+    bool dueBusy;                   ///< Device was busy when the job fell due
+    unsigned long runs;
+    unsigned long forced;           ///< Runs while busy because the slack ran out
+    unsigned long dueWhileBusy;     ///< Runs that fell due while busy (fixed schedule would overlap)
+    unsigned long maxWaitMs;        ///< Longest delay between falling due and running
+    unsigned long totalUs;
+    unsigned long maxUs;
+};
+
+struct MaintenanceScheduler {
+    MaintenanceJob jobs[MAINTENANCE_MAX_JOBS];
+    uint8_t count;
+    unsigned long overlapUs;        ///< Job time spent while busy
+    unsigned long fixedOverlapUs;   ///< Job time that fell due while busy
+};
+
+void maintenanceBegin(MaintenanceScheduler& sched);
+
+/// @brief Register a job; a periodic job first falls due intervalMs after now
+/// @return Job id, or -1 when the table is full
+int maintenanceAdd(MaintenanceScheduler& sched, const char* name, void (*run)(),
+                   unsigned long intervalMs, unsigned long slackMs, unsigned long now);
+
+/// @brief Make a job due now (no-op if it is already due)
+void maintenanceTrigger(MaintenanceScheduler& sched, int id, unsigned long now);
+
+/// @brief Pick the job to run in this pass: an overdue job first, otherwise
+/// the longest-waiting due job if idle
+/// @return Job id, or -1 when nothing should run
+int maintenanceNext(MaintenanceScheduler& sched, unsigned long now, bool idle);
+
+/// @brief Account a finished run and schedule the job's next run
+void maintenanceDone(MaintenanceScheduler& sched, int id, unsigned long now, unsigned long durationUs, bool idle);
+
+#endif // MAINTENANCE_H
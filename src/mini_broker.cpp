@@ -0,0 +1,574 @@
+#include "mini_broker.h"
+#include <string.h>
+
+// MQTT control packet types (upper nibble of the fixed header)
+#define PKT_CONNECT 1
+#define PKT_CONNACK 2
+#define PKT_PUBLISH 3
+#define PKT_PUBACK 4
+#define PKT_SUBSCRIBE 8
+#define PKT_SUBACK 9
+#define PKT_UNSUBSCRIBE 10
+#define PKT_UNSUBACK 11
+#define PKT_PINGREQ 12
+#define PKT_PINGRESP 13
+#define PKT_DISCONNECT 14
+
+#define BROKER_CONNECT_TIMEOUT_MS 10000  // A reserved slot must send CONNECT within this time
+#define SUBACK_MAX_CODES (BROKER_RX_BUFFER / 3)  // A filter takes at least 3 bytes (length and QoS)
+
+struct BrokerClient {
+    bool used;                      // Slot reserved by brokerAccept()
+    bool connected;                 // CONNECT accepted
+    uint16_t keepAliveSec;
+    unsigned long lastSeen;
+    uint16_t nextPacketId;
+    uint8_t subCount;
+    char subs[BROKER_MAX_SUBS][BROKER_TOPIC_SIZE];
+    uint8_t subQos[BROKER_MAX_SUBS];
+    uint8_t rx[BROKER_RX_BUFFER];
+    size_t rxLen;
+};
+
+struct RetainedMessage {
+    bool used;
+    char topic[BROKER_TOPIC_SIZE];
+    uint8_t payload[BROKER_RETAINED_PAYLOAD];
+    uint16_t len;
+};
+
+BrokerStats brokerStats;
+
+static BrokerClient clients[BROKER_MAX_CLIENTS];
+static RetainedMessage retained[BROKER_MAX_RETAINED];
+static BrokerIO brokerIO;
+static uint8_t txBuffer[BROKER_TX_BUFFER];
+
+static void resetClient(uint8_t id) {
+    memset(&clients[id], 0, sizeof(BrokerClient));
+}
+
+static void dropClient(uint8_t id) {
+    if (clients[id].used) {
+        brokerIO.close(id);
+    }
+    resetClient(id);
+}
+
+static bool sendPacket(uint8_t id, const uint8_t* data, size_t len) {
+    if (brokerIO.send(id, data, len) != len) {
+        brokerStats.dropped++;
+        dropClient(id);  // Slow or broken consumer
+        return false;
+    }
+    brokerStats.bytesOut += len;
+    return true;
+}
+
+// Variable-length "remaining length" field; returns bytes written
+static size_t putRemainingLength(uint8_t* buf, size_t value) {
+    size_t n = 0;
+    do {
+        uint8_t digit = value % 128;
+        value /= 128;
+        buf[n++] = digit | (value > 0 ? 0x80 : 0);
+    } while (value > 0);
+    return n;
+}
+
+static bool readU16(const uint8_t* p, size_t len, size_t& pos, uint16_t& value) {
+    if (pos + 2 > len) {
+        return false;
+    }
+    value = (p[pos] << 8) | p[pos + 1];
+    pos += 2;
+    return true;
+}
+
+// Length-prefixed UTF-8 string into a terminated buffer; too long fails
+static bool readString(const uint8_t* p, size_t len, size_t& pos, char* out, size_t size) {
+    uint16_t n;
+    if (!readU16(p, len, pos, n) || pos + n > len || n >= size) {
+        return false;
+    }
+    memcpy(out, p + pos, n);
+    out[n] = '\0';
+    pos += n;
+    return true;
+}
+
+static bool skipString(const uint8_t* p, size_t len, size_t& pos) {
+    uint16_t n;
+    if (!readU16(p, len, pos, n) || pos + n > len) {
+        return false;
+    }
+    pos += n;
+    return true;
+}
+
+bool brokerTopicMatches(const char* filter, const char* topic) {
+    while (*filter) {
+        if (*filter == '#') {
+            return true;  // Matches the rest, including the parent level
+        }
+        if (*filter == '+') {
+            while (*topic && *topic != '/') {
+                topic++;
+            }
+            filter++;
+            continue;
+        }
+        if (*topic != *filter) {
+            // "a/#" also matches "a"
+            return *topic == '\0' && filter[0] == '/' && filter[1] == '#' && filter[2] == '\0';
+        }
+        filter++;
+        topic++;
+    }
+    return *topic == '\0';
+}
+
+// Send one PUBLISH to a client at the given QoS
+static void sendPublish(uint8_t id, const char* topic, const uint8_t* payload, size_t len,
+                        uint8_t qos, bool retain) {
+    size_t topicLen = strlen(topic);
+    size_t remaining = 2 + topicLen + (qos > 0 ? 2 : 0) + len;
+    if (remaining + 5 > sizeof(txBuffer)) {
+        brokerStats.dropped++;
+        return;
+    }
+    size_t n = 0;
+    txBuffer[n++] = (PKT_PUBLISH << 4) | (qos << 1) | (retain ? 1 : 0);
+    n += putRemainingLength(txBuffer + n, remaining);
+    txBuffer[n++] = topicLen >> 8;
+    txBuffer[n++] = topicLen & 0xFF;
+    memcpy(txBuffer + n, topic, topicLen);
+    n += topicLen;
+    if (qos > 0) {
+        BrokerClient& client = clients[id];
+        if (++client.nextPacketId == 0) {
+            client.nextPacketId = 1;
+        }
+        txBuffer[n++] = client.nextPacketId >> 8;
+        txBuffer[n++] = client.nextPacketId & 0xFF;
+    }
+    memcpy(txBuffer + n, payload, len);
+    n += len;
+    if (sendPacket(id, txBuffer, n)) {
+        brokerStats.messagesOut++;
+    }
+}
+
+// Deliver to every client with a matching subscription, at the lower of the two QoS levels
+static void route(const char* topic, const uint8_t* payload, size_t len, uint8_t qos) {
+    for (uint8_t id = 0; id < BROKER_MAX_CLIENTS; id++) {
+        BrokerClient& client = clients[id];
+        if (!client.connected) {
+            continue;
+        }
+        int granted = -1;
+        for (uint8_t s = 0; s < client.subCount; s++) {
+            if (brokerTopicMatches(client.subs[s], topic) && client.subQos[s] > granted) {
+                granted = client.subQos[s];
+            }
+        }
+        if (granted >= 0) {
+            sendPublish(id, topic, payload, len, granted < qos ? granted : qos, false);
+        }
+    }
+}
+
+static void storeRetained(const char* topic, const uint8_t* payload, size_t len) {
+    RetainedMessage* slot = NULL;
+    for (int i = 0; i < BROKER_MAX_RETAINED; i++) {
+        if (retained[i].used && strcmp(retained[i].topic, topic) == 0) {
+            slot = &retained[i];
+            break;
+        }
+    }
+    if (len == 0) {
+        if (slot) {
+            slot->used = false;  // Empty retained payload clears the topic
+        }
+        return;
+    }
+    if (!slot) {
+        for (int i = 0; i < BROKER_MAX_RETAINED && !slot; i++) {
+            if (!retained[i].used) {
+                slot = &retained[i];
+            }
+        }
+    }
+    if (!slot || len > BROKER_RETAINED_PAYLOAD || strlen(topic) >= BROKER_TOPIC_SIZE) {
+        brokerStats.dropped++;
+        return;
+    }
+    slot->used = true;
+    strncpy(slot->topic, topic, BROKER_TOPIC_SIZE - 1);
+    slot->topic[BROKER_TOPIC_SIZE - 1] = '\0';
+    memcpy(slot->payload, payload, len);
+    slot->len = len;
+}
+
+static void handleConnect(uint8_t id, const uint8_t* p, size_t len) {
+    size_t pos = 0;
+    char protocol[8];
+    char user[32] = "";
+    char password[64] = "";
+    uint16_t keepAlive = 0;
+    uint8_t returnCode = 0;
+
+    if (!readString(p, len, pos, protocol, sizeof(protocol)) || pos + 2 > len) {
+        brokerStats.rejected++;
+        dropClient(id);
+        return;
+    }
+    uint8_t level = p[pos++];
+    uint8_t flags = p[pos++];
+    if (!readU16(p, len, pos, keepAlive) || !skipString(p, len, pos)) {  // Client id is not needed
+        brokerStats.rejected++;
+        dropClient(id);
+        return;
+    }
+    bool ok = true;
+    if (flags & 0x04) {  // Will topic and message are parsed but not supported
+        ok = skipString(p, len, pos) && skipString(p, len, pos);
+    }
+    if (ok && (flags & 0x80)) {
+        ok = readString(p, len, pos, user, sizeof(user));
+    }
+    if (ok && (flags & 0x40)) {
+        ok = readString(p, len, pos, password, sizeof(password));
+    }
+
+    if (!ok) {
+        returnCode = 4;  // Malformed or oversized credentials
+    } else if (!((strcmp(protocol, "MQTT") == 0 && level == 4) || (strcmp(protocol, "MQIsdp") == 0 && level == 3))) {
+        returnCode = 1;  // Unacceptable protocol version
+    } else if (brokerIO.authenticate && !brokerIO.authenticate(user, password)) {
+        returnCode = 5;  // Not authorized
+    }
+
+    uint8_t connack[4] = {PKT_CONNACK << 4, 2, 0, returnCode};
+    if (!sendPacket(id, connack, sizeof(connack))) {
+        return;
+    }
+    if (returnCode != 0) {
+        brokerStats.rejected++;
+        dropClient(id);
+        return;
+    }
+    clients[id].connected = true;
+    clients[id].keepAliveSec = keepAlive;
+    brokerStats.connects++;
+}
+
+static void handlePublish(uint8_t id, uint8_t flags, const uint8_t* p, size_t len) {
+    size_t pos = 0;
+    char topic[BROKER_TOPIC_SIZE];
+    uint16_t packetId = 0;
+    uint8_t qos = (flags >> 1) & 0x03;
+    bool retain = flags & 0x01;
+
+    if (qos > 1 || !readString(p, len, pos, topic, sizeof(topic)) ||
+        strpbrk(topic, "+#") != NULL || (qos > 0 && !readU16(p, len, pos, packetId))) {
+        brokerStats.dropped++;
+        dropClient(id);  // QoS 2, wildcards in a topic name or a malformed packet
+        return;
+    }
+    const uint8_t* payload = p + pos;
+    size_t payloadLen = len - pos;
+    brokerStats.messagesIn++;
+
+    if (qos == 1) {
+        uint8_t puback[4] = {PKT_PUBACK << 4, 2, (uint8_t)(packetId >> 8), (uint8_t)(packetId & 0xFF)};
+        if (!sendPacket(id, puback, sizeof(puback))) {
+            return;
+        }
+    }
+    if (retain) {
+        storeRetained(topic, payload, payloadLen);
+    }
+    route(topic, payload, payloadLen, qos);
+    if (brokerIO.onPublish) {
+        brokerIO.onPublish(topic, payload, payloadLen, retain);
+    }
+}
+
+static void handleSubscribe(uint8_t id, const uint8_t* p, size_t len) {
+    BrokerClient& client = clients[id];
+    size_t pos = 0;
+    uint16_t packetId;
+    // One return code per filter, also for filters beyond the table (MQTT 3.1.1 3.9.3)
+    uint8_t codes[SUBACK_MAX_CODES];
+    size_t count = 0;
+    uint8_t firstNew = client.subCount;
+
+    if (!readU16(p, len, pos, packetId)) {
+        dropClient(id);
+        return;
+    }
+    while (pos < len) {
+        if (count >= SUBACK_MAX_CODES) {
+            dropClient(id);
+            return;
+        }
+        char filter[BROKER_TOPIC_SIZE];
+        bool valid = readString(p, len, pos, filter, sizeof(filter)) && pos < len;
+        if (!valid) {
+            // Too long for the table: skip it and refuse this filter only
+            if (!skipString(p, len, pos) || pos >= len) {
+                dropClient(id);
+                return;
+            }
+        }
+        uint8_t qos = p[pos++] & 0x03;
+        uint8_t granted = qos > 1 ? 1 : qos;
+
+        if (!valid) {
+            codes[count++] = 0x80;
+            continue;
+        }
+        int slot = -1;
+        for (uint8_t s = 0; s < client.subCount; s++) {
+            if (strcmp(client.subs[s], filter) == 0) {
+                slot = s;
+            }
+        }
+        if (slot < 0 && client.subCount < BROKER_MAX_SUBS) {
+            slot = client.subCount++;
+            strcpy(client.subs[slot], filter);
+        }
+        if (slot < 0) {
+            codes[count++] = 0x80;  // Subscription table full
+            continue;
+        }
+        client.subQos[slot] = granted;
+        codes[count++] = granted;
+    }
+
+    uint8_t suback[7 + SUBACK_MAX_CODES];
+    size_t n = 0;
+    suback[n++] = PKT_SUBACK << 4;
+    n += putRemainingLength(suback + n, 2 + count);
+    suback[n++] = packetId >> 8;
+    suback[n++] = packetId & 0xFF;
+    memcpy(suback + n, codes, count);
+    if (!sendPacket(id, suback, n + count)) {
+        return;
+    }
+
+    // Retained messages matching the new filters
+    for (int i = 0; i < BROKER_MAX_RETAINED; i++) {
+        if (!retained[i].used) {
+            continue;
+        }
+        for (uint8_t s = firstNew; s < client.subCount; s++) {
+            if (brokerTopicMatches(client.subs[s], retained[i].topic)) {
+                sendPublish(id, retained[i].topic, retained[i].payload, retained[i].len, client.subQos[s], true);
+                break;
+            }
+        }
+        if (!clients[id].connected) {
+            return;  // Dropped while sending
+        }
+    }
+}
+
+static void handleUnsubscribe(uint8_t id, const uint8_t* p, size_t len) {
+    BrokerClient& client = clients[id];
+    size_t pos = 0;
+    uint16_t packetId;
+
+    if (!readU16(p, len, pos, packetId)) {
+        dropClient(id);
+        return;
+    }
+    while (pos < len) {
+        char filter[BROKER_TOPIC_SIZE];
+        if (!readString(p, len, pos, filter, sizeof(filter))) {
+            break;
+        }
+        for (uint8_t s = 0; s < client.subCount; s++) {
+            if (strcmp(client.subs[s], filter) == 0) {
+                client.subCount--;
+                strcpy(client.subs[s], client.subs[client.subCount]);
+                client.subQos[s] = client.subQos[client.subCount];
+                break;
+            }
+        }
+    }
+    uint8_t unsuback[4] = {PKT_UNSUBACK << 4, 2, (uint8_t)(packetId >> 8), (uint8_t)(packetId & 0xFF)};
+    sendPacket(id, unsuback, sizeof(unsuback));
+}
+
+static void handlePacket(uint8_t id, uint8_t header, const uint8_t* p, size_t len) {
+    uint8_t type = header >> 4;
+    if (!clients[id].connected && type != PKT_CONNECT) {
+        dropClient(id);
+        return;
+    }
+    switch (type) {
+        case PKT_CONNECT:
+            if (clients[id].connected) {
+                dropClient(id);  // A second CONNECT is a protocol violation
+            } else {
+                handleConnect(id, p, len);
+            }
+            break;
+        case PKT_PUBLISH:
+            handlePublish(id, header & 0x0F, p, len);
+            break;
+        case PKT_PUBACK:
+            break;  // Outbound QoS 1 is not retransmitted, nothing to release
+        case PKT_SUBSCRIBE:
+            handleSubscribe(id, p, len);
+            break;
+        case PKT_UNSUBSCRIBE:
+            handleUnsubscribe(id, p, len);
+            break;
+        case PKT_PINGREQ: {
+            uint8_t pingresp[2] = {PKT_PINGRESP << 4, 0};
+            sendPacket(id, pingresp, sizeof(pingresp));
+            break;
+        }
+        case PKT_DISCONNECT:
+        default:
+            dropClient(id);
+            break;
+    }
+}
+
+// Handle every complete packet in the client's receive buffer
+static void processBuffer(uint8_t id) {
+    BrokerClient& client = clients[id];
+    while (client.used && client.rxLen >= 2) {
+        size_t remaining = 0;
+        size_t multiplier = 1;
+        size_t pos = 1;
+        bool complete = false;
+        while (pos < client.rxLen && pos <= 4) {
+            uint8_t digit = client.rx[pos++];
+            remaining += (digit & 0x7F) * multiplier;
+            multiplier *= 128;
+            if (!(digit & 0x80)) {
+                complete = true;
+                break;
+            }
+        }
+        if (!complete) {
+            if (pos > 4) {
+                dropClient(id);  // Malformed length
+            }
+            return;
+        }
+        size_t total = pos + remaining;
+        if (total > BROKER_RX_BUFFER) {
+            brokerStats.dropped++;
+            dropClient(id);  // Larger than we are willing to buffer
+            return;
+        }
+        if (client.rxLen < total) {
+            return;  // Wait for the rest
+        }
+        handlePacket(id, client.rx[0], client.rx + pos, remaining);
+        if (!client.used) {
+            return;
+        }
+        memmove(client.rx, client.rx + total, client.rxLen - total);
+        client.rxLen -= total;
+    }
+}
+
+void brokerBegin(const BrokerIO& io) {
+    brokerIO = io;
+    memset(clients, 0, sizeof(clients));
+    memset(retained, 0, sizeof(retained));
+    memset(&brokerStats, 0, sizeof(brokerStats));
+}
+
+void brokerStop() {
+    for (uint8_t id = 0; id < BROKER_MAX_CLIENTS; id++) {
+        dropClient(id);
+    }
+}
+
+int brokerAccept() {
+    for (uint8_t id = 0; id < BROKER_MAX_CLIENTS; id++) {
+        if (!clients[id].used) {
+            resetClient(id);
+            clients[id].used = true;
+            clients[id].lastSeen = brokerIO.nowMillis();
+            return id;
+        }
+    }
+    brokerStats.rejected++;
+    return -1;
+}
+
+void brokerReceive(uint8_t id, const uint8_t* data, size_t len) {
+    if (id >= BROKER_MAX_CLIENTS || !clients[id].used) {
+        return;
+    }
+    BrokerClient& client = clients[id];
+    client.lastSeen = brokerIO.nowMillis();
+    brokerStats.bytesIn += len;
+    while (len > 0 && client.used) {
+        size_t chunk = BROKER_RX_BUFFER - client.rxLen;
+        if (chunk == 0) {
+            brokerStats.dropped++;
+            dropClient(id);
+            return;
+        }
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(client.rx + client.rxLen, data, chunk);
+        client.rxLen += chunk;
+        data += chunk;
+        len -= chunk;
+        processBuffer(id);
+    }
+}
+
+void brokerDisconnected(uint8_t id) {
+    if (id < BROKER_MAX_CLIENTS) {
+        resetClient(id);  // Transport already closed
+    }
+}
+
+void brokerPoll() {
+    unsigned long now = brokerIO.nowMillis();
+    for (uint8_t id = 0; id < BROKER_MAX_CLIENTS; id++) {
+        BrokerClient& client = clients[id];
+        if (!client.used) {
+            continue;
+        }
+        unsigned long idle = now - client.lastSeen;
+        if ((!client.connected && idle > BROKER_CONNECT_TIMEOUT_MS) ||
+            (client.connected && client.keepAliveSec > 0 && idle > client.keepAliveSec * 1500UL)) {
+            dropClient(id);  // 1.5x keep-alive, as the spec requires
+        }
+    }
+}
+
+void brokerPublish(const char* topic, const uint8_t* payload, size_t len, bool retain) {
+    if (retain) {
+        storeRetained(topic, payload, len);
+    }
+    route(topic, payload, len, 1);
+}
+
+int brokerClientCount() {
+    int count = 0;
+    for (uint8_t id = 0; id < BROKER_MAX_CLIENTS; id++) {
+        if (clients[id].connected) {
+            count++;
+        }
+    }
+    return count;
+}
+
+size_t brokerMemoryFootprint() {
+    return sizeof(clients) + sizeof(retained) + sizeof(txBuffer);
+}
@@ -0,0 +1,73 @@
+#ifndef MINI_BROKER_H
+#define MINI_BROKER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Minimal MQTT 3.1.1 broker used as a LAN fallback while the upstream broker is
+// unreachable. Clean sessions only, QoS 0 and 1 (QoS 1 is acknowledged inbound
+// and delivered once outbound, without retransmission), no will messages.
+// All state lives in fixed tables; the transport is supplied by the caller so
+// the core also runs on the host (see bench/broker_bench.cpp).
+#define BROKER_PORT 1883
+#define BROKER_MAX_CLIENTS 4            // Concurrent LAN clients
+#define BROKER_MAX_SUBS 8               // Topic filters per client
+#define BROKER_TOPIC_SIZE 64            // Longest topic or filter, including terminator
+#define BROKER_RX_BUFFER 512            // Largest packet accepted from a client
+#define BROKER_MAX_RETAINED 16          // Retained messages kept
+#define BROKER_RETAINED_PAYLOAD 256     // Largest retained payload
+#define BROKER_TX_BUFFER (BROKER_TOPIC_SIZE + BROKER_RX_BUFFER + 8)
+
+/// @brief Transport and integration hooks
+struct BrokerIO {
+    size_t (*send)(uint8_t client, const uint8_t* data, size_t len);   ///< Bytes written
+    void (*close)(uint8_t client);                                     ///< Drop the connection
+    unsigned long (*nowMillis)();
+    bool (*authenticate)(const char* user, const char* password);      ///< NULL accepts everyone
+    void (*onPublish)(const char* topic, const uint8_t* payload, size_t len, bool retain);  ///< Client publishes, may be NULL
+};
+
+/// @brief Counters since brokerBegin()
+struct BrokerStats {
+    unsigned long connects;         ///< Accepted CONNECTs
+    unsigned long rejected;         ///< Refused: no free slot, bad credentials or protocol
+    unsigned long messagesIn;       ///< PUBLISH received from clients
+    unsigned long messagesOut;      ///< PUBLISH delivered to clients
+    unsigned long bytesIn;
+    unsigned long bytesOut;
+    unsigned long dropped;          ///< Oversized packets, failed sends, full retained table
+};
+
+extern BrokerStats brokerStats;
+
+/// @brief Reset all tables and install the transport
+void brokerBegin(const BrokerIO& io);
+
+/// @brief Close every client and clear subscriptions (retained messages are kept)
+void brokerStop();
+
+/// @brief Reserve a slot for a new connection; -1 when all slots are taken
+int brokerAccept();
+
+/// @brief Feed bytes received from a client
+void brokerReceive(uint8_t client, const uint8_t* data, size_t len);
+
+/// @brief The transport noticed the connection is gone
+void brokerDisconnected(uint8_t client);
+
+/// @brief Expire clients whose keep-alive ran out
+void brokerPoll();
+
+/// @brief Publish from the device itself to subscribed clients
+void brokerPublish(const char* topic, const uint8_t* payload, size_t len, bool retain);
+
+/// @brief Whether an MQTT topic filter (with + and #) matches a topic
+bool brokerTopicMatches(const char* filter, const char* topic);
+
+/// @brief Connected (CONNACKed) clients
+int brokerClientCount();
+
+/// @brief Bytes of static state used by the client, retained and transmit tables
+size_t brokerMemoryFootprint();
+
+#endif // MINI_BROKER_H
@@ -0,0 +1,567 @@
+#include "mqtt5.h"
+#include <string.h>
+
+// Control packet types, with the fixed flags where the type has them
+#define PACKET_CONNECT 0x10
+#define PACKET_CONNACK 0x20
+#define PACKET_PUBLISH 0x30
+#define PACKET_PUBACK 0x40
+#define PACKET_SUBSCRIBE 0x82
+#define PACKET_SUBACK 0x90
+#define PACKET_PINGREQ 0xC0
+#define PACKET_PINGRESP 0xD0
+#define PACKET_DISCONNECT 0xE0
+
+// Property identifiers
+#define PROP_MESSAGE_EXPIRY 0x02
+#define PROP_RESPONSE_TOPIC 0x08
+#define PROP_CORRELATION_DATA 0x09
+#define PROP_SESSION_EXPIRY 0x11
+#define PROP_SERVER_KEEP_ALIVE 0x13
+#define PROP_TOPIC_ALIAS_MAXIMUM 0x22
+#define PROP_TOPIC_ALIAS 0x23
+#define PROP_MAXIMUM_PACKET_SIZE 0x27
+
+#define HEADER_ROOM 5                   // Type byte plus the longest Remaining Length
+#define PROPERTIES_SIZE 192             // Outbound properties of one packet
+
+// Appends to a buffer; running out of room clears ok instead of writing
+struct Writer {
+    uint8_t* data;
+    size_t size;
+    size_t len;
+    bool ok;
+};
+
+// Reads from a packet body; reading past the end clears ok and yields zeros
+struct Reader {
+    const uint8_t* data;
+    size_t len;
+    size_t pos;
+    bool ok;
+};
+
+static size_t varIntSize(uint32_t value) {
+    return value < 128 ? 1 : value < 16384 ? 2 : value < 2097152 ? 3 : 4;
+}
+
+static size_t encodeVarInt(uint8_t* out, uint32_t value) {
+    size_t n = 0;
+    do {
+        uint8_t digit = value % 128;
+        value /= 128;
+        out[n++] = value ? digit | 0x80 : digit;
+    } while (value);
+    return n;
+}
+
+static void putBytes(Writer& w, const uint8_t* data, size_t len) {
+    if (!w.ok || w.len + len > w.size) {
+        w.ok = false;
+        return;
+    }
+    memcpy(w.data + w.len, data, len);
+    w.len += len;
+}
+
+static void putByte(Writer& w, uint8_t value) {
+    putBytes(w, &value, 1);
+}
+
+static void putU16(Writer& w, uint16_t value) {
+    uint8_t bytes[2] = {(uint8_t)(value >> 8), (uint8_t)value};
+    putBytes(w, bytes, 2);
+}
+
+static void putU32(Writer& w, uint32_t value) {
+    uint8_t bytes[4] = {(uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value};
+    putBytes(w, bytes, 4);
+}
+
+static void putVarInt(Writer& w, uint32_t value) {
+    uint8_t bytes[4];
+    putBytes(w, bytes, encodeVarInt(bytes, value));
+}
+
+static void putBinary(Writer& w, const uint8_t* data, size_t len) {
+    if (len > 0xFFFF) {
+        w.ok = false;
+        return;
+    }
+    putU16(w, len);
+    putBytes(w, data, len);
+}
+
+static void putString(Writer& w, const char* text) {
+    putBinary(w, (const uint8_t*)text, strlen(text));
+}
+
+// Property Length followed by the properties collected in props
+static void putProperties(Writer& w, const Writer& props) {
+    if (!props.ok) {
+        w.ok = false;
+        return;
+    }
+    putVarInt(w, props.len);
+    putBytes(w, props.data, props.len);
+}
+
+static const uint8_t* getBytes(Reader& r, size_t len) {
+    if (!r.ok || r.pos + len > r.len) {
+        r.ok = false;
+        return NULL;
+    }
+    const uint8_t* data = r.data + r.pos;
+    r.pos += len;
+    return data;
+}
+
+static uint8_t getByte(Reader& r) {
+    const uint8_t* p = getBytes(r, 1);
+    return p ? p[0] : 0;
+}
+
+static uint16_t getU16(Reader& r) {
+    const uint8_t* p = getBytes(r, 2);
+    return p ? (p[0] << 8) | p[1] : 0;
+}
+
+static uint32_t getU32(Reader& r) {
+    const uint8_t* p = getBytes(r, 4);
+    return p ? ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | (p[2] << 8) | p[3] : 0;
+}
+
+static uint32_t getVarInt(Reader& r) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        uint8_t digit = getByte(r);
+        value |= (uint32_t)(digit & 0x7F) << (7 * i);
+        if (!(digit & 0x80)) {
+            return value;
+        }
+    }
+    r.ok = false;
+    return 0;
+}
+
+// Skip a property the client does not use, by the data type of its identifier
+static void skipProperty(Reader& r, uint8_t id) {
+    switch (id) {
+        case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A:
+            getByte(r);
+            break;
+        case 0x13: case 0x21: case 0x22: case 0x23:
+            getU16(r);
+            break;
+        case 0x02: case 0x11: case 0x18: case 0x27:
+            getU32(r);
+            break;
+        case 0x0B:
+            getVarInt(r);
+            break;
+        case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1A: case 0x1C: case 0x1F:
+            getBytes(r, getU16(r));
+            break;
+        case 0x26:                      // User Property: a string pair
+            getBytes(r, getU16(r));
+            getBytes(r, getU16(r));
+            break;
+        default:
+            r.ok = false;
+            break;
+    }
+}
+
+// Packet bodies are written behind room for the fixed header
+static Writer bodyWriter(Mqtt5Client& client) {
+    Writer w = {client.tx + HEADER_ROOM, sizeof(client.tx) - HEADER_ROOM, 0, true};
+    return w;
+}
+
+// Prefix the body with its fixed header and send; returns the packet size, 0 on failure
+static size_t sendPacket(Mqtt5Client& client, uint8_t type, const Writer& body) {
+    if (!body.ok) {
+        return 0;
+    }
+    size_t header = 1 + varIntSize(body.len);
+    size_t total = header + body.len;
+    if (client.serverMaxPacket && total > client.serverMaxPacket) {
+        return 0;
+    }
+    uint8_t* start = client.tx + HEADER_ROOM - header;
+    start[0] = type;
+    encodeVarInt(start + 1, body.len);
+    if (client.io.send(start, total) != total) {
+        return 0;
+    }
+    client.lastSent = client.io.nowMillis();
+    return total;
+}
+
+static uint16_t nextPacketId(Mqtt5Client& client) {
+    if (++client.packetId == 0) {
+        client.packetId = 1;
+    }
+    return client.packetId;
+}
+
+size_t mqtt5V311PublishSize(size_t topicLen, size_t payloadLen) {
+    size_t remaining = 2 + topicLen + payloadLen;
+    return 1 + varIntSize(remaining) + remaining;
+}
+
+void mqtt5Begin(Mqtt5Client& client, const Mqtt5IO& io, uint8_t protocol) {
+    memset(&client, 0, sizeof(client));
+    client.io = io;
+    client.protocol = protocol;
+}
+
+bool mqtt5Connect(Mqtt5Client& client, const char* clientId, const char* user, const char* password,
+                  uint16_t keepAliveS, uint32_t sessionExpiryS) {
+    bool hasUser = user && *user;
+    bool hasPassword = hasUser && password && *password;   // 3.1.1 allows no password without a user
+    uint8_t flags = (hasUser ? 0x80 : 0) | (hasPassword ? 0x40 : 0) | (sessionExpiryS ? 0 : 0x02);
+
+    Writer w = bodyWriter(client);
+    putString(w, "MQTT");
+    putByte(w, client.protocol);
+    putByte(w, flags);
+    putU16(w, keepAliveS);
+    if (client.protocol == MQTT5_PROTOCOL_V5) {
+        uint8_t buffer[16];
+        Writer props = {buffer, sizeof(buffer), 0, true};
+        if (sessionExpiryS) {
+            putByte(props, PROP_SESSION_EXPIRY);
+            putU32(props, sessionExpiryS);
+        }
+        putByte(props, PROP_TOPIC_ALIAS_MAXIMUM);
+        putU16(props, MQTT5_INBOUND_ALIASES);
+        putProperties(w, props);
+    }
+    putString(w, clientId);
+    if (hasUser) {
+        putString(w, user);
+    }
+    if (hasPassword) {
+        putString(w, password);
+    }
+
+    // Aliases and partial packets belong to the previous connection
+    client.state = MQTT5_CONNECTING;
+    client.keepAliveS = keepAliveS;
+    client.serverAliasMax = 0;
+    client.serverMaxPacket = 0;
+    client.aliasCount = 0;
+    memset(client.inboundAliases, 0, sizeof(client.inboundAliases));
+    client.rxLen = 0;
+    client.rxSkip = 0;
+    client.pingPending = false;
+    client.lastReceived = client.io.nowMillis();
+    if (!sendPacket(client, PACKET_CONNECT, w)) {
+        client.state = MQTT5_DISCONNECTED;
+        return false;
+    }
+    return true;
+}
+
+bool mqtt5Subscribe(Mqtt5Client& client, const char* filter, uint8_t options) {
+    if (client.state != MQTT5_CONNECTED) {
+        return false;
+    }
+    Writer w = bodyWriter(client);
+    putU16(w, nextPacketId(client));
+    if (client.protocol == MQTT5_PROTOCOL_V5) {
+        putVarInt(w, 0);                // No properties
+    }
+    putString(w, filter);
+    putByte(w, client.protocol == MQTT5_PROTOCOL_V5 ? options : options & 0x03);
+    return sendPacket(client, PACKET_SUBSCRIBE, w) != 0;
+}
+
+// Alias of a topic (1-based): existing, or the next free one; 0 when it gets none
+static uint16_t findAlias(const Mqtt5Client& client, const char* topic, size_t topicLen, bool* known) {
+    *known = false;
+    if (client.protocol != MQTT5_PROTOCOL_V5 || topicLen >= MQTT5_ALIAS_TOPIC_SIZE) {
+        return 0;
+    }
+    for (int i = 0; i < client.aliasCount; i++) {
+        if (strcmp(client.aliases[i], topic) == 0) {
+            *known = true;
+            return i + 1;
+        }
+    }
+    int limit = client.serverAliasMax < MQTT5_ALIAS_SLOTS ? client.serverAliasMax : MQTT5_ALIAS_SLOTS;
+    return client.aliasCount < limit ? client.aliasCount + 1 : 0;
+}
+
+bool mqtt5Publish(Mqtt5Client& client, const char* topic, const uint8_t* payload, size_t len, bool retain,
+                  const Mqtt5Properties* props) {
+    if (client.state != MQTT5_CONNECTED) {
+        return false;
+    }
+    size_t topicLen = strlen(topic);
+    bool known;
+    uint16_t alias = findAlias(client, topic, topicLen, &known);
+
+    Writer w = bodyWriter(client);
+    if (known) {
+        putU16(w, 0);                   // Empty topic, the alias stands for it
+    } else {
+        putBinary(w, (const uint8_t*)topic, topicLen);
+    }
+    if (client.protocol == MQTT5_PROTOCOL_V5) {
+        uint8_t buffer[PROPERTIES_SIZE];
+        Writer p = {buffer, sizeof(buffer), 0, true};
+        if (props && props->messageExpiryS) {
+            putByte(p, PROP_MESSAGE_EXPIRY);
+            putU32(p, props->messageExpiryS);
+        }
+        if (alias) {
+            putByte(p, PROP_TOPIC_ALIAS);
+            putU16(p, alias);
+        }
+        if (props && props->responseTopic) {
+            putByte(p, PROP_RESPONSE_TOPIC);
+            putString(p, props->responseTopic);
+        }
+        if (props && props->correlation) {
+            putByte(p, PROP_CORRELATION_DATA);
+            putBinary(p, props->correlation, props->correlationLen);
+        }
+        putProperties(w, p);
+    }
+    putBytes(w, payload, len);
+
+    size_t sent = sendPacket(client, PACKET_PUBLISH | (retain ? 0x01 : 0), w);
+    if (!sent) {
+        return false;
+    }
+    if (alias && !known) {
+        memcpy(client.aliases[client.aliasCount++], topic, topicLen + 1);
+    }
+    client.stats.messagesOut++;
+    client.stats.bytesOut += sent;
+    client.stats.v311BytesOut += mqtt5V311PublishSize(topicLen, len);
+    client.stats.aliasHits += known;
+    return true;
+}
+
+// Read a properties block, handing each property to take(); unknown ones are skipped
+template <typename Take>
+static void readProperties(Reader& r, Take take) {
+    uint32_t length = getVarInt(r);
+    size_t end = r.pos + length;
+    if (!r.ok || end > r.len) {
+        r.ok = false;
+        return;
+    }
+    while (r.ok && r.pos < end) {
+        uint8_t id = getByte(r);
+        if (!take(id)) {
+            skipProperty(r, id);
+        }
+    }
+    if (r.pos != end) {
+        r.ok = false;
+    }
+}
+
+static void handleConnack(Mqtt5Client& client, Reader& r) {
+    uint8_t flags = getByte(r);
+    uint8_t reason = getByte(r);
+    if (client.protocol == MQTT5_PROTOCOL_V5 && r.pos < r.len) {
+        readProperties(r, [&](uint8_t id) -> bool {
+            switch (id) {
+                case PROP_TOPIC_ALIAS_MAXIMUM: client.serverAliasMax = getU16(r); return true;
+                case PROP_SERVER_KEEP_ALIVE: client.keepAliveS = getU16(r); return true;
+                case PROP_MAXIMUM_PACKET_SIZE: client.serverMaxPacket = getU32(r); return true;
+                default: return false;
+            }
+        });
+    }
+    if (!r.ok || client.state != MQTT5_CONNECTING) {
+        client.stats.protocolErrors++;
+        client.state = MQTT5_DISCONNECTED;
+        return;
+    }
+    client.reason = reason;
+    client.sessionPresent = flags & 0x01;
+    client.state = reason == 0 ? MQTT5_CONNECTED : MQTT5_DISCONNECTED;
+}
+
+static void handlePublish(Mqtt5Client& client, uint8_t flags, Reader& r, size_t packetSize) {
+    uint8_t qos = (flags >> 1) & 0x03;
+    uint16_t topicLen = getU16(r);
+    const uint8_t* topicData = getBytes(r, topicLen);
+    uint16_t packetId = qos ? getU16(r) : 0;
+
+    Mqtt5Properties props = {0, NULL, NULL, 0};
+    char responseTopic[MQTT5_TOPIC_SIZE];
+    uint16_t alias = 0;
+    if (client.protocol == MQTT5_PROTOCOL_V5) {
+        readProperties(r, [&](uint8_t id) -> bool {
+            switch (id) {
+                case PROP_MESSAGE_EXPIRY:
+                    props.messageExpiryS = getU32(r);
+                    return true;
+                case PROP_TOPIC_ALIAS:
+                    alias = getU16(r);
+                    return true;
+                case PROP_RESPONSE_TOPIC: {
+                    uint16_t len = getU16(r);
+                    const uint8_t* data = getBytes(r, len);
+                    if (data && len < sizeof(responseTopic)) {
+                        memcpy(responseTopic, data, len);
+                        responseTopic[len] = '\0';
+                        props.responseTopic = responseTopic;
+                    }
+                    return true;
+                }
+                case PROP_CORRELATION_DATA:
+                    props.correlationLen = getU16(r);
+                    props.correlation = getBytes(r, props.correlationLen);
+                    return true;
+                default:
+                    return false;
+            }
+        });
+    }
+    if (!r.ok || qos > 1 || topicLen >= MQTT5_TOPIC_SIZE || alias > MQTT5_INBOUND_ALIASES) {
+        client.stats.protocolErrors++;
+        return;
+    }
+
+    char topic[MQTT5_TOPIC_SIZE];
+    memcpy(topic, topicData, topicLen);
+    topic[topicLen] = '\0';
+    if (alias && topicLen) {
+        // Broker sets up (or moves) an alias; topics too long to keep cannot be resolved later
+        if (topicLen < MQTT5_ALIAS_TOPIC_SIZE) {
+            memcpy(client.inboundAliases[alias - 1], topic, topicLen + 1);
+        } else {
+            client.inboundAliases[alias - 1][0] = '\0';
+        }
+    } else if (alias) {
+        strcpy(topic, client.inboundAliases[alias - 1]);
+        client.stats.inboundAliasHits++;
+    }
+    if (!topic[0]) {
+        client.stats.protocolErrors++;
+        return;
+    }
+
+    if (qos == 1) {
+        Writer w = bodyWriter(client);
+        putU16(w, packetId);            // Reason code 0 and no properties may be left out
+        sendPacket(client, PACKET_PUBACK, w);
+    }
+    const uint8_t* payload = r.data + r.pos;
+    size_t payloadLen = r.len - r.pos;
+    client.stats.messagesIn++;
+    client.stats.bytesIn += packetSize;
+    client.stats.v311BytesIn += mqtt5V311PublishSize(strlen(topic), payloadLen) + (qos ? 2 : 0);
+    if (client.io.onMessage) {
+        client.io.onMessage(topic, payload, payloadLen, props);
+    }
+}
+
+static void handlePacket(Mqtt5Client& client, const uint8_t* packet, size_t header, size_t remaining) {
+    Reader r = {packet + header, remaining, 0, true};
+    client.lastReceived = client.io.nowMillis();
+    switch (packet[0] & 0xF0) {
+        case PACKET_CONNACK:
+            handleConnack(client, r);
+            break;
+        case PACKET_PUBLISH:
+            handlePublish(client, packet[0] & 0x0F, r, header + remaining);
+            break;
+        case PACKET_PINGRESP:
+            client.pingPending = false;
+            break;
+        case PACKET_DISCONNECT:
+            client.reason = remaining ? getByte(r) : 0;
+            client.state = MQTT5_DISCONNECTED;
+            break;
+        default:
+            break;                      // SUBACK and PUBACK need no handling for QoS 0 publishes
+    }
+}
+
+void mqtt5Receive(Mqtt5Client& client, const uint8_t* data, size_t len) {
+    while (len > 0) {
+        if (client.rxSkip) {
+            size_t n = len < client.rxSkip ? len : client.rxSkip;
+            client.rxSkip -= n;
+            data += n;
+            len -= n;
+            continue;
+        }
+        size_t n = sizeof(client.rx) - client.rxLen;
+        n = len < n ? len : n;
+        memcpy(client.rx + client.rxLen, data, n);
+        client.rxLen += n;
+        data += n;
+        len -= n;
+
+        while (client.rxLen > 1) {
+            Reader r = {client.rx + 1, client.rxLen - 1, 0, true};
+            uint32_t remaining = getVarInt(r);
+            if (!r.ok) {
+                if (client.rxLen > HEADER_ROOM) {
+                    client.stats.protocolErrors++;
+                    client.state = MQTT5_DISCONNECTED;
+                    client.rxLen = 0;
+                    return;
+                }
+                break;                  // Remaining Length not complete yet
+            }
+            size_t header = 1 + r.pos;
+            size_t total = header + remaining;
+            if (total > sizeof(client.rx)) {
+                client.stats.oversized++;
+                client.rxSkip = total - client.rxLen;
+                client.rxLen = 0;
+                break;
+            }
+            if (client.rxLen < total) {
+                break;
+            }
+            handlePacket(client, client.rx, header, remaining);
+            memmove(client.rx, client.rx + total, client.rxLen - total);
+            client.rxLen -= total;
+        }
+    }
+}
+
+bool mqtt5Poll(Mqtt5Client& client) {
+    if (client.state != MQTT5_CONNECTED) {
+        return client.state == MQTT5_CONNECTING;
+    }
+    if (client.keepAliveS == 0) {
+        return true;
+    }
+    unsigned long now = client.io.nowMillis();
+    unsigned long period = client.keepAliveS * 1000UL;
+    if (now - client.lastReceived > period || now - client.lastSent > period) {
+        if (client.pingPending) {
+            client.state = MQTT5_DISCONNECTED;
+            return false;
+        }
+        Writer w = bodyWriter(client);
+        if (!sendPacket(client, PACKET_PINGREQ, w)) {
+            client.state = MQTT5_DISCONNECTED;
+            return false;
+        }
+        client.pingPending = true;
+        client.lastReceived = now;      // Give the broker a full period to answer
+    }
+    return true;
+}
+
+void mqtt5Disconnect(Mqtt5Client& client) {
+    if (client.state != MQTT5_DISCONNECTED) {
+        Writer w = bodyWriter(client);
+        sendPacket(client, PACKET_DISCONNECT, w);
+    }
+    client.state = MQTT5_DISCONNECTED;
+}
@@ -0,0 +1,123 @@
+#ifndef MQTT5_H
+#define MQTT5_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Small MQTT client codec for protocol level 5, with level 4 (3.1.1) kept
+// selectable so both can be measured with the same code. Publishes are QoS 0,
+// subscriptions QoS 0 or 1. The connection and clock are injected, so the
+// codec runs unchanged on the device (mqtt5_client.h) and on a host
+// (bench/mqtt5_bench.cpp).
+//
+// Level 5 features in use:
+// - Topic aliases: the first publish to a topic carries the topic and an
+//   alias, later ones an empty topic and the two-byte alias. Aliases are
+//   handed out first come, first served up to the broker's Topic Alias
+//   Maximum (at most MQTT5_ALIAS_SLOTS); topics beyond that go out in full.
+//   Aliases the broker assigns to topics it sends are resolved as well.
+// - Message expiry, response topic and correlation data are passed to the
+//   message handler and can be set on publishes.
+// - Subscription options, e.g. to skip retained messages when a persistent
+//   session is resumed.
+#define MQTT5_PROTOCOL_V311 4
+#define MQTT5_PROTOCOL_V5 5
+#define MQTT5_PACKET_SIZE 1024          // Largest packet sent or received
+#define MQTT5_TOPIC_SIZE 128            // Longest topic handled, including the terminator
+#define MQTT5_ALIAS_TOPIC_SIZE 64       // Longer topics never get an alias
+#define MQTT5_ALIAS_SLOTS 16            // Outbound topics with an alias
+#define MQTT5_INBOUND_ALIASES 8         // Topic Alias Maximum offered to the broker
+#define MQTT5_SUB_RETAIN_IF_NEW 0x10    // Subscription option: retained messages only for a new subscription
+
+enum Mqtt5State : uint8_t {
+    MQTT5_DISCONNECTED,
+    MQTT5_CONNECTING,               ///< CONNECT sent, waiting for CONNACK
+    MQTT5_CONNECTED
+};
+
+/// @brief Properties of one application message (0 / NULL when absent)
+struct Mqtt5Properties {
+    uint32_t messageExpiryS;        ///< Message Expiry Interval; what is left of it on inbound messages
+    const char* responseTopic;
+    const uint8_t* correlation;     ///< Correlation Data
+    uint16_t correlationLen;
+};
+
+/// @brief Connection and clock of a client
+struct Mqtt5IO {
+    size_t (*send)(const uint8_t* data, size_t len);   ///< Returns the bytes written
+    unsigned long (*nowMillis)();
+    /// An application message arrived; topic is terminated and its alias resolved.
+    /// Payload and properties point into the receive buffer and are valid for the call only.
+    void (*onMessage)(const char* topic, const uint8_t* payload, size_t len, const Mqtt5Properties& props);
+};
+
+/// @brief Traffic counters since mqtt5Begin()
+struct Mqtt5Stats {
+    unsigned long messagesOut;
+    unsigned long messagesIn;
+    unsigned long bytesOut;         ///< PUBLISH packets as sent
+    unsigned long bytesIn;          ///< PUBLISH packets as received
+    unsigned long v311BytesOut;     ///< The same messages encoded for 3.1.1
+    unsigned long v311BytesIn;
+    unsigned long aliasHits;        ///< Publishes sent with an alias instead of the topic
+    unsigned long inboundAliasHits; ///< Received publishes that carried only an alias
+    unsigned long oversized;        ///< Received packets dropped for exceeding MQTT5_PACKET_SIZE
+    unsigned long protocolErrors;
+};
+
+/// @brief One client session
+struct Mqtt5Client {
+    Mqtt5IO io;
+    uint8_t protocol;               ///< MQTT5_PROTOCOL_V311 or MQTT5_PROTOCOL_V5
+    Mqtt5State state;
+    uint8_t reason;                 ///< Reason code of the last CONNACK or DISCONNECT
+    bool sessionPresent;            ///< Broker resumed a stored session
+    uint16_t keepAliveS;            ///< As requested, or the broker's Server Keep Alive
+    uint16_t serverAliasMax;        ///< Broker's Topic Alias Maximum
+    uint32_t serverMaxPacket;       ///< Broker's Maximum Packet Size, 0 = unlimited
+    uint16_t packetId;
+    unsigned long lastSent;
+    unsigned long lastReceived;
+    bool pingPending;
+    char aliases[MQTT5_ALIAS_SLOTS][MQTT5_ALIAS_TOPIC_SIZE];             ///< Topic of outbound alias i + 1
+    uint8_t aliasCount;
+    char inboundAliases[MQTT5_INBOUND_ALIASES][MQTT5_ALIAS_TOPIC_SIZE];  ///< Topic of inbound alias i + 1
+    uint8_t rx[MQTT5_PACKET_SIZE];
+    size_t rxLen;
+    size_t rxSkip;                  ///< Bytes still to drop of an oversized packet
+    uint8_t tx[MQTT5_PACKET_SIZE];
+    Mqtt5Stats stats;
+};
+
+/// @brief Reset a client and its counters
+void mqtt5Begin(Mqtt5Client& client, const Mqtt5IO& io, uint8_t protocol);
+
+/// @brief Send CONNECT on an open connection; the CONNACK arrives through mqtt5Receive()
+/// @param sessionExpiryS 0 for a clean session, else how long the broker keeps it after a disconnect
+///        (3.1.1 has no expiry: any non-zero value asks for a persistent session)
+bool mqtt5Connect(Mqtt5Client& client, const char* clientId, const char* user, const char* password,
+                  uint16_t keepAliveS, uint32_t sessionExpiryS);
+
+/// @brief Subscribe to one filter
+/// @param options QoS (0 or 1) plus MQTT5_SUB_* flags; only the QoS is sent on 3.1.1
+bool mqtt5Subscribe(Mqtt5Client& client, const char* filter, uint8_t options);
+
+/// @brief Publish at QoS 0; props may be NULL and is ignored on 3.1.1
+bool mqtt5Publish(Mqtt5Client& client, const char* topic, const uint8_t* payload, size_t len, bool retain,
+                  const Mqtt5Properties* props);
+
+/// @brief Feed bytes read from the connection; handles every complete packet
+void mqtt5Receive(Mqtt5Client& client, const uint8_t* data, size_t len);
+
+/// @brief Keep-alive: ping when a keep-alive period passed without traffic
+/// @return false when the session is down or the broker missed a ping (close the connection)
+bool mqtt5Poll(Mqtt5Client& client);
+
+/// @brief Send DISCONNECT and mark the session down
+void mqtt5Disconnect(Mqtt5Client& client);
+
+/// @brief Size of a QoS 0 PUBLISH in 3.1.1, for comparisons
+size_t mqtt5V311PublishSize(size_t topicLen, size_t payloadLen);
+
+#endif // MQTT5_H
@@ -0,0 +1,158 @@
+#include "mqtt5_client.h"
+
+Mqtt5PubSub* Mqtt5PubSub::active = NULL;
+
+Mqtt5PubSub::Mqtt5PubSub(WiFiClient& client, uint8_t protocol)
+    : client(client), callback(NULL), host(NULL), port(0), dispatching(false), 
+      connectTimeoutMs(MQTT5_CONNECT_TIMEOUT_MS), acks(0) {
+    active = this;
+    Mqtt5IO io = {send, now, message};
+    mqtt5Begin(mqtt, io, protocol);
+}
+
+Mqtt5PubSub& Mqtt5PubSub::setServer(IPAddress address, uint16_t port) {
+    this->address = address;
+    this->host = NULL;
+    this->port = port;
+    return *this;
+}
+
+Mqtt5PubSub& Mqtt5PubSub::setServer(const char* host, uint16_t port) {
+    this->host = host;
+    this->port = port;
+    return *this;
+}
+
+Mqtt5PubSub& Mqtt5PubSub::setCallback(Callback callback) {
+    this->callback = callback;
+    return *this;
+}
+
+bool Mqtt5PubSub::setBufferSize(uint16_t size) {
+    return size <= MQTT5_PACKET_SIZE;
+}
+
+Mqtt5PubSub& Mqtt5PubSub::setSocketTimeout(uint16_t seconds) {
+    connectTimeoutMs = (unsigned long)seconds * 1000;
+    return *this;
+}
+
+bool Mqtt5PubSub::connect(const char* id, const char* user, const char* password) {
+    if (connected()) {
+        return true;
+    }
+    // mqtt_connect.h hands over an already connected socket, as with PubSubClient
+    if (!client.connected()) {
+        int result = host ? client.connect(host, port) : client.connect(address, port);
+        if (!result) {
+            return false;
+        }
+    }
+    if (!mqtt5Connect(mqtt, id, user, password, MQTT5_KEEPALIVE_S, MQTT5_SESSION_EXPIRY_S)) {
+        client.stop();
+        return false;
+    }
+    unsigned long start = millis();
+    while (mqtt.state == MQTT5_CONNECTING && millis() - start < connectTimeoutMs) {
+        if (!client.connected()) {
+            break;
+        }
+        readAvailable();
+        delay(1);
+    }
+    if (mqtt.state != MQTT5_CONNECTED) {
+        mqtt.state = MQTT5_DISCONNECTED;
+        client.stop();
+        return false;
+    }
+    return true;
+}
+
+void Mqtt5PubSub::disconnect() {
+    mqtt5Disconnect(mqtt);
+    client.stop();
+}
+
+bool Mqtt5PubSub::connected() {
+    if (mqtt.state == MQTT5_CONNECTED && !client.connected()) {
+        mqtt.state = MQTT5_DISCONNECTED;
+    }
+    return mqtt.state == MQTT5_CONNECTED;
+}
+
+bool Mqtt5PubSub::loop() {
+    if (!connected()) {
+        return false;
+    }
+    if (dispatching) {
+        return true;                    // Publishes are sent immediately, nothing to flush
+    }
+    readAvailable();
+    if (!mqtt5Poll(mqtt)) {
+        client.stop();
+        return false;
+    }
+    return connected();
+}
+
+bool Mqtt5PubSub::publish(const char* topic, const char* payload, bool retain) {
+    return publish(topic, (const uint8_t*)payload, strlen(payload), retain, NULL);
+}
+
+bool Mqtt5PubSub::publish(const char* topic, const uint8_t* payload, unsigned int length, bool retain) {
+    return publish(topic, payload, length, retain, NULL);
+}
+
+bool Mqtt5PubSub::publish(const char* topic, const uint8_t* payload, unsigned int length, bool retain,
+                          const Mqtt5Properties* props) {
+    return connected() && mqtt5Publish(mqtt, topic, payload, length, retain, props);
+}
+
+bool Mqtt5PubSub::subscribe(const char* topic) {
+    return connected() && mqtt5Subscribe(mqtt, topic, MQTT5_COMMAND_QOS | MQTT5_SUB_RETAIN_IF_NEW);
+}
+
+void Mqtt5PubSub::readAvailable() {
+    uint8_t buffer[128];
+    int available;
+    while ((available = client.available()) > 0) {
+        int n = client.read(buffer, available < (int)sizeof(buffer) ? available : sizeof(buffer));
+        if (n <= 0) {
+            break;
+        }
+        mqtt5Receive(mqtt, buffer, n);
+    }
+}
+
+size_t Mqtt5PubSub::send(const uint8_t* data, size_t len) {
+    return active->client.write(data, len);
+}
+
+unsigned long Mqtt5PubSub::now() {
+    return millis();
+}
+
+void Mqtt5PubSub::message(const char* topic, const uint8_t* payload, size_t len, const Mqtt5Properties& props) {
+    Mqtt5PubSub& self = *active;
+    if (!self.callback) {
+        return;
+    }
+    // The callback may modify its arguments, as PubSubClient allows
+    char topicCopy[MQTT5_TOPIC_SIZE];
+    strlcpy(topicCopy, topic, sizeof(topicCopy));
+    unsigned long start = micros();
+    self.dispatching = true;
+    self.callback(topicCopy, (uint8_t*)payload, len);
+    self.dispatching = false;
+    if (!props.responseTopic) {
+        return;
+    }
+    char ack[MQTT5_TOPIC_SIZE + 64];
+    int ackLen = snprintf(ack, sizeof(ack), "{\"topic\":\"%s\",\"status\":\"handled\",\"handled_us\":%lu}",
+                          topic, micros() - start);
+    ackLen = ackLen < (int)sizeof(ack) ? ackLen : sizeof(ack) - 1;
+    Mqtt5Properties reply = {0, NULL, props.correlation, props.correlationLen};
+    if (mqtt5Publish(self.mqtt, props.responseTopic, (const uint8_t*)ack, ackLen, false, &reply)) {
+        self.acks++;
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef MQTT5_CLIENT_H
+#define MQTT5_CLIENT_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include "mqtt5.h"
+
+// PubSubClient-compatible front end of the MQTT codec (mqtt5.h) on a
+// WiFiClient, so FEATURE_MQTT5 swaps the protocol without touching the rest of
+// the firmware. Beyond PubSubClient it:
+// - resumes a persistent session (MQTT5_SESSION_EXPIRY_S), so commands sent
+//   during a short outage are delivered on reconnect, while the broker drops
+//   those whose Message Expiry Interval ran out in the meantime
+// - subscribes at MQTT5_COMMAND_QOS and asks for retained messages only on a
+//   new subscription, so a resumed session does not replay doorbell/set/*
+// - answers every message that carries a Response Topic, after the callback
+//   returned, with {"topic","status","handled_us"} and the Correlation Data
+#define MQTT5_KEEPALIVE_S 15            // PubSubClient's default
+#define MQTT5_CONNECT_TIMEOUT_MS 15000  // Default CONNACK wait (PubSubClient's socket timeout)
+#define MQTT5_SESSION_EXPIRY_S 300      // Broker keeps subscriptions and queued commands this long
+#define MQTT5_COMMAND_QOS 1             // Lets the broker queue commands for the session
+
+class Mqtt5PubSub {
+public:
+    typedef void (*Callback)(char* topic, uint8_t* payload, unsigned int length);
+
+    explicit Mqtt5PubSub(WiFiClient& client, uint8_t protocol = MQTT5_PROTOCOL_V5);
+
+    Mqtt5PubSub& setServer(IPAddress address, uint16_t port);
+    Mqtt5PubSub& setServer(const char* host, uint16_t port);
+    Mqtt5PubSub& setCallback(Callback callback);
+    bool setBufferSize(uint16_t size);  ///< Buffers are fixed; true when size fits MQTT5_PACKET_SIZE
+    Mqtt5PubSub& setSocketTimeout(uint16_t seconds);  ///< CONNACK wait
+
+    bool connect(const char* id, const char* user, const char* password);
+    void disconnect();
+    bool connected();
+    bool loop();
+
+    bool publish(const char* topic, const char* payload, bool retain = false);
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length, bool retain = false);
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length, bool retain,
+                 const Mqtt5Properties* props);
+    bool subscribe(const char* topic);
+
+    const Mqtt5Client& session() const { return mqtt; }
+    unsigned long acksSent() const { return acks; }
+
+private:
+    static size_t send(const uint8_t* data, size_t len);
+    static unsigned long now();
+    static void message(const char* topic, const uint8_t* payload, size_t len, const Mqtt5Properties& props);
+    void readAvailable();
+
+    static Mqtt5PubSub* active;         // Codec callbacks carry no context; one instance per firmware
+    WiFiClient& client;
+    Mqtt5Client mqtt;
+    Callback callback;
+    IPAddress address;
+    const char* host;
+    uint16_t port;
+    bool dispatching;                   // Inside the callback, where loop() must not read
+    unsigned long connectTimeoutMs;
+    unsigned long acks;
+};
+
+#endif // MQTT5_CLIENT_H
@@ -0,0 +1,326 @@
+#include "mqtt_connect.h"
+#include <lwip/sockets.h>
+
+// Cached name; address 0 means the name was requested but never resolved
+struct DnsEntry {
+    char host[DNS_HOST_SIZE];
+    uint32_t address;
+    unsigned long resolvedAt;
+    unsigned long lastAttempt;
+    bool refreshQueued;
+};
+
+DnsStats dnsStats;
+
+static DnsEntry dnsCache[DNS_CACHE_SIZE];
+static portMUX_TYPE dnsMux = portMUX_INITIALIZER_UNLOCKED;
+// WiFi.hostByName() signals completion through one shared event bit, so lookups
+// from the loop and the refresh task must not overlap
+static SemaphoreHandle_t lookupLock = NULL;
+static QueueHandle_t refreshQueue = NULL;
+
+// Caller holds dnsMux
+static DnsEntry* findEntry(const char* host) {
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        if (dnsCache[i].host[0] != '\0' && strcmp(dnsCache[i].host, host) == 0) {
+            return &dnsCache[i];
+        }
+    }
+    return NULL;
+}
+
+// Caller holds dnsMux; reuses an empty slot or the least recently resolved one
+static DnsEntry* claimEntry(const char* host) {
+    DnsEntry* entry = findEntry(host);
+    if (entry) {
+        return entry;
+    }
+    entry = &dnsCache[0];
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        if (dnsCache[i].host[0] == '\0') {
+            entry = &dnsCache[i];
+            break;
+        }
+        if (dnsCache[i].resolvedAt < entry->resolvedAt) {
+            entry = &dnsCache[i];
+        }
+    }
+    memset(entry, 0, sizeof(DnsEntry));
+    strlcpy(entry->host, host, sizeof(entry->host));
+    return entry;
+}
+
+static bool lookup(const char* host, IPAddress& address) {
+    xSemaphoreTake(lookupLock, portMAX_DELAY);
+    bool ok = WiFi.hostByName(host, address) == 1 && (uint32_t)address != 0;
+    xSemaphoreGive(lookupLock);
+    return ok;
+}
+
+static void store(const char* host, bool ok, const IPAddress& address) {
+    unsigned long now = millis();
+    portENTER_CRITICAL(&dnsMux);
+    DnsEntry* entry = claimEntry(host);
+    entry->lastAttempt = now;
+    entry->refreshQueued = false;
+    if (ok) {
+        entry->address = (uint32_t)address;
+        entry->resolvedAt = now;
+    }
+    portEXIT_CRITICAL(&dnsMux);
+}
+
+// Hand a name to the refresh task unless it is already queued or failed recently
+static void requestRefresh(const char* host) {
+    bool queue = false;
+    unsigned long now = millis();
+    portENTER_CRITICAL(&dnsMux);
+    DnsEntry* entry = claimEntry(host);
+    if (!entry->refreshQueued && (entry->lastAttempt == 0 || now - entry->lastAttempt >= DNS_RETRY_MS)) {
+        entry->refreshQueued = true;
+        queue = true;
+    }
+    portEXIT_CRITICAL(&dnsMux);
+
+    if (!queue) {
+        return;
+    }
+    char name[DNS_HOST_SIZE];
+    strlcpy(name, host, sizeof(name));
+    if (xQueueSend(refreshQueue, name, 0) != pdTRUE) {
+        portENTER_CRITICAL(&dnsMux);
+        entry = findEntry(host);
+        if (entry) {
+            entry->refreshQueued = false;
+        }
+        portEXIT_CRITICAL(&dnsMux);
+    }
+}
+
+static void dnsRefreshTask(void* param) {
+    char host[DNS_HOST_SIZE];
+
+    for (;;) {
+        if (xQueueReceive(refreshQueue, host, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        IPAddress address;
+        bool ok = WiFi.status() == WL_CONNECTED && lookup(host, address);
+        store(host, ok, address);
+        if (ok) {
+            dnsStats.refreshes++;
+        } else {
+            dnsStats.failures++;
+        }
+    }
+}
+
+void dnsBegin() {
+    lookupLock = xSemaphoreCreateMutex();
+    refreshQueue = xQueueCreate(DNS_CACHE_SIZE, DNS_HOST_SIZE);
+    xTaskCreatePinnedToCore(dnsRefreshTask, "dns_refresh", 3072, NULL, 1, NULL, 0);
+}
+
+bool dnsResolve(const char* host, IPAddress& address, bool allowBlocking, DnsSource* source) {
+    *source = DNS_SOURCE_NONE;
+    if (host[0] == '\0') {
+        return false;
+    }
+    if (address.fromString(host)) {
+        *source = DNS_SOURCE_LITERAL;
+        return true;
+    }
+
+    uint32_t cached = 0;
+    unsigned long age = 0;
+    unsigned long now = millis();
+    portENTER_CRITICAL(&dnsMux);
+    DnsEntry* entry = findEntry(host);
+    if (entry && entry->address != 0) {
+        cached = entry->address;
+        age = now - entry->resolvedAt;
+    }
+    portEXIT_CRITICAL(&dnsMux);
+
+    if (cached != 0 && age < DNS_TTL_MS) {
+        dnsStats.hits++;
+        address = IPAddress(cached);
+        *source = DNS_SOURCE_HIT;
+        return true;
+    }
+    if (cached != 0 && age < DNS_STALE_MS) {
+        // Serve the old address now, the refresh task updates it for next time
+        dnsStats.staleHits++;
+        address = IPAddress(cached);
+        *source = DNS_SOURCE_STALE;
+        requestRefresh(host);
+        return true;
+    }
+
+    if (!allowBlocking) {
+        requestRefresh(host);
+        return false;
+    }
+    dnsStats.misses++;
+    bool ok = lookup(host, address);
+    store(host, ok, address);
+    if (!ok) {
+        dnsStats.failures++;
+        return false;
+    }
+    *source = DNS_SOURCE_LOOKUP;
+    return true;
+}
+
+// Start a non-blocking connect; -1 if it failed immediately
+static int openSocket(const IPAddress& address, uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = (uint32_t)address;
+    addr.sin_port = htons(port);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool connectRaceBegin(ConnectRace& race, const ConnectTarget* targets, int count, uint8_t skipMask,
+                      bool allowBlocking, ConnectTiming& timing) {
+    race.count = min(count, CONNECT_TARGETS);
+    race.next = 0;
+
+    timing.winner = -1;
+    timing.attempted = 0;
+    timing.dnsSource = DNS_SOURCE_NONE;
+    timing.tcpMs = 0;
+
+    // Cache-only pass first, so a cached backup is not held up by a lookup for the
+    // primary; block only when no target has an address at all
+    unsigned long start = millis();
+    bool resolved = false;
+    for (int i = 0; i < race.count; i++) {
+        race.fds[i] = -1;
+        race.sources[i] = DNS_SOURCE_NONE;
+        race.ports[i] = targets[i].port;
+        if (!(skipMask & (1 << i)) && dnsResolve(targets[i].host, race.addresses[i], false, &race.sources[i])) {
+            resolved = true;
+        }
+    }
+    for (int i = 0; i < race.count && !resolved && allowBlocking; i++) {
+        if (!(skipMask & (1 << i))) {
+            resolved = dnsResolve(targets[i].host, race.addresses[i], true, &race.sources[i]);
+        }
+    }
+    timing.dnsMs = millis() - start;
+    race.start = millis();
+    race.nextStart = race.start;
+    return resolved;
+}
+
+int connectRacePoll(ConnectRace& race, unsigned long waitMs, WiFiClient& client, ConnectTiming& timing) {
+    unsigned long pollStart = millis();
+    int winner = -1;
+    while (winner < 0) {
+        unsigned long now = millis();
+        if (now - race.start >= CONNECT_TIMEOUT_MS) {
+            break;
+        }
+
+        // Launch the next target when its turn comes or every earlier attempt failed
+        while (race.next < race.count && (long)(now - race.nextStart) >= 0) {
+            int i = race.next++;
+            if (race.sources[i] != DNS_SOURCE_NONE) {
+                race.fds[i] = openSocket(race.addresses[i], race.ports[i]);
+                if (race.fds[i] >= 0) {
+                    timing.attempted++;
+                    race.nextStart = now + CONNECT_STAGGER_MS;
+                }
+            }
+        }
+
+        fd_set writable;
+        FD_ZERO(&writable);
+        int maxFd = -1;
+        for (int i = 0; i < race.count; i++) {
+            if (race.fds[i] >= 0) {
+                FD_SET(race.fds[i], &writable);
+                maxFd = max(maxFd, race.fds[i]);
+            }
+        }
+        if (maxFd < 0) {
+            if (race.next >= race.count) {
+                break;  // Every attempt failed
+            }
+            race.nextStart = now;
+            continue;
+        }
+
+        unsigned long wait = CONNECT_TIMEOUT_MS - (now - race.start);
+        if (race.next < race.count) {
+            wait = min(wait, (unsigned long)max(0L, (long)(race.nextStart - now)));
+        }
+        wait = min(wait, waitMs - min(waitMs, now - pollStart));
+        struct timeval tv;
+        tv.tv_sec = wait / 1000;
+        tv.tv_usec = (wait % 1000) * 1000;
+        if (select(maxFd + 1, NULL, &writable, NULL, &tv) > 0) {
+            for (int i = 0; i < race.count && winner < 0; i++) {
+                if (race.fds[i] < 0 || !FD_ISSET(race.fds[i], &writable)) {
+                    continue;
+                }
+                int error = 0;
+                socklen_t len = sizeof(error);
+                getsockopt(race.fds[i], SOL_SOCKET, SO_ERROR, &error, &len);
+                if (error == 0) {
+                    winner = i;
+                } else {
+                    // Refused or unreachable: let the next target start right away
+                    close(race.fds[i]);
+                    race.fds[i] = -1;
+                    race.nextStart = millis();
+                }
+            }
+        }
+        if (winner < 0 && millis() - pollStart >= waitMs) {
+            return CONNECT_PENDING;
+        }
+    }
+
+    int fd = winner >= 0 ? race.fds[winner] : -1;
+    for (int i = 0; i < race.count; i++) {
+        if (race.fds[i] >= 0 && i != winner) {
+            close(race.fds[i]);
+        }
+        race.fds[i] = -1;
+    }
+    timing.tcpMs = millis() - race.start;
+    if (winner < 0) {
+        return -1;
+    }
+
+    // WiFiClient expects a blocking socket, as its own connect() leaves it
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+    client.stop();
+    client = WiFiClient(fd);
+
+    timing.winner = winner;
+    timing.address = race.addresses[winner];
+    timing.dnsSource = race.sources[winner];
+    return winner;
+}
+
+int connectRace(const ConnectTarget* targets, int count, uint8_t skipMask, WiFiClient& client, ConnectTiming& timing) {
+    ConnectRace race;
+    if (!connectRaceBegin(race, targets, count, skipMask, true, timing)) {
+        return -1;
+    }
+    return connectRacePoll(race, CONNECT_TIMEOUT_MS, client, timing);
+}
@@ -0,0 +1,96 @@
+#ifndef MQTT_CONNECT_H
+#define MQTT_CONNECT_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+// Cached DNS resolution and a staggered TCP race between the configured
+// MQTT brokers, so a slow resolver or a dead primary does not stall reconnects
+#define DNS_CACHE_SIZE 4
+#define DNS_HOST_SIZE 64
+#define DNS_TTL_MS 300000           // A lookup is fresh this long
+#define DNS_STALE_MS 86400000UL     // Expired entries are still used, while refreshed in the background, up to this age
+#define DNS_RETRY_MS 30000          // Minimum time between refreshes of a failing name
+#define CONNECT_TARGETS 2           // Primary and backup broker
+#define CONNECT_STAGGER_MS 250      // Head start of the primary before the backup attempt begins
+#define CONNECT_TIMEOUT_MS 5000     // TCP connect limit for the whole race
+
+/// @brief How an address was obtained
+enum DnsSource {
+    DNS_SOURCE_NONE,                ///< Not resolved
+    DNS_SOURCE_LITERAL,             ///< Host is an IP address
+    DNS_SOURCE_HIT,                 ///< Fresh cache entry
+    DNS_SOURCE_STALE,               ///< Expired cache entry, refresh requested
+    DNS_SOURCE_LOOKUP               ///< Blocking lookup on the caller's task
+};
+
+/// @brief Resolver counters, written by both the loop and the refresh task
+struct DnsStats {
+    unsigned long hits;
+    unsigned long staleHits;
+    unsigned long misses;           ///< Blocking lookups done while connecting
+    unsigned long refreshes;        ///< Background lookups that succeeded
+    unsigned long failures;         ///< Lookups (blocking or background) that failed
+};
+
+/// @brief One broker to race
+struct ConnectTarget {
+    const char* host;
+    uint16_t port;
+};
+
+/// @brief Timing breakdown of the last race
+struct ConnectTiming {
+    int winner;                     ///< Index into the targets, -1 if every attempt failed
+    IPAddress address;
+    DnsSource dnsSource;            ///< For the winner
+    unsigned long dnsMs;            ///< Resolving all targets
+    unsigned long tcpMs;            ///< First connect() to established winner
+    int attempted;                  ///< Targets with an address that got a socket
+};
+
+extern DnsStats dnsStats;
+
+/// @brief Create the cache lock and start the background refresh task
+void dnsBegin();
+
+/// @brief Resolve a host through the cache; blocking only on a miss when allowed
+/// @return false when no address is available (a refresh is queued on a miss)
+bool dnsResolve(const char* host, IPAddress& address, bool allowBlocking, DnsSource* source);
+
+/// @brief A race in progress, advanced by connectRacePoll()
+struct ConnectRace {
+    int fds[CONNECT_TARGETS];       ///< -1 when not started or failed
+    IPAddress addresses[CONNECT_TARGETS];
+    DnsSource sources[CONNECT_TARGETS];
+    uint16_t ports[CONNECT_TARGETS];
+    int count;
+    int next;                       ///< Next target to launch
+    unsigned long start;
+    unsigned long nextStart;        ///< When the next target may launch
+};
+
+#define CONNECT_PENDING -2          ///< connectRacePoll(): no winner yet, call again
+
+/// @brief Connect to whichever target completes the TCP handshake first
+///
+/// The first target starts immediately, each following one CONNECT_STAGGER_MS
+/// later unless an earlier attempt already won. The winning socket is handed to
+/// client, which is then already connected when PubSubClient::connect() sends
+/// CONNECT. Targets listed in skipMask (bit per index) are not attempted.
+int connectRace(const ConnectTarget* targets, int count, uint8_t skipMask, WiFiClient& client, ConnectTiming& timing);
+
+/// @brief Resolve the targets and launch the first one, without waiting
+///
+/// Without allowBlocking only cached or literal addresses are used; a miss
+/// queues a background lookup for the next attempt.
+/// @return false when no target has an address
+bool connectRaceBegin(ConnectRace& race, const ConnectTarget* targets, int count, uint8_t skipMask,
+                      bool allowBlocking, ConnectTiming& timing);
+
+/// @brief Advance a race for at most waitMs
+/// @return The winner (its socket handed to client), -1 once every attempt failed
+///         or CONNECT_TIMEOUT_MS ran out, CONNECT_PENDING otherwise
+int connectRacePoll(ConnectRace& race, unsigned long waitMs, WiFiClient& client, ConnectTiming& timing);
+
+#endif // MQTT_CONNECT_H
@@ -0,0 +1,150 @@
+#include "notifier.h"
+#include "config.h"
+#include "notify_ca.h"
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+#include <HTTPClient.h>
+
+// Queued notification; copied by value through the FreeRTOS queue
+struct NotifyItem {
+    char title[48];
+    char message[160];
+    char tags[32];
+    unsigned long enqueuedAt;
+};
+
+// Counters are updated on both cores; every access holds statsMux
+static NotifierStats notifierStats;
+static portMUX_TYPE statsMux = portMUX_INITIALIZER_UNLOCKED;
+
+static QueueHandle_t notifyQueue = NULL;
+static char notifyUrl[NOTIFY_URL_SIZE] = "";
+static portMUX_TYPE notifyUrlMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Connections live for the whole task so keep-alive can reuse an open TCP/TLS connection
+static WiFiClientSecure secureClient;
+static WiFiClient plainClient;
+static HTTPClient http;
+
+// POST one notification. The HTTPClient keeps the connection open between
+// calls (setReuse), so rings while the server keeps it open skip the TCP and
+// TLS handshakes. Once the server closes it, the next ring pays a full
+// handshake: WiFiClientSecure has no TLS session resumption.
+static bool deliver(const NotifyItem& item, const char* url) {
+    bool secure = strncmp(url, "https://", 8) == 0;
+    WiFiClient& client = secure ? (WiFiClient&)secureClient : plainClient;
+
+    if (!http.begin(client, url)) {
+        return false;
+    }
+    http.addHeader("Title", item.title);
+    http.addHeader("Priority", "high");
+    http.addHeader("Tags", item.tags);
+    int code = http.POST((uint8_t*)item.message, strlen(item.message));
+    // end() keeps the socket open when reuse is enabled and the server allows keep-alive
+    http.end();
+    return code >= 200 && code < 300;
+}
+
+static void notifierTask(void* param) {
+    NotifyItem item;
+    char url[NOTIFY_URL_SIZE];
+
+    for (;;) {
+        if (xQueueReceive(notifyQueue, &item, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        bool delivered = false;
+        unsigned long backoff = NOTIFY_RETRY_BASE_MS;
+        for (int attempt = 0; attempt < NOTIFY_MAX_ATTEMPTS && !delivered; attempt++) {
+            if (attempt > 0) {
+                portENTER_CRITICAL(&statsMux);
+                notifierStats.retries++;
+                portEXIT_CRITICAL(&statsMux);
+                vTaskDelay(pdMS_TO_TICKS(backoff));
+                backoff *= 2;
+            }
+
+            portENTER_CRITICAL(&notifyUrlMux);
+            strlcpy(url, notifyUrl, sizeof(url));
+            portEXIT_CRITICAL(&notifyUrlMux);
+            if (url[0] == '\0') {
+                break;  // Disabled while queued
+            }
+            if (WiFi.status() != WL_CONNECTED) {
+                continue;
+            }
+            delivered = deliver(item, url);
+        }
+
+        unsigned long latency = millis() - item.enqueuedAt;
+        portENTER_CRITICAL(&statsMux);
+        if (delivered) {
+            notifierStats.sent++;
+            notifierStats.lastLatencyMs = latency;
+            notifierStats.totalLatencyMs += latency;
+            if (latency > notifierStats.maxLatencyMs) {
+                notifierStats.maxLatencyMs = latency;
+            }
+        } else {
+            notifierStats.failed++;
+        }
+        portEXIT_CRITICAL(&statsMux);
+    }
+}
+
+void notifierBegin() {
+    // Roots from notify_ca.h, or NOTIFY_CA_CERT in config.h for other servers
+    secureClient.setCACert(NOTIFY_CA_CERT);
+    secureClient.setHandshakeTimeout(NOTIFY_HTTP_TIMEOUT_MS / 1000);
+    http.setReuse(true);
+    http.setConnectTimeout(NOTIFY_HTTP_TIMEOUT_MS);
+    http.setTimeout(NOTIFY_HTTP_TIMEOUT_MS);
+
+    notifyQueue = xQueueCreate(NOTIFY_QUEUE_DEPTH, sizeof(NotifyItem));
+    // Core 0 keeps TLS work off the loop task on core 1
+    xTaskCreatePinnedToCore(notifierTask, "notifier", 8192, NULL, 1, NULL, 0);
+}
+
+void notifierConfigure(const char* url) {
+    portENTER_CRITICAL(&notifyUrlMux);
+    strlcpy(notifyUrl, url ? url : "", sizeof(notifyUrl));
+    portEXIT_CRITICAL(&notifyUrlMux);
+}
+
+bool notifierEnabled() {
+    return notifyUrl[0] != '\0';
+}
+
+bool notifierEnqueue(const char* title, const char* message, const char* tags) {
+    if (!notifyQueue || !notifierEnabled()) {
+        return false;
+    }
+
+    NotifyItem item;
+    strlcpy(item.title, title, sizeof(item.title));
+    strlcpy(item.message, message, sizeof(item.message));
+    strlcpy(item.tags, tags, sizeof(item.tags));
+    item.enqueuedAt = millis();
+
+    bool queued = xQueueSend(notifyQueue, &item, 0) == pdTRUE;
+    portENTER_CRITICAL(&statsMux);
+    if (queued) {
+        notifierStats.queued++;
+    } else {
+        notifierStats.dropped++;
+    }
+    portEXIT_CRITICAL(&statsMux);
+    return queued;
+}
+
+int notifierQueueDepth() {
+    return notifyQueue ? uxQueueMessagesWaiting(notifyQueue) : 0;
+}
+
+void notifierGetStats(NotifierStats& out) {
+    portENTER_CRITICAL(&statsMux);
+    out = notifierStats;
+    portEXIT_CRITICAL(&statsMux);
+}
@@ -0,0 +1,43 @@
+#ifndef NOTIFIER_H
+#define NOTIFIER_H
+
+#include <Arduino.h>
+
+// Direct push notifications to an ntfy-compatible endpoint
+#define NOTIFY_QUEUE_DEPTH 8        // Notifications waiting for delivery
+#define NOTIFY_MAX_ATTEMPTS 4       // Delivery attempts per notification
+#define NOTIFY_RETRY_BASE_MS 1000   // First retry delay, doubled on each further attempt
+#define NOTIFY_HTTP_TIMEOUT_MS 5000 // Connect and response timeout per attempt
+#define NOTIFY_URL_SIZE 96
+
+/// @brief Delivery counters, updated by the notifier task and the enqueuing loop
+struct NotifierStats {
+    unsigned long queued;           ///< Notifications accepted into the queue
+    unsigned long sent;             ///< Delivered with a 2xx response
+    unsigned long failed;           ///< Given up after NOTIFY_MAX_ATTEMPTS
+    unsigned long dropped;          ///< Rejected because the queue was full
+    unsigned long retries;          ///< Extra attempts beyond the first
+    unsigned long lastLatencyMs;    ///< Enqueue to 2xx of the last delivery
+    unsigned long maxLatencyMs;
+    unsigned long totalLatencyMs;   ///< Sum over all deliveries, for the average
+};
+
+/// @brief Create the queue and start the background delivery task
+void notifierBegin();
+
+/// @brief Set the endpoint URL (e.g. https://ntfy.sh/mytopic); empty disables the notifier
+void notifierConfigure(const char* url);
+
+/// @brief Whether an endpoint is configured
+bool notifierEnabled();
+
+/// @brief Queue a notification without blocking; returns false if disabled or the queue is full
+bool notifierEnqueue(const char* title, const char* message, const char* tags);
+
+/// @brief Notifications currently waiting in the queue
+int notifierQueueDepth();
+
+/// @brief Consistent copy of the delivery counters
+void notifierGetStats(NotifierStats& out);
+
+#endif // NOTIFIER_H
@@ -0,0 +1,229 @@
+#include "outputs.h"
+#include <string.h>
+
+struct Output {
+    const char* name;
+    OutputLimits limits;
+    OutputStats stats;
+    OutputStep steps[OUTPUT_MAX_STEPS];
+    uint8_t stepCount;
+    uint8_t step;                   // Step being played
+    uint8_t repeatsLeft;            // Runs of the pattern after the current one
+    bool running;                   // Pattern in progress
+    bool waiting;                   // Current step held back by minOffMs
+    bool active;                    // Last state reported through onActive
+    uint8_t level;
+    unsigned long onSince;
+    unsigned long offSince;
+    unsigned long stepEndsAt;
+};
+
+static Output outputs[OUTPUT_MAX];
+static int count = 0;
+static OutputDriver io;
+static unsigned long nextDue = 0;   // Earliest step end or limit over all outputs
+static bool scheduled = false;      // nextDue is valid
+
+static bool reached(unsigned long now, unsigned long at) {
+    return (long)(now - at) >= 0;
+}
+
+static void writeLevel(int i, uint8_t level, unsigned long now) {
+    Output& o = outputs[i];
+    if (level > 0 && o.level == 0) {
+        o.onSince = now;
+    } else if (level == 0 && o.level > 0) {
+        o.offSince = now;
+        o.stats.onMs += now - o.onSince;
+    }
+    o.level = level;
+    io.write(i, level);
+}
+
+static void reportActivity(int i) {
+    Output& o = outputs[i];
+    bool active = o.running || o.level > 0;
+    if (active != o.active) {
+        o.active = active;
+        if (io.onActive) {
+            io.onActive(i, active);
+        }
+    }
+}
+
+// Begin the current step, unless the off-time limit holds a switch-on back
+static void startStep(int i, unsigned long now) {
+    Output& o = outputs[i];
+    const OutputStep& step = o.steps[o.step];
+    if (step.level > 0 && o.level == 0 && o.limits.minOffMs && now - o.offSince < o.limits.minOffMs) {
+        if (!o.waiting) {
+            o.waiting = true;
+            o.stats.delayed++;
+        }
+        o.stepEndsAt = o.offSince + o.limits.minOffMs;
+        return;
+    }
+    o.waiting = false;
+    writeLevel(i, step.level, now);
+    if (step.ms == 0) {
+        o.running = false;  // Hold until changed
+    } else {
+        o.stepEndsAt = now + step.ms;
+    }
+}
+
+static void advance(int i, unsigned long now) {
+    Output& o = outputs[i];
+    if (!o.waiting && ++o.step >= o.stepCount) {
+        if (o.repeatsLeft == 0) {
+            o.running = false;
+            writeLevel(i, 0, now);
+            return;
+        }
+        o.repeatsLeft--;
+        o.step = 0;
+    }
+    startStep(i, now);
+}
+
+static void service(int i, unsigned long now) {
+    Output& o = outputs[i];
+    if (o.level > 0 && o.limits.maxOnMs && reached(now, o.onSince + o.limits.maxOnMs)) {
+        o.stats.limited++;
+        o.running = false;
+        o.waiting = false;
+        writeLevel(i, 0, now);
+    }
+    if (o.running && reached(now, o.stepEndsAt)) {
+        advance(i, now);
+    }
+    reportActivity(i);
+}
+
+// Recompute the single deadline outputsUpdate() waits for
+static void schedule() {
+    scheduled = false;
+    for (int i = 0; i < count; i++) {
+        const Output& o = outputs[i];
+        if (o.running && (!scheduled || (long)(o.stepEndsAt - nextDue) < 0)) {
+            nextDue = o.stepEndsAt;
+            scheduled = true;
+        }
+        if (o.level > 0 && o.limits.maxOnMs) {
+            unsigned long limit = o.onSince + o.limits.maxOnMs;
+            if (!scheduled || (long)(limit - nextDue) < 0) {
+                nextDue = limit;
+                scheduled = true;
+            }
+        }
+    }
+}
+
+void outputsBegin(const OutputDriver& driver) {
+    io = driver;
+    count = 0;
+    scheduled = false;
+}
+
+int outputAdd(const char* name, const OutputLimits& limits) {
+    if (count >= OUTPUT_MAX) {
+        return -1;
+    }
+    Output& o = outputs[count];
+    memset(&o, 0, sizeof(Output));
+    o.name = name;
+    o.limits = limits;
+    o.offSince = io.nowMillis() - limits.minOffMs;  // The first switch-on is never delayed
+    io.write(count, 0);
+    return count++;
+}
+
+int outputFind(const char* name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(outputs[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool outputSet(int output, uint8_t level, uint16_t ms) {
+    OutputStep step = {level, ms};
+    return outputPattern(output, &step, 1, 1);
+}
+
+bool outputPattern(int output, const OutputStep* steps, int stepCount, uint8_t repeat) {
+    if (output < 0 || output >= count || stepCount < 1 || stepCount > OUTPUT_MAX_STEPS) {
+        return false;
+    }
+    for (int s = 0; s < stepCount - 1; s++) {
+        if (steps[s].ms == 0) {
+            return false;  // Only the last step may hold
+        }
+    }
+
+    Output& o = outputs[output];
+    memcpy(o.steps, steps, stepCount * sizeof(OutputStep));
+    o.stepCount = stepCount;
+    o.step = 0;
+    o.repeatsLeft = repeat > 1 ? repeat - 1 : 0;
+    o.running = true;
+    o.waiting = false;
+    o.stats.activations++;
+    startStep(output, io.nowMillis());
+    reportActivity(output);
+    schedule();
+    return true;
+}
+
+void outputStop(int output) {
+    if (output < 0 || output >= count) {
+        return;
+    }
+    Output& o = outputs[output];
+    o.running = false;
+    o.waiting = false;
+    if (o.level > 0) {
+        writeLevel(output, 0, io.nowMillis());
+    }
+    reportActivity(output);
+    schedule();
+}
+
+void outputsUpdate() {
+    if (!scheduled) {
+        return;
+    }
+    unsigned long now = io.nowMillis();
+    if (!reached(now, nextDue)) {
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        service(i, now);
+    }
+    schedule();
+}
+
+uint8_t outputLevel(int output) {
+    return output >= 0 && output < count ? outputs[output].level : 0;
+}
+
+bool outputActive(int output) {
+    return output >= 0 && output < count && (outputs[output].running || outputs[output].level > 0);
+}
+
+int outputCount() {
+    return count;
+}
+
+const char* outputName(int output) {
+    return outputs[output].name;
+}
+
+const OutputLimits& outputLimits(int output) {
+    return outputs[output].limits;
+}
+
+const OutputStats& outputStats(int output) {
+    return outputs[output].stats;
+}
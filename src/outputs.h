@@ -0,0 +1,74 @@
+#ifndef OUTPUTS_H
+#define OUTPUTS_H
+
+#include <stdint.h>
+
+// Output manager for relays, LEDs and external chimes. Every output plays a
+// pattern of timed levels under its own safety limits; one deadline shared by
+// all outputs means outputsUpdate() costs a single comparison until something
+// is due. Pins, LEDC and polarity are handled by the driver supplied by the caller.
+#define OUTPUT_MAX 8                // Outputs that can be registered
+#define OUTPUT_MAX_STEPS 8          // Steps per pattern
+#define OUTPUT_LEVEL_ON 255         // Full on; lower non-zero levels are PWM duty on PWM outputs
+
+/// @brief One pattern step: hold a level for a time (0 ms = hold until changed, last step only)
+struct OutputStep {
+    uint8_t level;
+    uint16_t ms;
+};
+
+/// @brief Safety limits of an output (0 = no limit)
+struct OutputLimits {
+    unsigned long maxOnMs;          ///< Longest continuous on-time; the output is forced off after it
+    unsigned long minOffMs;         ///< Shortest off-time; a switch-on inside it is delayed
+};
+
+/// @brief Hardware access and notifications
+struct OutputDriver {
+    void (*write)(uint8_t output, uint8_t level);
+    unsigned long (*nowMillis)();
+    void (*onActive)(uint8_t output, bool active);  ///< Output started or finished being used, may be NULL
+};
+
+/// @brief Counters since outputsBegin()
+struct OutputStats {
+    unsigned long activations;      ///< Patterns and levels started
+    unsigned long onMs;             ///< Total on-time of completed on periods
+    unsigned long limited;          ///< Forced off by maxOnMs
+    unsigned long delayed;          ///< Switch-ons held back by minOffMs
+};
+
+/// @brief Install the driver and remove all outputs
+void outputsBegin(const OutputDriver& driver);
+
+/// @brief Register an output (initially off); returns its index or -1 when full
+int outputAdd(const char* name, const OutputLimits& limits);
+
+/// @brief Index of a named output, -1 if unknown
+int outputFind(const char* name);
+
+/// @brief Hold a level for ms (0 = until changed), replacing any running pattern
+bool outputSet(int output, uint8_t level, uint16_t ms);
+
+/// @brief Play steps, repeat times in total (0 counts as 1); the output is off afterwards
+///        unless the last step holds (0 ms)
+bool outputPattern(int output, const OutputStep* steps, int count, uint8_t repeat);
+
+/// @brief Switch off and cancel any pattern
+void outputStop(int output);
+
+/// @brief Advance every output whose next step or limit is due
+void outputsUpdate();
+
+/// @brief Current level (0 = off)
+uint8_t outputLevel(int output);
+
+/// @brief On, or inside a pattern (including its off steps)
+bool outputActive(int output);
+
+int outputCount();
+const char* outputName(int output);
+const OutputLimits& outputLimits(int output);
+const OutputStats& outputStats(int output);
+
+#endif // OUTPUTS_H
@@ -0,0 +1,784 @@
+#include "pair.h"
+#include <stdio.h>
+#include <string.h>
+
+#define PAIR_MAGIC_0 'D'
+#define PAIR_MAGIC_1 'P'
+#define PAIR_VERSION 2
+#define PAIR_HEADER_SIZE 25             // Magic, version, role, id, term, millis, echo, boot, priority
+
+// Appends to a packet; running out of room clears ok instead of writing
+struct PairWriter {
+    uint8_t* data;
+    size_t size;
+    size_t len;
+    bool ok;
+};
+
+// Reads from a packet; reading past the end clears ok and yields zeros
+struct PairReader {
+    const uint8_t* data;
+    size_t len;
+    size_t pos;
+    bool ok;
+};
+
+static void putBytes(PairWriter& w, const void* data, size_t len) {
+    if (!w.ok || w.len + len > w.size) {
+        w.ok = false;
+        return;
+    }
+    memcpy(w.data + w.len, data, len);
+    w.len += len;
+}
+
+static void putByte(PairWriter& w, uint8_t value) {
+    putBytes(w, &value, 1);
+}
+
+static void putU16(PairWriter& w, uint16_t value) {
+    uint8_t bytes[2] = {(uint8_t)(value >> 8), (uint8_t)value};
+    putBytes(w, bytes, 2);
+}
+
+static void putU32(PairWriter& w, uint32_t value) {
+    uint8_t bytes[4] = {(uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value};
+    putBytes(w, bytes, 4);
+}
+
+static const uint8_t* getBytes(PairReader& r, size_t len) {
+    if (!r.ok || r.pos + len > r.len) {
+        r.ok = false;
+        return nullptr;
+    }
+    const uint8_t* p = r.data + r.pos;
+    r.pos += len;
+    return p;
+}
+
+static uint8_t getByte(PairReader& r) {
+    const uint8_t* p = getBytes(r, 1);
+    return p ? p[0] : 0;
+}
+
+static uint16_t getU16(PairReader& r) {
+    const uint8_t* p = getBytes(r, 2);
+    return p ? (uint16_t)((p[0] << 8) | p[1]) : 0;
+}
+
+static uint32_t getU32(PairReader& r) {
+    const uint8_t* p = getBytes(r, 4);
+    return p ? ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3] : 0;
+}
+
+// SHA-256 (FIPS 180-4), only as much as the HMAC needs
+struct Sha256 {
+    uint32_t state[8];
+    uint8_t block[64];
+    size_t used;
+    uint64_t total;
+};
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+static void sha256Block(Sha256& sha, const uint8_t* p) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) | ((uint32_t)p[i * 4 + 2] << 8) | p[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = sha.state[0], b = sha.state[1], c = sha.state[2], d = sha.state[3];
+    uint32_t e = sha.state[4], f = sha.state[5], g = sha.state[6], h = sha.state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    sha.state[0] += a;
+    sha.state[1] += b;
+    sha.state[2] += c;
+    sha.state[3] += d;
+    sha.state[4] += e;
+    sha.state[5] += f;
+    sha.state[6] += g;
+    sha.state[7] += h;
+}
+
+static void sha256Begin(Sha256& sha) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(sha.state, initial, sizeof(initial));
+    sha.used = 0;
+    sha.total = 0;
+}
+
+static void sha256Add(Sha256& sha, const uint8_t* data, size_t len) {
+    sha.total += len;
+    while (len > 0) {
+        size_t n = 64 - sha.used < len ? 64 - sha.used : len;
+        memcpy(sha.block + sha.used, data, n);
+        sha.used += n;
+        data += n;
+        len -= n;
+        if (sha.used == 64) {
+            sha256Block(sha, sha.block);
+            sha.used = 0;
+        }
+    }
+}
+
+static void sha256End(Sha256& sha, uint8_t digest[32]) {
+    uint64_t bits = sha.total * 8;
+    uint8_t pad = 0x80;
+    sha256Add(sha, &pad, 1);
+    pad = 0;
+    while (sha.used != 56) {
+        sha256Add(sha, &pad, 1);
+    }
+    uint8_t length[8];
+    for (int i = 0; i < 8; i++) {
+        length[i] = (uint8_t)(bits >> (56 - i * 8));
+    }
+    sha256Add(sha, length, 8);
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (uint8_t)(sha.state[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(sha.state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(sha.state[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)sha.state[i];
+    }
+}
+
+// HMAC-SHA256 (RFC 2104) truncated to PAIR_MAC_SIZE; key is one zero-padded block
+static void pairMac(const uint8_t* key, const uint8_t* data, size_t len, uint8_t mac[PAIR_MAC_SIZE]) {
+    uint8_t pad[PAIR_KEY_SIZE];
+    uint8_t digest[32];
+    Sha256 sha;
+    for (int i = 0; i < PAIR_KEY_SIZE; i++) {
+        pad[i] = key[i] ^ 0x36;
+    }
+    sha256Begin(sha);
+    sha256Add(sha, pad, sizeof(pad));
+    sha256Add(sha, data, len);
+    sha256End(sha, digest);
+    for (int i = 0; i < PAIR_KEY_SIZE; i++) {
+        pad[i] = key[i] ^ 0x5c;
+    }
+    sha256Begin(sha);
+    sha256Add(sha, pad, sizeof(pad));
+    sha256Add(sha, digest, sizeof(digest));
+    sha256End(sha, digest);
+    memcpy(mac, digest, PAIR_MAC_SIZE);
+}
+
+// Compares every byte, so the time taken tells nothing about where a forged MAC went wrong
+static bool macEqual(const uint8_t* a, const uint8_t* b, size_t len) {
+    uint8_t diff = 0;
+    for (size_t i = 0; i < len; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+// FNV-1a; only compares two copies of the same block, so it need not be strong
+static uint32_t blockHash(const uint8_t* data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static int blockCount(const PairRegion& region) {
+    return (region.size + PAIR_BLOCK_SIZE - 1) / PAIR_BLOCK_SIZE;
+}
+
+static size_t blockLength(const PairRegion& region, int block) {
+    size_t offset = (size_t)block * PAIR_BLOCK_SIZE;
+    return region.size - offset < PAIR_BLOCK_SIZE ? region.size - offset : PAIR_BLOCK_SIZE;
+}
+
+// A standby reports and completes its shadow copy; the active unit serves its live data
+static const uint8_t* regionBytes(const PairNode& node, const PairRegion& region) {
+    return node.role == PAIR_STANDBY ? region.shadow : region.data;
+}
+
+static uint32_t regionBlockHash(const PairNode& node, const PairRegion& region, int block) {
+    return blockHash(regionBytes(node, region) + (size_t)block * PAIR_BLOCK_SIZE, blockLength(region, block));
+}
+
+static void clearPresses(PairPress* presses, int count) {
+    for (int i = 0; i < count; i++) {
+        presses[i].button = -1;
+    }
+}
+
+// Store in a free slot, or over the oldest entry
+static void addPress(PairPress* presses, int count, int button, unsigned long at) {
+    int slot = 0;
+    for (int i = 0; i < count; i++) {
+        if (presses[i].button < 0) {
+            slot = i;
+            break;
+        }
+        if ((long)(presses[i].at - presses[slot].at) < 0) {
+            slot = i;
+        }
+    }
+    presses[slot].button = (int8_t)button;
+    presses[slot].at = at;
+}
+
+// Remove and return true for an entry of button within PAIR_PRESS_MATCH_MS of at
+static bool takePress(PairPress* presses, int count, int button, unsigned long at) {
+    for (int i = 0; i < count; i++) {
+        long apart = (long)(presses[i].at - at);
+        if (presses[i].button == button && apart <= PAIR_PRESS_MATCH_MS && apart >= -PAIR_PRESS_MATCH_MS) {
+            presses[i].button = -1;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void expirePresses(PairPress* presses, int count, unsigned long now, unsigned long maxAge) {
+    for (int i = 0; i < count; i++) {
+        if (presses[i].button >= 0 && now - presses[i].at > maxAge) {
+            presses[i].button = -1;
+        }
+    }
+}
+
+// Rank of a unit: the higher term wins, then the higher priority, then the higher id
+static bool outranks(uint32_t term, uint8_t priority, uint32_t id,
+                     uint32_t otherTerm, uint8_t otherPriority, uint32_t otherId) {
+    if (term != otherTerm) {
+        return term > otherTerm;
+    }
+    if (priority != otherPriority) {
+        return priority > otherPriority;
+    }
+    return id > otherId;
+}
+
+static void sendState(PairNode& node, unsigned long now) {
+    uint8_t packet[PAIR_PACKET_SIZE];
+    PairWriter w = {packet, sizeof(packet), 0, true};
+    putByte(w, PAIR_MAGIC_0);
+    putByte(w, PAIR_MAGIC_1);
+    putByte(w, PAIR_VERSION);
+    putByte(w, node.role);
+    putU32(w, node.nodeId);
+    putU32(w, node.term);
+    putU32(w, (uint32_t)now);
+    putU32(w, node.echo);
+    putU32(w, node.boot);
+    putByte(w, node.priority);
+
+    // Presses this unit rang recently, in its own clock
+    uint8_t presses = 0;
+    if (node.role == PAIR_ACTIVE) {
+        expirePresses(node.announced, PAIR_PRESSES, now, PAIR_PRESS_MATCH_MS);
+        for (int i = 0; i < PAIR_PRESSES; i++) {
+            presses += node.announced[i].button >= 0;
+        }
+    }
+    putByte(w, presses);
+    for (int i = 0; i < PAIR_PRESSES && presses; i++) {
+        if (node.announced[i].button >= 0) {
+            putByte(w, (uint8_t)node.announced[i].button);
+            putU32(w, (uint32_t)node.announced[i].at);
+        }
+    }
+
+    // Block hashes of every region
+    uint32_t hashes[PAIR_MAX_REGIONS][PAIR_MAX_BLOCKS];
+    putByte(w, (uint8_t)node.regionCount);
+    for (int r = 0; r < node.regionCount; r++) {
+        putU16(w, node.regions[r].size);
+        for (int b = 0; b < blockCount(node.regions[r]); b++) {
+            hashes[r][b] = regionBlockHash(node, node.regions[r], b);
+            putU32(w, hashes[r][b]);
+        }
+    }
+
+    // Blocks the standby reported different, round robin so a busy region cannot starve another
+    size_t countAt = w.len;
+    uint8_t blocks = 0;
+    putByte(w, 0);
+    bool peerListening = node.peerSeen && node.peerRole == PAIR_STANDBY && now - node.peerHeardAt < PAIR_LEASE_MS;
+    if (node.role == PAIR_ACTIVE && node.peerHashesValid && peerListening) {
+        int total = 0;
+        int index[PAIR_MAX_REGIONS * PAIR_MAX_BLOCKS][2];
+        for (int r = 0; r < node.regionCount; r++) {
+            for (int b = 0; b < blockCount(node.regions[r]); b++) {
+                index[total][0] = r;
+                index[total][1] = b;
+                total++;
+            }
+        }
+        int start = node.nextBlock % total;
+        for (int n = 0; n < total && blocks < PAIR_BLOCKS_PER_PACKET; n++) {
+            int i = (start + n) % total;
+            int r = index[i][0], b = index[i][1];
+            if (hashes[r][b] == node.peerHashes[r][b]) {
+                continue;
+            }
+            size_t len = blockLength(node.regions[r], b);
+            if (w.len + 2 + len + PAIR_MAC_SIZE > w.size) {
+                break;
+            }
+            putByte(w, (uint8_t)r);
+            putByte(w, (uint8_t)b);
+            putBytes(w, node.regions[r].data + (size_t)b * PAIR_BLOCK_SIZE, len);
+            // Assume delivered; the standby's next report brings back what was lost
+            node.peerHashes[r][b] = hashes[r][b];
+            node.nextBlock = (uint8_t)((i + 1) % total);
+            blocks++;
+        }
+        packet[countAt] = blocks;
+    }
+    uint8_t mac[PAIR_MAC_SIZE];
+    pairMac(node.key, packet, w.len, mac);
+    putBytes(w, mac, sizeof(mac));
+    if (!w.ok) {
+        return;
+    }
+    if (node.io.send(packet, w.len)) {
+        node.stats.packetsSent++;
+        node.stats.bytesSent += w.len;
+        node.stats.blocksSent += blocks;
+    }
+    node.lastSent = now;
+}
+
+// Standby: the broker shows a live lease of the other unit, so it is still active
+static bool brokerHolds(const PairNode& node, unsigned long now) {
+    return node.leaseHeld && node.leaseHeardAt && now - node.leaseHeardAt < PAIR_LEASE_MS && node.io.brokerUp();
+}
+
+static void sendLease(PairNode& node, unsigned long now) {
+    char lease[PAIR_LEASE_SIZE];
+    size_t len = pairLeaseMessage(node, true, lease, sizeof(lease));
+    if (len && node.io.sendLease(lease, len)) {
+        node.stats.leasesSent++;
+    }
+    node.leaseSentAt = now;
+}
+
+static void becomeActive(PairNode& node, unsigned long now) {
+    unsigned long since = node.activeHeardAt ? node.activeHeardAt : node.startedAt;
+    node.role = PAIR_ACTIVE;
+    node.term++;
+    node.heldOff = false;
+    node.leaseHeld = false;
+    node.stats.takeovers++;
+    node.stats.lastTakeoverMs = now - since;
+    node.peerHashesValid = false;
+    clearPresses(node.announced, PAIR_PRESSES);
+    node.io.onRole(PAIR_ACTIVE, PAIR_REASON_LEASE_EXPIRED);
+    // Presses only this unit saw: the old active unit was already gone
+    for (int i = 0; i < PAIR_PRESSES; i++) {
+        PairPress& press = node.pending[i];
+        if (press.button >= 0 && now - press.at <= PAIR_CATCHUP_MS) {
+            node.stats.caughtUp++;
+            node.io.onCatchUp(press.button, press.at);
+        }
+    }
+    clearPresses(node.pending, PAIR_PRESSES);
+    clearPresses(node.unmatched, PAIR_PRESSES);
+    sendState(node, now);
+    if (node.io.brokerUp()) {
+        sendLease(node, now);
+    }
+}
+
+static void becomeStandby(PairNode& node) {
+    node.role = PAIR_STANDBY;
+    node.stats.yields++;
+    for (int r = 0; r < node.regionCount; r++) {
+        // Start from what we served; the active unit sends what differs
+        memcpy(node.regions[r].shadow, node.regions[r].data, node.regions[r].size);
+        node.regions[r].complete = false;
+        node.regions[r].changed = false;
+    }
+    clearPresses(node.pending, PAIR_PRESSES);
+    clearPresses(node.unmatched, PAIR_PRESSES);
+    node.io.onRole(PAIR_STANDBY, PAIR_REASON_OUTRANKED);
+}
+
+// Standby: an announcement of the active unit, converted to our clock
+static void handleAnnounced(PairNode& node, int button, uint32_t peerAt, unsigned long now) {
+    for (int i = 0; i < PAIR_PRESSES * 2; i++) {
+        if (node.seen[i].button == button && node.seen[i].at == peerAt) {
+            return;
+        }
+    }
+    node.seen[node.seenNext].button = (int8_t)button;
+    node.seen[node.seenNext].at = peerAt;
+    node.seenNext = (node.seenNext + 1) % (PAIR_PRESSES * 2);
+
+    unsigned long at = pairPeerToLocal(node, peerAt);
+    if (takePress(node.pending, PAIR_PRESSES, button, at)) {
+        node.stats.confirmed++;
+    } else {
+        expirePresses(node.unmatched, PAIR_PRESSES, now, PAIR_PRESS_MATCH_MS);
+        addPress(node.unmatched, PAIR_PRESSES, button, at);
+    }
+}
+
+void pairBegin(PairNode& node, const PairIO& io, uint32_t nodeId, uint8_t priority, const char* key, uint32_t boot) {
+    memset(&node, 0, sizeof(node));
+    node.io = io;
+    size_t keyLen = strlen(key);
+    if (keyLen > PAIR_KEY_SIZE) {
+        Sha256 sha;
+        sha256Begin(sha);
+        sha256Add(sha, (const uint8_t*)key, keyLen);
+        sha256End(sha, node.key);
+    } else {
+        memcpy(node.key, key, keyLen);
+    }
+    node.nodeId = nodeId;
+    node.boot = boot;
+    node.priority = priority;
+    node.role = PAIR_STANDBY;
+    node.startedAt = io.nowMillis();
+    node.lastSent = node.startedAt - PAIR_HEARTBEAT_MS;
+    clearPresses(node.announced, PAIR_PRESSES);
+    clearPresses(node.pending, PAIR_PRESSES);
+    clearPresses(node.unmatched, PAIR_PRESSES);
+    clearPresses(node.seen, PAIR_PRESSES * 2);
+}
+
+int pairAddRegion(PairNode& node, const char* name, void* data, uint16_t size) {
+    if (node.regionCount >= PAIR_MAX_REGIONS || size == 0 || size > PAIR_MAX_BLOCKS * PAIR_BLOCK_SIZE) {
+        return -1;
+    }
+    PairRegion& region = node.regions[node.regionCount];
+    region.name = name;
+    region.data = (uint8_t*)data;
+    region.size = size;
+    memcpy(region.shadow, data, size);
+    region.complete = false;
+    region.changed = false;
+    return node.regionCount++;
+}
+
+void pairReceive(PairNode& node, const uint8_t* data, size_t len) {
+    if (len < PAIR_HEADER_SIZE + PAIR_MAC_SIZE || data[0] != PAIR_MAGIC_0 || data[1] != PAIR_MAGIC_1 ||
+        data[2] != PAIR_VERSION) {
+        node.stats.malformed++;
+        return;
+    }
+    // Nothing of a packet is looked at before its MAC checks out
+    len -= PAIR_MAC_SIZE;
+    uint8_t mac[PAIR_MAC_SIZE];
+    pairMac(node.key, data, len, mac);
+    if (!macEqual(mac, data + len, PAIR_MAC_SIZE)) {
+        node.stats.unauthenticated++;
+        return;
+    }
+    PairReader r = {data, len, 3, true};
+    PairRole role = getByte(r) == PAIR_ACTIVE ? PAIR_ACTIVE : PAIR_STANDBY;
+    uint32_t id = getU32(r);
+    uint32_t term = getU32(r);
+    uint32_t peerMillis = getU32(r);
+    uint32_t echo = getU32(r);
+    uint32_t boot = getU32(r);
+    uint8_t priority = getByte(r);
+    if (id == node.nodeId) {
+        if (boot != node.boot) {
+            node.stats.duplicateIds++;  // Another unit with our id; neither can see the other
+        }
+        return;  // Our own broadcast
+    }
+    unsigned long now = node.io.nowMillis();
+    // Echo the peer's newest packet; a replayed older one cannot move it back
+    if (boot != node.peerBoot || (int32_t)(peerMillis - node.echo) > 0) {
+        node.peerBoot = boot;
+        node.echo = peerMillis;
+    }
+    // An active unit's packet counts only if it answers one of our recent packets
+    if (role == PAIR_ACTIVE && (uint32_t)now - echo > PAIR_LEASE_MS) {
+        node.stats.stale++;
+        return;
+    }
+    node.stats.packetsReceived++;
+    node.peerSeen = true;
+    node.peerId = id;
+    node.peerPriority = priority;
+    node.peerRole = role;
+    node.peerHeardAt = now;
+    node.peerClockOffset = (long)(peerMillis - (uint32_t)now);
+
+    if (role == PAIR_ACTIVE) {
+        if (node.role == PAIR_ACTIVE) {
+            node.stats.conflicts++;
+            if (!outranks(term, priority, id, node.term, node.priority, node.nodeId)) {
+                sendState(node, now);  // Let it see us and yield without waiting a heartbeat
+                return;
+            }
+            becomeStandby(node);
+        } else if (node.activeHeardAt && now - node.activeHeardAt > node.stats.maxGapMs) {
+            node.stats.maxGapMs = now - node.activeHeardAt;
+        }
+        node.activeHeardAt = now;
+        node.heldOff = false;
+    }
+    if (term > node.term) {
+        node.term = term;
+    }
+
+    uint8_t presses = getByte(r);
+    for (int i = 0; i < presses && r.ok; i++) {
+        uint8_t button = getByte(r);
+        uint32_t at = getU32(r);
+        if (r.ok && role == PAIR_ACTIVE && node.role == PAIR_STANDBY) {
+            handleAnnounced(node, button, at, now);
+        }
+    }
+
+    uint8_t regions = getByte(r);
+    if (!r.ok) {
+        node.stats.malformed++;
+        return;
+    }
+    if (regions != node.regionCount) {
+        node.stats.mismatched++;
+        node.peerHashesValid = false;
+        return;
+    }
+    for (int i = 0; i < regions && r.ok; i++) {
+        if (getU16(r) != node.regions[i].size) {
+            node.stats.mismatched++;
+            node.peerHashesValid = false;
+            return;
+        }
+        for (int b = 0; b < blockCount(node.regions[i]); b++) {
+            node.peerHashes[i][b] = getU32(r);
+        }
+    }
+    node.peerHashesValid = r.ok;
+
+    uint8_t blocks = getByte(r);
+    bool apply = role == PAIR_ACTIVE && node.role == PAIR_STANDBY;
+    for (int i = 0; i < blocks && r.ok; i++) {
+        uint8_t region = getByte(r);
+        uint8_t block = getByte(r);
+        if (region >= node.regionCount || block >= blockCount(node.regions[region])) {
+            r.ok = false;
+            break;
+        }
+        size_t blockLen = blockLength(node.regions[region], block);
+        const uint8_t* bytes = getBytes(r, blockLen);
+        if (bytes && apply) {
+            memcpy(node.regions[region].shadow + (size_t)block * PAIR_BLOCK_SIZE, bytes, blockLen);
+            node.regions[region].changed = true;
+            node.stats.blocksApplied++;
+        }
+    }
+    if (!r.ok) {
+        node.stats.malformed++;
+        node.peerHashesValid = false;
+        return;
+    }
+
+    // Copy a region into place only once its shadow matches the active copy as a whole
+    if (apply) {
+        for (int i = 0; i < node.regionCount; i++) {
+            PairRegion& region = node.regions[i];
+            region.complete = true;
+            for (int b = 0; b < blockCount(region) && region.complete; b++) {
+                region.complete = regionBlockHash(node, region, b) == node.peerHashes[i][b];
+            }
+            if (region.complete && region.changed) {
+                region.changed = false;
+                memcpy(region.data, region.shadow, region.size);
+                node.io.onRegion(i);
+            }
+        }
+    }
+}
+
+void pairUpdate(PairNode& node) {
+    unsigned long now = node.io.nowMillis();
+    if (node.role == PAIR_STANDBY) {
+        unsigned long since = node.activeHeardAt ? node.activeHeardAt : node.startedAt;
+        unsigned long wait = PAIR_LEASE_MS + PAIR_GUARD_MS;
+        // Two standby units: the lower-ranked one leaves the claim to the other
+        if (node.peerSeen && node.peerRole == PAIR_STANDBY && now - node.peerHeardAt < PAIR_LEASE_MS &&
+            outranks(0, node.peerPriority, node.peerId, 0, node.priority, node.nodeId)) {
+            wait += PAIR_DEFER_MS;
+        }
+        if (now - since >= wait && node.io.linkUp()) {
+            // Silent on the LAN, but still holding its lease on the broker: not gone
+            if (!brokerHolds(node, now)) {
+                becomeActive(node, now);
+                return;
+            }
+            if (!node.heldOff) {
+                node.heldOff = true;
+                node.stats.brokerHolds++;
+            }
+        }
+        expirePresses(node.pending, PAIR_PRESSES, now, PAIR_CATCHUP_MS);
+    } else if (now - node.leaseSentAt >= PAIR_LEASE_REFRESH_MS && node.io.brokerUp()) {
+        sendLease(node, now);
+    }
+    if (now - node.lastSent >= PAIR_HEARTBEAT_MS) {
+        sendState(node, now);
+    }
+}
+
+// Authenticated fields of a lease
+static void leaseMac(const PairNode& node, uint32_t id, uint32_t boot, uint32_t term, uint8_t priority, bool held,
+                     char hex[PAIR_MAC_SIZE * 2 + 1]) {
+    uint8_t fields[20];
+    PairWriter w = {fields, sizeof(fields), 0, true};
+    putBytes(w, "DPL", 3);
+    putU32(w, id);
+    putU32(w, boot);
+    putU32(w, term);
+    putByte(w, priority);
+    putByte(w, held);
+    uint8_t mac[PAIR_MAC_SIZE];
+    pairMac(node.key, fields, w.len, mac);
+    for (int i = 0; i < PAIR_MAC_SIZE; i++) {
+        snprintf(hex + i * 2, 3, "%02x", mac[i]);
+    }
+}
+
+size_t pairLeaseMessage(const PairNode& node, bool held, char* out, size_t size) {
+    char hex[PAIR_MAC_SIZE * 2 + 1];
+    leaseMac(node, node.nodeId, node.boot, node.term, node.priority, held, hex);
+    int len = snprintf(out, size, "{\"id\":%lu,\"boot\":%lu,\"term\":%lu,\"priority\":%u,\"held\":%s,\"mac\":\"%s\"}",
+                       (unsigned long)node.nodeId, (unsigned long)node.boot, (unsigned long)node.term, node.priority, held ? "true" : "false", hex);
+    return len > 0 && (size_t)len < size ? (size_t)len : 0;
+}
+
+void pairLeaseReceive(PairNode& node, const char* lease, size_t len) {
+    char text[PAIR_LEASE_SIZE];
+    unsigned long id, boot, term;
+    unsigned int priority;
+    char held[6], hex[PAIR_MAC_SIZE * 2 + 1], expected[PAIR_MAC_SIZE * 2 + 1];
+    if (len >= sizeof(text)) {
+        node.stats.malformed++;
+        return;
+    }
+    memcpy(text, lease, len);
+    text[len] = '\0';
+    if (sscanf(text, "{\"id\":%lu,\"boot\":%lu,\"term\":%lu,\"priority\":%u,\"held\":%5[a-z],\"mac\":\"%32[0-9a-f]\"}",
+               &id, &boot, &term, &priority, held, hex) != 6 || priority > 255) {
+        node.stats.malformed++;
+        return;
+    }
+    bool isHeld = strcmp(held, "true") == 0;
+    leaseMac(node, (uint32_t)id, (uint32_t)boot, (uint32_t)term, (uint8_t)priority, isHeld, expected);
+    if (strlen(hex) != PAIR_MAC_SIZE * 2 || !macEqual((const uint8_t*)hex, (const uint8_t*)expected, PAIR_MAC_SIZE * 2)) {
+        node.stats.unauthenticated++;
+        return;
+    }
+    unsigned long now = node.io.nowMillis();
+    if ((uint32_t)id == node.nodeId) {
+        // Ours, or left over from before a restart; a held one of another boot that
+        // is refreshed comes from a second unit with our id
+        if ((uint32_t)boot != node.boot && isHeld) {
+            if (node.foreignLeaseAt && now - node.foreignLeaseAt <= PAIR_LEASE_MS) {
+                node.stats.duplicateIds++;
+            }
+            node.foreignLeaseAt = now;
+        }
+        return;
+    }
+    node.leaseHeld = isHeld;
+    node.leaseId = (uint32_t)id;
+    node.leaseHeardAt = now;
+    if (!isHeld) {
+        return;
+    }
+    // Active units that cannot see each other on the LAN meet here
+    if (node.role == PAIR_ACTIVE) {
+        if ((uint32_t)term >= node.term) {
+            node.stats.conflicts++;  // Not a retained lease left over from an earlier term
+        }
+        if (!outranks((uint32_t)term, (uint8_t)priority, (uint32_t)id, node.term, node.priority, node.nodeId)) {
+            return;
+        }
+        becomeStandby(node);
+    }
+    if ((uint32_t)term > node.term) {
+        node.term = (uint32_t)term;
+    }
+}
+
+bool pairPress(PairNode& node, int button, unsigned long at) {
+    unsigned long now = node.io.nowMillis();
+    if (node.role == PAIR_ACTIVE) {
+        addPress(node.announced, PAIR_PRESSES, button, at);
+        sendState(node, now);  // Announce now rather than at the next heartbeat
+        return true;
+    }
+    expirePresses(node.unmatched, PAIR_PRESSES, now, PAIR_PRESS_MATCH_MS);
+    if (takePress(node.unmatched, PAIR_PRESSES, button, at)) {
+        node.stats.confirmed++;
+    } else {
+        expirePresses(node.pending, PAIR_PRESSES, now, PAIR_CATCHUP_MS);
+        addPress(node.pending, PAIR_PRESSES, button, at);
+    }
+    return false;
+}
+
+unsigned long pairPeerToLocal(const PairNode& node, unsigned long peerMillis) {
+    return (unsigned long)((uint32_t)peerMillis - (uint32_t)node.peerClockOffset);
+}
+
+bool pairInSync(const PairNode& node) {
+    if (node.role == PAIR_STANDBY) {
+        for (int r = 0; r < node.regionCount; r++) {
+            if (!node.regions[r].complete) {
+                return false;
+            }
+        }
+        return node.regionCount == 0 || node.peerHashesValid;
+    }
+    if (!node.peerHashesValid) {
+        return false;
+    }
+    for (int r = 0; r < node.regionCount; r++) {
+        for (int b = 0; b < blockCount(node.regions[r]); b++) {
+            if (regionBlockHash(node, node.regions[r], b) != node.peerHashes[r][b]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+const char* pairRoleName(PairRole role) {
+    return role == PAIR_ACTIVE ? "active" : "standby";
+}
@@ -0,0 +1,200 @@
+#ifndef PAIR_H
+#define PAIR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Active/standby election and warm-state replication for two units wired to
+// the same inputs. Transport and clock are injected, so the same code runs on
+// the device (UDP) and in the simulator (bench/pair_bench.cpp).
+//
+// Both units send a state packet every PAIR_HEARTBEAT_MS. The active unit's
+// packet is its lease: a standby that hears no active unit for
+// PAIR_LEASE_MS + PAIR_GUARD_MS claims the role with the next term, provided
+// its own network link is up. Two active units (boot race, healed partition)
+// resolve on sight: the higher term wins, then the higher priority, then the
+// higher node id. Without preemption a recovered unit stays standby.
+//
+// Broker lease: the active unit also publishes a lease through the MQTT broker
+// every PAIR_LEASE_REFRESH_MS. A standby connected to the broker does not
+// claim while that lease is live, so losing each other on the LAN alone no
+// longer makes both ring; only when neither path can arbitrate do both. An
+// active unit that sees a higher-ranked unit's lease yields as on the LAN.
+//
+// Packets and leases carry an HMAC-SHA256 (truncated to PAIR_MAC_SIZE) with a
+// key both units share; anything else is dropped before it can change state.
+// An active unit's packet also echoes the last packet it heard from the peer,
+// and only counts when that echo is recent, so a recorded packet played back
+// later renews no lease and writes no state.
+//
+// Node ids must differ: a unit takes a packet with its own id for its own
+// broadcast. One with its own id but another boot value, or a held lease of
+// another boot refreshed within a lease, comes from a second unit with the
+// same id; it is counted (stats.duplicateIds) and otherwise ignored.
+//
+// Replication: the owner registers memory regions (settings, warm state).
+// Each packet lists a hash per PAIR_BLOCK_SIZE block of every region; the
+// active unit sends the blocks whose hash differs from what the standby
+// reported, a few per packet, until both agree. The standby collects them in a
+// shadow copy and copies a region into place, then tells the owner, only once
+// every block matches; a half-applied region is never visible.
+//
+// Presses: both units see every press. The active unit rings it and announces
+// it; the standby keeps its own detection until the announcement matches it.
+// Presses still unmatched when a standby takes over were missed by the failed
+// unit and are handed back to be rung (PAIR_CATCHUP_MS).
+#define PAIR_HEARTBEAT_MS 250
+#define PAIR_LEASE_MS 1500              // Silence after which the active unit is presumed gone
+#define PAIR_GUARD_MS 250               // Margin for jitter and clock drift
+#define PAIR_DEFER_MS 500               // Extra wait of the lower-ranked of two standby units
+#define PAIR_LEASE_REFRESH_MS 500       // Broker lease interval of the active unit
+#define PAIR_BLOCK_SIZE 64
+#define PAIR_MAX_REGIONS 2
+#define PAIR_MAX_BLOCKS 8               // Per region, so regions up to 512 bytes
+#define PAIR_BLOCKS_PER_PACKET 4
+#define PAIR_PACKET_SIZE 600
+#define PAIR_MAC_SIZE 16
+#define PAIR_KEY_SIZE 64                // HMAC block; longer keys are hashed first
+#define PAIR_LEASE_SIZE 160             // Lease message, text
+#define PAIR_PRESSES 4                  // Presses remembered per list
+#define PAIR_PRESS_MATCH_MS 1500        // Announced and local detection of one press are this close
+#define PAIR_CATCHUP_MS (PAIR_LEASE_MS + PAIR_GUARD_MS + PAIR_DEFER_MS + 1000)
+
+enum PairRole : uint8_t {
+    PAIR_STANDBY,
+    PAIR_ACTIVE
+};
+
+/// @brief Why a unit changed role
+enum PairReason : uint8_t {
+    PAIR_REASON_LEASE_EXPIRED,      ///< Standby heard no active unit in time and claimed
+    PAIR_REASON_OUTRANKED           ///< Active unit met a higher-ranked active unit or lease and yielded
+};
+
+/// @brief Memory kept identical on both units
+struct PairRegion {
+    const char* name;
+    uint8_t* data;
+    uint16_t size;
+    uint8_t shadow[PAIR_MAX_BLOCKS * PAIR_BLOCK_SIZE];  ///< Standby: blocks received, copied to data when complete
+    bool complete;                  ///< Standby: equal to the active unit's copy at last check
+    bool changed;                   ///< Standby: blocks applied since it was last complete
+};
+
+/// @brief A press and when it was detected (local clock)
+struct PairPress {
+    int8_t button;                  ///< -1 = free slot
+    unsigned long at;
+};
+
+/// @brief Connection, clock and callbacks of a unit
+struct PairIO {
+    bool (*send)(const uint8_t* data, size_t len);
+    unsigned long (*nowMillis)();
+    bool (*linkUp)();                       ///< A unit without its own network link never claims
+    void (*onRole)(PairRole role, PairReason reason);
+    void (*onRegion)(int region);           ///< Standby: a region became equal to the active copy
+    void (*onCatchUp)(int button, unsigned long at);  ///< New active unit: ring a press the old one missed
+    bool (*brokerUp)();                     ///< Connected to the broker that carries the lease
+    bool (*sendLease)(const char* lease, size_t len);  ///< Publish retained (active unit)
+};
+
+struct PairStats {
+    unsigned long packetsSent;
+    unsigned long packetsReceived;
+    unsigned long bytesSent;
+    unsigned long blocksSent;
+    unsigned long blocksApplied;
+    unsigned long takeovers;        ///< Claims after a lease expired
+    unsigned long yields;           ///< Active role given up to a higher-ranked unit
+    unsigned long conflicts;        ///< Packets from another active unit while active
+    unsigned long confirmed;        ///< Local presses matched by an announcement
+    unsigned long caughtUp;         ///< Presses rung after a takeover
+    unsigned long lastTakeoverMs;   ///< Active silence before the last claim
+    unsigned long maxGapMs;         ///< Longest gap between active packets seen while standby
+    unsigned long mismatched;       ///< Packets with a different region layout (firmware mismatch)
+    unsigned long malformed;
+    unsigned long unauthenticated;  ///< Packets and leases with a wrong MAC (other key or forged)
+    unsigned long stale;            ///< Active packets echoing none of our recent packets (replayed or late)
+    unsigned long brokerHolds;      ///< Claims held back by a live broker lease of the peer
+    unsigned long duplicateIds;     ///< Packets and leases of another unit with our node id
+    unsigned long leasesSent;
+};
+
+struct PairNode {
+    PairIO io;
+    uint8_t key[PAIR_KEY_SIZE];
+    uint32_t nodeId;
+    uint32_t boot;                  ///< Random per start, tells the peer our clock restarted
+    uint8_t priority;
+    PairRole role;
+    uint32_t term;
+    unsigned long startedAt;
+    unsigned long lastSent;
+    unsigned long leaseSentAt;
+    // Peer, as of its last packet
+    bool peerSeen;
+    uint32_t peerId;
+    uint8_t peerPriority;
+    PairRole peerRole;
+    unsigned long peerHeardAt;
+    unsigned long activeHeardAt;    ///< Last packet of an active peer (0 = none yet)
+    long peerClockOffset;           ///< Peer millis() minus ours, latency ignored
+    uint32_t peerBoot;
+    uint32_t echo;                  ///< Newest millis() the peer sent; our packets return it
+    bool heldOff;                   ///< Standby: the current claim is held back by the broker lease
+    // Broker lease of the other unit, as of its last message
+    bool leaseHeld;
+    uint32_t leaseId;
+    unsigned long leaseHeardAt;
+    unsigned long foreignLeaseAt;   ///< Last held lease with our id from another boot (0 = none)
+    uint32_t peerHashes[PAIR_MAX_REGIONS][PAIR_MAX_BLOCKS];
+    bool peerHashesValid;
+    PairRegion regions[PAIR_MAX_REGIONS];
+    int regionCount;
+    uint8_t nextBlock;              ///< Round-robin start for block selection
+    // Active: presses announced with every packet while younger than PAIR_PRESS_MATCH_MS
+    PairPress announced[PAIR_PRESSES];
+    // Standby: own detections not yet announced, announcements not yet detected,
+    // and announcements already handled (peer clock, they repeat in every packet)
+    PairPress pending[PAIR_PRESSES];
+    PairPress unmatched[PAIR_PRESSES];
+    PairPress seen[PAIR_PRESSES * 2];
+    uint8_t seenNext;
+    PairStats stats;
+};
+
+/// @brief Start as standby; the first claim comes after a full lease without an active unit
+/// @param key Shared secret of the two units (NUL-terminated)
+/// @param boot Random value, different on every start
+void pairBegin(PairNode& node, const PairIO& io, uint32_t nodeId, uint8_t priority, const char* key, uint32_t boot);
+
+/// @brief Replicate size bytes at data (at most PAIR_MAX_BLOCKS blocks); returns the index or -1
+int pairAddRegion(PairNode& node, const char* name, void* data, uint16_t size);
+
+/// @brief Handle a packet from the peer
+void pairReceive(PairNode& node, const uint8_t* data, size_t len);
+
+/// @brief Send the periodic packet and lease, and claim the active role when the lease expired
+void pairUpdate(PairNode& node);
+
+/// @brief Handle a lease message from the broker (including our own)
+void pairLeaseReceive(PairNode& node, const char* lease, size_t len);
+
+/// @brief Lease message of this unit; held = false releases it (broker last will)
+/// @return Length written, 0 if it does not fit
+size_t pairLeaseMessage(const PairNode& node, bool held, char* out, size_t size);
+
+/// @brief A local input detected a press
+/// @return true when this unit should ring it (active); a standby remembers it
+bool pairPress(PairNode& node, int button, unsigned long at);
+
+/// @brief Convert a millis() value of the peer to ours
+unsigned long pairPeerToLocal(const PairNode& node, unsigned long peerMillis);
+
+/// @brief All regions replicated (active: as reported by the standby; standby: as announced)
+bool pairInSync(const PairNode& node);
+
+const char* pairRoleName(PairRole role);
+
+#endif // PAIR_H
@@ -0,0 +1,81 @@
+#include "pulse_decoder.h"
+
+static const char* const errorNames[PULSE_ERROR_COUNT] = {
+    "ok", "empty", "too_long", "too_many", "unknown"
+};
+
+PulseResult pulseDecode(const PulseSegment* segments, int count, const PulseTiming& timing,
+                        const PulseCode* codes, int codeCount) {
+    PulseResult result = {-1, PULSE_EMPTY, 0, 0, 0, 0};
+
+    // Fold glitches into the segment before them and join equal levels; a
+    // glitch at the very start has nothing before it and is dropped
+    PulseSegment merged[PULSE_MAX_SEGMENTS];
+    int n = 0;
+    for (int i = 0; i < count && i < PULSE_MAX_SEGMENTS; i++) {
+        PulseSegment segment = segments[i];
+        if (segment.us < timing.glitchUs) {
+            result.glitches++;
+            if (n > 0) {
+                merged[n - 1].us += segment.us;
+            }
+            continue;
+        }
+        if (n > 0 && merged[n - 1].level == segment.level) {
+            merged[n - 1].us += segment.us;
+        } else {
+            merged[n++] = segment;
+        }
+    }
+
+    uint32_t elapsed = 0;
+    uint32_t firstStart = 0;
+    for (int i = 0; i < n; i++) {
+        if (merged[i].level == timing.activeLevel) {
+            if (merged[i].us > timing.maxPulseUs) {
+                result.error = PULSE_TOO_LONG;
+                return result;
+            }
+            if (result.pulses == PULSE_MAX_PULSES) {
+                result.error = PULSE_TOO_MANY;
+                return result;
+            }
+            if (result.pulses == 0) {
+                firstStart = elapsed;
+            }
+            if (merged[i].us >= timing.longUs) {
+                result.longMask |= 1 << result.pulses;
+            }
+            result.pulses++;
+            result.durationUs = elapsed + merged[i].us - firstStart;
+        }
+        elapsed += merged[i].us;
+    }
+    if (result.pulses == 0) {
+        return result;
+    }
+
+    result.error = PULSE_UNKNOWN;
+    for (int i = 0; i < codeCount; i++) {
+        if (codes[i].pulses == result.pulses && codes[i].longMask == result.longMask) {
+            result.button = codes[i].button;
+            result.error = PULSE_OK;
+            break;
+        }
+    }
+    return result;
+}
+
+int pulseRawCount(const PulseSegment* segments, int count, uint8_t activeLevel) {
+    int pulses = 0;
+    for (int i = 0; i < count; i++) {
+        if (segments[i].level == activeLevel && (i == 0 || segments[i - 1].level != activeLevel)) {
+            pulses++;
+        }
+    }
+    return pulses;
+}
+
+const char* pulseErrorName(PulseError error) {
+    return error < PULSE_ERROR_COUNT ? errorNames[error] : "unknown";
+}
@@ -0,0 +1,64 @@
+#ifndef PULSE_DECODER_H
+#define PULSE_DECODER_H
+
+#include <stdint.h>
+
+// Decoder for pulse-coded intercom lines. The capture hardware (RMT) delivers
+// a frame as a list of segments, each a line level held for some time, ending
+// once the line has been idle long enough. Segments shorter than the glitch
+// time are folded into the segment before them (contact bounce, EMI spikes);
+// what remains at the active level are the pulses. Each pulse is short or
+// long, and the pulse count plus the long-pulse mask select a button.
+#define PULSE_MAX_PULSES 16             // Longer trains are rejected
+#define PULSE_MAX_SEGMENTS 64           // Segments kept per frame (RMT items carry two each)
+
+/// @brief One captured level and how long it lasted
+struct PulseSegment {
+    uint8_t level;
+    uint32_t us;
+};
+
+/// @brief Timing of the panel's pulses
+struct PulseTiming {
+    uint8_t activeLevel;            ///< Line level during a pulse
+    uint32_t glitchUs;              ///< Shorter segments are noise
+    uint32_t longUs;                ///< Pulses at least this long are long
+    uint32_t maxPulseUs;            ///< Longer pulses are not part of a code (e.g. a held line)
+};
+
+/// @brief A pulse pattern and the button it stands for
+struct PulseCode {
+    uint8_t pulses;
+    uint16_t longMask;              ///< Bit i set: pulse i (first = bit 0) is long
+    int8_t button;                  ///< 0 = downstairs, 1 = door
+};
+
+enum PulseError : uint8_t {
+    PULSE_OK = 0,
+    PULSE_EMPTY,                    ///< No pulse left after glitch removal
+    PULSE_TOO_LONG,                 ///< A pulse exceeded maxPulseUs
+    PULSE_TOO_MANY,                 ///< More than PULSE_MAX_PULSES pulses
+    PULSE_UNKNOWN,                  ///< Valid train that matches no code
+    PULSE_ERROR_COUNT
+};
+
+/// @brief Outcome of decoding one frame
+struct PulseResult {
+    int8_t button;                  ///< -1 unless error is PULSE_OK
+    PulseError error;
+    uint8_t pulses;
+    uint16_t longMask;
+    uint8_t glitches;               ///< Segments folded away as noise
+    uint32_t durationUs;            ///< First pulse start to last pulse end
+};
+
+/// @brief Decode one frame of segments against a code table
+PulseResult pulseDecode(const PulseSegment* segments, int count, const PulseTiming& timing,
+                        const PulseCode* codes, int codeCount);
+
+/// @brief Active-level segments in a raw frame (what an edge counter sees)
+int pulseRawCount(const PulseSegment* segments, int count, uint8_t activeLevel);
+
+const char* pulseErrorName(PulseError error);
+
+#endif // PULSE_DECODER_H
@@ -0,0 +1,69 @@
+#include "recorder.h"
+#include <string.h>
+
+static const char* const kindNames[RECORD_KIND_COUNT] = {"mqtt", "session"};
+
+RecorderStats recorderStats;
+
+static Record records[RECORDER_SLOTS];
+static int oldest = 0;
+static int count = 0;
+
+void recorderClear() {
+    oldest = 0;
+    count = 0;
+}
+
+void recorderAppend(RecordKind kind, uint32_t timeMs, const char* topic, const uint8_t* payload, size_t length) {
+    if (count == RECORDER_SLOTS) {
+        oldest = (oldest + 1) % RECORDER_SLOTS;
+        count--;
+        recorderStats.overwritten++;
+    }
+    Record& record = records[(oldest + count) % RECORDER_SLOTS];
+    count++;
+    recorderStats.recorded++;
+
+    size_t topicLength = strlen(topic);
+    if (topicLength > RECORDER_MAX_TOPIC) {
+        topicLength = RECORDER_MAX_TOPIC;
+    }
+    size_t room = RECORDER_DATA_SIZE - topicLength;
+    record.timeMs = timeMs;
+    record.kind = kind;
+    record.topicLength = topicLength;
+    record.truncated = length > room;
+    record.payloadLength = record.truncated ? room : length;
+    memcpy(record.data, topic, topicLength);
+    memcpy(record.data + topicLength, payload, record.payloadLength);
+    if (record.truncated) {
+        recorderStats.truncated++;
+    }
+}
+
+int recorderCount() {
+    return count;
+}
+
+const Record& recorderAt(int i) {
+    return records[(oldest + i) % RECORDER_SLOTS];
+}
+
+void recordTopic(const Record& record, char* out, size_t size) {
+    size_t n = record.topicLength < size - 1 ? record.topicLength : size - 1;
+    memcpy(out, record.data, n);
+    out[n] = '\0';
+}
+
+const char* recordKindName(uint8_t kind) {
+    return kind < RECORD_KIND_COUNT ? kindNames[kind] : "unknown";
+}
+
+RecordKind recordKindFromName(const char* name) {
+    for (int i = 0; i < RECORD_KIND_COUNT; i++) {
+        if (strcmp(name, kindNames[i]) == 0) {
+            return (RecordKind)i;
+        }
+    }
+    return RECORD_KIND_COUNT;
+}
@@ -0,0 +1,66 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Fixed ring of inbound traffic (MQTT commands and, optionally, analyzed ADC
+// sessions) with arrival times, so an incident can be dumped and replayed
+// against the same firmware with the original spacing
+#define RECORDER_SLOTS 32           // Records kept; the oldest is overwritten
+#define RECORDER_DATA_SIZE 248      // Topic plus payload bytes per record
+#define RECORDER_MAX_TOPIC 128      // Longer topics are cut
+
+/// @brief What a record holds
+enum RecordKind : uint8_t {
+    RECORD_MQTT = 0,                ///< Inbound message: topic and payload
+    RECORD_SESSION,                 ///< Analyzed ADC session or pulse frame: payload is the button ("0" or "1")
+    RECORD_KIND_COUNT
+};
+
+/// @brief One recorded input; topic and payload are stored back to back in data
+struct Record {
+    uint32_t timeMs;                ///< Arrival time (millis)
+    uint16_t payloadLength;         ///< Payload bytes stored
+    uint8_t topicLength;
+    uint8_t kind;
+    bool truncated;                 ///< Payload did not fit and was cut; not replayable
+    uint8_t data[RECORDER_DATA_SIZE];
+};
+
+/// @brief Counters since boot
+struct RecorderStats {
+    unsigned long recorded;
+    unsigned long overwritten;      ///< Oldest records lost to newer ones
+    unsigned long truncated;
+};
+
+extern RecorderStats recorderStats;
+
+/// @brief Drop every record
+void recorderClear();
+
+/// @brief Append a record, overwriting the oldest when the ring is full
+void recorderAppend(RecordKind kind, uint32_t timeMs, const char* topic, const uint8_t* payload, size_t length);
+
+/// @brief Records currently held
+int recorderCount();
+
+/// @brief Record i, 0 being the oldest
+const Record& recorderAt(int i);
+
+/// @brief Topic of a record, copied into out (always terminated)
+void recordTopic(const Record& record, char* out, size_t size);
+
+/// @brief Payload bytes of a record
+inline const uint8_t* recordPayload(const Record& record) {
+    return record.data + record.topicLength;
+}
+
+/// @brief Lower-case kind name for dumps
+const char* recordKindName(uint8_t kind);
+
+/// @brief Kind from its name; RECORD_KIND_COUNT if unknown
+RecordKind recordKindFromName(const char* name);
+
+#endif // RECORDER_H
@@ -0,0 +1,261 @@
+#include "rule_vm.h"
+#include <string.h>
+
+Rule rules[RULE_MAX_RULES];
+
+// Number of immediate bytes following an opcode, -1 for unknown opcodes
+static int operandSize(uint8_t op) {
+    switch (op) {
+        case OP_END:
+        case OP_ADD: case OP_SUB:
+        case OP_LT: case OP_LE: case OP_GT: case OP_GE: case OP_EQ: case OP_NE:
+        case OP_AND: case OP_OR: case OP_NOT:
+            return 0;
+        case OP_PUSH8: case OP_GET: case OP_LOAD: case OP_STORE:
+        case OP_JZ: case OP_JMP: case OP_ACT:
+            return 1;
+        case OP_PUSH16:
+            return 2;
+        default:
+            return -1;
+    }
+}
+
+// Stack values an opcode needs and how it changes the depth
+static void stackEffect(uint8_t op, int& needs, int& delta) {
+    switch (op) {
+        case OP_PUSH8: case OP_PUSH16: case OP_GET: case OP_LOAD:
+            needs = 0; delta = 1; break;
+        case OP_STORE: case OP_JZ: case OP_ACT:
+            needs = 1; delta = -1; break;
+        case OP_NOT:
+            needs = 1; delta = 0; break;
+        case OP_END: case OP_JMP:
+            needs = 0; delta = 0; break;
+        default:  // Binary operators
+            needs = 2; delta = -1; break;
+    }
+}
+
+// Check opcodes, operands, jump targets and stack depth along every path.
+// Jumps only go forward, so one pass in program order sees every predecessor
+// of an instruction before the instruction itself.
+static bool verifyCode(const uint8_t* code, int len, const char** error) {
+    int8_t depth[RULE_MAX_CODE + 1];
+    memset(depth, -1, sizeof(depth));
+    depth[0] = 0;
+
+    int pc = 0;
+    while (pc < len) {
+        uint8_t op = code[pc];
+        int size = operandSize(op);
+        if (size < 0) {
+            *error = "unknown opcode";
+            return false;
+        }
+        int next = pc + 1 + size;
+        if (next > len) {
+            *error = "truncated instruction";
+            return false;
+        }
+
+        int d = depth[pc];
+        if (d < 0) {
+            pc = next;  // Unreachable
+            continue;
+        }
+
+        uint8_t imm = size > 0 ? code[pc + 1] : 0;
+        if ((op == OP_GET && imm >= RULE_VAR_COUNT) ||
+            ((op == OP_LOAD || op == OP_STORE) && imm >= RULE_SLOT_COUNT) ||
+            (op == OP_ACT && imm >= RULE_ACT_COUNT)) {
+            *error = "operand out of range";
+            return false;
+        }
+
+        int needs, delta;
+        stackEffect(op, needs, delta);
+        if (d < needs) {
+            *error = "stack underflow";
+            return false;
+        }
+        int after = d + delta;
+        if (after > RULE_STACK_DEPTH) {
+            *error = "stack overflow";
+            return false;
+        }
+
+        // Successors: fall-through and/or jump target
+        int targets[2];
+        int targetCount = 0;
+        if (op != OP_END && op != OP_JMP) {
+            targets[targetCount++] = next;
+        }
+        if (op == OP_JZ || op == OP_JMP) {
+            targets[targetCount++] = next + imm;
+        }
+        for (int i = 0; i < targetCount; i++) {
+            int t = targets[i];
+            if (t > len) {
+                *error = "jump out of range";
+                return false;
+            }
+            if (depth[t] < 0) {
+                depth[t] = after;
+            } else if (depth[t] != after) {
+                *error = "inconsistent stack depth";
+                return false;
+            }
+        }
+        pc = next;
+    }
+    return true;
+}
+
+bool ruleLoad(uint8_t index, const uint8_t* data, size_t len, const char** error) {
+    if (index >= RULE_MAX_RULES) {
+        *error = "rule index out of range";
+        return false;
+    }
+    if (len < RULE_HEADER_SIZE || data[0] != RULE_FORMAT_VERSION) {
+        *error = "bad header";
+        return false;
+    }
+    if (data[1] >= RULE_EVT_COUNT) {
+        *error = "unknown event";
+        return false;
+    }
+    size_t codeLen = len - RULE_HEADER_SIZE;
+    if (codeLen > RULE_MAX_CODE) {
+        *error = "code too long";
+        return false;
+    }
+    if (!verifyCode(data + RULE_HEADER_SIZE, codeLen, error)) {
+        return false;
+    }
+
+    Rule& rule = rules[index];
+    // Retained rules arrive again on every reconnect: the same rule keeps its variables and metrics
+    if (rule.loaded && rule.event == data[1] && rule.eventArg == data[2] && rule.codeLen == codeLen &&
+        memcmp(rule.code, data + RULE_HEADER_SIZE, codeLen) == 0) {
+        return true;
+    }
+    memset(&rule, 0, sizeof(rule));
+    rule.event = data[1];
+    rule.eventArg = data[2];
+    rule.codeLen = codeLen;
+    memcpy(rule.code, data + RULE_HEADER_SIZE, codeLen);
+    rule.loaded = true;
+    return true;
+}
+
+void ruleClear(uint8_t index) {
+    if (index < RULE_MAX_RULES) {
+        memset(&rules[index], 0, sizeof(Rule));
+    }
+}
+
+// Execute one verified rule. The runtime checks are a backstop for the verifier.
+static RuleStatus ruleRun(Rule& rule, uint8_t index, int32_t eventArg, const RuleEnv& env) {
+    int32_t stack[RULE_STACK_DEPTH];
+    int sp = 0;
+    int pc = 0;
+
+    while (pc < rule.codeLen) {
+        uint8_t op = rule.code[pc++];
+        int32_t a, b;
+
+        switch (op) {
+            case OP_END:
+                return RULE_STATUS_OK;
+            case OP_PUSH8:
+                if (sp >= RULE_STACK_DEPTH) return RULE_STATUS_STACK;
+                stack[sp++] = (int8_t)rule.code[pc++];
+                break;
+            case OP_PUSH16:
+                if (sp >= RULE_STACK_DEPTH) return RULE_STATUS_STACK;
+                stack[sp++] = (int16_t)(rule.code[pc] | (rule.code[pc + 1] << 8));
+                pc += 2;
+                break;
+            case OP_GET:
+                if (sp >= RULE_STACK_DEPTH) return RULE_STATUS_STACK;
+                stack[sp++] = env.getVar(rule.code[pc++], eventArg);
+                break;
+            case OP_LOAD:
+                if (sp >= RULE_STACK_DEPTH) return RULE_STATUS_STACK;
+                if (rule.code[pc] >= RULE_SLOT_COUNT) return RULE_STATUS_BAD_OPERAND;
+                stack[sp++] = rule.slots[rule.code[pc++]];
+                break;
+            case OP_STORE:
+                if (sp < 1) return RULE_STATUS_STACK;
+                if (rule.code[pc] >= RULE_SLOT_COUNT) return RULE_STATUS_BAD_OPERAND;
+                rule.slots[rule.code[pc++]] = stack[--sp];
+                break;
+            case OP_NOT:
+                if (sp < 1) return RULE_STATUS_STACK;
+                stack[sp - 1] = !stack[sp - 1];
+                break;
+            case OP_JZ:
+                if (sp < 1) return RULE_STATUS_STACK;
+                a = stack[--sp];
+                pc += 1 + (a == 0 ? rule.code[pc] : 0);
+                break;
+            case OP_JMP:
+                pc += 1 + rule.code[pc];
+                break;
+            case OP_ACT:
+                if (sp < 1) return RULE_STATUS_STACK;
+                a = stack[--sp];
+                env.action(rule.code[pc++], a, index);
+                rule.actions++;
+                break;
+            default:
+                // Binary operators
+                if (sp < 2) return RULE_STATUS_STACK;
+                b = stack[--sp];
+                a = stack[sp - 1];
+                switch (op) {
+                    case OP_ADD: a = a + b; break;
+                    case OP_SUB: a = a - b; break;
+                    case OP_LT: a = a < b; break;
+                    case OP_LE: a = a <= b; break;
+                    case OP_GT: a = a > b; break;
+                    case OP_GE: a = a >= b; break;
+                    case OP_EQ: a = a == b; break;
+                    case OP_NE: a = a != b; break;
+                    case OP_AND: a = a && b; break;
+                    case OP_OR: a = a || b; break;
+                    default: return RULE_STATUS_BAD_OPERAND;
+                }
+                stack[sp - 1] = a;
+                break;
+        }
+    }
+    return RULE_STATUS_OK;
+}
+
+int ruleDispatch(uint8_t event, int32_t arg, const RuleEnv& env) {
+    int executed = 0;
+    for (uint8_t i = 0; i < RULE_MAX_RULES; i++) {
+        Rule& rule = rules[i];
+        if (!rule.loaded || rule.event != event ||
+            (rule.eventArg != RULE_ANY_ARG && rule.eventArg != arg)) {
+            continue;
+        }
+
+        unsigned long start = env.nowMicros();
+        rule.lastStatus = ruleRun(rule, i, arg, env);
+        unsigned long elapsed = env.nowMicros() - start;
+
+        rule.runs++;
+        rule.totalMicros += elapsed;
+        if (elapsed > rule.maxMicros) {
+            rule.maxMicros = elapsed;
+        }
+        if (rule.lastStatus != RULE_STATUS_OK) {
+            rule.errors++;
+        }
+        executed++;
+    }
+    return executed;
+}
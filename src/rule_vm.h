@@ -0,0 +1,113 @@
+#ifndef RULE_VM_H
+#define RULE_VM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Static limits of the automation rule engine
+#define RULE_MAX_RULES 8        // Number of rule slots
+#define RULE_MAX_CODE 64        // Maximum bytecode length per rule
+#define RULE_STACK_DEPTH 8      // Evaluation stack depth
+#define RULE_SLOT_COUNT 4       // Persistent variables per rule (s0..s3)
+#define RULE_HEADER_SIZE 3      // version, trigger event, trigger argument
+#define RULE_FORMAT_VERSION 1
+#define RULE_ANY_ARG 0xFF       // Trigger argument matching any event argument
+
+/// @brief Events published on the rule event bus
+enum RuleEvent : uint8_t {
+    RULE_EVT_BUTTON = 0,        ///< Button press, arg = 0 downstairs / 1 door
+    RULE_EVT_TIMER,             ///< Timer expired, arg = track
+    RULE_EVT_RELAY,             ///< Door relay changed, arg = 1 on / 0 off
+    RULE_EVT_PLAYBACK_DONE,     ///< Chime finished, arg = button (0/1) or 2 for other tracks
+    RULE_EVT_COUNT
+};
+
+/// @brief Values a rule can read with OP_GET
+enum RuleVar : uint8_t {
+    RULE_VAR_ARG = 0,           ///< Argument of the triggering event
+    RULE_VAR_UPTIME,            ///< Seconds since boot
+    RULE_VAR_HOUR,              ///< Local hour (0-23), -1 if the clock is not set
+    RULE_VAR_MINUTE,            ///< Local minute (0-59), -1 if the clock is not set
+    RULE_VAR_PLAYING,           ///< 1 while a chime is playing
+    RULE_VAR_RELAY,             ///< 1 while the door relay is active
+    RULE_VAR_COUNT
+};
+
+/// @brief Actions a rule can take with OP_ACT (one argument popped from the stack)
+enum RuleAction : uint8_t {
+    RULE_ACT_OPEN_RELAY = 0,    ///< Open the front door (argument ignored)
+    RULE_ACT_PLAY,              ///< Queue a track (argument = track)
+    RULE_ACT_SET_VOLUME,        ///< Override the volume of the ring being handled (percent)
+    RULE_ACT_SUPPRESS,          ///< Do not chime for the button press being handled
+    RULE_ACT_NOTIFY,            ///< Publish a rule notification (argument = user code)
+    RULE_ACT_COUNT
+};
+
+/// @brief Bytecode instruction set. Jumps are forward-only so every rule terminates
+/// after at most RULE_MAX_CODE instructions.
+enum RuleOp : uint8_t {
+    OP_END = 0x00,
+    OP_PUSH8 = 0x01,            ///< imm: int8
+    OP_PUSH16 = 0x02,           ///< imm: int16 little endian
+    OP_GET = 0x03,              ///< imm: RuleVar
+    OP_LOAD = 0x04,             ///< imm: slot
+    OP_STORE = 0x05,            ///< imm: slot
+    OP_ADD = 0x10,
+    OP_SUB = 0x11,
+    OP_LT = 0x12,
+    OP_LE = 0x13,
+    OP_GT = 0x14,
+    OP_GE = 0x15,
+    OP_EQ = 0x16,
+    OP_NE = 0x17,
+    OP_AND = 0x18,
+    OP_OR = 0x19,
+    OP_NOT = 0x1A,
+    OP_JZ = 0x20,               ///< imm: forward offset from the next instruction
+    OP_JMP = 0x21,              ///< imm: forward offset from the next instruction
+    OP_ACT = 0x30               ///< imm: RuleAction
+};
+
+/// @brief Result of the last execution of a rule
+enum RuleStatus : uint8_t {
+    RULE_STATUS_OK = 0,
+    RULE_STATUS_STACK,          ///< Stack overflow or underflow
+    RULE_STATUS_BAD_OPERAND     ///< Operand outside its valid range at runtime
+};
+
+/// @brief Hooks into the firmware used while executing rules
+struct RuleEnv {
+    int32_t (*getVar)(uint8_t var, int32_t eventArg);
+    void (*action)(uint8_t action, int32_t arg, uint8_t rule);
+    unsigned long (*nowMicros)();
+};
+
+/// @brief A loaded rule with its persistent variables and execution metrics
+struct Rule {
+    bool loaded;
+    uint8_t event;                      ///< RuleEvent that triggers the rule
+    uint8_t eventArg;                   ///< Required event argument or RULE_ANY_ARG
+    uint8_t codeLen;
+    uint8_t code[RULE_MAX_CODE];
+    int32_t slots[RULE_SLOT_COUNT];     ///< Persistent variables, zeroed when a different rule is loaded
+    unsigned long runs;                 ///< Number of executions
+    unsigned long actions;              ///< Number of actions taken
+    unsigned long errors;               ///< Executions aborted by a runtime error
+    unsigned long totalMicros;          ///< Accumulated execution time
+    unsigned long maxMicros;            ///< Longest single execution
+    RuleStatus lastStatus;
+};
+
+extern Rule rules[RULE_MAX_RULES];
+
+/// @brief Validate and install a compiled rule. Returns false and sets error on rejection.
+/// Reloading the rule already in the slot keeps its variables and metrics.
+bool ruleLoad(uint8_t index, const uint8_t* data, size_t len, const char** error);
+
+/// @brief Remove the rule in a slot
+void ruleClear(uint8_t index);
+
+/// @brief Run every rule triggered by an event. Returns the number of rules executed.
+int ruleDispatch(uint8_t event, int32_t arg, const RuleEnv& env);
+
+#endif // RULE_VM_H
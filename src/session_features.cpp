@@ -0,0 +1,84 @@
+#include "session_features.h"
+#include <math.h>
+#include <string.h>
+
+void featuresBegin(SessionFeatures& f, int line, float threshold, float release, unsigned long leadMs) {
+    memset(&f, 0, sizeof(SessionFeatures));
+    f.line = line;
+    f.threshold = threshold;
+    f.release = release;
+    f.leadMs = leadMs;
+}
+
+void featuresAdd(SessionFeatures& f, float v1, float v2, unsigned long delta) {
+    f.samples++;
+    f.lastDelta = delta;
+
+    // Cross-channel co-moments
+    float d1 = v1 - f.mean1;
+    float d2 = v2 - f.mean2;
+    f.mean1 += d1 / f.samples;
+    f.mean2 += d2 / f.samples;
+    f.m2_1 += d1 * (v1 - f.mean1);
+    f.m2_2 += d2 * (v2 - f.mean2);
+    f.c12 += d1 * (v2 - f.mean2);
+
+    // Dropouts: both lines below the release level, counted once they recover
+    bool low = v1 < f.release && v2 < f.release;
+    if (low && !f.inDropout) {
+        f.inDropout = true;
+        f.dropoutStart = delta;
+    } else if (!low && f.inDropout) {
+        f.inDropout = false;
+        f.dropouts++;
+        if (delta - f.dropoutStart > f.longestDropoutMs) {
+            f.longestDropoutMs = delta - f.dropoutStart;
+        }
+    }
+
+    if (f.line < 0) {
+        return;
+    }
+    float v = f.line == 0 ? v1 : v2;
+    float other = f.line == 0 ? v2 : v1;
+
+    if (v >= f.release && other < f.release) {
+        f.dominant++;
+    }
+
+    if (v > f.peak) {
+        f.peak = v;
+        if (f.riseLevel < FEATURE_RISE_FRACTION * f.peak) {
+            f.riseLevel = v;
+            f.riseDelta = delta;
+        }
+    }
+
+    if (v >= f.threshold) {
+        f.plateauCount++;
+        float dp = v - f.plateauMean;
+        f.plateauMean += dp / f.plateauCount;
+        f.plateauM2 += dp * (v - f.plateauMean);
+    }
+}
+
+unsigned long featuresRiseMs(const SessionFeatures& f) {
+    return f.leadMs + f.riseDelta;
+}
+
+float featuresPlateau(const SessionFeatures& f) {
+    return f.plateauMean;
+}
+
+float featuresRipple(const SessionFeatures& f) {
+    return f.plateauCount > 1 ? sqrtf(f.plateauM2 / (f.plateauCount - 1)) : 0;
+}
+
+float featuresCorrelation(const SessionFeatures& f) {
+    float denominator = sqrtf(f.m2_1 * f.m2_2);
+    return denominator > 1e-9f ? f.c12 / denominator : 0;
+}
+
+float featuresConfidence(const SessionFeatures& f) {
+    return f.samples && f.line >= 0 ? (float)f.dominant / f.samples : 0;
+}
@@ -0,0 +1,56 @@
+#ifndef SESSION_FEATURES_H
+#define SESSION_FEATURES_H
+
+#include <stdint.h>
+
+// Per-session features of an analog button press, updated in O(1) per sample
+// while the session is captured, so a summary can be published instead of the
+// raw readings. The session line is the one that started the session.
+//
+// - rise: from the line leaving idle (leadMs before the session started) to
+//   the first sample within 90% of the peak; a later peak more than 11% above
+//   that sample restarts the rise at the new peak
+// - plateau: mean and standard deviation of session-line samples at or above
+//   the trigger threshold
+// - dropouts: dips of both lines below the release level that recovered
+// - correlation: Pearson correlation of the two lines over the session
+// - confidence: share of samples where only the session line is above the
+//   release level (1.0 = clean press, low = crosstalk or a weak line)
+#define FEATURE_RISE_FRACTION 0.9f
+
+/// @brief Running state of the extractor
+struct SessionFeatures {
+    int8_t line;                    ///< Session line (0 or 1), -1 if unknown
+    float threshold;                ///< Trigger level
+    float release;                  ///< Release level (threshold minus hysteresis)
+    unsigned long leadMs;
+    uint16_t samples;
+    unsigned long lastDelta;        ///< Offset of the last sample from the session start
+    float peak;                     ///< On the session line
+    float riseLevel;                ///< Sample that ended the rise
+    unsigned long riseDelta;
+    uint16_t plateauCount;
+    float plateauMean;
+    float plateauM2;
+    bool inDropout;
+    unsigned long dropoutStart;
+    uint16_t dropouts;
+    unsigned long longestDropoutMs;
+    float mean1, mean2;             ///< Welford means and co-moments of the two lines
+    float m2_1, m2_2, c12;
+    uint16_t dominant;
+};
+
+/// @brief Start extracting for a session begun by line (leadMs: time the line took from idle to the trigger)
+void featuresBegin(SessionFeatures& f, int line, float threshold, float release, unsigned long leadMs);
+
+/// @brief Add one reading taken delta ms after the session start
+void featuresAdd(SessionFeatures& f, float v1, float v2, unsigned long delta);
+
+unsigned long featuresRiseMs(const SessionFeatures& f);
+float featuresPlateau(const SessionFeatures& f);
+float featuresRipple(const SessionFeatures& f);
+float featuresCorrelation(const SessionFeatures& f);   ///< 0 when either line is flat
+float featuresConfidence(const SessionFeatures& f);
+
+#endif // SESSION_FEATURES_H